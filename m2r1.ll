@@ -0,0 +1,72 @@
+target datalayout = "e-p:32:32-i64:64"
+target triple = "le32-unknown-nacl"
+declare i32 @printf(i8*, ...)
+@.s = private constant [13 x i8] c"%d %d %d %d\0A\00"
+define i32 @pun(i32 %x) {
+entry:
+  %a = alloca i32, align 4
+  store i32 %x, i32* %a
+  %p = bitcast i32* %a to i8*
+  %b = load i8, i8* %p
+  %c = sext i8 %b to i32
+  ret i32 %c
+}
+define i32 @pun2(i32 %x) {
+entry:
+  %a = alloca i64, align 8
+  store i64 0, i64* %a
+  %p = bitcast i64* %a to i32*
+  %q = getelementptr i32, i32* %p, i32 1
+  store i32 %x, i32* %q
+  %v = load i64, i64* %a
+  %s = lshr i64 %v, 32
+  %t = trunc i64 %s to i32
+  ret i32 %t
+}
+define i32 @loopy(i32 %n) {
+entry:
+  %a = alloca i32
+  %i = alloca i32
+  store i32 0, i32* %a
+  store i32 0, i32* %i
+  br label %h
+h:
+  %iv = load i32, i32* %i
+  %c = icmp slt i32 %iv, %n
+  br i1 %c, label %b, label %e
+b:
+  %av = load i32, i32* %a
+  %av2 = add i32 %av, %iv
+  store i32 %av2, i32* %a
+  %iv2 = add i32 %iv, 1
+  store i32 %iv2, i32* %i
+  br label %h
+e:
+  %r = load i32, i32* %a
+  ret i32 %r
+}
+define i32 @arr(i32 %k) {
+entry:
+  %a = alloca [4 x i32]
+  %p0 = getelementptr [4 x i32], [4 x i32]* %a, i32 0, i32 0
+  %p1 = getelementptr [4 x i32], [4 x i32]* %a, i32 0, i32 1
+  %p2 = getelementptr [4 x i32], [4 x i32]* %a, i32 0, i32 2
+  %p3 = getelementptr [4 x i32], [4 x i32]* %a, i32 0, i32 3
+  store i32 10, i32* %p0
+  store i32 20, i32* %p1
+  store i32 30, i32* %p2
+  store i32 40, i32* %p3
+  %pk = getelementptr [4 x i32], [4 x i32]* %a, i32 0, i32 %k
+  store i32 99, i32* %pk
+  %v = load i32, i32* %p2
+  ret i32 %v
+}
+define i32 @main() {
+  %r1 = call i32 @pun(i32 511)
+  %r2 = call i32 @pun2(i32 77)
+  %r3 = call i32 @loopy(i32 10)
+  %r4 = call i32 @arr(i32 2)
+  %p = getelementptr [13 x i8], [13 x i8]* @.s, i32 0, i32 0
+  call i32 (i8*, ...) @printf(i8* %p, i32 %r1, i32 %r2, i32 %r3, i32 %r4)
+  ret i32 0
+}
@@ -4,22 +4,66 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
 #include "vmir.h"
 
+/**
+ * Load the bitcode from a pipe while it's being written
+ */
+static vmir_errcode_t
+load_stream(ir_unit_t *iu, int fd)
+{
+  uint8_t buf[65536];
+  ssize_t r;
+
+  vmir_load_begin(iu);
+  while((r = read(fd, buf, sizeof(buf))) > 0) {
+    vmir_errcode_t err = vmir_load_feed(iu, buf, r);
+    if(err)
+      return err;
+  }
+  if(r == -1)
+    return VMIR_ERR_IO;
+  return vmir_load_end(iu);
+}
+
 static void
 usage(const char *argv0)
 {
   printf("\n");
-  printf("Usage ... %s [OPTIONS] <file.bc>\n", argv0);
+  printf("Usage ... %s [OPTIONS] <file.bc | ->\n", argv0);
   printf("\n");
   printf("  -f FUNCTION         Function to diagnose [ALL]\n");
   printf("  -l                  Dump lowered function(s)\n");
   printf("  -p                  Dump parsed function(s)\n");
   printf("  -i                  List all functions\n");
   printf("  -n                  Don't try to run code\n");
+  printf("  -t COUNT            JIT functions in background after COUNT\n");
+  printf("                      calls or loop iterations\n");
+  printf("  -c                  Use copy-and-patch compiler for functions\n");
+  printf("                      instead of interpreting them\n");
+  printf("  -a FILE.so          Compile to shared object ahead-of-time\n");
+  printf("                      (or load it if already compiled)\n");
+  printf("  -I SIZE             Inline functions with at most SIZE\n");
+  printf("                      instructions, 0 disables [16]\n");
+  printf("  -L COUNT            Allocate registers with linear scan in\n");
+  printf("                      functions with at least COUNT values [4096]\n");
+  printf("  -T THREADS          Compile functions on THREADS threads while\n");
+  printf("                      loading, 0 = one per CPU [0]\n");
+  printf("  -z MODE             Compile functions lazily, 1 = when first\n");
+  printf("                      called, 2 = if reachable from main() [0]\n");
+  printf("  -k FILE             Cache compiled code in FILE and load it\n");
+  printf("                      from there if compiled already. Disables\n");
+  printf("                      the JIT and -t, combine with -c for\n");
+  printf("                      native code\n");
+  printf("  -P FILE             Write opcode profile to FILE (requires\n");
+  printf("                      vmir.profile build)\n");
+  printf("\n");
+  printf("  The bitcode is read from stdin and parsed as it arrives if the\n");
+  printf("  file is -\n");
   printf("\n");
 }
 
@@ -35,7 +79,16 @@ main(int argc, char **argv)
   int opt;
   const char *argv0 = argv[0];
   int print_stats = 0;
-  while((opt = getopt(argc, argv, "plidf:nhrbsj")) != -1) {
+  int jit_threshold = 0;
+  int copy_patch = 0;
+  const char *aot_path = NULL;
+  const char *op_profile_path = NULL;
+  int inline_size = -1;
+  const char *linear_scan = NULL;
+  int compile_threads = 0;
+  int lazy = VMIR_LAZY_NONE;
+  const char *cache_path = NULL;
+  while((opt = getopt(argc, argv, "plidf:nhrbsjt:ca:I:L:T:z:k:P:")) != -1) {
     switch(opt) {
     case 'p':
       debug_flags |= VMIR_DBG_DUMP_PARSED_FUNCTION;
@@ -70,6 +123,33 @@ main(int argc, char **argv)
     case 's':
       print_stats = 1;
       break;
+    case 't':
+      jit_threshold = atoi(optarg);
+      break;
+    case 'c':
+      copy_patch = 1;
+      break;
+    case 'a':
+      aot_path = optarg;
+      break;
+    case 'I':
+      inline_size = atoi(optarg);
+      break;
+    case 'L':
+      linear_scan = optarg;
+      break;
+    case 'T':
+      compile_threads = atoi(optarg);
+      break;
+    case 'z':
+      lazy = atoi(optarg);
+      break;
+    case 'k':
+      cache_path = optarg;
+      break;
+    case 'P':
+      op_profile_path = optarg;
+      break;
     default:
       usage(argv0);
       exit(1);
@@ -84,25 +164,6 @@ main(int argc, char **argv)
   argc -= optind;
   argv += optind;
 
-  int fd = open(argv[0], O_RDONLY);
-  if(fd == -1) {
-    perror("open");
-    exit(1);
-  }
-
-  struct stat st;
-  if(fstat(fd, &st)) {
-    perror("stat");
-    exit(1);
-  }
-
-  uint8_t *buf = malloc(st.st_size);
-  if(read(fd, buf, st.st_size) != st.st_size) {
-    perror("read");
-    exit(1);
-  }
-  close(fd);
-
 #define MB(x) ((x) * 1024 * 1024)
 
   void *mem = malloc(MB(64));
@@ -111,8 +172,23 @@ main(int argc, char **argv)
 
   vmir_set_debug_flags(iu, debug_flags);
   vmir_set_debugged_function(iu, debugged_function);
-
-  if(vmir_load(iu, buf, st.st_size)) {
+  vmir_set_jit_threshold(iu, jit_threshold);
+  vmir_set_copy_patch(iu, copy_patch);
+  vmir_set_aot(iu, aot_path);
+  if(inline_size >= 0)
+    vmir_set_inline_size(iu, inline_size);
+  if(linear_scan != NULL)
+    vmir_set_linear_scan_threshold(iu, atoi(linear_scan));
+  vmir_set_compile_threads(iu, compile_threads);
+  vmir_set_lazy(iu, lazy);
+  vmir_set_cache(iu, cache_path);
+  vmir_set_op_profile(iu, op_profile_path);
+
+  vmir_errcode_t err = strcmp(argv[0], "-") ?
+    vmir_load_file(iu, argv[0]) : load_stream(iu, STDIN_FILENO);
+  if(err) {
+    if(err == VMIR_ERR_IO)
+      perror(argv[0]);
     free(mem);
     vmir_destroy(iu);
     return -1;
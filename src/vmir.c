@@ -22,6 +22,10 @@
  * SOFTWARE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pthread_getattr_np()
+#endif
+
 #include <setjmp.h>
 #include <string.h>
 #include <stdarg.h>
@@ -32,6 +36,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "bitcode.h"
 
@@ -41,9 +50,11 @@
 #include "vmir.h"
 
 #include "vmir_support.c"
+#include "vmir_sha256.c"
 #include "vmir_bitstream.c"
+#include "vmir_arena.c"
 
-TAILQ_HEAD(ir_abbrev_queue, ir_abbrev);
+VECTOR_HEAD(ir_abbrev_vector, struct ir_abbrev *);
 LIST_HEAD(ir_blockinfo_list, ir_blockinfo);
 
 typedef enum {
@@ -64,8 +75,7 @@ LIST_HEAD(ir_attr_list, ir_attr);
 typedef struct ir_blockinfo {
   LIST_ENTRY(ir_blockinfo) ib_link;
   int ib_id;
-  int ib_num_abbrevs;
-  struct ir_abbrev_queue ib_abbrevs;
+  struct ir_abbrev_vector ib_abbrevs;
 } ir_blockinfo_t;
 
 /**
@@ -77,17 +87,23 @@ typedef struct ir_abbrev_operand {
 } ir_abbrev_operand_t;
 
 /**
- *
+ * An abbreviation prepared for decoding (see ir_define_abbrev()). The
+ * scalar operands come first and are followed by an array or a blob
+ * if ia_tail says so. Leading literal operands are stored as arguments
+ * ready to be copied
  */
 typedef struct ir_abbrev {
-  TAILQ_ENTRY(ir_abbrev) ia_link;
-  int ia_nops;
+  int ia_nops;                     // Scalar operands
+  int ia_num_literals;             // Leading literal operands
+  int ia_tail;                     // IAOT_ARRAY, IAOT_BLOB or 0
+  ir_abbrev_operand_t ia_element;  // Type of array elements
+  const ir_arg_t *ia_literals;
   ir_abbrev_operand_t ia_ops[0];
 } ir_abbrev_t;
 
 typedef struct ir_block {
   LIST_ENTRY(ir_block) ib_link;
-  struct ir_abbrev_queue ib_scoped_abbrevs;
+  struct ir_abbrev_vector ib_scoped_abbrevs;
   ir_blockinfo_t *ib_blockinfo;
 } ir_block_t;
 
@@ -104,6 +120,9 @@ static void ir_parse_blocks(struct ir_unit *iu,
                             rec_handler_t *rh,
                             const ir_blockinfo_t *ib);
 
+static void tier_request(struct ir_unit *iu, int gfid);
+static const uint16_t *lazy_materialize(struct ir_unit *iu, uint32_t gfid);
+
 VECTOR_HEAD(ir_op_vector, struct ir_op);
 VECTOR_HEAD(ir_attrset_vector, struct ir_attrset);
 VECTOR_HEAD(ir_type_vector, struct ir_type);
@@ -127,7 +146,20 @@ typedef struct vmir_stats {
   int cmp_branch_combine;
   int mla_combine;
   int load_cast_combine;
+  int tail_calls;
+  int inlined_calls;
+  int allocas_promoted;
+  int sccp_constants;
+  int sccp_branches;
+  int licm_hoisted;
+  int ivs_reduced;
+  int gvn_eliminated;
+  int linear_scan_functions;
   int moves_killed;
+  int parallel_functions;
+  int lazy_functions;
+  int failed_compiles;      // After load, see function_reparse()
+  int cached_functions;
 
   int lea_load_combined;
   int lea_load_combined_failed;
@@ -136,24 +168,90 @@ typedef struct vmir_stats {
   int vm_binop_acc_imm;
   int vm_binop_acc_acc;
   int vm_binop_acc_acc_imm;
+  int vm_loop_branches;
+  int vm_far_functions;     // Emitted with branch veneers
+
+  int vm_superinstructions;
+
+  int cp_functions;
+  int cp_functions_failed;
+
+  int aot_functions;
+  int aot_functions_failed;
 
 } vmir_stats_t;
 
 
 
+/**
+ * Position (in bytes) and opcode of an emitted VM instruction
+ */
+typedef struct vm_insn {
+  int vi_offset;
+  int vi_op;
+} vm_insn_t;
+
+
+/**
+ * Branch operand that is out of range for an int16_t delta and the
+ * VM_BL that reaches its target instead (see branch_fixup())
+ */
+typedef struct vm_veneer {
+  int vv_operand; // Position (in bytes) of the operand
+  int vv_veneer;  // Position of the VM_BL
+} vm_veneer_t;
+
+
+/**
+ * Direct call emitted in the VM text of function ce_caller, collected
+ * while loading to lay out the text (see vmir_layout.c)
+ */
+typedef struct call_edge {
+  int ce_caller;
+  int ce_callee;
+  int ce_weight;  // Number of call sites
+} call_edge_t;
+
+
+/**
+ * Offset of a literal in the JITed code pointing into the VM text of
+ * function jr_gfid (see vmir_layout.c)
+ */
+typedef struct jit_reloc {
+  int jr_offset;
+  int jr_gfid;
+} jit_reloc_t;
+
+
+/**
+ * Position (in bytes) of an instruction in the VM text of function
+ * ci_gfid, stored in the cache so it can be checked (see vmir_cache.c)
+ */
+typedef struct cache_insn {
+  int ci_gfid;
+  int ci_offset;
+} cache_insn_t;
+
+
 /**
  * Translation unit
  */
 struct ir_unit {
   void *iu_mem;
   void **iu_vm_funcs;
+  uint32_t *iu_vm_frame_sizes; // Register frame size of iu_vm_funcs
+  uint32_t iu_vm_funcs_gen; // Bumped when iu_vm_funcs changes at runtime
   vm_ext_function_t **iu_ext_funcs;
   jmp_buf iu_err_jmpbuf;
   int iu_exit_code;
   void *iu_opaque;
-  void *iu_jit_mem;
+  void *iu_jit_mem;   // JITed code is executed here
+  void *iu_jit_wmem;  // and written here, see vmir_jit_mem.c
+  int iu_jit_fd;
   int iu_jit_mem_alloced;
+  int iu_jit_mem_failed;
   int iu_jit_ptr;
+  int iu_jit_sealed;  // Code before this offset is final
 
   uint32_t iu_data_ptr;
   uint32_t iu_heap_start;
@@ -161,6 +259,12 @@ struct ir_unit {
   uint32_t iu_rsize;
   uint32_t iu_asize;
   uint32_t iu_alloca_ptr;
+  struct vm_call_frame *iu_vm_frames; // vm_exec() return stack
+  const char *iu_vm_host_stack_lo; // Host thread stack bounds
+  const char *iu_vm_host_stack_hi;
+  const char *iu_vm_host_stack_limit; // Native code recursion stops here
+  int iu_vm_frames_size;
+  int iu_vm_depth;
   uint32_t iu_memsize;
 
   uint32_t iu_debug_flags;
@@ -193,31 +297,110 @@ struct ir_unit {
   struct ir_function *iu_current_function;
   struct ir_bb *iu_current_bb;
 
+  // Inlining
+
+  int iu_inline_size;         // Max instructions of inlined functions
+  int iu_inline_base;         // First callee value while parsing for inlining
+  int iu_inline_argc;
+  const int *iu_inline_args;  // Values passed to the inlined function
+
+  int iu_linear_scan_threshold; // Values in functions using linear scan
+
+  // Parallel compilation
+
+  int iu_compile_threads;     // Functions are compiled while parsing if < 2
+  struct compile_queue *iu_compile_queue;
+
+  ir_arena_pool_t *iu_arena_pool; // Chunks for the functions' arenas
+
+  // Lazy compilation
+
+  int iu_lazy;                // VMIR_LAZY_*
+  uint16_t *iu_lazy_stubs;    // VM text that compiles the function it's in
+  pthread_mutex_t iu_lazy_mutex;
+  VECTOR_HEAD(, int) iu_lazy_queue; // Reachable functions to compile
+
 #define IU_MAX_TMP_STR 32
   char *iu_tmp_str[IU_MAX_TMP_STR];
   int iu_tmp_str_ptr;
 
   VECTOR_HEAD(, struct ir_function *) iu_functions;
   VECTOR_HEAD(, struct ir_initializer) iu_initializers;
+  VECTOR_HEAD(, int) iu_constant_globals; // In order of address
 
   VECTOR_HEAD(, int) iu_branch_fixups;
+  VECTOR_HEAD(, vm_veneer_t) iu_branch_veneers;
   VECTOR_HEAD(, int) iu_jit_vmcode_fixups;
   VECTOR_HEAD(, int) iu_jit_vmbb_fixups;
   VECTOR_HEAD(, int) iu_jit_branch_fixups;
+  VECTOR_HEAD(, jit_reloc_t) iu_jit_relocs; // All functions
+  VECTOR_HEAD(, vm_insn_t) iu_vm_insns; // Ops of the current function
+  int iu_vm_record_insns; // Fill iu_vm_insns, see vm_emit_function()
+
+  ir_code_arena_t iu_code; // VM text of all functions
+  VECTOR_HEAD(, call_edge_t) iu_call_edges;
 
   int iu_types_created;
 
+  // Tiered compilation
+
+  uint32_t iu_tier_threshold; // 0 = JIT everything at load time
+  uint32_t *iu_tier_counters;
+  int iu_tier_up;             // Set when compiling hot functions
+  int iu_tier_stop;
+  int iu_tier_thread_running;
+  pthread_t iu_tier_thread;
+  pthread_mutex_t iu_tier_mutex;
+  pthread_cond_t iu_tier_cond;
+  struct ir_function_queue iu_tier_queue;
+
+  // Copy-and-patch compiler
+
+  int iu_copy_patch;
+  void *iu_cp_mem;
+  int iu_cp_ptr;
+  int iu_cp_sealed;   // Code before this offset is executable
+  uint32_t *iu_cp_opmap;  // Resolved opcode << 16 | vm_op_t
+  int iu_cp_opmap_size;
+
+  // Ahead-of-time compiler
+
+  char *iu_aot_path;    // Shared object with the compiled module
+  FILE *iu_aot_src;     // C source of the functions translated so far
+  char *iu_aot_src_buf;
+  size_t iu_aot_src_size;
+  uint64_t iu_aot_hash; // Hash of the VM text of all functions
+  void *iu_aot_handle;
+  VECTOR_HEAD(, int) iu_aot_funcs;
+
+  // Compiled code cache
+
+  char *iu_cache_path;
+  uint8_t iu_cache_key[SHA256_DIGEST_SIZE];
+  void *iu_cache_map;   // Set when loaded from the cache
+  size_t iu_cache_size;
+  VECTOR_HEAD(, cache_insn_t) iu_cache_insns;
+
+  // Opcode profile (VMIR_VM_PROFILE)
+
+  char *iu_op_profile_path;
+  struct vm_op_profile *iu_op_profile;
+
   // Parser
 
   jmp_buf      iu_err_jmp;
+  jmp_buf     *iu_compile_err; // Set while compiling after load
 
   void *iu_text_alloc;
   void *iu_text_ptr;
   size_t iu_text_alloc_memsize;
 
   bcbitstream_t *iu_bs;
+  struct ir_stream *iu_stream; // Between vmir_load_begin() and _end()
 
-  VECTOR_HEAD(, ir_arg_t) iu_argv;
+  VECTOR_HEAD(, ir_arg_t) iu_argv; // Arguments of the current record
+  const uint8_t *iu_blob;           // Blob of the current record, if any
+  int iu_blob_size;
 
   char        iu_err_buf[256];
   const char *iu_err_file;
@@ -271,10 +454,23 @@ typedef struct ir_function {
   int if_num_bbs;
   struct ir_bb_queue if_bbs;
   struct ir_bb_edge_list if_edges;
+  ir_arena_t *if_arena; // All of the above and their instructions
 
   void *if_vm_text;
   int if_vm_text_size;
 
+  // Copy of function body bitcode, kept around for tiering up and inlining
+  TAILQ_ENTRY(ir_function) if_tier_link;
+  uint8_t *if_body;
+  int if_body_size;
+  int if_body_abbrev_width;
+  int if_inline_size;   // Instructions in body, 0 if it can't be inlined,
+                        // -1 if not known yet (see vmir_lazy.c)
+  char if_tier_queued;
+  char if_lazy_queued;  // Found to be reachable (VMIR_LAZY_REACHABLE)
+  void *if_tier0_text;  // Interpreted text, retired when tiered up
+  int if_tier0_text_size;
+
   vm_ext_function_t *if_ext_func;
 
 } ir_function_t;
@@ -288,6 +484,7 @@ typedef struct ir_globalvar {
   unsigned int ig_type;
   char *ig_name;
   uint32_t ig_addr;
+  int ig_constant;
 
 } ir_globalvar_t;
 
@@ -311,6 +508,7 @@ typedef struct ir_bb {
   int ib_jit_offset;
   int ib_id;
   int ib_mark;
+  ir_arena_t *ib_arena; // Of the function
 
   struct ir_bb_edge_list ib_incoming_edges;
   struct ir_bb_edge_list ib_outgoing_edges;
@@ -326,6 +524,7 @@ typedef struct ir_bb_edge {
   LIST_ENTRY(ir_bb_edge) ibe_function_link;
   ir_bb_t *ibe_from;
   ir_bb_t *ibe_to;
+  int ibe_executable;  // Used by propagate_constants()
 } ir_bb_edge_t;
 
 
@@ -387,10 +586,9 @@ typedef struct ir_instr {
   int ii_ret_value;  // -1 if instruction does not emit a new value
 
 
-  uint32_t *ii_liveness; /* Points to three consecutive bitfields used for
-                          * durign liveness analysis.
-                          * [out] [gen] [in]
-                          * The size of these bitfields are given by the number
+  uint32_t *ii_liveness; /* Set of values live out of the instruction.
+                          * Only kept for the last instruction of JIT
+                          * segments. The size is given by the number
                           * of temporaries in each function
                           */
   struct ir_bb **ii_succ;
@@ -401,7 +599,16 @@ typedef struct ir_instr {
 } ir_instr_t;
 
 static void type_print_list(ir_unit_t *iu);
+static void function_parse_inline(ir_unit_t *iu, ir_function_t *callee,
+                                  ir_function_t *scratch, const int *args);
 static void value_print_list(ir_unit_t *iu);
+static int compile_parallel(ir_unit_t *iu);
+static void compile_function(ir_unit_t *iu, ir_function_t *f);
+static void compile_drain(ir_unit_t *iu);
+static unsigned int lazy_reference(ir_unit_t *iu, unsigned int val);
+static void lazy_reach(ir_unit_t *iu, ir_function_t *f);
+static int lazy_inline_size(ir_unit_t *iu, ir_function_t *f);
+static void cache_record_insns(ir_unit_t *iu, ir_function_t *f);
 
 #define parser_error(iu, fmt...) \
   parser_error0(iu, __FILE__, __LINE__, fmt)
@@ -435,6 +642,10 @@ parser_error0(ir_unit_t *iu, const char *file, int line,
     }
   }
 
+  // Functions compiled after load fail on their own
+  if(iu->iu_compile_err != NULL)
+    longjmp(*iu->iu_compile_err, 1);
+
   abort();
   longjmp(iu->iu_err_jmp, 1);
 }
@@ -473,12 +684,27 @@ addstr(char **dst, const char *str)
 #include "vmir_instr_parse.c"
 #include "vmir_function.c"
 #if defined(__arm__) && defined(__linux__)
+#include "vmir_jit_mem.c"
 #include "vmir_jit_arm.c"
+#elif defined(__x86_64__) && defined(__linux__)
+#include "vmir_jit_mem.c"
+#include "vmir_jit_x86_64.c"
+#endif
+#ifdef VMIR_VM_JIT
+#include "vmir_jit.c"
 #endif
 #include "vmir_transform.c"
+#include "vmir_layout.c"
 #include "vmir_vm.c"
+#include "vmir_copy_patch.c"
+#include "vmir_aot.c"
 #include "vmir_libc.c"
 #include "vmir_bitcode_parser.c"
+#include "vmir_tier.c"
+#include "vmir_compile.c"
+#include "vmir_lazy.c"
+#include "vmir_cache.c"
+#include "vmir_stream.c"
 
 
 /**
@@ -488,10 +714,14 @@ static void
 iu_cleanup(ir_unit_t *iu)
 {
   VECTOR_CLEAR(&iu->iu_branch_fixups);
+  VECTOR_CLEAR(&iu->iu_branch_veneers);
+  VECTOR_CLEAR(&iu->iu_vm_insns);
   VECTOR_CLEAR(&iu->iu_jit_vmcode_fixups);
   VECTOR_CLEAR(&iu->iu_jit_vmbb_fixups);
   VECTOR_CLEAR(&iu->iu_jit_branch_fixups);
+  VECTOR_CLEAR(&iu->iu_jit_relocs);
   VECTOR_CLEAR(&iu->iu_initializers);
+  VECTOR_CLEAR(&iu->iu_constant_globals);
   value_resize(iu, 0);
 
   iu->iu_current_bb = NULL;
@@ -514,6 +744,29 @@ iu_cleanup(ir_unit_t *iu)
 void
 vmir_destroy(ir_unit_t *iu)
 {
+#ifdef VMIR_VM_JIT
+  if(iu->iu_tier_threshold)
+    tier_stop(iu);
+#endif
+  if(iu->iu_tier_threshold || iu->iu_lazy)
+    iu_cleanup(iu);
+  stream_destroy(iu);
+  lazy_stop(iu);
+  cache_destroy(iu);
+  free(iu->iu_text_alloc);
+#ifdef VMIR_VM_JIT
+  jit_mem_destroy(iu);
+#endif
+#ifdef VMIR_COPY_PATCH
+  cp_destroy(iu);
+#endif
+#ifdef VMIR_AOT
+  aot_destroy(iu);
+#endif
+#ifdef VMIR_VM_PROFILE
+  vm_profile_destroy(iu);
+#endif
+
   for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++) {
     function_destroy(VECTOR_ITEM(&iu->iu_functions, i));
   }
@@ -523,7 +776,13 @@ vmir_destroy(ir_unit_t *iu)
     type_clean(it);
   }
 
+  arena_pool_destroy(iu->iu_arena_pool);
+  code_arena_destroy(&iu->iu_code);
+  VECTOR_CLEAR(&iu->iu_call_edges);
+
   free(iu->iu_vm_funcs);
+  free(iu->iu_vm_frame_sizes);
+  free(iu->iu_vm_frames);
   free(iu->iu_ext_funcs);
 
   VECTOR_CLEAR(&iu->iu_types);
@@ -548,68 +807,273 @@ vmir_create(void *membase, uint32_t memsize,
   iu->iu_rsize = rsize;
   iu->iu_alloca_ptr = rsize;
   iu->iu_asize = asize;
-  iu->iu_text_alloc_memsize = 1024 * 1024;
+  iu->iu_text_alloc_memsize = 64 * 1024; // Grown by emit_reserve()
   iu->iu_text_alloc = malloc(iu->iu_text_alloc_memsize);
+  iu->iu_inline_size = INLINE_SIZE_DEFAULT;
+  iu->iu_linear_scan_threshold = LINEAR_SCAN_DEFAULT;
+  iu->iu_compile_threads = compile_threads_online();
+  iu->iu_arena_pool = arena_pool_create();
   return iu;
 }
 
 /**
- *
+ * Settings that affect parsing
  */
-int
-vmir_load(ir_unit_t *iu, const uint8_t *u8, int len)
+static void
+load_prepare(ir_unit_t *iu)
 {
-  bcbitstream_t bs = {0};
-  bs.rdata = u8;
-  bs.bytes_length = len;
-
-  uint32_t x = read_bits(&bs, 32);
+#ifdef VMIR_VM_PROFILE
+  // Profile the interpreter running the ops as emitted
+  iu->iu_debug_flags |= VMIR_DBG_DISABLE_JIT;
+  vmir_set_aot(iu, NULL);
+#endif
 
-  if(x != 0xdec04342)
-    return VMIR_ERR_NOT_BITCODE;
+  if(iu->iu_debug_flags & (VMIR_DBG_DISABLE_JIT | VMIR_DBG_BB_INSTRUMENT)) {
+    iu->iu_tier_threshold = 0;
+    iu->iu_copy_patch = 0;
+  }
 
-  iu->iu_bs = &bs;
+#ifdef VMIR_AOT
+  if(iu->iu_aot_path != NULL) {
+    aot_init(iu);
+    iu->iu_lazy = VMIR_LAZY_NONE; // The shared object has all functions
+  }
+#endif
 
   TAILQ_INIT(&iu->iu_functions_with_bodies);
   iu->iu_data_ptr = iu->iu_rsize + iu->iu_asize;
+}
 
-  if(setjmp(iu->iu_err_jmp)) {
-    iu_cleanup(iu);
-    return VMIR_ERR_LOAD_ERROR;
-  }
 
-  //  int64_t ts = get_ts();
-  ir_parse_blocks(iu, 2, len - 4, NULL, NULL);
-  //  printf("Parse took %"PRId64"us\n", get_ts() - ts);
-  free(iu->iu_text_alloc);
+/**
+ * Called when all of the bitcode has been parsed
+ */
+static void
+load_parsed(ir_unit_t *iu)
+{
+  compile_stop(iu);
+  layout_text(iu);
 
 #ifdef VMIR_VM_JIT
   jit_seal_code(iu);
 #endif
+#ifdef VMIR_COPY_PATCH
+  cp_seal_code(iu);
+#endif
+#ifdef VMIR_AOT
+  if(iu->iu_aot_path != NULL)
+    aot_bind(iu);
+#endif
+}
+
+
+/**
+ * Set up memory and function tables for running
+ */
+static int
+load_finish(ir_unit_t *iu, int cached)
+{
+  if(!iu->iu_tier_threshold && !iu->iu_lazy) {
+    free(iu->iu_text_alloc);
+    iu->iu_text_alloc = NULL;
+  }
+
   iu->iu_heap_start = VMIR_ALIGN(iu->iu_data_ptr, 4096);
 
   vmir_heap_init(iu);
 
-  initialize_globals(iu, iu->iu_mem);
+  if(cached) {
+    cache_start(iu);
+  } else {
+    initialize_globals(iu, iu->iu_mem);
+    if(iu->iu_cache_path != NULL)
+      cache_save(iu);
+    initialize_libc(iu);
+  }
 
-  initialize_libc(iu);
+#ifdef VMIR_COPY_PATCH
+  // Only VM text is cached, it's compiled once saved or loaded
+  if(iu->iu_copy_patch && iu->iu_cache_path != NULL)
+    cp_compile_module(iu);
+#endif
 
   iu->iu_vm_funcs  = calloc(VECTOR_LEN(&iu->iu_functions), sizeof(void *));
+  iu->iu_vm_frame_sizes = calloc(VECTOR_LEN(&iu->iu_functions),
+                                 sizeof(uint32_t));
   iu->iu_ext_funcs = calloc(VECTOR_LEN(&iu->iu_functions), sizeof(void *));
   for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++) {
     ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
 
     iu->iu_vm_funcs[i]  = f->if_vm_text;
+    if(f->if_vm_text != NULL)
+      iu->iu_vm_frame_sizes[i] = f->if_regframe_size;
     iu->iu_ext_funcs[i] = f->if_ext_func;
+  }
 
-    if(f->if_used && f->if_vm_text == NULL && f->if_ext_func == NULL)
+  if(iu->iu_lazy)
+    lazy_start(iu);
+
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++) {
+    ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    if(f->if_vm_text != NULL || f->if_ext_func != NULL)
+      continue;
+    if(iu->iu_lazy ? lazy_undefined(f) : f->if_used)
       parser_error(iu, "Function %s() is not defined", f->if_name);
   }
 
-  iu_cleanup(iu);
+#ifdef VMIR_VM_JIT
+  if(iu->iu_tier_threshold)
+    tier_start(iu);
+#endif
+
+  // Types, module level values and blockinfo are needed for compiling
+  // functions after load so iu_cleanup() is deferred
+  if(!iu->iu_tier_threshold && !iu->iu_lazy) {
+    iu_cleanup(iu);
+    arena_pool_trim(iu->iu_arena_pool);
+  }
   return 0;
 }
 
+
+/**
+ *
+ */
+int
+vmir_load(ir_unit_t *iu, const uint8_t *u8, int len)
+{
+  bcbitstream_t bs = {0};
+  bs.rdata = u8;
+  bs.bytes_length = len;
+
+  uint32_t x = read_bits(&bs, 32);
+
+  if(x != 0xdec04342)
+    return VMIR_ERR_NOT_BITCODE;
+
+  iu->iu_bs = &bs;
+
+  load_prepare(iu);
+
+  if(iu->iu_cache_path != NULL && cache_init(iu, u8, len)) {
+    free(iu->iu_cache_path);
+    iu->iu_cache_path = NULL;
+  }
+
+  const int cached = iu->iu_cache_path != NULL && cache_load(iu);
+
+  if(setjmp(iu->iu_err_jmp)) {
+    iu_cleanup(iu);
+    return VMIR_ERR_LOAD_ERROR;
+  }
+
+  if(!cached) {
+    //  int64_t ts = get_ts();
+    ir_parse_blocks(iu, 2, len - 4, NULL, NULL);
+    load_parsed(iu);
+    //  printf("Parse took %"PRId64"us\n", get_ts() - ts);
+  }
+
+  return load_finish(iu, cached);
+}
+
+
+/**
+ * The cache is keyed on all of the bitcode so it is not used here
+ */
+void
+vmir_load_begin(ir_unit_t *iu)
+{
+  load_prepare(iu);
+  free(iu->iu_cache_path);
+  iu->iu_cache_path = NULL;
+  stream_begin(iu);
+}
+
+
+/**
+ *
+ */
+int
+vmir_load_feed(ir_unit_t *iu, const void *data, int len)
+{
+  if(iu->iu_stream == NULL)
+    return VMIR_ERR_LOAD_ERROR;
+
+  if(setjmp(iu->iu_err_jmp)) {
+    stream_destroy(iu);
+    iu_cleanup(iu);
+    return VMIR_ERR_LOAD_ERROR;
+  }
+
+  const int r = stream_feed(iu, data, len);
+  if(r)
+    stream_destroy(iu);
+  return r;
+}
+
+
+/**
+ *
+ */
+int
+vmir_load_end(ir_unit_t *iu)
+{
+  if(iu->iu_stream == NULL)
+    return VMIR_ERR_LOAD_ERROR;
+
+  if(setjmp(iu->iu_err_jmp)) {
+    stream_destroy(iu);
+    iu_cleanup(iu);
+    return VMIR_ERR_LOAD_ERROR;
+  }
+
+  stream_end(iu);
+  stream_destroy(iu);
+  load_parsed(iu);
+  return load_finish(iu, 0);
+}
+
+
+/**
+ * Function bodies kept for compiling later are copied out of the
+ * bitcode so the mapping is not needed after vmir_load()
+ */
+int
+vmir_load_fd(ir_unit_t *iu, int fd)
+{
+  struct stat st;
+  if(fstat(fd, &st))
+    return VMIR_ERR_IO;
+
+  if(st.st_size < 4 || st.st_size > INT32_MAX)
+    return VMIR_ERR_NOT_BITCODE;
+
+  void *bitcode = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(bitcode == MAP_FAILED)
+    return VMIR_ERR_IO;
+
+  madvise(bitcode, st.st_size, MADV_SEQUENTIAL);
+  int r = vmir_load(iu, bitcode, st.st_size);
+  munmap(bitcode, st.st_size);
+  return r;
+}
+
+
+/**
+ *
+ */
+int
+vmir_load_file(ir_unit_t *iu, const char *path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1)
+    return VMIR_ERR_IO;
+  int r = vmir_load_fd(iu, fd);
+  close(fd);
+  return r;
+}
+
  
 /**
  *
@@ -700,7 +1164,8 @@ vmir_run(ir_unit_t *iu, int argc, char **argv)
 
   if(r == VM_STOP_ABORT ||
      r == VM_STOP_BAD_INSTRUCTION ||
-     r == VM_STOP_UNREACHABLE)
+     r == VM_STOP_UNREACHABLE ||
+     r == VM_STOP_STACK_OVERFLOW)
     exit(r);
 }
 
@@ -725,15 +1190,199 @@ vmir_set_debugged_function(ir_unit_t *iu, const char *function)
 }
 
 
+/**
+ *
+ */
+void
+vmir_set_jit_threshold(ir_unit_t *iu, int threshold)
+{
+#ifdef VMIR_VM_JIT
+  iu->iu_tier_threshold = threshold;
+#endif
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_copy_patch(ir_unit_t *iu, int on)
+{
+#ifdef VMIR_COPY_PATCH
+  iu->iu_copy_patch = on;
+#endif
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_aot(ir_unit_t *iu, const char *path)
+{
+#ifdef VMIR_AOT
+  free(iu->iu_aot_path);
+  iu->iu_aot_path = path ? strdup(path) : NULL;
+#endif
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_cache(ir_unit_t *iu, const char *path)
+{
+  free(iu->iu_cache_path);
+  iu->iu_cache_path = path ? strdup(path) : NULL;
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_inline_size(ir_unit_t *iu, int size)
+{
+  iu->iu_inline_size = size;
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_linear_scan_threshold(ir_unit_t *iu, int values)
+{
+  iu->iu_linear_scan_threshold = values;
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_compile_threads(ir_unit_t *iu, int threads)
+{
+  iu->iu_compile_threads = threads > 0 ? threads : compile_threads_online();
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_lazy(ir_unit_t *iu, int mode)
+{
+  iu->iu_lazy = mode;
+}
+
+
+/**
+ *
+ */
+void
+vmir_set_op_profile(ir_unit_t *iu, const char *path)
+{
+#ifdef VMIR_VM_PROFILE
+  free(iu->iu_op_profile_path);
+  iu->iu_op_profile_path = path ? strdup(path) : NULL;
+#endif
+}
+
+
+/**
+ * Metadata is what's allocated from the host heap for the unit: The
+ * function table and anything kept for compiling functions after load
+ * (bitcode of function bodies, types, module level values, IR of
+ * functions being dumped and the emitter's scratch buffer)
+ */
+void
+vmir_get_footprint(ir_unit_t *iu, vmir_footprint_t *vf)
+{
+  const int num_functions = VECTOR_LEN(&iu->iu_functions);
+  size_t meta = sizeof(ir_unit_t);
+
+  memset(vf, 0, sizeof(vmir_footprint_t));
+
+  for(int i = 0; i < num_functions; i++) {
+    const ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    vf->vm_text += f->if_vm_text_size + f->if_tier0_text_size;
+
+    meta += sizeof(ir_function_t) + strlen(f->if_name) + 1;
+    if(f->if_body != NULL)
+      meta += f->if_body_size;
+    meta += arena_size(f->if_arena);
+  }
+  meta += iu->iu_functions.vh_capacity * sizeof(ir_function_t *);
+  if(iu->iu_vm_funcs != NULL)
+    meta += num_functions * (sizeof(iu->iu_vm_funcs[0]) +
+                             sizeof(iu->iu_vm_frame_sizes[0]) +
+                             sizeof(iu->iu_ext_funcs[0]));
+  meta += iu->iu_vm_frames_size * sizeof(iu->iu_vm_frames[0]);
+  if(iu->iu_lazy_stubs != NULL)
+    meta += num_functions * LAZY_STUB_SIZE * sizeof(uint16_t);
+
+  meta += iu->iu_types.vh_capacity * sizeof(ir_type_t);
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_types); i++) {
+    const ir_type_t *it = &VECTOR_ITEM(&iu->iu_types, i);
+    if(it->it_code == IR_TYPE_STRUCT)
+      meta += it->it_struct.num_elements * sizeof(it->it_struct.elements[0]);
+    else if(it->it_code == IR_TYPE_FUNCTION)
+      meta += it->it_function.num_parameters * sizeof(int);
+  }
+
+  meta += iu->iu_values.vh_capacity * sizeof(ir_value_t *);
+  for(int i = 0; i < iu->iu_next_value; i++) {
+    const ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, i);
+    if(iv == NULL)
+      continue;
+    meta += sizeof(ir_value_t);
+    if(iv->iv_name != NULL)
+      meta += strlen(iv->iv_name) + 1;
+  }
+
+  if(iu->iu_text_alloc != NULL)
+    meta += iu->iu_text_alloc_memsize;
+
+  const ir_arena_pool_t *iap = iu->iu_arena_pool;
+  meta += sizeof(ir_arena_pool_t) +
+    iap->iap_num_free * (ARENA_CHUNK_HDR + ARENA_CHUNK_SIZE);
+
+  vf->jit_code = iu->iu_jit_ptr + iu->iu_cp_ptr;
+  vf->data = iu->iu_data_ptr - (iu->iu_rsize + iu->iu_asize);
+  vf->metadata = meta;
+}
+
+
+/**
+ *
+ */
 void
 vmir_print_stats(ir_unit_t *iu)
 {
+  vmir_footprint_t vf;
+  vmir_get_footprint(iu, &vf);
+
   printf("       Moves killed: %d\n", iu->iu_stats.moves_killed);
   printf("  Lea+Load combined: %d\n", iu->iu_stats.lea_load_combined);
   printf(" Lea+Load comb-fail: %d\n", iu->iu_stats.lea_load_combined_failed);
   printf("Cmp+Branch combined: %d\n", iu->iu_stats.cmp_branch_combine);
   printf("   Mul+Add combined: %d\n", iu->iu_stats.mla_combine);
   printf(" Load+Cast combined: %d\n", iu->iu_stats.load_cast_combine);
+  printf("         Tail calls: %d\n", iu->iu_stats.tail_calls);
+  printf("      Inlined calls: %d\n", iu->iu_stats.inlined_calls);
+  printf("   Allocas promoted: %d\n", iu->iu_stats.allocas_promoted);
+  printf("   Constants folded: %d\n", iu->iu_stats.sccp_constants);
+  printf("    Branches folded: %d\n", iu->iu_stats.sccp_branches);
+  printf(" Invariants hoisted: %d\n", iu->iu_stats.licm_hoisted);
+  printf("        IVs reduced: %d\n", iu->iu_stats.ivs_reduced);
+  printf("  Redundant removed: %d\n", iu->iu_stats.gvn_eliminated);
+  printf(" Linear scan allocs: %d\n", iu->iu_stats.linear_scan_functions);
+  printf("  Parallel compiles: %d\n", iu->iu_stats.parallel_functions);
+  printf("      Lazy compiles: %d\n", iu->iu_stats.lazy_functions);
+  printf("    Failed compiles: %d\n", iu->iu_stats.failed_compiles);
+  printf("   Cached functions: %d\n", iu->iu_stats.cached_functions);
   printf("     VM Reg Acc ops: %d+%d+%d+%d = %d\n",
          iu->iu_stats.vm_binop_acc,
          iu->iu_stats.vm_binop_acc_imm,
@@ -743,6 +1392,17 @@ vmir_print_stats(ir_unit_t *iu)
          iu->iu_stats.vm_binop_acc_imm +
          iu->iu_stats.vm_binop_acc_acc +
          iu->iu_stats.vm_binop_acc_acc_imm);
+  printf("      Loop branches: %d\n", iu->iu_stats.vm_loop_branches);
+  printf("  Far branching fns: %d\n", iu->iu_stats.vm_far_functions);
+  printf("  Superinstructions: %d\n", iu->iu_stats.vm_superinstructions);
+  printf(" Copy-and-patch fns: %d (%d interpreted)\n",
+         iu->iu_stats.cp_functions, iu->iu_stats.cp_functions_failed);
+  printf("            AOT fns: %d (%d interpreted)\n",
+         iu->iu_stats.aot_functions, iu->iu_stats.aot_functions_failed);
+  printf("            VM text: %zu bytes\n", vf.vm_text);
+  printf("           JIT code: %zu bytes\n", vf.jit_code);
+  printf("       Data segment: %zu bytes\n", vf.data);
+  printf("  Retained metadata: %zu bytes\n", vf.metadata);
 
   vmir_heap_print0(iu->iu_heap);
 }
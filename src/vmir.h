@@ -30,6 +30,7 @@ typedef struct ir_unit ir_unit_t;
 typedef enum vmir_errcode {
   VMIR_ERR_NOT_BITCODE = -1,
   VMIR_ERR_LOAD_ERROR = -2,
+  VMIR_ERR_IO = -3,
 } vmir_errcode_t;
 
 
@@ -54,6 +55,41 @@ ir_unit_t *vmir_create(void *membase, uint32_t memsize,
 vmir_errcode_t vmir_load(ir_unit_t *iu, const uint8_t *bitcode,
                          int bitcode_len);
 
+/**
+ * Same as vmir_load() but maps the bitcode from the file open as 'fd'
+ * instead of reading it into memory. Only the parts of the file that
+ * are parsed are paged in and the mapping is gone when this returns.
+ *
+ * The file descriptor is not closed
+ */
+vmir_errcode_t vmir_load_fd(ir_unit_t *iu, int fd);
+
+/**
+ * Same as vmir_load_fd() for the file at 'path'
+ */
+vmir_errcode_t vmir_load_file(ir_unit_t *iu, const char *path);
+
+/**
+ * Load bitcode as it arrives instead of all at once. Call
+ * vmir_load_begin(), then vmir_load_feed() with the bitcode in chunks
+ * of any size and vmir_load_end() when all of it has been fed.
+ *
+ * Each call to vmir_load_feed() parses everything that is complete,
+ * functions are compiled as soon as all of their body has arrived.
+ * The data is copied so it can be reused once the call returns.
+ *
+ * vmir_load_feed() and vmir_load_end() return the same errors as
+ * vmir_load(). After an error the load is aborted and further calls
+ * fail with VMIR_ERR_LOAD_ERROR.
+ *
+ * The cache (see vmir_set_cache()) is not used when streaming
+ */
+void vmir_load_begin(ir_unit_t *iu);
+
+vmir_errcode_t vmir_load_feed(ir_unit_t *iu, const void *data, int len);
+
+vmir_errcode_t vmir_load_end(ir_unit_t *iu);
+
 /**
  * Run will call main() with argc and argv as given by this call.
  *
@@ -95,6 +131,132 @@ void vmir_set_debug_flags(ir_unit_t *iu, int flags);
  */
 void vmir_set_debugged_function(ir_unit_t *iu, const char *function);
 
+/**
+ * Enable tiered compilation. Functions are interpreted until they have
+ * been called or looped 'threshold' times. They are then compiled again
+ * with the JIT on a background thread. Zero (default) will JIT all code
+ * at load time. Has no effect if there is no JIT for the host platform.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_jit_threshold(ir_unit_t *iu, int threshold);
+
+/**
+ * Compile functions to native code using the copy-and-patch baseline
+ * compiler instead of interpreting them. Functions containing
+ * instructions that it can't handle are still interpreted. When
+ * combined with vmir_set_jit_threshold() hot functions are later
+ * compiled again with the JIT. Has no effect unless built with
+ * VMIR_COPY_PATCH.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_copy_patch(ir_unit_t *iu, int on);
+
+/**
+ * Compile the module ahead-of-time to the shared object at 'path'.
+ *
+ * If the shared object was built from the same module its functions
+ * are used instead of the VM text. Otherwise the functions are
+ * translated to C which is written to 'path'.c and compiled with the
+ * host C compiler ($VMIR_AOT_CC or cc) into 'path'. Functions
+ * containing instructions that can't be translated are still
+ * interpreted. Disables the JIT and copy-and-patch compiler. Has no
+ * effect unless built with VMIR_AOT.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_aot(ir_unit_t *iu, const char *path);
+
+/**
+ * Inline calls to functions with at most 'size' instructions. Callees
+ * that are hot when tiering up may be four times larger. A function
+ * grows by at most four times its size (and 1024 instructions) and gets
+ * at most 64 calls inlined. Zero disables inlining. Defaults to 16.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_inline_size(ir_unit_t *iu, int size);
+
+/**
+ * Allocate registers with a linear scan over live intervals instead of
+ * coloring an interference graph in functions with at least 'values'
+ * values. Linear scan is much faster and uses far less memory for large
+ * functions but the register frames get somewhat larger. Zero uses it
+ * for all functions and a negative value disables it. Defaults to 4096.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_linear_scan_threshold(ir_unit_t *iu, int values);
+
+/**
+ * Transform functions on 'threads' worker threads while the bitcode is
+ * parsed. Zero uses one thread per online CPU (the default) and one
+ * compiles each function in the loading thread as soon as it's parsed.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_compile_threads(ir_unit_t *iu, int threads);
+
+/**
+ * Compile functions lazily. With VMIR_LAZY_CALL the bodies are only
+ * scanned when loading and each function is compiled the first time
+ * it's called. With VMIR_LAZY_REACHABLE the functions that can be
+ * reached from main() or from function pointers stored in global
+ * variables are compiled when loading and the others are never
+ * compiled unless they are called after all. Has no effect with
+ * vmir_set_aot(). Defaults to VMIR_LAZY_NONE.
+ *
+ * Must be called before vmir_load()
+ */
+#define VMIR_LAZY_NONE      0
+#define VMIR_LAZY_CALL      1
+#define VMIR_LAZY_REACHABLE 2
+
+void vmir_set_lazy(ir_unit_t *iu, int mode);
+
+/**
+ * Write the number of times each sequence of two and three VM
+ * instructions was executed to 'path' when the unit is destroyed.
+ *
+ * The profile is used by vmir_supergen to generate superinstructions.
+ * Has no effect unless built with VMIR_VM_PROFILE (make vmir.profile)
+ */
+void vmir_set_op_profile(ir_unit_t *iu, const char *path);
+
+/**
+ * Cache the compiled module in the file at 'path'. If the file was
+ * written for the same bitcode (by the same build of vmir with the
+ * same settings) the module is loaded from it instead of being
+ * compiled. Otherwise it's (re)written once the module is compiled.
+ * Has no effect when tiering, with the AOT compiler or with any debug
+ * flag but VMIR_DBG_DISABLE_JIT. Only VM text is cached so lazy
+ * compilation and the JIT (which compiles from the IR) are disabled.
+ * The copy-and-patch compiler translates the VM text each time the
+ * module is loaded, use it for native code with the cache. The file
+ * is ignored unless it's owned by the effective user and not writable
+ * by group or others.
+ *
+ * Must be called before vmir_load()
+ */
+void vmir_set_cache(ir_unit_t *iu, const char *path);
+
+/**
+ * Memory used by a loaded unit, in bytes
+ */
+typedef struct vmir_footprint {
+  size_t vm_text;   // VM text of all functions
+  size_t jit_code;  // JITed and copy-and-patch compiled code
+  size_t data;      // Data segment (in the memory given to vmir_create())
+  size_t metadata;  // Allocated from the host heap to run the unit
+} vmir_footprint_t;
+
+/**
+ * Report how much memory the unit uses after vmir_load(). Code loaded
+ * from a shared object compiled ahead-of-time is not included
+ */
+void vmir_get_footprint(ir_unit_t *iu, vmir_footprint_t *vf);
+
 /**
  * Print various stats about code transformation to stdout
  */
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Ahead-of-time compiler
+ *
+ * Each function is translated from its VM text to a C function that
+ * calls the (inlined) VMOP() handlers with constant operands, see
+ * vmir_aot_prelude.h. When the module is loaded the shared object given
+ * to vmir_set_aot() is opened. If it was built from the same module
+ * (and the same VM) its functions replace the VM text, otherwise the C
+ * source is written next to it and compiled with the host C compiler
+ * ($VMIR_AOT_CC or cc, which is run directly, not via the shell) first.
+ *
+ * Functions containing instructions that can't be translated are left
+ * to the interpreter.
+ */
+
+#ifdef VMIR_AOT
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "vmir_aot_src.h"
+#include "vmir_vm_opnames.h"
+
+#define AOT_NUM_OPS (sizeof(vm_opnames) / sizeof(vm_opnames[0]))
+
+static const vm_aot_host_t aot_host_funcs = {
+  .vm_strchr            = vm_strchr,
+  .vm_strrchr           = vm_strrchr,
+  .vm_vaarg32           = vm_vaarg32,
+  .vm_vaarg64           = vm_vaarg64,
+  .vm_stop              = vm_stop,
+  .vm_native_jsr_vm     = vm_native_jsr_vm,
+  .vm_native_jsr_ext    = vm_native_jsr_ext,
+  .vm_native_jsr_r      = vm_native_jsr_r,
+  .vm_native_tail_vm    = vm_native_tail_vm,
+  .vm_native_tail_r     = vm_native_tail_r,
+  .vm_native_tier_count = vm_native_tier_count,
+  .vm_native_check_frame = vm_native_check_frame,
+};
+
+
+/**
+ * FNV-1a
+ */
+static uint64_t
+aot_hash(uint64_t h, const void *data, size_t len)
+{
+  const uint8_t *d = data;
+  for(size_t i = 0; i < len; i++) {
+    h ^= d[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+
+/**
+ *
+ */
+static void
+aot_init(ir_unit_t *iu)
+{
+  iu->iu_tier_threshold = 0;
+  iu->iu_copy_patch = 0;
+  iu->iu_aot_src = open_memstream(&iu->iu_aot_src_buf,
+                                  &iu->iu_aot_src_size);
+  iu->iu_aot_hash = aot_hash(0xcbf29ce484222325ULL,
+                             vmir_aot_src, sizeof(vmir_aot_src));
+}
+
+
+/**
+ * Branch deltas are in bytes relative to the first operand
+ */
+static int
+aot_target(int pos, uint16_t delta)
+{
+  return pos + 1 + (int16_t)delta / 2;
+}
+
+
+/**
+ *
+ */
+static void
+aot_emit_switch(FILE *fp, int gfid, int pos, const uint16_t *I, int width)
+{
+  const int p = I[1];
+  const int words = width == 64 ? 4 : width == 32 ? 2 : 1;
+  const uint16_t *targets = I + 2 + p * words;
+
+  fprintf(fp, "{ const uint16_t *I = t%d + %d; switch(R%d(0)) {",
+          gfid, pos + 1, width);
+  for(int i = 0; i < p; i++) {
+    const uint16_t *v = I + 2 + i * words;
+    switch(width) {
+    case 8:
+      fprintf(fp, " case 0x%x:", v[0] & 0xff);
+      break;
+    case 32:
+      fprintf(fp, " case 0x%xU:", v[0] | (uint32_t)v[1] << 16);
+      break;
+    case 64:
+      fprintf(fp, " case 0x%"PRIx64"ULL:",
+              v[0] | (uint64_t)v[1] << 16 |
+              (uint64_t)v[2] << 32 | (uint64_t)v[3] << 48);
+      break;
+    }
+    fprintf(fp, " goto L%d;", aot_target(pos, targets[i]));
+  }
+  fprintf(fp, " default: goto L%d; } }\n", aot_target(pos, targets[p]));
+}
+
+
+/**
+ * Translate the instructions of a function to C.
+ *
+ * Called right after vm_emit_function() while iu_vm_insns is valid
+ */
+static void
+aot_function(ir_unit_t *iu, ir_function_t *f)
+{
+  const uint16_t *text = f->if_vm_text;
+  const int len = f->if_vm_text_size / 2;
+  const int num_insns = VECTOR_LEN(&iu->iu_vm_insns);
+  const int gfid = f->if_gfid;
+  FILE *fp = iu->iu_aot_src;
+  uint64_t h = iu->iu_aot_hash;
+
+  VECTOR_SORT(&iu->iu_vm_insns, vm_insn_cmp);
+
+  h = aot_hash(h, &gfid, sizeof(gfid));
+  for(int i = 0; i < num_insns; i++) {
+    const vm_insn_t *vi = &VECTOR_ITEM(&iu->iu_vm_insns, i);
+    const uint16_t op = vi->vi_op;
+    const int pos = vi->vi_offset / 2;
+    const int next = i + 1 < num_insns ?
+      VECTOR_ITEM(&iu->iu_vm_insns, i + 1).vi_offset / 2 : len;
+    h = aot_hash(h, &op, sizeof(op));
+    h = aot_hash(h, text + pos + 1, (next - pos - 1) * 2);
+  }
+  iu->iu_aot_hash = h;
+
+  for(int i = 0; i < num_insns; i++) {
+    const int op = VECTOR_ITEM(&iu->iu_vm_insns, i).vi_op;
+    switch(op) {
+    case VM_JIT_CALL:
+    case VM_INSTRUMENT_COUNT:
+    case VM_NATIVE:
+      return;
+    default:
+      if(op >= AOT_NUM_OPS || vm_opnames[op] == NULL)
+        return;
+    }
+  }
+
+  fprintf(fp, "\n/* %s() */\nstatic const uint16_t t%d[] = {", f->if_name,
+          gfid);
+  for(int i = 0; i < len; i++)
+    fprintf(fp, "%s0x%04x,", i % 12 ? " " : "\n  ", text[i]);
+  fprintf(fp, "\n};\n\nstatic void\nf%d(void *rf, void *mem, vm_frame_t *vf)\n"
+          "{\n", gfid);
+
+  for(int i = 0; i < num_insns; i++) {
+    const vm_insn_t *vi = &VECTOR_ITEM(&iu->iu_vm_insns, i);
+    const int pos = vi->vi_offset / 2;
+    const uint16_t *I = text + pos + 1;
+    const char *name = vm_opnames[vi->vi_op];
+
+    fprintf(fp, " L%d: ", pos);
+
+    switch(vi->vi_op) {
+    case VM_NOP:
+      fprintf(fp, ";\n");
+      break;
+
+    case VM_RET_VOID:
+    case VM_RET_R8:
+    case VM_RET_R16:
+    case VM_RET_R32:
+    case VM_RET_R64:
+    case VM_RET_R32C:
+    case VM_RET_R64C:
+    case VM_JSR_VM_TAIL:
+    case VM_JSR_R_TAIL:
+    case VM_UNREACHABLE:
+      fprintf(fp, "aot_%s(rf, mem, vf, t%d + %d); return;\n",
+              name, gfid, pos + 1);
+      break;
+
+    case VM_B:
+      fprintf(fp, "goto L%d;\n", aot_target(pos, I[0]));
+      break;
+
+    case VM_BL:
+      fprintf(fp, "goto L%d;\n",
+              pos + 1 + (int32_t)(I[0] | (uint32_t)I[1] << 16) / 2);
+      break;
+
+    case VM_BCOND:
+      fprintf(fp, "if(aot_BCOND(rf, mem, vf, t%d + %d) == 1) "
+              "goto L%d; goto L%d;\n", gfid, pos + 1,
+              aot_target(pos, I[1]), aot_target(pos, I[2]));
+      break;
+
+    case VM_EQ8_BR ... VM_ADD_SLE32_C_BR:
+      fprintf(fp, "if(aot_%s(rf, mem, vf, t%d + %d) == 0) "
+              "goto L%d; goto L%d;\n", name, gfid, pos + 1,
+              aot_target(pos, I[0]), aot_target(pos, I[1]));
+      break;
+
+    case VM_JSR_VM:
+      // Direct call, the callee is either translated or a stub
+      fprintf(fp, "{ vm_frame_t cvf = {rf + %d, vf->vf_iu, "
+              "vf->vf_allocaptr}; vm_native_check_frame(vf, %d, rf + %d); "
+              "f%d(rf + %d, mem, &cvf); }\n",
+              I[2], I[0], I[1], I[0], I[1]);
+      break;
+
+    case VM_JUMPTABLE:
+      fprintf(fp, "{ const uint16_t *I = t%d + %d; switch(R8(0)) {",
+              gfid, pos + 1);
+      for(int j = 0; j < I[1]; j++)
+        fprintf(fp, " case %d: goto L%d;", j, aot_target(pos, I[2 + j]));
+      fprintf(fp, " default: __builtin_unreachable(); } }\n");
+      break;
+
+    case VM_SWITCH8_BS:
+      aot_emit_switch(fp, gfid, pos, I, 8);
+      break;
+    case VM_SWITCH32_BS:
+      aot_emit_switch(fp, gfid, pos, I, 32);
+      break;
+    case VM_SWITCH64_BS:
+      aot_emit_switch(fp, gfid, pos, I, 64);
+      break;
+
+    default:
+      fprintf(fp, "aot_%s(rf, mem, vf, t%d + %d);\n", name, gfid, pos + 1);
+      break;
+    }
+  }
+  fprintf(fp, "}\n");
+
+  VECTOR_PUSH_BACK(&iu->iu_aot_funcs, gfid);
+}
+
+
+/**
+ * Open the shared object and check that it was built from this module
+ */
+static void *
+aot_open(ir_unit_t *iu, const char *path)
+{
+  void *h = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if(h == NULL)
+    return NULL;
+
+  const uint64_t *hash = dlsym(h, "vmir_aot_hash");
+  const int *num_funcs = dlsym(h, "vmir_aot_num_funcs");
+  if(hash == NULL || *hash != iu->iu_aot_hash ||
+     num_funcs == NULL || *num_funcs != VECTOR_LEN(&iu->iu_functions) ||
+     dlsym(h, "vmir_aot_funcs") == NULL ||
+     dlsym(h, "vmir_aot_init") == NULL) {
+    dlclose(h);
+    return NULL;
+  }
+  return h;
+}
+
+
+/**
+ * Compile 'src' to the shared object 'out'. Returns 0 if the compiler
+ * succeeded
+ */
+static int
+aot_cc(const char *cc, const char *out, const char *src)
+{
+  char *const argv[] = {
+    (char *)cc, "-O2", "-fPIC", "-shared", "-fno-strict-aliasing",
+    "-o", (char *)out, (char *)src, "-lm", NULL
+  };
+
+  const pid_t pid = fork();
+  if(pid == -1)
+    return -1;
+  if(pid == 0) {
+    execvp(cc, argv);
+    _exit(127);
+  }
+
+  int status;
+  while(waitpid(pid, &status, 0) == -1) {
+    if(errno != EINTR)
+      return -1;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+
+/**
+ * Write the C source for the module next to the shared object and
+ * compile it
+ */
+static int
+aot_build(ir_unit_t *iu)
+{
+  const char *path = iu->iu_aot_path;
+  const int num_funcs = VECTOR_LEN(&iu->iu_functions);
+  char *src = malloc(strlen(path) + 3);
+  char *tmp = malloc(strlen(path) + 32);
+  sprintf(src, "%s.c", path);
+  sprintf(tmp, "%s.%d.tmp", path, (int)getpid());
+
+  FILE *fp = fopen(src, "w");
+  if(fp == NULL) {
+    printf("AOT: Unable to write %s\n", src);
+    free(src);
+    free(tmp);
+    return -1;
+  }
+
+  fprintf(fp, "/* Generated by vmir, do not edit */\n\n"
+          "#include <stdint.h>\n#include <string.h>\n"
+          "#include <stdlib.h>\n#include <math.h>\n\n");
+  fwrite(vmir_aot_src, 1, sizeof(vmir_aot_src) - 1, fp);
+  fprintf(fp, "}\n\n"); // Ends aot_ops_begin() opened by the prelude
+
+  for(int i = 0; i < num_funcs; i++)
+    fprintf(fp, "static vm_native_t f%d;\n", i);
+
+  fwrite(iu->iu_aot_src_buf, 1, iu->iu_aot_src_size, fp);
+
+  // Functions that are not translated are called via the interpreter
+  char *translated = calloc(1, MAX(num_funcs, 1));
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_aot_funcs); i++)
+    translated[VECTOR_ITEM(&iu->iu_aot_funcs, i)] = 1;
+
+  for(int i = 0; i < num_funcs; i++) {
+    if(translated[i])
+      continue;
+    fprintf(fp, "\nstatic void\nf%d(void *rf, void *mem, vm_frame_t *vf)\n"
+            "{\n  vm_native_jsr_vm(vf, %d, rf, vf->vf_ret);\n}\n", i, i);
+  }
+
+  fprintf(fp, "\nconst uint64_t vmir_aot_hash = 0x%"PRIx64"ULL;\n"
+          "const int vmir_aot_num_funcs = %d;\n"
+          "vm_native_t *const vmir_aot_funcs[%d] = {\n",
+          iu->iu_aot_hash, num_funcs, num_funcs ?: 1);
+  for(int i = 0; i < num_funcs; i++) {
+    if(translated[i])
+      fprintf(fp, "  [%d] = f%d,\n", i, i);
+  }
+  fprintf(fp, "};\n");
+  free(translated);
+
+  int err = ferror(fp);
+  if(fclose(fp) || err) {
+    printf("AOT: Unable to write %s\n", src);
+    free(src);
+    free(tmp);
+    return -1;
+  }
+
+  const char *cc = getenv("VMIR_AOT_CC") ?: "cc";
+  int r = aot_cc(cc, tmp, src);
+  if(r) {
+    printf("AOT: Compiling %s with %s failed\n", src, cc);
+    unlink(tmp);
+  } else if(rename(tmp, path)) {
+    printf("AOT: Unable to rename %s to %s\n", tmp, path);
+    unlink(tmp);
+    r = -1;
+  }
+
+  free(src);
+  free(tmp);
+  return r ? -1 : 0;
+}
+
+
+/**
+ * Replace the VM text of all translated functions with native code
+ * from the shared object, building it first if needed
+ */
+static void
+aot_bind(ir_unit_t *iu)
+{
+  fclose(iu->iu_aot_src);
+  iu->iu_aot_src = NULL;
+
+  void *h = aot_open(iu, iu->iu_aot_path);
+  if(h == NULL) {
+    if(aot_build(iu) ||
+       (h = aot_open(iu, iu->iu_aot_path)) == NULL) {
+      printf("AOT: Unable to load %s, functions will be interpreted\n",
+             iu->iu_aot_path);
+      return;
+    }
+  }
+
+  iu->iu_aot_handle = h;
+
+  void (*init)(const vm_aot_host_t *host) = dlsym(h, "vmir_aot_init");
+  vm_native_t *const *funcs = dlsym(h, "vmir_aot_funcs");
+
+  init(&aot_host_funcs);
+
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++) {
+    ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    if(f->if_vm_text == NULL)
+      continue;
+    if(funcs[i] != NULL) {
+      vm_set_native(iu, f, funcs[i]);
+      iu->iu_stats.aot_functions++;
+    } else {
+      iu->iu_stats.aot_functions_failed++;
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+aot_destroy(ir_unit_t *iu)
+{
+  if(iu->iu_aot_src != NULL)
+    fclose(iu->iu_aot_src);
+  free(iu->iu_aot_src_buf);
+  free(iu->iu_aot_path);
+  VECTOR_CLEAR(&iu->iu_aot_funcs);
+  if(iu->iu_aot_handle != NULL)
+    dlclose(iu->iu_aot_handle);
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Prelude of the C source emitted by the AOT compiler
+ *
+ * This file is not part of the vmir translation unit. The build embeds
+ * it, together with vmir_vm.h, vmir_vm_ops.h and vmir_vm_native_ops.h,
+ * as a string in vmir_aot_src.h which vmir_aot.c writes out in front of
+ * the translated functions.
+ *
+ * Every VMOP() becomes an always inlined function aot_<op>(rf, mem, vf, I)
+ * where I points to the operands of the instruction in a constant array,
+ * so the C compiler folds the operands just like vm_exec() would decode
+ * them. The function returns -1 to continue with the next instruction,
+ * -2 to return from the function or the index of the operand that holds
+ * the branch target to jump to.
+ */
+
+#ifndef __has_builtin
+#define __has_builtin(x) 0
+#endif
+
+#define VMIR_ALIGN(a, b) (((a) + (b) - 1) & ~((b) - 1))
+
+static const vm_aot_host_t *aot_host;
+
+#define vm_strchr(a, b, mem)  aot_host->vm_strchr(a, b, mem)
+#define vm_strrchr(a, b, mem) aot_host->vm_strrchr(a, b, mem)
+#define vm_vaarg32(rf, ptr)   aot_host->vm_vaarg32(rf, ptr)
+#define vm_vaarg64(rf, ptr)   aot_host->vm_vaarg64(rf, ptr)
+#define vm_stop(iu, reason, code) aot_host->vm_stop(iu, reason, code)
+#define vm_native_jsr_vm(vf, fid, rf, ret) \
+  aot_host->vm_native_jsr_vm(vf, fid, rf, ret)
+#define vm_native_jsr_ext(vf, fid, rf, ret) \
+  aot_host->vm_native_jsr_ext(vf, fid, rf, ret)
+#define vm_native_jsr_r(vf, fid, rf, ret) \
+  aot_host->vm_native_jsr_r(vf, fid, rf, ret)
+#define vm_native_tail_vm(vf, fid, rf, argoffset, argsize) \
+  aot_host->vm_native_tail_vm(vf, fid, rf, argoffset, argsize)
+#define vm_native_tail_r(vf, fid, rf, argoffset, argsize) \
+  aot_host->vm_native_tail_r(vf, fid, rf, argoffset, argsize)
+#define vm_native_tier_count(vf, fid) \
+  aot_host->vm_native_tier_count(vf, fid)
+#define vm_native_check_frame(vf, fid, rf) \
+  aot_host->vm_native_check_frame(vf, fid, rf)
+
+void vmir_aot_init(const vm_aot_host_t *host);
+
+void
+vmir_aot_init(const vm_aot_host_t *host)
+{
+  aot_host = host;
+}
+
+static inline __attribute__((always_inline)) float
+imm_flt(uint32_t u)
+{
+  union { uint32_t u; float f; } x = { u };
+  return x.f;
+}
+
+static inline __attribute__((always_inline)) double
+imm_dbl(uint64_t u)
+{
+  union { uint64_t u; double d; } x = { u };
+  return x.d;
+}
+
+#define ACCPOS 8
+#define R32_ACC *(uint32_t *)(rf + ACCPOS)
+#define S32_ACC *(int32_t  *)(rf + ACCPOS)
+
+#define REG(r) (rf + (int16_t)I[r])
+
+#define R8(r)  *(uint8_t  *)REG(r)
+#define S8(r)  *(int8_t   *)REG(r)
+#define R16(r) *(uint16_t *)REG(r)
+#define S16(r) *(int16_t  *)REG(r)
+#define R32(r) *(uint32_t *)REG(r)
+#define S32(r) *(int32_t  *)REG(r)
+#define R64(r) *(uint64_t *)REG(r)
+#define S64(r) *(int64_t  *)REG(r)
+#define RFLT(r)  *(float  *)REG(r)
+#define RDBL(r)  *(double *)REG(r)
+
+#define AR8(r, src)  R8(r) = src
+#define AS8(r, src)  S8(r) = src
+#define AR16(r, src) R16(r) = src
+#define AS16(r, src) S16(r) = src
+#define AR32(r, src) R32(r) = src
+#define AS32(r, src) S32(r) = src
+#define AR32_ACC(src) R32_ACC = src
+#define AS32_ACC(src) S32_ACC = src
+#define AR64(r, src) R64(r) = src
+#define AS64(r, src) S64(r) = src
+#define AFLT(r, src) RFLT(r) = src
+#define ADBL(r, src) RDBL(r) = src
+
+#define UIMM8(r)  ((uint8_t)I[r])
+#define SIMM8(r)  ((int8_t)I[r])
+#define UIMM16(r) ((uint16_t)I[r])
+#define SIMM16(r) ((int16_t)I[r])
+#define UIMM32(r) ((uint32_t)I[r] | (uint32_t)I[(r) + 1] << 16)
+#define SIMM32(r) ((int32_t)UIMM32(r))
+#define UIMM64(r) ((uint64_t)UIMM32((r) + 2) << 32 | UIMM32(r))
+#define SIMM64(r) ((int64_t)UIMM64(r))
+
+#define IMMFLT(r) imm_flt(UIMM32(r))
+#define IMMDBL(r) imm_dbl(UIMM64(r))
+
+#define MEM(x) ((mem) + (x))
+
+#define LOAD8(r, ea)   R8(r)  = *(uint8_t *)MEM(ea)
+#define LOAD8_ZEXT_32(r, ea)   R32(r)  = *(uint8_t *)MEM(ea)
+#define LOAD8_SEXT_32(r, ea)   S32(r)  = *(int8_t *)MEM(ea)
+#define LOAD16(r, ea)  R16(r) = *(uint16_t *)MEM(ea)
+#define LOAD16_ZEXT_32(r, ea)   R32(r)  = *(uint16_t *)MEM(ea)
+#define LOAD16_SEXT_32(r, ea)   S32(r)  = *(int16_t *)MEM(ea)
+#define LOAD32(r, ea)  R32(r) = *(uint32_t *)MEM(ea)
+#define LOAD64(r, ea)  R64(r) = *(uint64_t *)MEM(ea)
+#define STORE8(ea, v)   *(uint8_t *)MEM(ea) = v
+#define STORE16(ea, v)  *(uint16_t *)MEM(ea) = v
+#define STORE32(ea, v)  *(uint32_t *)MEM(ea) = v
+#define STORE64(ea, v)  *(uint64_t *)MEM(ea) = v
+
+#define allocaptr (vf->vf_allocaptr)
+
+#define VMOP(x)                                                 \
+  }                                                             \
+  static inline __attribute__((always_inline)) int              \
+  aot_ ## x(void *rf, void *mem, vm_frame_t *vf, const uint16_t *I) {
+
+#define VMOPN(x, n) VMOP(x)
+
+#define NEXT(n) return -1
+
+#define BRANCH(n) return n
+
+#define RETURN() return -2
+
+
+static void __attribute__((unused))
+aot_ops_begin(void)
+{
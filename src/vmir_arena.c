@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Region allocator for the IR
+ *
+ * The basic blocks, instructions, edges and value bindings of a
+ * function (and the arrays hanging off them) are allocated from the
+ * function's arena and released all at once by arena_destroy(), so
+ * there is no per-object free(). Instructions and edges removed while
+ * transforming are just unlinked.
+ *
+ * Arenas get their chunks from a pool owned by the unit which keeps
+ * released chunks for the next function. Functions are compiled on
+ * worker threads (and the tiering thread) so the pool is locked, but
+ * that's only done once per chunk.
+ */
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_POOL_MAX   32 // Free chunks kept by the pool
+#define ARENA_ALIGN      16 // Same as malloc()
+
+typedef struct ir_arena_chunk {
+  struct ir_arena_chunk *iac_next;
+  size_t iac_size;
+} ir_arena_chunk_t;
+
+#define ARENA_CHUNK_HDR VMIR_ALIGN(sizeof(ir_arena_chunk_t), ARENA_ALIGN)
+
+
+typedef struct ir_arena_pool {
+  pthread_mutex_t iap_mutex;
+  ir_arena_chunk_t *iap_free;
+  int iap_num_free;
+} ir_arena_pool_t;
+
+
+typedef struct ir_arena {
+  ir_arena_pool_t *ira_pool;
+  ir_arena_chunk_t *ira_chunks;
+  uint8_t *ira_ptr;
+  uint8_t *ira_end;
+} ir_arena_t;
+
+
+/**
+ *
+ */
+static ir_arena_pool_t *
+arena_pool_create(void)
+{
+  ir_arena_pool_t *iap = calloc(1, sizeof(ir_arena_pool_t));
+  pthread_mutex_init(&iap->iap_mutex, NULL);
+  return iap;
+}
+
+
+/**
+ * Free the chunks kept for reuse
+ */
+static void
+arena_pool_trim(ir_arena_pool_t *iap)
+{
+  ir_arena_chunk_t *iac;
+  pthread_mutex_lock(&iap->iap_mutex);
+  while((iac = iap->iap_free) != NULL) {
+    iap->iap_free = iac->iac_next;
+    free(iac);
+  }
+  iap->iap_num_free = 0;
+  pthread_mutex_unlock(&iap->iap_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+arena_pool_destroy(ir_arena_pool_t *iap)
+{
+  arena_pool_trim(iap);
+  pthread_mutex_destroy(&iap->iap_mutex);
+  free(iap);
+}
+
+
+/**
+ *
+ */
+static ir_arena_t *
+arena_create(ir_arena_pool_t *iap)
+{
+  ir_arena_t *ira = calloc(1, sizeof(ir_arena_t));
+  ira->ira_pool = iap;
+  return ira;
+}
+
+
+/**
+ * Allocations larger than a quarter of a chunk get a chunk of their own
+ * so the rest of the current chunk is not wasted
+ */
+static void * __attribute__((noinline))
+arena_alloc_slow(ir_arena_t *ira, size_t size)
+{
+  ir_arena_pool_t *iap = ira->ira_pool;
+  ir_arena_chunk_t *iac = NULL;
+  const int large = size > ARENA_CHUNK_SIZE / 4;
+
+  if(!large) {
+    pthread_mutex_lock(&iap->iap_mutex);
+    if((iac = iap->iap_free) != NULL) {
+      iap->iap_free = iac->iac_next;
+      iap->iap_num_free--;
+    }
+    pthread_mutex_unlock(&iap->iap_mutex);
+  }
+
+  if(iac == NULL) {
+    const size_t chunksize = large ? size : ARENA_CHUNK_SIZE;
+    iac = malloc(ARENA_CHUNK_HDR + chunksize);
+    iac->iac_size = chunksize;
+  }
+
+  iac->iac_next = ira->ira_chunks;
+  ira->ira_chunks = iac;
+
+  uint8_t *p = (uint8_t *)iac + ARENA_CHUNK_HDR;
+  if(!large) {
+    ira->ira_ptr = p + size;
+    ira->ira_end = p + iac->iac_size;
+  }
+  return memset(p, 0, size);
+}
+
+
+/**
+ * Returns zeroed memory that lives until arena_destroy()
+ */
+static inline void *
+arena_alloc(ir_arena_t *ira, size_t size)
+{
+  size = VMIR_ALIGN(size, ARENA_ALIGN);
+  if(__builtin_expect(size > ira->ira_end - ira->ira_ptr, 0))
+    return arena_alloc_slow(ira, size);
+  void *p = ira->ira_ptr;
+  ira->ira_ptr += size;
+  return memset(p, 0, size);
+}
+
+
+/**
+ * Bytes allocated for 'ira'
+ */
+static size_t
+arena_size(const ir_arena_t *ira)
+{
+  size_t size = 0;
+  if(ira == NULL)
+    return 0;
+  for(const ir_arena_chunk_t *iac = ira->ira_chunks; iac != NULL;
+      iac = iac->iac_next)
+    size += ARENA_CHUNK_HDR + iac->iac_size;
+  return sizeof(ir_arena_t) + size;
+}
+
+
+/**
+ * Release everything allocated from 'ira', chunks of the standard size
+ * go back to the pool
+ */
+static void
+arena_destroy(ir_arena_t *ira)
+{
+  if(ira == NULL)
+    return;
+
+  ir_arena_pool_t *iap = ira->ira_pool;
+  ir_arena_chunk_t *iac, *next;
+
+  pthread_mutex_lock(&iap->iap_mutex);
+  for(iac = ira->ira_chunks; iac != NULL; iac = next) {
+    next = iac->iac_next;
+    if(iac->iac_size == ARENA_CHUNK_SIZE &&
+       iap->iap_num_free < ARENA_POOL_MAX) {
+      iac->iac_next = iap->iap_free;
+      iap->iap_free = iac;
+      iap->iap_num_free++;
+    } else {
+      free(iac);
+    }
+  }
+  pthread_mutex_unlock(&iap->iap_mutex);
+  free(ira);
+}
+
+
+/**
+ * Code arena
+ *
+ * VM text is allocated from page aligned mappings that are released all
+ * at once by code_arena_destroy(). Text that is replaced (when tiering
+ * up or translating to native code) stays until then as other threads
+ * may still execute it, unless it's the last allocation and given back
+ * by code_release()
+ */
+
+#define CODE_CHUNK_SIZE (256 * 1024)
+#define CODE_ALIGN      16
+
+typedef struct ir_code_chunk {
+  struct ir_code_chunk *icc_next;
+  uint8_t *icc_mem;
+  size_t icc_size;
+} ir_code_chunk_t;
+
+
+typedef struct ir_code_arena {
+  ir_code_chunk_t *ica_chunks; // Current chunk first
+  uint8_t *ica_ptr;
+  uint8_t *ica_end;
+} ir_code_arena_t;
+
+
+/**
+ * Make sure the next 'size' bytes are allocated from the same mapping.
+ * Returns -1 if out of memory
+ */
+static int
+code_arena_reserve(ir_code_arena_t *ica, size_t size)
+{
+  if(size <= ica->ica_end - ica->ica_ptr)
+    return 0;
+
+  const size_t mapsize = VMIR_ALIGN(size, CODE_CHUNK_SIZE);
+  void *p = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    return -1;
+
+  ir_code_chunk_t *icc = malloc(sizeof(ir_code_chunk_t));
+  icc->icc_mem = p;
+  icc->icc_size = mapsize;
+  icc->icc_next = ica->ica_chunks;
+  ica->ica_chunks = icc;
+  ica->ica_ptr = p;
+  ica->ica_end = p + mapsize;
+  return 0;
+}
+
+
+/**
+ * Returns NULL if out of memory
+ */
+static void *
+code_alloc(ir_code_arena_t *ica, size_t size)
+{
+  size = VMIR_ALIGN(size, CODE_ALIGN);
+  if(code_arena_reserve(ica, size))
+    return NULL;
+  void *p = ica->ica_ptr;
+  ica->ica_ptr += size;
+  return p;
+}
+
+
+/**
+ * Give back 'p' if nothing was allocated after it
+ */
+static void
+code_release(ir_code_arena_t *ica, void *p, size_t size)
+{
+  if((uint8_t *)p + VMIR_ALIGN(size, CODE_ALIGN) == ica->ica_ptr)
+    ica->ica_ptr = p;
+}
+
+
+/**
+ *
+ */
+static void
+code_arena_destroy(ir_code_arena_t *ica)
+{
+  ir_code_chunk_t *icc;
+  while((icc = ica->ica_chunks) != NULL) {
+    ica->ica_chunks = icc->icc_next;
+    munmap(icc->icc_mem, icc->icc_size);
+    free(icc);
+  }
+  ica->ica_ptr = ica->ica_end = NULL;
+}
@@ -1,12 +1,10 @@
 
 static void
-abbrev_queue_free(struct ir_abbrev_queue *iaq)
+abbrev_vector_free(struct ir_abbrev_vector *iav)
 {
-  ir_abbrev_t *ia;
-  while((ia = TAILQ_FIRST(iaq)) != NULL) {
-    TAILQ_REMOVE(iaq, ia, ia_link);
-    free(ia);
-  }
+  for(int i = 0; i < VECTOR_LEN(iav); i++)
+    free(VECTOR_ITEM(iav, i));
+  VECTOR_CLEAR(iav);
 }
 
 /**
@@ -16,7 +14,7 @@ static void
 blockinfo_destroy(ir_blockinfo_t *ib)
 {
   LIST_REMOVE(ib, ib_link);
-  abbrev_queue_free(&ib->ib_abbrevs);
+  abbrev_vector_free(&ib->ib_abbrevs);
   free(ib);
 }
 
@@ -34,7 +32,6 @@ blockinfo_find(ir_unit_t *iu, int id)
   ib = calloc(1, sizeof(ir_blockinfo_t));
   ib->ib_id = id;
   LIST_INSERT_HEAD(&iu->iu_blockinfos, ib, ib_link);
-  TAILQ_INIT(&ib->ib_abbrevs);
   return ib;
 }
 
@@ -45,7 +42,7 @@ blockinfo_find(ir_unit_t *iu, int id)
 static void
 block_destroy(ir_block_t *ib)
 {
-  abbrev_queue_free(&ib->ib_scoped_abbrevs);
+  abbrev_vector_free(&ib->ib_scoped_abbrevs);
   LIST_REMOVE(ib, ib_link);
   free(ib);
 }
@@ -99,6 +96,7 @@ module_globalvar(ir_unit_t *iu, unsigned int argc, const ir_arg_t *argv)
 
   ir_globalvar_t *ig = calloc(1, sizeof(ir_globalvar_t));
   ig->ig_type = pointee;
+  ig->ig_constant = argv[1].i64 & 1;
 
   unsigned int alignment = vmir_llvm_alignment(argv[4].i64);
   const int val_id = value_append(iu);
@@ -111,6 +109,9 @@ module_globalvar(ir_unit_t *iu, unsigned int argc, const ir_arg_t *argv)
   ig->ig_addr = iu->iu_data_ptr;
   iu->iu_data_ptr += type_sizeof(iu, pointee);
 
+  if(ig->ig_constant)
+    VECTOR_PUSH_BACK(&iu->iu_constant_globals, val_id);
+
   const unsigned int initializer = argv[2].i64;
 
   if(initializer > 0) {
@@ -320,29 +321,6 @@ paramattr_rec_handler(ir_unit_t *iu, int op,
 }
 
 
-/**
- *
- */
-static void
-metadata_rec_handler(ir_unit_t *iu, int op,
-                     unsigned int argc, const ir_arg_t *argv)
-{
-  //  printf("metadata: Handling rec %d\n", op);
-  //  prinargs(argv, argc);
-}
-
-
-
-
-/**
- *
- */
-static void
-uselist_rec_handler(ir_unit_t *iu, int op,
-                    unsigned int argc, const ir_arg_t *argv)
-{
-}
-
 /**
  *
  */
@@ -357,6 +335,9 @@ value_symtab_rec_handler(ir_unit_t *iu, int op,
     if(argc < 2)
       parser_error(iu, "Bad args to VST_CODE_ENTRY");
 
+    if(iu->iu_inline_base)
+      break; // Arguments of inlined functions are the caller's values
+
     unsigned int vid = argv[0].i64;
     char *str = read_str_from_argv(argc - 1, argv + 1);
 
@@ -504,7 +485,7 @@ constants_rec_handler(ir_unit_t *iu, int op,
     int *values = malloc(sizeof(int) * iv->iv_num_values);
     iv->iv_data = values;
     for(int i = 0; i < iv->iv_num_values; i++)
-      values[i] = argv[i].i64;
+      values[i] = instr_value_relocate_abs(iu, argv[i].i64);
     break;
 
   case CST_CODE_DATA:
@@ -570,7 +551,7 @@ constants_rec_handler(ir_unit_t *iu, int op,
     ic = iv->iv_ce = malloc(sizeof(ir_constexpr_t));
     ic->ic_code = op;
     ic->ic_cast.op  = argv[0].i64;
-    ic->ic_cast.src = argv[2].i64;
+    ic->ic_cast.src = instr_value_relocate_abs(iu, argv[2].i64);
     break;
 
   case CST_CODE_CE_GEP:
@@ -586,7 +567,8 @@ constants_rec_handler(ir_unit_t *iu, int op,
     ic->ic_gep.num_values = argc / 2;
     ic->ic_gep.values = malloc(iv->iv_ce->ic_gep.num_values * sizeof(int));
     for(int i = 0; i < ic->ic_gep.num_values; i++)
-      ic->ic_gep.values[i] = argv[1 + i * 2].i64;
+      ic->ic_gep.values[i] = instr_value_relocate_abs(iu,
+                                                      argv[1 + i * 2].i64);
     break;
 
   case CST_CODE_CE_BINOP:
@@ -596,8 +578,8 @@ constants_rec_handler(ir_unit_t *iu, int op,
     ic = iv->iv_ce = malloc(sizeof(ir_constexpr_t));
     ic->ic_code = op;
     ic->ic_binop.op  = argv[0].i64;
-    ic->ic_binop.lhs = argv[1].i64;
-    ic->ic_binop.rhs = argv[2].i64;
+    ic->ic_binop.lhs = instr_value_relocate_abs(iu, argv[1].i64);
+    ic->ic_binop.rhs = instr_value_relocate_abs(iu, argv[2].i64);
     break;
 
   case CST_CODE_CE_CMP:
@@ -607,8 +589,8 @@ constants_rec_handler(ir_unit_t *iu, int op,
     ic = iv->iv_ce = malloc(sizeof(ir_constexpr_t));
     ic->ic_code = op;
     ic->ic_cmp.opty = argv[0].i64;
-    ic->ic_cmp.lhs  = argv[1].i64;
-    ic->ic_cmp.rhs  = argv[2].i64;
+    ic->ic_cmp.lhs  = instr_value_relocate_abs(iu, argv[1].i64);
+    ic->ic_cmp.rhs  = instr_value_relocate_abs(iu, argv[2].i64);
     ic->ic_cmp.pred = argv[3].i64;
     break;
 
@@ -666,6 +648,7 @@ initialize_global(ir_unit_t *iu, void *addr,
       break;
     case IR_VC_FUNCTION:
       *(uint32_t *)addr = value_function_addr(c);
+      lazy_reach(iu, c->iv_func);
       break;
 
     default:
@@ -757,14 +740,24 @@ initialize_globals(ir_unit_t *iu, void *mem)
 
 
 /**
- *
+ * Emit code for a transformed function
  */
 static void
-metadata_attachment_rec_handler(ir_unit_t *iu, int op,
-                                unsigned int argc, const ir_arg_t *argv)
+function_emit(ir_unit_t *iu, ir_function_t *f)
 {
-  //  printf("metadata_attachment: Handling rec %d\n", op);
-  //  prinargs(argv, argc);
+  if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_LOWERED_FUNCTION)
+    function_print(iu, iu->iu_current_function, "lowered");
+
+  vm_emit_function(iu, f);
+
+#ifdef VMIR_AOT
+  if(iu->iu_aot_path != NULL)
+    aot_function(iu, f);
+#endif
+#ifdef VMIR_COPY_PATCH
+  if(iu->iu_copy_patch && !iu->iu_tier_up && iu->iu_cache_path == NULL)
+    cp_compile_function(iu, f);
+#endif
 }
 
 
@@ -779,12 +772,46 @@ function_process(ir_unit_t *iu, ir_function_t *f)
   if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_PARSED_FUNCTION)
     function_print(iu, iu->iu_current_function, "parsed");
 
+  inline_prepare(iu, f);
   transform_function(iu, f);
+  function_emit(iu, f);
+}
 
-  if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_LOWERED_FUNCTION)
-    function_print(iu, iu->iu_current_function, "lowered");
 
-  vm_emit_function(iu, f);
+/**
+ *
+ */
+static int
+function_enter(ir_unit_t *iu, ir_function_t *f)
+{
+  const int valuelistsize = iu->iu_next_value;
+  iu->iu_first_func_value = iu->iu_next_value;
+
+  if(iu->iu_debugged_function != NULL &&
+     strcmp(iu->iu_debugged_function, f->if_name))
+    iu->iu_debug_flags_func = 0;
+  else
+    iu->iu_debug_flags_func = iu->iu_debug_flags;
+
+  // When tiering, functions are interpreted (or copy-and-patch
+  // compiled) until they get hot. The AOT compiler translates the
+  // VM text so it must not contain calls to JITed code
+  if(((iu->iu_tier_threshold || iu->iu_copy_patch) && !iu->iu_tier_up) ||
+     iu->iu_aot_path != NULL)
+    iu->iu_debug_flags_func |= VMIR_DBG_DISABLE_JIT;
+
+#ifdef VMIR_VM_JIT
+  // Without room for JITed code the function is interpreted
+  if(!(iu->iu_debug_flags_func & VMIR_DBG_DISABLE_JIT) && jit_mem_reserve(iu))
+    iu->iu_debug_flags_func |= VMIR_DBG_DISABLE_JIT;
+#endif
+
+  // Functions compiled in parallel before this one must be emitted first
+  if(!compile_parallel(iu))
+    compile_drain(iu);
+
+  function_prepare_parse(iu, f);
+  return valuelistsize;
 }
 
 
@@ -800,11 +827,25 @@ ir_enter_subblock(ir_unit_t *iu)
   align_bits32(bs);
   const uint32_t blocklen = read_bits(bs, 32) * 4;
 
+  switch(blockid) {
+  case 15: // METADATA block
+  case 16: // METADATA_ATTACHMENT block
+  case 18: // USELIST block
+    // Nothing in these is used so they are skipped without decoding
+    skip_bytes(bs, blocklen);
+    return;
+  }
+
+  // Values of functions queued for parallel compilation are numbered
+  // after the module level values so no more of those can be added
+  const ir_block_t *parent = LIST_FIRST(&iu->iu_blocks);
+  if(blockid != 12 && parent != NULL && LIST_NEXT(parent, ib_link) == NULL)
+    compile_drain(iu);
+
   ir_block_t *ib = calloc(1, sizeof(ir_block_t));
 
   LIST_INSERT_HEAD(&iu->iu_blocks, ib, ib_link);
 
-  TAILQ_INIT(&ib->ib_scoped_abbrevs);
   ir_blockinfo_t *ibi = blockinfo_find(iu, blockid);
 
   int valuelistsize = 0;
@@ -827,9 +868,6 @@ ir_enter_subblock(ir_unit_t *iu)
     rh = constants_rec_handler;
     break;
   case 12:  // FUNCTION block
-    valuelistsize = iu->iu_next_value;
-    iu->iu_first_func_value = iu->iu_next_value;
-
     if(iu->iu_current_function == NULL) {
       iu->iu_current_function = TAILQ_FIRST(&iu->iu_functions_with_bodies);
     } else {
@@ -842,30 +880,33 @@ ir_enter_subblock(ir_unit_t *iu)
     if(f == NULL)
       parser_error(iu, "Function body without matching function");
 
-    if(iu->iu_debugged_function != NULL &&
-       strcmp(iu->iu_debugged_function, f->if_name))
-      iu->iu_debug_flags_func = 0;
-    else
-      iu->iu_debug_flags_func = iu->iu_debug_flags;
+    if(iu->iu_tier_threshold || iu->iu_inline_size || iu->iu_lazy) {
+      // Save the body so we can compile it again once it gets hot or
+      // inline it into functions that follow
+      f->if_body_size = blocklen;
+      f->if_body_abbrev_width = inner_id_width;
+      f->if_body = malloc(blocklen);
+      memcpy(f->if_body, bs->rdata + byte_offset(bs), blocklen);
+    }
+
+    if(iu->iu_lazy) {
+      // Compiled after load, see vmir_lazy.c
+      if(iu->iu_inline_size)
+        f->if_inline_size = -1;
+      skip_bytes(bs, blocklen);
+      block_destroy(ib);
+      return;
+    }
 
-    function_prepare_parse(iu, f);
+    valuelistsize = function_enter(iu, f);
     rh = function_rec_handler;
     break;
   case 14:  // VALUE_SYMTAB block
     rh = value_symtab_rec_handler;
     break;
-  case 15:  // METADATA block
-    rh = metadata_rec_handler;
-    break;
-  case 16:  // METADATA_ATTACHMENT block
-    rh = metadata_attachment_rec_handler;
-    break;
   case 17:  // TYPES_NEW block
     rh = types_new_rec_handler;
     break;
-  case 18:  // USELIST block
-    rh = uselist_rec_handler;
-    break;
   default:
     parser_error(iu, "Invalid block type %d", blockid);
   }
@@ -874,9 +915,19 @@ ir_enter_subblock(ir_unit_t *iu)
 
   switch(blockid) {
   case 12:
-    function_process(iu, iu->iu_current_function);
+    if(compile_parallel(iu)) {
+      inline_prepare(iu, iu->iu_current_function);
+      compile_function(iu, iu->iu_current_function);
+    } else {
+      function_process(iu, iu->iu_current_function);
+      value_resize(iu, valuelistsize);
+      function_emitted(iu, iu->iu_current_function);
+    }
 
-    value_resize(iu, valuelistsize);
+    if(!iu->iu_tier_threshold && !iu->iu_current_function->if_inline_size) {
+      free(iu->iu_current_function->if_body);
+      iu->iu_current_function->if_body = NULL;
+    }
     break;
 
   case 11:
@@ -887,29 +938,30 @@ ir_enter_subblock(ir_unit_t *iu)
   block_destroy(ib);
 }
 
+static const char char6[64] =
+  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._";
+
 /**
  *
  */
 static void
 ir_unabbrev_record(ir_unit_t *iu, rec_handler_t *rh)
 {
-  int i;
   bcbitstream_t *bs = iu->iu_bs;
   const uint32_t code = read_vbr(bs, 6);
   const uint32_t numops = read_vbr(bs, 6);
 
-  ir_arg_t *argv = malloc(numops * sizeof(ir_arg_t));
-  for(i = 0; i < numops; i++) {
+  VECTOR_SET_CAPACITY(&iu->iu_argv, numops);
+  ir_arg_t *argv = iu->iu_argv.vh_p;
+  for(int i = 0; i < numops; i++)
     argv[i].i64 = read_vbr64(bs, 6);
-  }
 
   rh(iu, code, numops, argv);
-  free(argv);
 }
 
 
 /**
- *
+ * Read an abbreviation definition and prepare it for decoding
  */
 static int
 ir_define_abbrev(ir_unit_t *iu)
@@ -917,23 +969,41 @@ ir_define_abbrev(ir_unit_t *iu)
   bcbitstream_t *bs = iu->iu_bs;
   const uint32_t numops = read_vbr(bs, 5);
   ir_abbrev_t *ia = calloc(1, sizeof(ir_abbrev_t) +
-                           sizeof(ir_abbrev_operand_t) * numops);
-  ia->ia_nops = numops;
+                           (sizeof(ir_abbrev_operand_t) +
+                            sizeof(ir_arg_t)) * numops);
+  ir_arg_t *literals = (void *)&ia->ia_ops[numops];
+  ia->ia_literals = literals;
+
   int i;
   for(i = 0; i < numops; i++) {
-    ir_abbrev_operand_t *iao = &ia->ia_ops[i];
+    ir_abbrev_operand_t *iao = &ia->ia_ops[ia->ia_nops];
     const int litteral = read_bits(bs, 1);
     if(litteral) {
       iao->iao_type = IAOT_LITTERAL;
       iao->iao_data = read_vbr(bs, 8);
+      // The element type of an array is the last operand
+      if(i == numops - 1 && ia->ia_tail == IAOT_ARRAY)
+        parser_error(iu, "Bad array type %d\n", iao->iao_type);
+      if(ia->ia_num_literals == ia->ia_nops) {
+        literals[ia->ia_num_literals].i64 = iao->iao_data;
+        ia->ia_num_literals++;
+      }
+      ia->ia_nops++;
       continue;
     }
 
     iao->iao_type = read_bits(bs, 3);
     switch(iao->iao_type) {
     case IAOT_FIXED_WIDTH:
+      iao->iao_data = read_vbr(bs, 5);
+      if(iao->iao_data > 32)
+        parser_error(iu, "Bad fixed width %d in abbrev", iao->iao_data);
+      break;
+
     case IAOT_VBR:
       iao->iao_data = read_vbr(bs, 5);
+      if(iao->iao_data < 2 || iao->iao_data > 32)
+        parser_error(iu, "Bad VBR width %d in abbrev", iao->iao_data);
       break;
 
     case IAOT_CHAR6:
@@ -942,61 +1012,108 @@ ir_define_abbrev(ir_unit_t *iu)
     case IAOT_BLOB:
       if(i != numops - 1)
         parser_error(iu, "Blob is not last\n");
-      break;
+      ia->ia_tail = IAOT_BLOB;
+      continue;
 
     case IAOT_ARRAY:
       if(i != numops - 2)
         parser_error(iu, "Array is not next to last\n");
-      break;
+      ia->ia_tail = IAOT_ARRAY;
+      continue;
 
     default:
       parser_error(iu, "Bad type %d in abbrev", iao->iao_type);
     }
+
+    if(ia->ia_tail == IAOT_ARRAY) {
+      ia->ia_element = *iao;
+      break;
+    }
+    ia->ia_nops++;
   }
 
   ir_block_t *ib = LIST_FIRST(&iu->iu_blocks);
 
   if(ib->ib_blockinfo != NULL) {
-    TAILQ_INSERT_TAIL(&ib->ib_blockinfo->ib_abbrevs, ia, ia_link);
-    ib->ib_blockinfo->ib_num_abbrevs++;
+    VECTOR_PUSH_BACK(&ib->ib_blockinfo->ib_abbrevs, ia);
   } else {
-    TAILQ_INSERT_TAIL(&ib->ib_scoped_abbrevs, ia, ia_link);
+    VECTOR_PUSH_BACK(&ib->ib_scoped_abbrevs, ia);
   }
   return 0;
 }
 
 
 /**
- *
+ * Decode the elements of an array operand directly into the arguments
+ * after the first 'pos' ones
  */
 static int
-load_array(bcbitstream_t *bs, ir_unit_t *iu, const ir_abbrev_operand_t *type)
+load_array(bcbitstream_t *bs, ir_unit_t *iu, int pos,
+           const ir_abbrev_operand_t *type)
 {
   const int arraysize = read_vbr(bs, 6);
-  for(int i = 0; i < arraysize; i++) {
-
-    ir_arg_t a;
-
-    switch(type->iao_type) {
-    case IAOT_FIXED_WIDTH:
-      a.i64 = read_bits(bs, type->iao_data);
-      break;
-    case IAOT_VBR:
-      a.i64 = read_vbr(bs, type->iao_data);
-      break;
-    case IAOT_CHAR6:
-      a.i64 = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "0123456789._"[read_bits(bs, 6)];
-      break;
-    default:
-      parser_error(iu, "Bad array type %d\n", type->iao_type);
-    }
-    VECTOR_PUSH_BACK(&iu->iu_argv, a);
+  VECTOR_SET_CAPACITY(&iu->iu_argv, pos + arraysize);
+  ir_arg_t *a = iu->iu_argv.vh_p + pos;
+  const int width = type->iao_data;
+
+  switch(type->iao_type) {
+  case IAOT_FIXED_WIDTH:
+    for(int i = 0; i < arraysize; i++)
+      a[i].i64 = read_bits(bs, width);
+    break;
+  case IAOT_VBR:
+    for(int i = 0; i < arraysize; i++)
+      a[i].i64 = read_vbr64(bs, width);
+    break;
+  case IAOT_CHAR6:
+    for(int i = 0; i < arraysize; i++)
+      a[i].i64 = char6[read_bits(bs, 6)];
+    break;
+  default:
+    parser_error(iu, "Bad array type %d\n", type->iao_type);
   }
   return arraysize;
 }
 
 
+/**
+ * Blobs are passed to the record handler in iu_blob, pointing into the
+ * bitcode
+ */
+static void
+load_blob(bcbitstream_t *bs, ir_unit_t *iu)
+{
+  const int size = read_vbr(bs, 6);
+  align_bits32(bs);
+  const int offset = byte_offset(bs);
+  if(size > bs->bytes_length - offset)
+    parser_error(iu, "Blob of %d bytes is out of bounds", size);
+  iu->iu_blob = bs->rdata + offset;
+  iu->iu_blob_size = size;
+  skip_bytes(bs, size);
+  align_bits32(bs);
+}
+
+
+/**
+ * Abbreviations from the blockinfo are numbered before the ones
+ * defined in the current block
+ */
+static const ir_abbrev_t *
+abbrev_find(ir_unit_t *iu, unsigned int id, const ir_blockinfo_t *ibi)
+{
+  const ir_block_t *b = LIST_FIRST(&iu->iu_blocks);
+  const int num_blockinfo_abbrevs = VECTOR_LEN(&ibi->ib_abbrevs);
+  const unsigned int idx = id - 4;
+
+  if(idx < num_blockinfo_abbrevs)
+    return VECTOR_ITEM(&ibi->ib_abbrevs, idx);
+  if(idx - num_blockinfo_abbrevs < VECTOR_LEN(&b->ib_scoped_abbrevs))
+    return VECTOR_ITEM(&b->ib_scoped_abbrevs, idx - num_blockinfo_abbrevs);
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -1005,61 +1122,56 @@ ir_dispatch_abbrev(ir_unit_t *iu, unsigned int id, rec_handler_t *rh,
                    const ir_blockinfo_t *ibi)
 {
   bcbitstream_t *bs = iu->iu_bs;
-  const ir_abbrev_t *ia;
-  const struct ir_abbrev_queue *iaq;
-  const int orig_id = id;
-  id -= 4;
-  ir_block_t *b = LIST_FIRST(&iu->iu_blocks);
-
-  if(id >= ibi->ib_num_abbrevs) {
-    // Search in local scope
-    id -= ibi->ib_num_abbrevs;
-    iaq = &b->ib_scoped_abbrevs;
-  } else {
-    iaq = &ibi->ib_abbrevs;
-  }
-  TAILQ_FOREACH(ia, iaq, ia_link) {
-    if(id == 0)
-      break;
-    id--;
-  }
+  const ir_abbrev_t *ia = abbrev_find(iu, id, ibi);
 
   if(ia == NULL)
-    parser_error(iu, "Abbrev %d not found\n", orig_id);
+    parser_error(iu, "Abbrev %d not found\n", id);
 
+  const int nops = ia->ia_nops;
+  VECTOR_SET_CAPACITY(&iu->iu_argv, nops);
+  ir_arg_t *argv = iu->iu_argv.vh_p;
 
-  VECTOR_RESIZE(&iu->iu_argv, 0);
+  int i = ia->ia_num_literals;
+  memcpy(argv, ia->ia_literals, i * sizeof(ir_arg_t));
 
-  int i;
-  int nops = ia->ia_nops;
-
-  for(i = 0; i < nops; i++) {
-    ir_arg_t a;
-    switch(ia->ia_ops[i].iao_type) {
+  for(; i < nops; i++) {
+    const ir_abbrev_operand_t *iao = &ia->ia_ops[i];
+    switch(iao->iao_type) {
     case IAOT_LITTERAL:
-      a.i64 = ia->ia_ops[i].iao_data;
+      argv[i].i64 = iao->iao_data;
       break;
     case IAOT_FIXED_WIDTH:
-      a.i64 = read_bits(bs, ia->ia_ops[i].iao_data);
+      argv[i].i64 = read_bits(bs, iao->iao_data);
       break;
     case IAOT_VBR:
-      a.i64 = read_vbr64(bs, ia->ia_ops[i].iao_data);
+      argv[i].i64 = read_vbr64(bs, iao->iao_data);
+      break;
+    case IAOT_CHAR6:
+      argv[i].i64 = char6[read_bits(bs, 6)];
       break;
     case IAOT_ARRAY:
-      assert(i == ia->ia_nops - 2);
-      load_array(bs, iu, &ia->ia_ops[i + 1]);
-      nops--; // Cut off last argument (which was array type)
-      continue;
-
-    default:
-      parser_error(iu, "Can't handle abbrevs with arg %d yet",
-                           ia->ia_ops[i].iao_type);
+    case IAOT_BLOB:
+      abort();
     }
-    VECTOR_PUSH_BACK(&iu->iu_argv, a);
   }
 
-  rh(iu, iu->iu_argv.vh_p[0].i64, iu->iu_argv.vh_length - 1,
-     &iu->iu_argv.vh_p[1]);
+  int argc = nops;
+  switch(ia->ia_tail) {
+  case IAOT_ARRAY:
+    argc += load_array(bs, iu, nops, &ia->ia_element);
+    argv = iu->iu_argv.vh_p;
+    break;
+  case IAOT_BLOB:
+    load_blob(bs, iu);
+    break;
+  }
+
+  if(argc == 0)
+    parser_error(iu, "Abbreviated record %d without code", id);
+
+  rh(iu, argv[0].i64, argc - 1, argv + 1);
+  iu->iu_blob = NULL;
+  iu->iu_blob_size = 0;
 }
 
 
@@ -1072,8 +1184,7 @@ ir_parse_blocks(ir_unit_t *iu, int abbrev_id_width, int bytes,
 {
   uint32_t id;
   bcbitstream_t *bs = iu->iu_bs;
-  assert(bs->remain == 0);
-  const int start = bs->bytes_offset;
+  const int start = byte_offset(bs);
 
   while((id = read_bits(bs, abbrev_id_width)) != 0) {
     switch(id) {
@@ -1086,8 +1197,106 @@ ir_parse_blocks(ir_unit_t *iu, int abbrev_id_width, int bytes,
 
   align_bits32(bs);
 
-  assert(bs->remain == 0);
-  const int stop = bs->bytes_offset;
+  const int stop = byte_offset(bs);
 
   assert(bytes == (stop - start));
 }
+
+
+/**
+ * Parse and compile a function again from the bitcode saved at load
+ * time. Returns -1 if that fails, the function then keeps its old text
+ */
+static int
+function_reparse(ir_unit_t *iu, ir_function_t *f)
+{
+  bcbitstream_t bs = {0};
+  const ir_block_t *outer = LIST_FIRST(&iu->iu_blocks);
+  void *text = f->if_vm_text;
+  const int text_size = f->if_vm_text_size;
+  const int valuelistsize = iu->iu_next_value;
+  jmp_buf err;
+
+  if(setjmp(err)) {
+    while(LIST_FIRST(&iu->iu_blocks) != outer)
+      block_destroy(LIST_FIRST(&iu->iu_blocks));
+    value_resize(iu, valuelistsize);
+    function_remove_bb(f);
+    f->if_vm_text = text;
+    f->if_vm_text_size = text_size;
+    iu->iu_inline_base = 0;
+    iu->iu_current_function = NULL;
+    iu->iu_current_bb = NULL;
+    iu->iu_bs = NULL;
+    iu->iu_compile_err = NULL;
+    iu->iu_failed = 0;
+    return -1;
+  }
+  iu->iu_compile_err = &err;
+
+  bs.rdata = f->if_body;
+  bs.bytes_length = f->if_body_size;
+  iu->iu_bs = &bs;
+
+  ir_block_t *ib = calloc(1, sizeof(ir_block_t));
+  LIST_INSERT_HEAD(&iu->iu_blocks, ib, ib_link);
+
+  function_remove_bb(f);
+  f->if_num_bbs = 0;
+
+  iu->iu_current_function = f;
+  function_enter(iu, f);
+  ir_parse_blocks(iu, f->if_body_abbrev_width, f->if_body_size,
+                  function_rec_handler, blockinfo_find(iu, 12));
+  function_process(iu, f);
+  value_resize(iu, valuelistsize);
+  function_emitted(iu, f);
+
+  block_destroy(ib);
+  iu->iu_current_function = NULL;
+  iu->iu_bs = NULL;
+  iu->iu_compile_err = NULL;
+  return 0;
+}
+
+
+/**
+ * Parse the saved body of 'callee' into 'scratch' so it can be inlined
+ * into the current function. The callee's values are appended after
+ * the values of the current function and its arguments are replaced
+ * by 'args'
+ */
+static void
+function_parse_inline(ir_unit_t *iu, ir_function_t *callee,
+                      ir_function_t *scratch, const int *args)
+{
+  bcbitstream_t bs = {0};
+  bcbitstream_t *saved_bs = iu->iu_bs;
+  ir_function_t *saved_function = iu->iu_current_function;
+  ir_bb_t *saved_bb = iu->iu_current_bb;
+
+  bs.rdata = callee->if_body;
+  bs.bytes_length = callee->if_body_size;
+  iu->iu_bs = &bs;
+
+  ir_block_t *ib = calloc(1, sizeof(ir_block_t));
+  LIST_INSERT_HEAD(&iu->iu_blocks, ib, ib_link);
+
+  // References to these placeholders are relocated to 'args'
+  iu->iu_inline_argc =
+    type_get(iu, callee->if_type)->it_function.num_parameters;
+  iu->iu_inline_args = args;
+  iu->iu_inline_base = iu->iu_next_value;
+  for(int i = 0; i < iu->iu_inline_argc; i++)
+    value_append_and_get(iu)->iv_class = IR_VC_DEAD;
+
+  iu->iu_current_function = scratch;
+  ir_parse_blocks(iu, callee->if_body_abbrev_width, callee->if_body_size,
+                  function_rec_handler, blockinfo_find(iu, 12));
+  iu->iu_inline_base = 0;
+
+  block_destroy(ib);
+  iu->iu_current_function = saved_function;
+  iu->iu_current_bb = saved_bb;
+  iu->iu_bs = saved_bs;
+}
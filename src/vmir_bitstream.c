@@ -22,40 +22,72 @@
  * SOFTWARE.
  */
 
+/**
+ * Bits are consumed LSB first from 'buf' which is refilled a 64 bit
+ * word at a time (byte by byte at the end of the data). 'bytes_offset'
+ * is the next byte to load so the current position (in bits) is
+ * bytes_offset * 8 - remain
+ */
 typedef struct bcbitstream {
   const uint8_t *rdata;
 
   int bytes_length;
   int bytes_offset;
-  int remain;
-  uint8_t tmp;
+  int remain;     // Valid bits in buf
+  int overrun;    // Set when reading past the end
+  uint64_t buf;
 } bcbitstream_t;
 
 
+/**
+ * Make sure there are at least 32 bits in the buffer unless at the end
+ * of the data
+ */
+static inline void
+refill_bits(bcbitstream_t *bs)
+{
+  if(bs->bytes_offset + 8 <= bs->bytes_length) {
+    uint64_t w;
+    memcpy(&w, bs->rdata + bs->bytes_offset, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    const int bytes = (64 - bs->remain) >> 3;
+    if(bytes < 8)
+      w &= (1ULL << (bytes * 8)) - 1;
+    bs->buf |= w << bs->remain;
+    bs->bytes_offset += bytes;
+    bs->remain += bytes * 8;
+    return;
+  }
+
+  while(bs->remain <= 56 && bs->bytes_offset < bs->bytes_length) {
+    bs->buf |= (uint64_t)bs->rdata[bs->bytes_offset] << bs->remain;
+    bs->bytes_offset++;
+    bs->remain += 8;
+  }
+}
+
 
-static uint32_t
+/**
+ * Read 'num' (at most 32) bits. Returns 0 if past the end of the data
+ */
+static inline uint32_t
 read_bits(bcbitstream_t *bs, int num)
 {
-  int r = 0;
-  int off = 0;
-
-  while(num > 0) {
-    if(bs->bytes_offset >= bs->bytes_length)
+  if(__builtin_expect(bs->remain < num, 0)) {
+    refill_bits(bs);
+    if(bs->remain < num) {
+      bs->buf = 0;
+      bs->remain = 0;
+      bs->overrun = 1;
       return 0;
-
-    if(bs->remain == 0) {
-      bs->tmp = bs->rdata[bs->bytes_offset];
-      bs->bytes_offset++;
-      bs->remain = 8;
     }
-
-    int pick = MIN(num, bs->remain);
-    r |= (bs->tmp & ((1 << pick) - 1)) << off;
-    bs->tmp = bs->tmp >> pick;
-    off += pick;
-    num -= pick;
-    bs->remain -= pick;
   }
+
+  const uint32_t r = bs->buf & ((1ULL << num) - 1);
+  bs->buf >>= num;
+  bs->remain -= num;
   return r;
 }
 
@@ -66,64 +98,112 @@ read_bits(bcbitstream_t *bs, int num)
 static void
 align_bits32(bcbitstream_t *bs)
 {
-  bs->bytes_offset = (bs->bytes_offset + 3) & ~3;
+  const int pos = bs->bytes_offset - bs->remain / 8; // Bytes, rounded up
+  bs->bytes_offset = (pos + 3) & ~3;
+  bs->buf = 0;
   bs->remain = 0;
 }
 
+
 /**
- *
+ * Current position in bytes, must be byte aligned
  */
-static uint32_t
-read_vbr(bcbitstream_t *bs, int width)
+static int
+byte_offset(const bcbitstream_t *bs)
 {
-  assert(width > 0);
+  assert(bs->remain % 8 == 0);
+  return bs->bytes_offset - bs->remain / 8;
+}
+
+
+/**
+ * Skip 'bytes' from an aligned position
+ */
+static void
+skip_bytes(bcbitstream_t *bs, int bytes)
+{
+  bs->bytes_offset = byte_offset(bs) + bytes;
+  bs->buf = 0;
+  bs->remain = 0;
+}
+
 
-  uint32_t ret = 0;
+/**
+ *
+ */
+static uint32_t __attribute__((noinline))
+read_vbr_slow(bcbitstream_t *bs, int width, uint32_t x)
+{
   const uint32_t cont = (1 << (width - 1));
   const uint32_t mask = cont - 1;
-  int stride = 0;
+  uint32_t ret = x & mask;
+  int stride = width - 1;
 
   while(1) {
-    uint32_t x = read_bits(bs, width);
+    assert(stride < 32);
+    x = read_bits(bs, width);
     ret |= (x & mask) << stride;
-    if(cont & x) {
-      stride += width - 1;
-      assert(stride < 32);
-    } else {
+    if(!(cont & x))
       break;
-    }
+    stride += width - 1;
   }
   return ret;
 }
 
 
 /**
- *
+ * Values that fit in one chunk are the common case
  */
-static uint64_t
-read_vbr64(bcbitstream_t *bs, int width)
+static inline uint32_t
+read_vbr(bcbitstream_t *bs, int width)
 {
   assert(width > 0);
 
-  uint64_t ret = 0;
+  const uint32_t x = read_bits(bs, width);
+  if(__builtin_expect(!(x & (1 << (width - 1))), 1))
+    return x;
+  return read_vbr_slow(bs, width, x);
+}
+
+
+/**
+ *
+ */
+static uint64_t __attribute__((noinline))
+read_vbr64_slow(bcbitstream_t *bs, int width, uint32_t x)
+{
   const uint32_t cont = (1 << (width - 1));
   const uint32_t mask = cont - 1;
-  int stride = 0;
+  uint64_t ret = x & mask;
+  int stride = width - 1;
 
   while(1) {
-    uint32_t x = read_bits(bs, width);
+    assert(stride < 64);
+    x = read_bits(bs, width);
     ret |= (uint64_t)(x & mask) << stride;
-    if(cont & x) {
-      stride += width - 1;
-      assert(stride < 64);
-    } else {
+    if(!(cont & x))
       break;
-    }
+    stride += width - 1;
   }
   return ret;
 }
 
 
+/**
+ *
+ */
+static inline uint64_t
+read_vbr64(bcbitstream_t *bs, int width)
+{
+  assert(width > 0);
+
+  const uint32_t x = read_bits(bs, width);
+  if(__builtin_expect(!(x & (1 << (width - 1))), 1))
+    return x;
+  return read_vbr64_slow(bs, width, x);
+}
+
+
 typedef struct ir_arg {
   int64_t i64;
 } ir_arg_t;
@@ -0,0 +1,752 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Compiled code cache
+ *
+ * After a module is compiled everything needed to run it is written to
+ * the file given to vmir_set_cache(): The types, the function table
+ * (names, types, whether they are bound to external functions and where
+ * the instructions of their VM text start), the initialized data
+ * segment and the VM text of all functions. Loading the same module
+ * again (with the same build of VMIR and the same settings) maps the
+ * file instead of parsing the bitcode. The module is keyed on a SHA-256
+ * digest of the bitcode.
+ *
+ * The VM text is used in place (mapped copy-on-write as the inline
+ * caches of indirect calls live in it). No native code is cached. The
+ * JIT works on the IR, which is gone after load, so it's disabled when
+ * caching. The copy-and-patch compiler works on the VM text so it
+ * compiles the text once it's saved or checked and loaded. As the VM
+ * trusts its text the file is only used if it's owned by us and nobody
+ * else can write it, and every instruction is checked before the text
+ * is used (cache_check_text()).
+ *
+ * The file is laid out as
+ *
+ *   header, types, functions, data segment (8 byte aligned)
+ *   VM text  (page aligned, functions 16 byte aligned)
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "VMIRC003"
+#define CACHE_PAGE_SIZE 4096
+#define CACHE_TEXT_ALIGN 16 // Same as malloc() as text depends on it
+
+#define CACHE_FUNCTION_EXT 0x1  // Bound to an external function
+
+typedef struct cache_header {
+  char ch_magic[8];
+  uint8_t ch_key[SHA256_DIGEST_SIZE];
+  uint32_t ch_size;
+  uint32_t ch_num_types;
+  uint32_t ch_num_functions;
+  uint32_t ch_data_start;
+  uint32_t ch_data_end;
+  uint32_t ch_text_offset;
+  uint32_t ch_text_size;
+  uint32_t ch_num_stdio;
+  libc_stdio_t ch_stdio[3];
+  vmir_stats_t ch_stats;
+} cache_header_t;
+
+
+typedef struct cache_function {
+  int32_t cf_text_offset; // -1 if no VM text
+  uint32_t cf_text_size;
+  uint32_t cf_regframe_size;
+  uint32_t cf_type;
+  uint32_t cf_name_size;  // Including terminating zero, 0 if no name
+  uint32_t cf_flags;
+  uint32_t cf_num_insns;  // Followed by their offsets in the VM text
+} cache_function_t;
+
+
+typedef struct cache_reader {
+  const uint8_t *cr_ptr;
+  const uint8_t *cr_end;
+} cache_reader_t;
+
+
+/**
+ * Compute the key of the module. It covers the bitcode, the build of
+ * VMIR and all settings that affect the emitted code. Returns -1 if
+ * the cache can't be used with the current settings. The JIT is
+ * disabled as only VM text is cached
+ */
+static int
+cache_init(ir_unit_t *iu, const uint8_t *u8, int len)
+{
+  // Tiering and lazy compilation need the IR after load and the
+  // AOT compiler's shared object is not cached
+  if(iu->iu_tier_threshold || iu->iu_aot_path ||
+     iu->iu_debugged_function != NULL ||
+     iu->iu_debug_flags & ~VMIR_DBG_DISABLE_JIT)
+    return -1;
+
+  iu->iu_lazy = VMIR_LAZY_NONE;
+  iu->iu_debug_flags |= VMIR_DBG_DISABLE_JIT;
+
+  const struct {
+    uint32_t rsize, asize, memsize;
+    int inline_size, linear_scan_threshold, debug_flags, copy_patch;
+    int pointer_size, stats_size;
+  } config = {
+    iu->iu_rsize, iu->iu_asize, iu->iu_memsize,
+    iu->iu_inline_size, iu->iu_linear_scan_threshold, iu->iu_debug_flags,
+    iu->iu_copy_patch, sizeof(void *), sizeof(vmir_stats_t),
+  };
+
+  sha256_t s;
+  sha256_init(&s);
+  sha256_update(&s, __DATE__ __TIME__, sizeof(__DATE__ __TIME__));
+  for(int op = 0; op < VM_NUM_OPS; op++) {
+    const uint16_t o = vm_resolve(op);
+    sha256_update(&s, &o, sizeof(o));
+  }
+  sha256_update(&s, &config, sizeof(config));
+  sha256_update(&s, u8, len);
+  sha256_final(&s, iu->iu_cache_key);
+  return 0;
+}
+
+
+/**
+ * Remember where the instructions of 'f' start, from iu_vm_insns. Called
+ * once the function is emitted
+ */
+static void
+cache_record_insns(ir_unit_t *iu, ir_function_t *f)
+{
+  if(iu->iu_cache_path == NULL || iu->iu_vm_funcs != NULL)
+    return;
+
+  VECTOR_SORT(&iu->iu_vm_insns, vm_insn_cmp);
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_vm_insns); i++) {
+    cache_insn_t ci = {f->if_gfid, VECTOR_ITEM(&iu->iu_vm_insns, i).vi_offset};
+    VECTOR_PUSH_BACK(&iu->iu_cache_insns, ci);
+  }
+}
+
+
+/**
+ * Write 'len' bytes padded to 8 bytes
+ */
+static void
+cache_write(FILE *fp, const void *data, size_t len)
+{
+  static const uint8_t zeroes[8];
+  fwrite(data, 1, len, fp);
+  fwrite(zeroes, 1, VMIR_ALIGN(len, 8) - len, fp);
+}
+
+
+/**
+ * Pad the file with zeroes to 'align' and return the position
+ */
+static uint32_t
+cache_pad(FILE *fp, int align)
+{
+  long pos = ftell(fp);
+  for(; pos & (align - 1); pos++)
+    fputc(0, fp);
+  return pos;
+}
+
+
+/**
+ *
+ */
+static const void *
+cache_read(cache_reader_t *cr, size_t len)
+{
+  const void *r = cr->cr_ptr;
+  len = VMIR_ALIGN(len, 8);
+  if(cr->cr_end - cr->cr_ptr < len)
+    return NULL;
+  cr->cr_ptr += len;
+  return r;
+}
+
+
+/**
+ * Sort on function and offset
+ */
+static int
+cache_insn_cmp(const cache_insn_t *a, const cache_insn_t *b)
+{
+  if(a->ci_gfid != b->ci_gfid)
+    return a->ci_gfid - b->ci_gfid;
+  return a->ci_offset - b->ci_offset;
+}
+
+
+/**
+ * Sort on address of the VM text
+ */
+static int
+cache_text_cmp(const void *A, const void *B)
+{
+  const uintptr_t a = (uintptr_t)(*(ir_function_t * const *)A)->if_vm_text;
+  const uintptr_t b = (uintptr_t)(*(ir_function_t * const *)B)->if_vm_text;
+  return a < b ? -1 : a > b;
+}
+
+
+/**
+ * Write the cache for the module just compiled. Called once the data
+ * segment is initialized but before libc allocates anything
+ */
+static void
+cache_save(ir_unit_t *iu)
+{
+  const char *path = iu->iu_cache_path;
+  const int num_functions = VECTOR_LEN(&iu->iu_functions);
+  const int num_types = VECTOR_LEN(&iu->iu_types);
+  char *tmp = malloc(strlen(path) + 32);
+  sprintf(tmp, "%s.%d.tmp", path, (int)getpid());
+
+  // Not writable by others, see cache_load()
+  const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  FILE *fp = fd != -1 ? fdopen(fd, "w") : NULL;
+  if(fp == NULL) {
+    printf("Cache: Unable to write %s\n", tmp);
+    if(fd != -1) {
+      close(fd);
+      unlink(tmp);
+    }
+    free(tmp);
+    return;
+  }
+
+  cache_header_t ch = {
+    .ch_num_types = num_types,
+    .ch_num_functions = num_functions,
+    .ch_data_start = iu->iu_rsize + iu->iu_asize,
+    .ch_data_end = iu->iu_data_ptr,
+    .ch_stats = iu->iu_stats,
+  };
+  memcpy(ch.ch_magic, CACHE_MAGIC, sizeof(ch.ch_magic));
+  memcpy(ch.ch_key, iu->iu_cache_key, sizeof(ch.ch_key));
+  ch.ch_num_stdio = libc_stdio_globals(iu, ch.ch_stdio);
+  cache_write(fp, &ch, sizeof(ch));
+
+  for(int i = 0; i < num_types; i++) {
+    const ir_type_t *it = &VECTOR_ITEM(&iu->iu_types, i);
+    cache_write(fp, it, sizeof(ir_type_t));
+    switch(it->it_code) {
+    default:
+      break;
+    case IR_TYPE_STRUCT: {
+      const uint32_t name_size =
+        it->it_struct.name ? strlen(it->it_struct.name) + 1 : 0;
+      cache_write(fp, it->it_struct.elements,
+                  it->it_struct.num_elements *
+                  sizeof(it->it_struct.elements[0]));
+      cache_write(fp, &name_size, sizeof(name_size));
+      cache_write(fp, it->it_struct.name, name_size);
+      break;
+    }
+    case IR_TYPE_FUNCTION:
+      cache_write(fp, it->it_function.parameters,
+                  it->it_function.num_parameters * sizeof(int));
+      break;
+    }
+  }
+
+  // The text section is in the same order as the text in memory (see
+  // vmir_layout.c), VM text of function i is at text_offsets[i]
+  ir_function_t **texts = malloc(num_functions * sizeof(ir_function_t *) + 1);
+  int32_t *text_offsets = malloc(num_functions * sizeof(int32_t) + 1);
+  uint32_t text_size = 0;
+  int num_texts = 0;
+  for(int i = 0; i < num_functions; i++) {
+    ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    text_offsets[i] = -1;
+    if(f->if_vm_text != NULL)
+      texts[num_texts++] = f;
+  }
+  qsort(texts, num_texts, sizeof(ir_function_t *), cache_text_cmp);
+  for(int i = 0; i < num_texts; i++) {
+    text_offsets[texts[i]->if_gfid] = text_size;
+    text_size = VMIR_ALIGN(text_size + texts[i]->if_vm_text_size,
+                           CACHE_TEXT_ALIGN);
+  }
+
+  const int num_insns = VECTOR_LEN(&iu->iu_cache_insns);
+  uint32_t *insns = malloc(num_insns * sizeof(uint32_t) + 1);
+  int insn = 0;
+  VECTOR_SORT(&iu->iu_cache_insns, cache_insn_cmp);
+
+  for(int i = 0; i < num_functions; i++) {
+    const ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    const uint32_t name_size = f->if_name ? strlen(f->if_name) + 1 : 0;
+    cache_function_t cf = {
+      .cf_text_offset = text_offsets[i],
+      .cf_type = f->if_type,
+      .cf_name_size = name_size,
+      .cf_flags = f->if_ext_func ? CACHE_FUNCTION_EXT : 0,
+    };
+    if(f->if_vm_text != NULL) {
+      cf.cf_text_size = f->if_vm_text_size;
+      cf.cf_regframe_size = f->if_regframe_size;
+    }
+    for(; insn < num_insns &&
+          VECTOR_ITEM(&iu->iu_cache_insns, insn).ci_gfid == i; insn++)
+      insns[cf.cf_num_insns++] = VECTOR_ITEM(&iu->iu_cache_insns,
+                                             insn).ci_offset;
+    cache_write(fp, &cf, sizeof(cf));
+    cache_write(fp, f->if_name, name_size);
+    cache_write(fp, insns, cf.cf_num_insns * sizeof(uint32_t));
+  }
+  free(insns);
+
+  cache_write(fp, iu->iu_mem + ch.ch_data_start,
+              ch.ch_data_end - ch.ch_data_start);
+
+  ch.ch_text_offset = cache_pad(fp, CACHE_PAGE_SIZE);
+  ch.ch_text_size = text_size;
+  for(int i = 0; i < num_texts; i++) {
+    fwrite(texts[i]->if_vm_text, 1, texts[i]->if_vm_text_size, fp);
+    cache_pad(fp, CACHE_TEXT_ALIGN);
+  }
+  free(texts);
+
+  ch.ch_size = cache_pad(fp, CACHE_PAGE_SIZE);
+  free(text_offsets);
+
+  rewind(fp);
+  fwrite(&ch, 1, sizeof(ch), fp);
+
+  int err = ferror(fp);
+  if(fclose(fp) || err) {
+    printf("Cache: Unable to write %s\n", tmp);
+    unlink(tmp);
+  } else if(rename(tmp, path)) {
+    printf("Cache: Unable to rename %s to %s\n", tmp, path);
+    unlink(tmp);
+  }
+  free(tmp);
+}
+
+
+/**
+ * Destroy functions and types loaded from the cache. Their VM text is
+ * in the mapped file
+ */
+static void
+cache_destroy_functions(ir_unit_t *iu)
+{
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++) {
+    ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    f->if_vm_text = NULL;
+    function_destroy(f);
+  }
+  VECTOR_RESIZE(&iu->iu_functions, 0);
+
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_types); i++)
+    type_clean(&VECTOR_ITEM(&iu->iu_types, i));
+  VECTOR_RESIZE(&iu->iu_types, 0);
+}
+
+
+/**
+ * End (in bytes) of instruction 'i'
+ */
+static uint32_t
+cache_insn_end(const uint32_t *insns, int num_insns, uint32_t size, int i)
+{
+  return i + 1 < num_insns ? insns[i + 1] : size;
+}
+
+
+/**
+ * Returns true if 'offset' is where an instruction starts
+ */
+static int
+cache_is_insn(const uint32_t *insns, int num_insns, int64_t offset)
+{
+  int lo = 0, hi = num_insns - 1;
+  while(lo <= hi) {
+    const int mid = (lo + hi) >> 1;
+    if(insns[mid] == offset)
+      return 1;
+    if(insns[mid] < offset)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Make the table mapping op words in the VM text back to the ops. Ops
+ * that are never in cached text map to -1
+ */
+static int16_t *
+cache_op_table(void)
+{
+  int16_t *ops = malloc(65536 * sizeof(int16_t));
+  memset(ops, 0xff, 65536 * sizeof(int16_t));
+  for(int op = 0; op < VM_NUM_OPS; op++)
+    ops[(uint16_t)vm_resolve(op)] = op;
+
+  // JIT and runtime compilation are off when the cache is used
+  static const vm_op_t never[] = {
+    VM_JIT_CALL, VM_INSTRUMENT_COUNT, VM_TIER_COUNT, VM_NATIVE,
+    VM_MATERIALIZE,
+  };
+  for(int i = 0; i < sizeof(never) / sizeof(never[0]); i++)
+    ops[(uint16_t)vm_resolve(never[i])] = -1;
+  return ops;
+}
+
+
+/**
+ * Check the VM text of 'f' before it's used. 'insns' are the offsets of
+ * its instructions, each must start with an op from 'ops' and all
+ * branches must land on an instruction. Calls must be to functions that
+ * exist. The inline caches are reset as they hold pointers of the
+ * process that wrote the cache. Returns -1 if the text is bad
+ */
+static int
+cache_check_text(ir_unit_t *iu, ir_function_t *f, const uint32_t *insns,
+                 int num_insns, const int16_t *ops)
+{
+  uint16_t *text = f->if_vm_text;
+  const uint32_t size = f->if_vm_text_size;
+  const int num_functions = VECTOR_LEN(&iu->iu_functions);
+
+  if(num_insns == 0 || insns[0] != 0)
+    return -1;
+  for(int i = 0; i < num_insns; i++) {
+    const uint32_t end = cache_insn_end(insns, num_insns, size, i);
+    if(end <= insns[i] || end > size || end & 1)
+      return -1;
+  }
+
+  for(int i = 0; i < num_insns; i++) {
+    const int64_t base = insns[i] + 2; // Branches are relative to this
+    const uint16_t *I = text + base / 2;
+    const int len = cache_insn_end(insns, num_insns, size, i) / 2 - base / 2;
+    int op = ops[text[insns[i] / 2]];
+    const ir_function_t *callee;
+    int first = 0;
+    int num_targets = 0;
+    int32_t bl;
+
+    if(op == -1)
+      return -1;
+
+#ifndef VMIR_VM_PROFILE
+    // Only the first op is replaced, the rest must be what it stands for
+    for(int j = 0; j < VM_NUM_SUPERS; j++) {
+      const vm_super_t *vs = &vm_supers[j];
+      if(vs->vs_op != op)
+        continue;
+      if(i + vs->vs_len > num_insns)
+        return -1;
+      for(int k = 0; k < vs->vs_len; k++) {
+        const int x = i + k;
+        if((k && ops[text[insns[x] / 2]] != vs->vs_ops[k]) ||
+           cache_insn_end(insns, num_insns, size, x) - insns[x] !=
+           2 * (1 + vs->vs_oplen[k]))
+          return -1;
+      }
+      op = vs->vs_ops[0];
+      break;
+    }
+#endif
+
+    switch(op) {
+    case VM_B:
+      num_targets = 1;
+      break;
+    case VM_BCOND:
+      first = 1;
+      num_targets = 2;
+      break;
+    case VM_EQ8_BR ... VM_ADD_SLE32_C_BR:
+      num_targets = 2;
+      break;
+    case VM_BL:
+      if(len < 2)
+        return -1;
+      memcpy(&bl, I, sizeof(bl));
+      if(!cache_is_insn(insns, num_insns, base + bl))
+        return -1;
+      break;
+    case VM_JUMPTABLE:
+      if(len < 2 || I[1] == 0 || I[1] > 256 || I[1] & (I[1] - 1))
+        return -1;
+      first = 2;
+      num_targets = I[1];
+      break;
+    case VM_SWITCH8_BS:
+    case VM_SWITCH32_BS:
+    case VM_SWITCH64_BS:
+      if(len < 2)
+        return -1;
+      first = 2 + I[1] * (op == VM_SWITCH8_BS ? 1 :
+                          op == VM_SWITCH32_BS ? 2 : 4);
+      num_targets = I[1] + 1;
+      break;
+    case VM_JSR_VM:
+    case VM_JSR_VM_TAIL:
+    case VM_JSR_EXT:
+      if(len < 3 || I[0] >= num_functions)
+        return -1;
+      callee = VECTOR_ITEM(&iu->iu_functions, I[0]);
+      if(op == VM_JSR_EXT ? callee->if_ext_func == NULL :
+         callee->if_vm_text == NULL)
+        return -1;
+      break;
+    case VM_JSR_R:
+    case VM_JSR_R_TAIL:
+      if(len < 3 + VM_IC_SIZE)
+        return -1;
+      vm_ic_init(iu, (vm_ic_t *)(I + 3));
+      break;
+    }
+
+    if(first + num_targets > len)
+      return -1;
+    for(int j = first; j < first + num_targets; j++)
+      if(!cache_is_insn(insns, num_insns, base + (int16_t)I[j]))
+        return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Read the types and functions from the cache. Returns -1 if the file
+ * is damaged
+ */
+static int
+cache_load_tables(ir_unit_t *iu, cache_reader_t *cr, const cache_header_t *ch,
+                  const uint8_t *text)
+{
+  for(int i = 0; i < ch->ch_num_types; i++) {
+    const ir_type_t *src = cache_read(cr, sizeof(ir_type_t));
+    if(src == NULL)
+      return -1;
+    ir_type_t it = *src;
+    const void *p;
+    const uint32_t *name_size;
+    size_t size;
+
+    switch(it.it_code) {
+    default:
+      break;
+    case IR_TYPE_STRUCT:
+      size = it.it_struct.num_elements * sizeof(it.it_struct.elements[0]);
+      it.it_struct.elements = NULL;
+      it.it_struct.name = NULL;
+      if((p = cache_read(cr, size)) == NULL ||
+         (name_size = cache_read(cr, sizeof(uint32_t))) == NULL)
+        return -1;
+      it.it_struct.elements = malloc(size);
+      memcpy(it.it_struct.elements, p, size);
+      if(*name_size) {
+        if((p = cache_read(cr, *name_size)) == NULL) {
+          free(it.it_struct.elements);
+          return -1;
+        }
+        it.it_struct.name = strndup(p, *name_size - 1);
+      }
+      break;
+    case IR_TYPE_FUNCTION:
+      size = it.it_function.num_parameters * sizeof(int);
+      it.it_function.parameters = NULL;
+      if((p = cache_read(cr, size)) == NULL)
+        return -1;
+      it.it_function.parameters = malloc(size);
+      memcpy(it.it_function.parameters, p, size);
+      break;
+    }
+    VECTOR_PUSH_BACK(&iu->iu_types, it);
+  }
+
+  // The text can only be checked once all functions are known
+  const cache_function_t **cfs = calloc(ch->ch_num_functions + 1,
+                                        sizeof(cache_function_t *));
+  const uint32_t **insns = calloc(ch->ch_num_functions + 1,
+                                  sizeof(uint32_t *));
+  int r = -1;
+
+  for(int i = 0; i < ch->ch_num_functions; i++) {
+    const cache_function_t *cf = cache_read(cr, sizeof(cache_function_t));
+    if(cf == NULL)
+      goto out;
+    cfs[i] = cf;
+    const char *name = cache_read(cr, cf->cf_name_size);
+    // An instruction is at least one word
+    if(cf->cf_num_insns <= cf->cf_text_size / 2)
+      insns[i] = cache_read(cr, cf->cf_num_insns * sizeof(uint32_t));
+    if(name == NULL || insns[i] == NULL ||
+       cf->cf_type >= ch->ch_num_types ||
+       (cf->cf_name_size && name[cf->cf_name_size - 1]) ||
+       (cf->cf_text_offset >= 0 &&
+        cf->cf_text_offset + (uint64_t)cf->cf_text_size > ch->ch_text_size))
+      goto out;
+
+    ir_function_t *f = calloc(1, sizeof(ir_function_t));
+    TAILQ_INIT(&f->if_bbs);
+    f->if_gfid = i;
+    f->if_type = cf->cf_type;
+    VECTOR_PUSH_BACK(&iu->iu_functions, f);
+
+    if(cf->cf_name_size) {
+      f->if_name = strdup(name);
+      function_route(f);
+    }
+    // The external functions must be the same as when the cache was made
+    if(!!f->if_ext_func != !!(cf->cf_flags & CACHE_FUNCTION_EXT))
+      goto out;
+    if(cf->cf_text_offset >= 0) {
+      f->if_vm_text = (void *)text + cf->cf_text_offset;
+      f->if_vm_text_size = cf->cf_text_size;
+      f->if_regframe_size = cf->cf_regframe_size;
+    }
+  }
+
+  int16_t *ops = cache_op_table();
+  r = 0;
+  for(int i = 0; i < ch->ch_num_functions && !r; i++) {
+    ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    if(f->if_vm_text != NULL)
+      r = cache_check_text(iu, f, insns[i], cfs[i]->cf_num_insns, ops);
+  }
+  free(ops);
+ out:
+  free(cfs);
+  free(insns);
+  return r;
+}
+
+
+/**
+ * Load the module from the cache if it was made from the same module.
+ * Returns 0 if not. The file must be ours and not writable by anyone
+ * else as the VM trusts its text
+ */
+static int
+cache_load(ir_unit_t *iu)
+{
+  int fd = open(iu->iu_cache_path, O_RDONLY | O_NOFOLLOW);
+  if(fd == -1)
+    return 0;
+
+  struct stat st;
+  cache_header_t ch;
+  if(fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+    close(fd);
+    return 0;
+  }
+  if(st.st_mode & (S_IWGRP | S_IWOTH)) {
+    printf("Cache: Not using %s, it's writable by others\n",
+           iu->iu_cache_path);
+    close(fd);
+    return 0;
+  }
+
+  if(st.st_size < sizeof(ch) ||
+     read(fd, &ch, sizeof(ch)) != sizeof(ch) ||
+     memcmp(ch.ch_magic, CACHE_MAGIC, sizeof(ch.ch_magic)) ||
+     memcmp(ch.ch_key, iu->iu_cache_key, sizeof(ch.ch_key)) ||
+     ch.ch_size != st.st_size ||
+     ch.ch_text_offset < sizeof(ch) ||
+     ch.ch_text_offset > ch.ch_size ||
+     ch.ch_text_size > ch.ch_size - ch.ch_text_offset ||
+     ch.ch_data_start != iu->iu_rsize + iu->iu_asize ||
+     ch.ch_data_end < ch.ch_data_start || ch.ch_data_end > iu->iu_memsize ||
+     ch.ch_num_stdio > 3) {
+    close(fd);
+    return 0;
+  }
+
+  // Private as the inline caches in the VM text are written to
+  uint8_t *map = mmap(NULL, ch.ch_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+    return 0;
+
+  const uint8_t *text = map + ch.ch_text_offset;
+  cache_reader_t cr = {map + sizeof(ch), map + ch.ch_text_offset};
+  const void *data;
+
+  if(cache_load_tables(iu, &cr, &ch, text) ||
+     (data = cache_read(&cr, ch.ch_data_end - ch.ch_data_start)) == NULL)
+    goto bad;
+
+  memcpy(iu->iu_mem + ch.ch_data_start, data,
+         ch.ch_data_end - ch.ch_data_start);
+  iu->iu_data_ptr = ch.ch_data_end;
+
+  iu->iu_cache_map = map;
+  iu->iu_cache_size = ch.ch_size;
+  iu->iu_stats = ch.ch_stats;
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++)
+    if(VECTOR_ITEM(&iu->iu_functions, i)->if_vm_text != NULL)
+      iu->iu_stats.cached_functions++;
+  return 1;
+
+ bad:
+  cache_destroy_functions(iu);
+  munmap(map, ch.ch_size);
+  return 0;
+}
+
+
+/**
+ * Restore what libc sets up when loading. Called once the heap exists
+ */
+static void
+cache_start(ir_unit_t *iu)
+{
+  const cache_header_t *ch = iu->iu_cache_map;
+  libc_stdio_bind(iu, ch->ch_stdio, ch->ch_num_stdio);
+}
+
+
+/**
+ *
+ */
+static void
+cache_destroy(ir_unit_t *iu)
+{
+  free(iu->iu_cache_path);
+  VECTOR_CLEAR(&iu->iu_cache_insns);
+  if(iu->iu_cache_map == NULL)
+    return;
+  cache_destroy_functions(iu);
+  munmap(iu->iu_cache_map, iu->iu_cache_size);
+}
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <unistd.h>
+
+/**
+ * Parallel compilation at load time
+ *
+ * Once a function body is parsed it's handed to a pool of worker threads
+ * that run transform_function() on it while the loader continues with
+ * the next body. Each worker has a unit of its own with the module state
+ * the transforms and the parser (when inlining) read, taken when the
+ * pool is started. A job carries the state of its function: the values,
+ * appended after the module level values just like when compiling
+ * serially, and a copy of the type table as lowering may add types.
+ * There is one worker per online CPU unless vmir_set_compile_threads()
+ * says otherwise, with one thread functions are compiled in the loading
+ * thread.
+ *
+ * The VM text (and JITed code) is emitted by the loader in the order the
+ * functions were parsed, using the job's values and types, so the output
+ * is identical to a serial compile.
+ */
+
+#define COMPILE_JOBS_PER_THREAD 4 // Max queued functions per worker
+
+// Debug output must not be interleaved
+#define COMPILE_SERIAL_FLAGS (VMIR_DBG_DUMP_PARSED_FUNCTION |   \
+                              VMIR_DBG_DUMP_LOWERED_FUNCTION |  \
+                              VMIR_DBG_DUMP_DEV |               \
+                              VMIR_DBG_DUMP_REGALLOC)
+
+TAILQ_HEAD(compile_job_queue, compile_job);
+
+typedef struct compile_job {
+  TAILQ_ENTRY(compile_job) cj_link;       // In parse order
+  TAILQ_ENTRY(compile_job) cj_work_link;  // Not yet picked by a worker
+  ir_function_t *cj_function;
+  struct ir_value_vector cj_values; // From iu_first_func_value and up
+  struct ir_type_vector cj_types;   // See compile_types_copy()
+  int cj_num_unit_types;
+  uint32_t cj_debug_flags_func;
+  vmir_stats_t cj_stats;
+  int cj_done;
+} compile_job_t;
+
+
+typedef struct compile_worker {
+  pthread_t cw_thread;
+  struct compile_queue *cw_queue;
+  ir_unit_t *cw_unit;                // See compile_worker_init()
+  struct ir_value_vector cw_values;  // Reused for all jobs
+  int cw_num_module_values;          // Valid module values in cw_values
+} compile_worker_t;
+
+
+typedef struct compile_queue {
+  pthread_mutex_t cq_mutex;
+  pthread_cond_t cq_work_cond;
+  pthread_cond_t cq_done_cond;
+  struct compile_job_queue cq_jobs;
+  struct compile_job_queue cq_work;
+  int cq_num_jobs;
+  int cq_stop;
+
+  ir_value_t **cq_module_values;  // Snapshot of the values before functions
+  int cq_num_module_values;
+
+  int cq_num_workers;
+  compile_worker_t *cq_workers;
+} compile_queue_t;
+
+
+/**
+ *
+ */
+static int
+compile_threads_online(void)
+{
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? cpus : 1;
+}
+
+
+/**
+ * Copy the type table for a job. Only the type descriptors are copied,
+ * the element and parameter lists of struct and function types are
+ * shared read-only with the unit which never changes them once the
+ * type table is parsed
+ */
+static void
+compile_types_copy(struct ir_type_vector *dst, const ir_unit_t *iu)
+{
+  const int num_types = VECTOR_LEN(&iu->iu_types);
+  memset(dst, 0, sizeof(*dst));
+  VECTOR_RESIZE(dst, num_types);
+  memcpy(dst->vh_p, iu->iu_types.vh_p, num_types * sizeof(ir_type_t));
+}
+
+
+/**
+ * Free a type table made by compile_types_copy(). Types added after the
+ * first 'num_shared' are scalars and pointers that own nothing
+ */
+static void
+compile_types_free(struct ir_type_vector *types, int num_shared)
+{
+  for(int i = num_shared; i < VECTOR_LEN(types); i++) {
+    const ir_type_t *it = &VECTOR_ITEM(types, i);
+    assert(it->it_code != IR_TYPE_STRUCT && it->it_code != IR_TYPE_FUNCTION);
+  }
+  VECTOR_CLEAR(types);
+}
+
+
+/**
+ * Set up the unit of a worker from the module state that the transforms
+ * and function_parse_inline() read. None of it changes while functions
+ * are parsed, compile_parallel() checks the module values. The state of
+ * the function being compiled is set for each job
+ */
+static void
+compile_worker_init(compile_worker_t *cw, const ir_unit_t *iu)
+{
+  ir_unit_t *u = calloc(1, sizeof(ir_unit_t));
+
+  u->iu_version = iu->iu_version;
+  u->iu_debug_flags = iu->iu_debug_flags;
+  u->iu_blockinfos = iu->iu_blockinfos;
+  u->iu_attribute_groups = iu->iu_attribute_groups;
+  u->iu_attrsets = iu->iu_attrsets;
+  u->iu_functions = iu->iu_functions;
+  u->iu_constant_globals = iu->iu_constant_globals;
+  u->iu_first_func_value = iu->iu_first_func_value;
+  u->iu_first_call_arg = iu->iu_first_call_arg;
+  u->iu_arena_pool = iu->iu_arena_pool;
+  u->iu_inline_size = iu->iu_inline_size;
+  u->iu_linear_scan_threshold = iu->iu_linear_scan_threshold;
+  u->iu_lazy = iu->iu_lazy;
+  u->iu_tier_threshold = iu->iu_tier_threshold;
+  u->iu_tier_counters = iu->iu_tier_counters;
+  u->iu_tier_up = iu->iu_tier_up;
+  u->iu_copy_patch = iu->iu_copy_patch;
+  u->iu_aot_path = iu->iu_aot_path;
+  LIST_INIT(&u->iu_blocks);
+  cw->cw_unit = u;
+}
+
+
+/**
+ *
+ */
+static void
+compile_worker_destroy(compile_worker_t *cw)
+{
+  ir_unit_t *u = cw->cw_unit;
+  for(int i = 0; i < IU_MAX_TMP_STR; i++)
+    free(u->iu_tmp_str[i]);
+  VECTOR_CLEAR(&u->iu_argv);
+  VECTOR_CLEAR(&cw->cw_values);
+  free(u);
+}
+
+
+/**
+ * Run transform_function() on a job's function with the values of the
+ * function appended to the worker's copy of the module values
+ */
+static void
+compile_job_run(compile_worker_t *cw, compile_job_t *cj)
+{
+  const compile_queue_t *cq = cw->cw_queue;
+  ir_unit_t *iu = cw->cw_unit;
+  const int ffv = iu->iu_first_func_value;
+  const int num_values = VECTOR_LEN(&cj->cj_values);
+
+  if(cw->cw_num_module_values != ffv) {
+    VECTOR_RESIZE(&cw->cw_values, ffv);
+    memcpy(cw->cw_values.vh_p, cq->cq_module_values,
+           ffv * sizeof(ir_value_t *));
+    cw->cw_num_module_values = ffv;
+  }
+
+  iu->iu_values = cw->cw_values;
+  VECTOR_RESIZE(&iu->iu_values, ffv + num_values);
+  memcpy(iu->iu_values.vh_p + ffv, cj->cj_values.vh_p,
+         num_values * sizeof(ir_value_t *));
+  iu->iu_next_value = ffv + num_values;
+
+  iu->iu_types = cj->cj_types;
+  iu->iu_debug_flags_func = cj->cj_debug_flags_func;
+  iu->iu_current_function = cj->cj_function;
+  memset(&iu->iu_stats, 0, sizeof(iu->iu_stats));
+
+  transform_function(iu, cj->cj_function);
+
+  cj->cj_types = iu->iu_types;
+  cj->cj_stats = iu->iu_stats;
+  memset(&iu->iu_types, 0, sizeof(iu->iu_types));
+  iu->iu_current_function = NULL;
+
+  // Values are handed back to the loader for emitting
+  const int n = iu->iu_next_value - ffv;
+  VECTOR_RESIZE(&cj->cj_values, n);
+  memcpy(cj->cj_values.vh_p, iu->iu_values.vh_p + ffv,
+         n * sizeof(ir_value_t *));
+
+  cw->cw_values = iu->iu_values;
+  VECTOR_RESIZE(&cw->cw_values, ffv);
+  memset(&iu->iu_values, 0, sizeof(iu->iu_values));
+}
+
+
+/**
+ *
+ */
+static void *
+compile_thread(void *aux)
+{
+  compile_worker_t *cw = aux;
+  compile_queue_t *cq = cw->cw_queue;
+  compile_job_t *cj;
+
+  pthread_mutex_lock(&cq->cq_mutex);
+  while(!cq->cq_stop) {
+    if((cj = TAILQ_FIRST(&cq->cq_work)) == NULL) {
+      pthread_cond_wait(&cq->cq_work_cond, &cq->cq_mutex);
+      continue;
+    }
+    TAILQ_REMOVE(&cq->cq_work, cj, cj_work_link);
+    pthread_mutex_unlock(&cq->cq_mutex);
+    compile_job_run(cw, cj);
+    pthread_mutex_lock(&cq->cq_mutex);
+    cj->cj_done = 1;
+    pthread_cond_broadcast(&cq->cq_done_cond);
+  }
+  pthread_mutex_unlock(&cq->cq_mutex);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+compile_start(ir_unit_t *iu)
+{
+  compile_queue_t *cq = calloc(1, sizeof(compile_queue_t));
+  const int ffv = iu->iu_first_func_value;
+
+  pthread_mutex_init(&cq->cq_mutex, NULL);
+  pthread_cond_init(&cq->cq_work_cond, NULL);
+  pthread_cond_init(&cq->cq_done_cond, NULL);
+  TAILQ_INIT(&cq->cq_jobs);
+  TAILQ_INIT(&cq->cq_work);
+
+  cq->cq_num_module_values = ffv;
+  cq->cq_module_values = malloc(ffv * sizeof(ir_value_t *));
+  memcpy(cq->cq_module_values, iu->iu_values.vh_p,
+         ffv * sizeof(ir_value_t *));
+
+  cq->cq_num_workers = iu->iu_compile_threads;
+  cq->cq_workers = calloc(cq->cq_num_workers, sizeof(compile_worker_t));
+  for(int i = 0; i < cq->cq_num_workers; i++) {
+    compile_worker_t *cw = &cq->cq_workers[i];
+    cw->cw_queue = cq;
+    cw->cw_num_module_values = -1;
+    compile_worker_init(cw, iu);
+    if(pthread_create(&cw->cw_thread, NULL, compile_thread, cw))
+      parser_error(iu, "Unable to start compile thread");
+  }
+  iu->iu_compile_queue = cq;
+}
+
+
+/**
+ * Returns true if the function being parsed can be compiled in parallel
+ */
+static int
+compile_parallel(ir_unit_t *iu)
+{
+  if(iu->iu_compile_threads < 2 || iu->iu_tier_up ||
+     iu->iu_debug_flags_func & COMPILE_SERIAL_FLAGS)
+    return 0;
+
+  const compile_queue_t *cq = iu->iu_compile_queue;
+  return cq == NULL || cq->cq_num_module_values == iu->iu_first_func_value;
+}
+
+
+/**
+ * Emit a function transformed by a worker
+ */
+static void
+compile_job_emit(ir_unit_t *iu, compile_job_t *cj)
+{
+  ir_function_t *f = cj->cj_function;
+  ir_function_t *current_function = iu->iu_current_function;
+  const uint32_t debug_flags_func = iu->iu_debug_flags_func;
+  const int ffv = iu->iu_first_func_value;
+  const int num_values = VECTOR_LEN(&cj->cj_values);
+
+  assert(iu->iu_next_value == ffv);
+  if(VECTOR_LEN(&iu->iu_values) < ffv + num_values)
+    VECTOR_RESIZE(&iu->iu_values, ffv + num_values);
+  memcpy(iu->iu_values.vh_p + ffv, cj->cj_values.vh_p,
+         num_values * sizeof(ir_value_t *));
+  iu->iu_next_value = ffv + num_values;
+
+  // Types created when lowering the function only exist in the job
+  struct ir_type_vector types = iu->iu_types;
+  iu->iu_types = cj->cj_types;
+
+  // All stats are counters
+  const int *src = (const int *)&cj->cj_stats;
+  int *dst = (int *)&iu->iu_stats;
+  for(int i = 0; i < sizeof(vmir_stats_t) / sizeof(int); i++)
+    dst[i] += src[i];
+
+  iu->iu_current_function = f;
+  iu->iu_debug_flags_func = cj->cj_debug_flags_func;
+
+  function_emit(iu, f);
+  value_resize(iu, ffv);
+  function_emitted(iu, f);
+
+  iu->iu_types = types;
+  iu->iu_current_function = current_function;
+  iu->iu_debug_flags_func = debug_flags_func;
+
+  compile_types_free(&cj->cj_types, cj->cj_num_unit_types);
+  VECTOR_CLEAR(&cj->cj_values);
+  free(cj);
+}
+
+
+/**
+ * Emit finished functions in parse order. If 'max_jobs' is non-negative
+ * wait until no more than that many functions are queued
+ */
+static void
+compile_collect(ir_unit_t *iu, int max_jobs)
+{
+  compile_queue_t *cq = iu->iu_compile_queue;
+  compile_job_t *cj;
+
+  if(cq == NULL)
+    return;
+
+  pthread_mutex_lock(&cq->cq_mutex);
+  while((cj = TAILQ_FIRST(&cq->cq_jobs)) != NULL) {
+    if(!cj->cj_done) {
+      if(cq->cq_num_jobs <= max_jobs)
+        break;
+      pthread_cond_wait(&cq->cq_done_cond, &cq->cq_mutex);
+      continue;
+    }
+    TAILQ_REMOVE(&cq->cq_jobs, cj, cj_link);
+    cq->cq_num_jobs--;
+    pthread_mutex_unlock(&cq->cq_mutex);
+    compile_job_emit(iu, cj);
+    pthread_mutex_lock(&cq->cq_mutex);
+  }
+  pthread_mutex_unlock(&cq->cq_mutex);
+}
+
+
+/**
+ * Wait for all queued functions and emit them
+ */
+static void
+compile_drain(ir_unit_t *iu)
+{
+  compile_collect(iu, 0);
+}
+
+
+/**
+ * Hand the function that was just parsed to the workers. Its values are
+ * moved to the job so the loader can parse the next function
+ */
+static void
+compile_function(ir_unit_t *iu, ir_function_t *f)
+{
+  const int ffv = iu->iu_first_func_value;
+  const int num_values = iu->iu_next_value - ffv;
+
+  if(iu->iu_compile_queue == NULL)
+    compile_start(iu);
+
+  compile_queue_t *cq = iu->iu_compile_queue;
+  compile_job_t *cj = calloc(1, sizeof(compile_job_t));
+  cj->cj_function = f;
+
+  VECTOR_RESIZE(&cj->cj_values, num_values);
+  memcpy(cj->cj_values.vh_p, iu->iu_values.vh_p + ffv,
+         num_values * sizeof(ir_value_t *));
+  memset(iu->iu_values.vh_p + ffv, 0, num_values * sizeof(ir_value_t *));
+  iu->iu_next_value = ffv;
+
+  compile_types_copy(&cj->cj_types, iu);
+  cj->cj_num_unit_types = VECTOR_LEN(&iu->iu_types);
+  cj->cj_debug_flags_func = iu->iu_debug_flags_func;
+
+  iu->iu_stats.parallel_functions++;
+
+  pthread_mutex_lock(&cq->cq_mutex);
+  TAILQ_INSERT_TAIL(&cq->cq_jobs, cj, cj_link);
+  TAILQ_INSERT_TAIL(&cq->cq_work, cj, cj_work_link);
+  cq->cq_num_jobs++;
+  pthread_cond_signal(&cq->cq_work_cond);
+  pthread_mutex_unlock(&cq->cq_mutex);
+
+  compile_collect(iu, cq->cq_num_workers * COMPILE_JOBS_PER_THREAD);
+}
+
+
+/**
+ * Called when all functions have been parsed
+ */
+static void
+compile_stop(ir_unit_t *iu)
+{
+  compile_queue_t *cq = iu->iu_compile_queue;
+  if(cq == NULL)
+    return;
+
+  compile_drain(iu);
+
+  pthread_mutex_lock(&cq->cq_mutex);
+  cq->cq_stop = 1;
+  pthread_cond_broadcast(&cq->cq_work_cond);
+  pthread_mutex_unlock(&cq->cq_mutex);
+
+  for(int i = 0; i < cq->cq_num_workers; i++) {
+    pthread_join(cq->cq_workers[i].cw_thread, NULL);
+    compile_worker_destroy(&cq->cq_workers[i]);
+  }
+
+  pthread_cond_destroy(&cq->cq_done_cond);
+  pthread_cond_destroy(&cq->cq_work_cond);
+  pthread_mutex_destroy(&cq->cq_mutex);
+  free(cq->cq_workers);
+  free(cq->cq_module_values);
+  free(cq);
+  iu->iu_compile_queue = NULL;
+}
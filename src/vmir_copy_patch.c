@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Copy-and-patch baseline compiler
+ *
+ * Translates the VM text of a function into native code by copying
+ * the precompiled stencil of each instruction (see vmir_stencils.c)
+ * and patching its holes with the operands from the instruction
+ * stream. Stencils are laid out in the same order as the VM text so
+ * the jump to the next instruction can usually be dropped.
+ *
+ * If any instruction lacks a stencil or an operand doesn't fit the
+ * relocation the function is left to the interpreter.
+ */
+
+#ifdef VMIR_COPY_PATCH
+
+#include <sys/mman.h>
+
+#define CP_MEM_SIZE (1024 * 1024 * 16)
+#define CP_TRAMPOLINE_SIZE 16
+
+typedef enum {
+  VM_HOLE_REG,       // Register frame offset (sign extended)
+  VM_HOLE_U16,       // 16 bit operand
+  VM_HOLE_U32,       // 32 bit operand
+  VM_HOLE_CONTINUE,  // Next instruction
+  VM_HOLE_TARGET,    // Branch target
+  VM_HOLE_DATA,      // Constant data stored after the stencil code
+  VM_HOLE_SYMBOL,    // Function in vmir or libc
+} vm_hole_kind_t;
+
+typedef enum {
+  VM_RELOC_ABS64,
+  VM_RELOC_ABS32,
+  VM_RELOC_ABS32S,
+  VM_RELOC_REL32,
+} vm_reloc_t;
+
+typedef struct vm_stencil_hole {
+  uint16_t offset;
+  uint8_t kind;
+  uint8_t operand;
+  uint8_t reloc;
+  int32_t addend;
+} vm_stencil_hole_t;
+
+typedef struct vm_stencil {
+  const uint8_t *code;
+  const vm_stencil_hole_t *holes;
+  uint16_t size;
+  uint8_t num_holes;
+  uint8_t oplen;  // Number of 16 bit operands
+  uint8_t tail;   // Size of trailing jump to next instruction
+} vm_stencil_t;
+
+
+#include "vmir_stencils.h"
+
+#define CP_NUM_STENCILS (sizeof(vm_stencils) / sizeof(vm_stencils[0]))
+
+
+/**
+ *
+ */
+static int
+cp_opmap_cmp(const void *A, const void *B)
+{
+  const uint32_t a = *(const uint32_t *)A >> 16;
+  const uint32_t b = *(const uint32_t *)B >> 16;
+  return a < b ? -1 : a > b;
+}
+
+
+/**
+ * Map resolved opcodes back to vm_op_t, sorted on resolved opcode.
+ * Only opcodes that have a stencil are included
+ */
+static void
+cp_init(ir_unit_t *iu)
+{
+  int n = 0;
+  iu->iu_cp_opmap = malloc(sizeof(uint32_t) * CP_NUM_STENCILS);
+  for(int i = 0; i < CP_NUM_STENCILS; i++) {
+    if(vm_stencils[i].code == NULL)
+      continue;
+    iu->iu_cp_opmap[n++] = (uint32_t)(uint16_t)vm_resolve(i) << 16 | i;
+  }
+  iu->iu_cp_opmap_size = n;
+  qsort(iu->iu_cp_opmap, n, sizeof(uint32_t), cp_opmap_cmp);
+
+  void *p = mmap(NULL, CP_MEM_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    parser_error(iu, "Copy-and-patch: Unable to map code memory");
+  iu->iu_cp_mem = p;
+
+  // Far calls from stencils go via trampolines placed first
+  for(int i = 0; vm_stencil_symbols[i] != NULL; i++) {
+    uint8_t *t = p + i * CP_TRAMPOLINE_SIZE;
+    t[0] = 0xff; // jmp *0(%rip)
+    t[1] = 0x25;
+    memset(t + 2, 0, 4);
+    memcpy(t + 6, &vm_stencil_symbols[i], 8);
+    iu->iu_cp_ptr += CP_TRAMPOLINE_SIZE;
+  }
+}
+
+
+/**
+ *
+ */
+static const vm_stencil_t *
+cp_stencil(ir_unit_t *iu, uint16_t opc)
+{
+  uint32_t key = (uint32_t)opc << 16;
+  const uint32_t *r = bsearch(&key, iu->iu_cp_opmap, iu->iu_cp_opmap_size,
+                              sizeof(uint32_t), cp_opmap_cmp);
+  return r ? &vm_stencils[*r & 0xffff] : NULL;
+}
+
+
+/**
+ * Patch one hole. Returns -1 if the value doesn't fit
+ */
+static int
+cp_patch(ir_unit_t *iu, void *code, const vm_stencil_hole_t *h,
+         const uint16_t *I, const int *native, int pos, int len)
+{
+  void *p = code + h->offset;
+  int64_t v;
+  int target;
+
+  switch(h->kind) {
+  case VM_HOLE_REG:
+    v = (int16_t)I[h->operand];
+    break;
+  case VM_HOLE_U16:
+    v = I[h->operand];
+    break;
+  case VM_HOLE_U32:
+    v = I[h->operand] | (uint32_t)I[h->operand + 1] << 16;
+    break;
+  case VM_HOLE_CONTINUE:
+    target = pos + 1 + h->operand;
+    if(native[target] == -1)
+      return -1;
+    v = (intptr_t)iu->iu_cp_mem + native[target];
+    break;
+  case VM_HOLE_TARGET:
+    target = pos + 1 + (int16_t)I[h->operand] / 2;
+    if(target < 0 || target > len || native[target] == -1)
+      return -1;
+    v = (intptr_t)iu->iu_cp_mem + native[target];
+    break;
+  case VM_HOLE_DATA:
+    v = (intptr_t)code;
+    break;
+  case VM_HOLE_SYMBOL:
+    v = (intptr_t)vm_stencil_symbols[h->operand];
+    if(h->reloc == VM_RELOC_REL32 &&
+       v + h->addend - (intptr_t)p != (int32_t)(v + h->addend - (intptr_t)p))
+      v = (intptr_t)iu->iu_cp_mem + h->operand * CP_TRAMPOLINE_SIZE;
+    break;
+  default:
+    return -1;
+  }
+
+  v += h->addend;
+
+  switch(h->reloc) {
+  case VM_RELOC_ABS64:
+    memcpy(p, &v, 8);
+    return 0;
+  case VM_RELOC_ABS32:
+    if(v != (uint32_t)v)
+      return -1;
+    break;
+  case VM_RELOC_ABS32S:
+    if(v != (int32_t)v)
+      return -1;
+    break;
+  case VM_RELOC_REL32:
+    v -= (intptr_t)p;
+    if(v != (int32_t)v)
+      return -1;
+    break;
+  default:
+    return -1;
+  }
+  uint32_t u32 = v;
+  memcpy(p, &u32, 4);
+  return 0;
+}
+
+
+/**
+ * Translate f->if_vm_text to native code. On success the VM text is
+ * replaced with a VM_NATIVE instruction that calls into the native code
+ */
+static void
+cp_compile_function(ir_unit_t *iu, ir_function_t *f)
+{
+  if(iu->iu_cp_mem == NULL)
+    cp_init(iu);
+
+  const uint16_t *text = f->if_vm_text;
+  const int len = f->if_vm_text_size / 2;
+  int *native = malloc(sizeof(int) * (len + 1));
+  const int start = iu->iu_cp_ptr;
+  int size = 0;
+  int pos;
+
+  for(pos = 0; pos <= len; pos++)
+    native[pos] = -1;
+
+  // Lay out stencils
+  pos = 0;
+  while(pos < len) {
+    const vm_stencil_t *s = cp_stencil(iu, text[pos]);
+    if(s == NULL)
+      goto fail;
+    native[pos] = start + size;
+    pos += 1 + s->oplen;
+    size += s->size - (pos < len ? s->tail : 0);
+  }
+  if(pos != len)
+    goto fail;
+
+  if(start + size > CP_MEM_SIZE)
+    goto fail;
+
+  // Copy and patch
+  pos = 0;
+  while(pos < len) {
+    const vm_stencil_t *s = cp_stencil(iu, text[pos]);
+    void *code = iu->iu_cp_mem + native[pos];
+    const int next = pos + 1 + s->oplen;
+    const int copy = s->size - (next < len ? s->tail : 0);
+
+    memcpy(code, s->code, s->size);
+    for(int i = 0; i < s->num_holes; i++) {
+      const vm_stencil_hole_t *h = &s->holes[i];
+      if(h->offset >= copy)
+        continue; // Trailing jump that was dropped
+      if(cp_patch(iu, code, h, text + pos + 1, native, pos, len))
+        goto fail;
+    }
+    pos = next;
+  }
+
+  iu->iu_cp_ptr = VMIR_ALIGN(start + size, 16);
+  free(native);
+
+  vm_set_native(iu, f, iu->iu_cp_mem + start);
+  iu->iu_stats.cp_functions++;
+  return;
+
+ fail:
+  free(native);
+  iu->iu_stats.cp_functions_failed++;
+}
+
+
+/**
+ * Make the code emitted since the last call executable and read-only.
+ * Code emitted later (when compiling lazily) continues on a fresh page
+ * so no page is ever writable and executable
+ */
+static void
+cp_seal_code(ir_unit_t *iu)
+{
+  if(iu->iu_cp_mem == NULL || iu->iu_cp_ptr == iu->iu_cp_sealed)
+    return;
+  iu->iu_cp_ptr = VMIR_ALIGN(iu->iu_cp_ptr, 4096);
+  mprotect(iu->iu_cp_mem + iu->iu_cp_sealed,
+           iu->iu_cp_ptr - iu->iu_cp_sealed, PROT_EXEC | PROT_READ);
+  iu->iu_cp_sealed = iu->iu_cp_ptr;
+}
+
+
+/**
+ * Translate the VM text of all functions. Used with the cache, which
+ * only holds VM text, once the text is saved or loaded
+ */
+static void
+cp_compile_module(ir_unit_t *iu)
+{
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_functions); i++) {
+    ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    if(f->if_vm_text != NULL)
+      cp_compile_function(iu, f);
+  }
+  cp_seal_code(iu);
+}
+
+
+/**
+ *
+ */
+static void
+cp_destroy(ir_unit_t *iu)
+{
+  if(iu->iu_cp_mem != NULL)
+    munmap(iu->iu_cp_mem, CP_MEM_SIZE);
+  free(iu->iu_cp_opmap);
+}
+
+#endif
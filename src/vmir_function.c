@@ -26,7 +26,6 @@ ibe_destroy(ir_bb_edge_t *ibe)
   LIST_REMOVE(ibe, ibe_from_link);
   LIST_REMOVE(ibe, ibe_to_link);
   LIST_REMOVE(ibe, ibe_function_link);
-  free(ibe);
 }
 
 
@@ -48,15 +47,8 @@ ibe_destroy_list(struct ir_bb_edge_list *list)
 static void
 bb_destroy(ir_bb_t *ib)
 {
-  ir_instr_t *ii, *next;
   ibe_destroy_list(&ib->ib_incoming_edges);
   ibe_destroy_list(&ib->ib_outgoing_edges);
-
-  for(ii = TAILQ_FIRST(&ib->ib_instrs); ii != NULL; ii = next) {
-    next = TAILQ_NEXT(ii, ii_link);
-    free(ii);
-  }
-  free(ib);
 }
 
 
@@ -70,6 +62,8 @@ function_prepare_parse(ir_unit_t *iu, ir_function_t *f)
 {
   f->if_regframe_size = 8; // Make space for temporary register for VM use
   f->if_callarg_size = 0;
+  if(f->if_arena == NULL)
+    f->if_arena = arena_create(iu->iu_arena_pool);
 
   ir_type_t *it = type_get(iu, f->if_type);
 
@@ -124,16 +118,33 @@ function_find(ir_unit_t *iu, const char *name)
 
 
 /**
- *
+ * Release the IR of 'f'. The value bindings are in the arena so the
+ * values of the function must be gone already
  */
 static void
 function_remove_bb(ir_function_t *f)
 {
-  ir_bb_t *ib;
-  while((ib = TAILQ_FIRST(&f->if_bbs)) != NULL) {
-    TAILQ_REMOVE(&f->if_bbs, ib, ib_link);
-    bb_destroy(ib);
-  }
+  TAILQ_INIT(&f->if_bbs);
+  LIST_INIT(&f->if_edges);
+  arena_destroy(f->if_arena);
+  f->if_arena = NULL;
+}
+
+
+/**
+ * Called when 'f' has been emitted and its values are gone. Only the
+ * VM text is needed to run it so the IR is released unless functions
+ * are being dumped
+ */
+static void
+function_emitted(ir_unit_t *iu, ir_function_t *f)
+{
+  if(iu->iu_debug_flags & (VMIR_DBG_DUMP_PARSED_FUNCTION |
+                           VMIR_DBG_DUMP_LOWERED_FUNCTION |
+                           VMIR_DBG_DUMP_DEV |
+                           VMIR_DBG_DUMP_REGALLOC))
+    return;
+  function_remove_bb(f);
 }
 
 
@@ -145,7 +156,7 @@ function_destroy(ir_function_t *f)
 {
   function_remove_bb(f);
   free(f->if_name);
-  free(f->if_vm_text);
+  free(f->if_body);
   free(f);
 }
 
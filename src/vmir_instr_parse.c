@@ -29,7 +29,8 @@
 static ir_bb_t *
 bb_add(ir_function_t *f, ir_bb_t *after)
 {
-  ir_bb_t *ib = calloc(1, sizeof(ir_bb_t));
+  ir_bb_t *ib = arena_alloc(f->if_arena, sizeof(ir_bb_t));
+  ib->ib_arena = f->if_arena;
   TAILQ_INIT(&ib->ib_instrs);
   ib->ib_id = f->if_num_bbs++;
   if(after != NULL)
@@ -41,6 +42,39 @@ bb_add(ir_function_t *f, ir_bb_t *after)
 
 
 
+/**
+ * When a function body is parsed for inlining (see inline_call()) its
+ * values are appended after the values of the function it's inlined
+ * into and its arguments are replaced by the values passed to it.
+ * Value ids computed relative to iu_next_value are fixed up here
+ */
+static unsigned int
+instr_value_relocate(ir_unit_t *iu, unsigned int val)
+{
+  const int base = iu->iu_inline_base;
+  if(base == 0)
+    return lazy_reference(iu, val);
+  if(val < base) // Global value
+    return lazy_reference(iu, val - (base - iu->iu_first_func_value));
+  if(val < base + iu->iu_inline_argc)
+    return iu->iu_inline_args[val - base];
+  return val;
+}
+
+
+/**
+ * Same as instr_value_relocate() but for absolute value ids
+ */
+static unsigned int
+instr_value_relocate_abs(ir_unit_t *iu, unsigned int val)
+{
+  const int base = iu->iu_inline_base;
+  if(base == 0 || val < iu->iu_first_func_value)
+    return lazy_reference(iu, val);
+  return instr_value_relocate(iu, val + (base - iu->iu_first_func_value));
+}
+
+
 /**
  *
  */
@@ -58,7 +92,7 @@ instr_get_vtp(ir_unit_t *iu, unsigned int *argcp, const ir_arg_t **argvp)
   if(val < iu->iu_next_value) {
     *argvp = argv + 1;
     *argcp = argc - 1;
-    return val;
+    return instr_value_relocate(iu, val);
   }
 
   if(val >= VECTOR_LEN(&iu->iu_values))
@@ -90,7 +124,7 @@ instr_get_value(ir_unit_t *iu, unsigned int *argcp, const ir_arg_t **argvp)
   *argvp = argv + 1;
   *argcp = argc - 1;
 
-  return iu->iu_next_value - argv[0].i64;
+  return instr_value_relocate(iu, iu->iu_next_value - argv[0].i64);
 }
 
 
@@ -110,7 +144,8 @@ instr_get_value_signed(ir_unit_t *iu,
   *argvp = argv + 1;
   *argcp = argc - 1;
 
-  return iu->iu_next_value - read_sign_rotated(argv);
+  return instr_value_relocate(iu, iu->iu_next_value -
+                              read_sign_rotated(argv));
 }
 
 
@@ -270,6 +305,7 @@ typedef struct ir_instr_arg {
 typedef struct ir_instr_call {
   ir_instr_t super;
   int callee;
+  int tail;  // Marked tail or musttail
   int argc;
   ir_instr_arg_t argv[0];
 } ir_instr_call_t;
@@ -374,15 +410,16 @@ typedef struct ir_instr_extractval {
 } ir_instr_extractval_t;
 
 /**
- *
+ * Create an instruction for 'ib', the caller inserts it
  */
 static ir_instr_t *
-instr_create(size_t size, instr_class_t ic)
+instr_create(ir_bb_t *ib, size_t size, instr_class_t ic)
 {
-  ir_instr_t *ii = calloc(1, size);
+  ir_instr_t *ii = arena_alloc(ib->ib_arena, size);
   LIST_INIT(&ii->ii_values);
   ii->ii_class = ic;
   ii->ii_ret_value = -1;
+  ii->ii_bb = ib;
   return ii;
 }
 
@@ -393,8 +430,7 @@ instr_create(size_t size, instr_class_t ic)
 static void *
 instr_add(ir_bb_t *ib, size_t size, instr_class_t ic)
 {
-  ir_instr_t *ii = instr_create(size, ic);
-  ii->ii_bb = ib;
+  ir_instr_t *ii = instr_create(ib, size, ic);
   TAILQ_INSERT_TAIL(&ib->ib_instrs, ii, ii_link);
   return ii;
 }
@@ -406,9 +442,7 @@ instr_add(ir_bb_t *ib, size_t size, instr_class_t ic)
 static void *
 instr_add_before(size_t size, instr_class_t ic, ir_instr_t *before)
 {
-  ir_bb_t *ib = before->ii_bb;
-  ir_instr_t *ii = instr_create(size, ic);
-  ii->ii_bb = ib;
+  ir_instr_t *ii = instr_create(before->ii_bb, size, ic);
   TAILQ_INSERT_BEFORE(before, ii, ii_link);
   return ii;
 }
@@ -420,27 +454,20 @@ instr_add_before(size_t size, instr_class_t ic, ir_instr_t *before)
 static void *
 instr_add_after(size_t size, instr_class_t ic, ir_instr_t *after)
 {
-  ir_bb_t *ib = after->ii_bb;
-  ir_instr_t *ii = instr_create(size, ic);
-  ii->ii_bb = ib;
-  TAILQ_INSERT_AFTER(&ib->ib_instrs,  after, ii, ii_link);
+  ir_instr_t *ii = instr_create(after->ii_bb, size, ic);
+  TAILQ_INSERT_AFTER(&after->ii_bb->ib_instrs, after, ii, ii_link);
   return ii;
 }
 
 
 /**
- *
+ * The memory is released with the function's arena
  */
 static void
 instr_destroy(ir_instr_t *ii)
 {
   instr_bind_clear(ii);
-  free(ii->ii_ret_values);
-  free(ii->ii_succ);
-  free(ii->ii_liveness);
-
   TAILQ_REMOVE(&ii->ii_bb->ib_instrs, ii, ii_link);
-  free(ii);
 }
 
 
@@ -775,11 +802,6 @@ parse_call(ir_unit_t *iu, unsigned int argc, const ir_arg_t *argv)
     parser_error(iu, "Call to non-function type %s",
                  type_str(iu, fnty));
 
-  if(cc & (1 << 14))
-    // MustTail
-    parser_error(iu, "Can't handle must-tail call to %s",
-                 type_str(iu, fnty));
-
   int function_args = fnty->it_function.num_parameters;
 
   int *args = alloca(argc * sizeof(int));
@@ -800,6 +822,7 @@ parse_call(ir_unit_t *iu, unsigned int argc, const ir_arg_t *argv)
     instr_add(ib, sizeof(ir_instr_call_t) +
               sizeof(ir_instr_arg_t) * n, IR_IC_CALL);
   i->callee = fnidx;
+  i->tail = !!(cc & (1 << 0 | 1 << 14)); // Tail, MustTail
   i->argc = n;
 
 
@@ -884,7 +907,7 @@ parse_switch(ir_unit_t *iu, unsigned int argc, const ir_arg_t *argv)
   i->width = type_bitwidth(iu, iv->iv_type);
 
   for(int n = 0; n < paths; n++) {
-    int val = instr_get_uint(iu, &argc, &argv);
+    int val = instr_value_relocate_abs(iu, instr_get_uint(iu, &argc, &argv));
     i->paths[n].block = instr_get_uint(iu, &argc, &argv);
     ir_value_t *iv = value_get(iu, val);
 
@@ -1342,12 +1365,14 @@ instr_print(ir_unit_t *iu, ir_instr_t *ii, int flags)
 
       if(f != NULL) {
 
-        printf("%s %s (%s) (",
+        printf("%s%s %s (%s) (",
+               p->tail ? "tail " : "",
                f->if_vmop ? "vmop" : "call",
                f->if_name,
                type_str_index(iu, iv->iv_type));
       } else {
-        printf("fptr in %s (%s) (", value_str_id(iu, p->callee),
+        printf("%sfptr in %s (%s) (", p->tail ? "tail " : "",
+               value_str_id(iu, p->callee),
                type_str_index(iu, iv->iv_type));
       }
       for(int i = 0; i < p->argc; i++) {
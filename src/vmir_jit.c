@@ -0,0 +1,99 @@
+/**
+ * Figure out which values are live only during a specific JIT
+ * segment. Such values are allocated to machine registers.
+ */
+static void
+jit_analyze_segment(ir_unit_t *iu, ir_instr_t *first, ir_instr_t *last)
+{
+  const ir_instr_t *stop = TAILQ_NEXT(last, ii_link);
+  ir_instr_t *ii;
+
+  // Live-out values from JITed segment
+  const uint32_t *liveout = last->ii_liveness;
+  const int ffv = iu->iu_first_func_value;
+#if 0
+  printf("Analyze segment first: ");
+  instr_print(iu, first, 0);
+  printf("\n");
+
+  printf("Analyze segment  last: ");
+  instr_print(iu, last, 0);
+  printf("\n");
+  printf("last liveout values\n");
+  for(int i = 0; i < 32;i++) {
+    if(bitchk(liveout, i))
+      printf("%s\n", value_str_id(iu, i + ffv));
+  }
+#endif
+  for(ii = first; ii != stop; ii = TAILQ_NEXT(ii, ii_link)) {
+    int r = ii->ii_ret_value;
+    if(r == -1)
+      continue;
+    r -= ffv;
+    if(bitchk(liveout, r))
+      continue; // Value is liveout
+
+    ir_value_t *iv = value_get(iu, ii->ii_ret_value);
+    assert(iv->iv_class == IR_VC_TEMPORARY);
+    iv->iv_jit = 1;
+#if 0
+    printf("Value %s is machineregisterable, emitted by ", value_str(iu, iv));
+    instr_print(iu, ii, 0);
+    printf("\n");
+#endif
+  }
+}
+
+
+/**
+ * Analyze instruction stream for JITable instructions.
+ * This happens just before register allocation.
+ */
+static void
+jit_analyze(ir_unit_t *iu, ir_function_t *f)
+{
+  ir_bb_t *ib;
+  ir_instr_t *ii;
+
+  ir_instr_t *first = NULL;
+
+  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
+    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
+
+      jit_check(iu, ii);
+      if(ii->ii_jit && first == NULL)
+        first = ii;
+
+      if(!ii->ii_jit && first != NULL) {
+        jit_analyze_segment(iu, first, TAILQ_PREV(ii, ir_instr_queue, ii_link));
+        first = NULL;
+      }
+    }
+    if(first != NULL) {
+      jit_analyze_segment(iu, first, TAILQ_LAST(&ib->ib_instrs, ir_instr_queue));
+      first = NULL;
+    }
+  }
+}
+
+
+/**
+ * Remember the literals of the JITed code of 'f' that point into its VM
+ * text so layout_text() can move the text. Called once the function is
+ * emitted
+ */
+static void
+jit_record_relocs(ir_unit_t *iu, ir_function_t *f)
+{
+  if(iu->iu_vm_funcs != NULL)
+    return;
+
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_jit_vmcode_fixups); i++) {
+    jit_reloc_t jr = {VECTOR_ITEM(&iu->iu_jit_vmcode_fixups, i), f->if_gfid};
+    VECTOR_PUSH_BACK(&iu->iu_jit_relocs, jr);
+  }
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_jit_vmbb_fixups); i++) {
+    jit_reloc_t jr = {VECTOR_ITEM(&iu->iu_jit_vmbb_fixups, i), f->if_gfid};
+    VECTOR_PUSH_BACK(&iu->iu_jit_relocs, jr);
+  }
+}
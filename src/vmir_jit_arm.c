@@ -75,15 +75,9 @@ make_imm12(uint32_t v)
 static void
 jit_push(ir_unit_t *iu, uint32_t opcode)
 {
-  if(iu->iu_jit_ptr + 4 >= iu->iu_jit_mem_alloced) {
-    assert(iu->iu_jit_mem == NULL); // TODO, realloc when we run out of space
-
-    iu->iu_jit_mem_alloced = 1024 * 1024 * 16;
-    iu->iu_jit_mem = mmap(NULL, iu->iu_jit_mem_alloced,
-                          PROT_EXEC | PROT_READ | PROT_WRITE,
-                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  }
-  uint32_t *p = iu->iu_jit_mem + iu->iu_jit_ptr;
+  if(jit_mem_map(iu, iu->iu_jit_ptr + 4))
+    parser_error(iu, "JIT: Out of code memory");
+  uint32_t *p = iu->iu_jit_wmem + iu->iu_jit_ptr;
   *p = opcode;
   iu->iu_jit_ptr += 4;
 }
@@ -112,7 +106,7 @@ jit_push_literal_pool(ir_unit_t *iu, jitctx_t *jc)
     printf("imm12=%d jitptr:%x instr:%x\n", imm12,
            iu->iu_jit_ptr, jc->literal_pool[i].instr);
 #endif
-    uint32_t *p = iu->iu_jit_mem + jc->literal_pool[i].instr;
+    uint32_t *p = iu->iu_jit_wmem + jc->literal_pool[i].instr;
     if(jc->literal_pool[i].addrp != NULL)
       *jc->literal_pool[i].addrp = iu->iu_jit_ptr;
     *p |= imm12;
@@ -1011,85 +1005,6 @@ jit_check(ir_unit_t *iu, ir_instr_t *ii)
 }
 
 
-/**
- * Figure out which values are live only during a specific JIT
- * segment. Such values are allocated to machine registers.
- */
-static void
-jit_analyze_segment(ir_unit_t *iu, ir_instr_t *first, ir_instr_t *last)
-{
-  const ir_instr_t *stop = TAILQ_NEXT(last, ii_link);
-  ir_instr_t *ii;
-
-  // Live-out values from JITed segment
-  const uint32_t *liveout = last->ii_liveness;
-  const int ffv = iu->iu_first_func_value;
-#if 0
-  printf("Analyze segment first: ");
-  instr_print(iu, first, 0);
-  printf("\n");
-
-  printf("Analyze segment  last: ");
-  instr_print(iu, last, 0);
-  printf("\n");
-  printf("last liveout values\n");
-  for(int i = 0; i < 32;i++) {
-    if(bitchk(liveout, i))
-      printf("%s\n", value_str_id(iu, i + ffv));
-  }
-#endif
-  for(ii = first; ii != stop; ii = TAILQ_NEXT(ii, ii_link)) {
-    int r = ii->ii_ret_value;
-    if(r == -1)
-      continue;
-    r -= ffv;
-    if(bitchk(liveout, r))
-      continue; // Value is liveout
-
-    ir_value_t *iv = value_get(iu, ii->ii_ret_value);
-    assert(iv->iv_class == IR_VC_TEMPORARY);
-    iv->iv_jit = 1;
-#if 0
-    printf("Value %s is machineregisterable, emitted by ", value_str(iu, iv));
-    instr_print(iu, ii, 0);
-    printf("\n");
-#endif
-  }
-}
-
-
-/**
- * Analyze instruction stream for JITable instructions.
- * This happens just before register allocation.
- */
-static void
-jit_analyze(ir_unit_t *iu, ir_function_t *f)
-{
-  ir_bb_t *ib;
-  ir_instr_t *ii;
-
-  ir_instr_t *first = NULL;
-
-  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
-    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
-
-      jit_check(iu, ii);
-      if(ii->ii_jit && first == NULL)
-        first = ii;
-
-      if(!ii->ii_jit && first != NULL) {
-        jit_analyze_segment(iu, first, TAILQ_PREV(ii, ir_instr_queue, ii_link));
-        first = NULL;
-      }
-    }
-    if(first != NULL) {
-      jit_analyze_segment(iu, first, TAILQ_LAST(&ib->ib_instrs, ir_instr_queue));
-      first = NULL;
-    }
-  }
-}
-
-
 /**
  *
  */
@@ -1167,14 +1082,14 @@ jit_branch_fixup(ir_unit_t *iu, ir_function_t *f)
   int x = VECTOR_LEN(&iu->iu_jit_vmcode_fixups);
   for(int i = 0; i < x; i++) {
     int off = VECTOR_ITEM(&iu->iu_jit_vmcode_fixups, i);
-    int32_t *literal = iu->iu_jit_mem + off;
+    int32_t *literal = iu->iu_jit_wmem + off;
     *literal += vmtext;
   }
 
   x = VECTOR_LEN(&iu->iu_jit_vmbb_fixups);
   for(int i = 0; i < x; i++) {
     int off = VECTOR_ITEM(&iu->iu_jit_vmbb_fixups, i);
-    int32_t *literal = iu->iu_jit_mem + off;
+    int32_t *literal = iu->iu_jit_wmem + off;
     ir_bb_t *bb = bb_find(f, *literal);
     assert(bb != NULL);
     *literal = vmtext + bb->ib_text_offset;
@@ -1184,7 +1099,7 @@ jit_branch_fixup(ir_unit_t *iu, ir_function_t *f)
   x = VECTOR_LEN(&iu->iu_jit_branch_fixups);
   for(int i = 0; i < x; i++) {
     int off = VECTOR_ITEM(&iu->iu_jit_branch_fixups, i);
-    int32_t *instrp = iu->iu_jit_mem + off;
+    int32_t *instrp = iu->iu_jit_wmem + off;
     ir_bb_t *bb = bb_find(f, *instrp & 0xffffff);
     assert(bb != NULL);
     int pc = off + 0x8;
@@ -1193,17 +1108,6 @@ jit_branch_fixup(ir_unit_t *iu, ir_function_t *f)
   }
 }
 
-
-/**
- *
- */
-static void
-jit_seal_code(ir_unit_t *iu)
-{
-  mprotect(iu->iu_jit_mem, iu->iu_jit_mem_alloced,
-           PROT_EXEC | PROT_READ);
-}
-
 #define VMIR_VM_JIT
 #define JIT_MACHINE_REGS 5
 
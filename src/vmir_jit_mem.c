@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Memory for JITed code
+ *
+ * The code is written through one mapping and executed through another
+ * mapping of the same memory. Functions compiled lazily or when tiering
+ * up are thus packed right after code that may be running in another
+ * thread and no page is ever writable and executable. Address space for
+ * both mappings is reserved up front and memory is mapped in chunks as
+ * code is emitted. Sealing write-protects the pages that are full.
+ *
+ * A function is only JIT compiled if there is room for at least
+ * JIT_MEM_HEADROOM bytes of code, otherwise it's interpreted
+ */
+
+#define JIT_MEM_RESERVE  (256 * 1024 * 1024) // Address space for code
+#define JIT_MEM_CHUNK    (1024 * 1024)       // Mapped at a time
+#define JIT_MEM_HEADROOM JIT_MEM_CHUNK
+
+
+/**
+ * Make sure the first 'size' bytes of code memory are mapped. Returns
+ * -1 if that can't be done
+ */
+static int
+jit_mem_map(ir_unit_t *iu, int size)
+{
+  if(size <= iu->iu_jit_mem_alloced)
+    return 0;
+  if(iu->iu_jit_mem_failed || size > JIT_MEM_RESERVE)
+    return -1;
+
+  if(iu->iu_jit_mem == NULL) {
+    const int fd = memfd_create("vmir-jit", MFD_CLOEXEC);
+    if(fd == -1) {
+      iu->iu_jit_mem_failed = 1;
+      return -1;
+    }
+    void *x = mmap(NULL, JIT_MEM_RESERVE, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void *w = mmap(NULL, JIT_MEM_RESERVE, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(x == MAP_FAILED || w == MAP_FAILED) {
+      if(x != MAP_FAILED)
+        munmap(x, JIT_MEM_RESERVE);
+      if(w != MAP_FAILED)
+        munmap(w, JIT_MEM_RESERVE);
+      close(fd);
+      iu->iu_jit_mem_failed = 1;
+      return -1;
+    }
+    iu->iu_jit_fd = fd;
+    iu->iu_jit_mem = x;
+    iu->iu_jit_wmem = w;
+  }
+
+  const int start = iu->iu_jit_mem_alloced;
+  const int end = MIN(VMIR_ALIGN(size, JIT_MEM_CHUNK), JIT_MEM_RESERVE);
+  if(ftruncate(iu->iu_jit_fd, end) ||
+     mmap(iu->iu_jit_wmem + start, end - start, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_FIXED, iu->iu_jit_fd, start) == MAP_FAILED ||
+     mmap(iu->iu_jit_mem + start, end - start, PROT_READ | PROT_EXEC,
+          MAP_SHARED | MAP_FIXED, iu->iu_jit_fd, start) == MAP_FAILED)
+    return -1;
+  iu->iu_jit_mem_alloced = end;
+  return 0;
+}
+
+
+/**
+ * Returns -1 if there is not enough room to JIT compile another function
+ */
+static int
+jit_mem_reserve(ir_unit_t *iu)
+{
+  return jit_mem_map(iu, iu->iu_jit_ptr + JIT_MEM_HEADROOM);
+}
+
+
+/**
+ * Make the code emitted since the last call visible to the executing
+ * mapping. Code emitted later continues right after it
+ */
+static void
+jit_seal_code(ir_unit_t *iu)
+{
+  if(iu->iu_jit_mem == NULL || iu->iu_jit_ptr == iu->iu_jit_sealed)
+    return;
+  __builtin___clear_cache(iu->iu_jit_mem + iu->iu_jit_sealed,
+                          iu->iu_jit_mem + iu->iu_jit_ptr);
+  // Only the last page can still be written
+  const int start = iu->iu_jit_sealed & ~4095;
+  const int end = iu->iu_jit_ptr & ~4095;
+  if(end > start)
+    mprotect(iu->iu_jit_wmem + start, end - start, PROT_READ);
+  iu->iu_jit_sealed = iu->iu_jit_ptr;
+}
+
+
+/**
+ *
+ */
+static void
+jit_mem_destroy(ir_unit_t *iu)
+{
+  if(iu->iu_jit_mem == NULL)
+    return;
+  munmap(iu->iu_jit_mem, JIT_MEM_RESERVE);
+  munmap(iu->iu_jit_wmem, JIT_MEM_RESERVE);
+  close(iu->iu_jit_fd);
+}
@@ -0,0 +1,1177 @@
+#include <sys/mman.h>
+
+/**
+ * Registers
+ */
+#define X86_RAX  0
+#define X86_RCX  1
+#define X86_RDX  2
+#define X86_RBX  3
+#define X86_RSP  4
+#define X86_RBP  5
+#define X86_RSI  6
+#define X86_RDI  7
+#define X86_R8   8
+#define X86_R9   9
+#define X86_R10 10
+#define X86_R11 11
+#define X86_R12 12
+#define X86_R13 13
+#define X86_R14 14
+#define X86_R15 15
+
+#define X86_NOREG -1
+
+// The JITed code is called as code(rf, mem) so per SysV ABI the
+// register frame arrives in RDI and the memory base in RSI
+#define R_VMSTACK X86_RDI
+#define R_MEM     X86_RSI
+#define R_TMPA    X86_RAX
+#define R_TMPB    X86_RDX
+#define R_TMPC    X86_RCX  // Must be RCX as it's used for shift counts
+
+/**
+ * Registers available to the register allocator. R8 - R11 are
+ * caller saved and free to use. RBX, R12 - R14 are saved by the prologue
+ */
+static const uint8_t jit_machine_regs[] = {
+  X86_R8, X86_R9, X86_R10, X86_R11, X86_RBX, X86_R12, X86_R13, X86_R14
+};
+
+#define X86_CC_ULT 0x2
+#define X86_CC_UGE 0x3
+#define X86_CC_EQ  0x4
+#define X86_CC_NE  0x5
+#define X86_CC_ULE 0x6
+#define X86_CC_UGT 0x7
+#define X86_CC_SLT 0xc
+#define X86_CC_SGE 0xd
+#define X86_CC_SLE 0xe
+#define X86_CC_SGT 0xf
+
+
+/**
+ *
+ */
+static void *
+jit_reserve(ir_unit_t *iu, int len)
+{
+  if(jit_mem_map(iu, iu->iu_jit_ptr + len))
+    parser_error(iu, "JIT: Out of code memory");
+  void *r = iu->iu_jit_wmem + iu->iu_jit_ptr;
+  iu->iu_jit_ptr += len;
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+jit_emit8(ir_unit_t *iu, uint8_t v)
+{
+  *(uint8_t *)jit_reserve(iu, 1) = v;
+}
+
+
+/**
+ *
+ */
+static void
+jit_emit32(ir_unit_t *iu, uint32_t v)
+{
+  *(uint32_t *)jit_reserve(iu, 4) = v;
+}
+
+
+/**
+ *
+ */
+static void
+jit_emit64(ir_unit_t *iu, uint64_t v)
+{
+  *(uint64_t *)jit_reserve(iu, 8) = v;
+}
+
+
+/**
+ * Emit an opcode. Two byte opcodes (0x0f escaped) are passed as 0x0fXX
+ */
+static void
+jit_opcode(ir_unit_t *iu, int opc)
+{
+  if(opc > 0xff)
+    jit_emit8(iu, opc >> 8);
+  jit_emit8(iu, opc);
+}
+
+
+/**
+ * Emit REX prefix if any of the operands are extended registers
+ */
+static void
+jit_rex(ir_unit_t *iu, int w, int reg, int index, int base)
+{
+  int rex = 0;
+  if(w)
+    rex |= 8;
+  if(reg & 8)
+    rex |= 4;
+  if(index != X86_NOREG && index & 8)
+    rex |= 2;
+  if(base & 8)
+    rex |= 1;
+  if(rex)
+    jit_emit8(iu, 0x40 | rex);
+}
+
+
+/**
+ * Register to register operation (ModRM mod=11)
+ *
+ * For opcodes with an opcode extension in the ModRM byte, pass the
+ * extension as 'reg'
+ */
+static void
+jit_op_rr(ir_unit_t *iu, int opc, int reg, int rm)
+{
+  jit_rex(iu, 0, reg, X86_NOREG, rm);
+  jit_opcode(iu, opc);
+  jit_emit8(iu, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+
+/**
+ * Register to memory operation: [base + index << scale + disp]
+ */
+static void
+jit_op_mem(ir_unit_t *iu, int opc, int reg, int base, int index, int scale,
+           int32_t disp)
+{
+  int mod;
+  assert(index != X86_RSP);
+
+  jit_rex(iu, 0, reg, index, base);
+  jit_opcode(iu, opc);
+
+  if(disp == 0 && (base & 7) != X86_RBP)
+    mod = 0;
+  else if(disp >= INT8_MIN && disp <= INT8_MAX)
+    mod = 1;
+  else
+    mod = 2;
+
+  if(index != X86_NOREG || (base & 7) == X86_RSP) {
+    jit_emit8(iu, mod << 6 | (reg & 7) << 3 | 4);
+    jit_emit8(iu, scale << 6 |
+              ((index == X86_NOREG ? X86_RSP : index) & 7) << 3 | (base & 7));
+  } else {
+    jit_emit8(iu, mod << 6 | (reg & 7) << 3 | (base & 7));
+  }
+
+  if(mod == 1)
+    jit_emit8(iu, disp);
+  else if(mod == 2)
+    jit_emit32(iu, disp);
+}
+
+
+/**
+ *
+ */
+static void
+jit_loadimm(ir_unit_t *iu, uint32_t imm, int reg)
+{
+  if(imm == 0) {
+    // XOR r32, r32
+    jit_op_rr(iu, 0x33, reg, reg);
+    return;
+  }
+  // MOV r32, imm32
+  jit_rex(iu, 0, 0, X86_NOREG, reg);
+  jit_emit8(iu, 0xb8 + (reg & 7));
+  jit_emit32(iu, imm);
+}
+
+
+/**
+ *
+ */
+static void
+jit_push_prologue(ir_unit_t *iu)
+{
+  jit_emit8(iu, 0x53);                      // push rbx
+  jit_emit8(iu, 0x41); jit_emit8(iu, 0x54); // push r12
+  jit_emit8(iu, 0x41); jit_emit8(iu, 0x55); // push r13
+  jit_emit8(iu, 0x41); jit_emit8(iu, 0x56); // push r14
+}
+
+
+/**
+ *
+ */
+static void
+jit_push_epilogue(ir_unit_t *iu)
+{
+  jit_emit8(iu, 0x41); jit_emit8(iu, 0x5e); // pop r14
+  jit_emit8(iu, 0x41); jit_emit8(iu, 0x5d); // pop r13
+  jit_emit8(iu, 0x41); jit_emit8(iu, 0x5c); // pop r12
+  jit_emit8(iu, 0x5b);                      // pop rbx
+  jit_emit8(iu, 0xc3);                      // ret
+}
+
+
+/**
+ * Return to the VM. The VM instruction pointer to continue at is
+ * returned in RAX. Returns offset of the 64 bit literal so it can
+ * be fixed up once we know where the VM code ends up
+ */
+static int
+jit_exit_to_vm(ir_unit_t *iu, int64_t literal)
+{
+  // MOVABS rax, imm64
+  jit_emit8(iu, 0x48);
+  jit_emit8(iu, 0xb8);
+  int ptr = iu->iu_jit_ptr;
+  jit_emit64(iu, literal);
+  jit_push_epilogue(iu);
+  return ptr;
+}
+
+
+/**
+ * Jump to the JITed code of another basic block. The rel32 is
+ * temporarily set to the basic block id and resolved in jit_branch_fixup()
+ */
+static void
+jit_jump(ir_unit_t *iu, int opc, int bb)
+{
+  jit_opcode(iu, opc);
+  VECTOR_PUSH_BACK(&iu->iu_jit_branch_fixups, iu->iu_jit_ptr);
+  jit_emit32(iu, bb);
+}
+
+
+/**
+ *
+ */
+static int
+jit_bb_is_jit(ir_unit_t *iu, int bbid)
+{
+  ir_bb_t *ib = bb_find(iu->iu_current_function, bbid);
+  ir_instr_t *tgt = TAILQ_FIRST(&ib->ib_instrs);
+  return tgt->ii_jit;
+}
+
+
+/**
+ *
+ */
+static int
+jit_mreg(const ir_value_t *iv)
+{
+  return jit_machine_regs[iv->iv_reg];
+}
+
+
+/**
+ * Load a value into a register
+ *
+ * If the value is a constant or stored on the regframe the register
+ * passed in 'reg' is used
+ *
+ * If the value is stored in a machine register, that register is returned
+ */
+static int __attribute__((warn_unused_result))
+jit_loadvalue(ir_unit_t *iu, const ir_value_t *iv, int reg)
+{
+  const ir_type_t *it;
+
+  switch(iv->iv_class) {
+  case IR_VC_MACHINEREG:
+    return jit_mreg(iv);
+
+  case IR_VC_REGFRAME:
+    it = type_get(iu, iv->iv_type);
+    switch(it->it_code) {
+    case IR_TYPE_INT8:
+      // MOVZX r32, m8
+      jit_op_mem(iu, 0x0fb6, reg, R_VMSTACK, X86_NOREG, 0, iv->iv_reg);
+      break;
+    case IR_TYPE_INT16:
+      // MOVZX r32, m16
+      jit_op_mem(iu, 0x0fb7, reg, R_VMSTACK, X86_NOREG, 0, iv->iv_reg);
+      break;
+    case IR_TYPE_INT32:
+    case IR_TYPE_FLOAT:
+    case IR_TYPE_POINTER:
+      // MOV r32, m32
+      jit_op_mem(iu, 0x8b, reg, R_VMSTACK, X86_NOREG, 0, iv->iv_reg);
+      break;
+    default:
+      parser_error(iu, "JIT: Can't load value typecode %d", it->it_code);
+    }
+    break;
+  case IR_VC_CONSTANT:
+  case IR_VC_GLOBALVAR:
+    jit_loadimm(iu, value_get_const32(iu, iv), reg);
+    break;
+  default:
+    parser_error(iu, "JIT: Can't load value-class %d", iv->iv_class);
+  }
+  return reg;
+}
+
+
+/**
+ * Like jit_loadvalue() but the value always ends up in 'reg'
+ */
+static void
+jit_movevalue(ir_unit_t *iu, const ir_value_t *iv, int reg)
+{
+  int r = jit_loadvalue(iu, iv, reg);
+  if(r != reg)
+    jit_op_rr(iu, 0x8b, reg, r);
+}
+
+
+/**
+ *
+ */
+static int
+jit_storevalue_reg(ir_unit_t *iu, const ir_value_t *iv, int reg)
+{
+  if(iv->iv_class == IR_VC_MACHINEREG)
+    return jit_mreg(iv);
+  return reg;
+}
+
+
+/**
+ *
+ */
+static void
+jit_storevalue(ir_unit_t *iu, const ir_value_t *iv, int reg)
+{
+  const ir_type_t *it;
+
+  switch(iv->iv_class) {
+  case IR_VC_MACHINEREG:
+    if(jit_mreg(iv) != reg)
+      jit_op_rr(iu, 0x8b, jit_mreg(iv), reg);
+    return;
+
+  case IR_VC_REGFRAME:
+    it = type_get(iu, iv->iv_type);
+
+    switch(it->it_code) {
+    case IR_TYPE_INT8:
+    case IR_TYPE_INT16:
+    case IR_TYPE_INT32:
+    case IR_TYPE_FLOAT:
+    case IR_TYPE_POINTER:
+      // Regframe slots are always (at least) 32 bit wide
+      jit_op_mem(iu, 0x89, reg, R_VMSTACK, X86_NOREG, 0, iv->iv_reg);
+      break;
+    default:
+      parser_error(iu, "JIT: Can't store value typecode %d", it->it_code);
+    }
+    break;
+  default:
+    parser_error(iu, "JIT: Can't store value-class %d", iv->iv_class);
+  }
+}
+
+
+/**
+ * reg = reg <op> value, for a value in a machine register or in
+ * the register frame. 'opc' is the 'r32, r/m32' form of the opcode
+ */
+static void
+jit_op_value(ir_unit_t *iu, int opc, int reg, const ir_value_t *iv)
+{
+  assert(reg != R_TMPB);
+
+  if(iv->iv_class == IR_VC_REGFRAME) {
+    switch(type_get(iu, iv->iv_type)->it_code) {
+    case IR_TYPE_INT32:
+    case IR_TYPE_FLOAT:
+    case IR_TYPE_POINTER:
+      jit_op_mem(iu, opc, reg, R_VMSTACK, X86_NOREG, 0, iv->iv_reg);
+      return;
+    default:
+      break;
+    }
+  }
+  jit_op_rr(iu, opc, reg, jit_loadvalue(iu, iv, R_TMPB));
+}
+
+
+/**
+ * reg = reg <binop> value
+ *
+ * Only for ADD, SUB, MUL, AND, OR, XOR. Also used for compare
+ * when binop is -1
+ */
+static void
+jit_arith(ir_unit_t *iu, int binop, int reg, const ir_value_t *iv)
+{
+  int ext;
+
+  switch(binop) {
+  case BINOP_ADD: ext = 0; break;
+  case BINOP_OR:  ext = 1; break;
+  case BINOP_AND: ext = 4; break;
+  case BINOP_SUB: ext = 5; break;
+  case BINOP_XOR: ext = 6; break;
+  case -1:        ext = 7; break; // CMP
+  case BINOP_MUL:
+    if(iv->iv_class == IR_VC_CONSTANT || iv->iv_class == IR_VC_GLOBALVAR) {
+      const int32_t imm = value_get_const32(iu, iv);
+      if(imm == (int8_t)imm) {
+        jit_op_rr(iu, 0x6b, reg, reg);
+        jit_emit8(iu, imm);
+      } else {
+        jit_op_rr(iu, 0x69, reg, reg);
+        jit_emit32(iu, imm);
+      }
+    } else {
+      jit_op_value(iu, 0x0faf, reg, iv);
+    }
+    return;
+  default:
+    abort();
+  }
+
+  if(iv->iv_class == IR_VC_CONSTANT || iv->iv_class == IR_VC_GLOBALVAR) {
+    const int32_t imm = value_get_const32(iu, iv);
+    if(imm == (int8_t)imm) {
+      jit_op_rr(iu, 0x83, ext, reg);
+      jit_emit8(iu, imm);
+    } else {
+      jit_op_rr(iu, 0x81, ext, reg);
+      jit_emit32(iu, imm);
+    }
+  } else {
+    jit_op_value(iu, (ext << 3) | 3, reg, iv);
+  }
+}
+
+
+/**
+ *
+ */
+static int
+is_r(const ir_value_t *iv)
+{
+  return iv->iv_class == IR_VC_REGFRAME || iv->iv_class == IR_VC_TEMPORARY;
+}
+
+/**
+ *
+ */
+static int
+is_rc(const ir_value_t *iv)
+{
+  return iv->iv_class == IR_VC_REGFRAME || iv->iv_class == IR_VC_TEMPORARY ||
+    iv->iv_class == IR_VC_CONSTANT || iv->iv_class == IR_VC_GLOBALVAR;
+}
+
+
+/**
+ * Values that fit in a 32 bit register
+ */
+static int
+is_r32(ir_unit_t *iu, const ir_value_t *iv)
+{
+  switch(type_get(iu, iv->iv_type)->it_code) {
+  case IR_TYPE_INT8:
+  case IR_TYPE_INT16:
+  case IR_TYPE_INT32:
+  case IR_TYPE_POINTER:
+  case IR_TYPE_FLOAT:
+    return is_rc(iv);
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ *
+ */
+static int
+jit_binop_check(ir_unit_t *iu, ir_instr_binary_t *ii)
+{
+  const int binop = ii->op;
+  const ir_value_t *lhs = value_get(iu, ii->lhs_value);
+  const ir_value_t *rhs = value_get(iu, ii->rhs_value);
+
+  int typecode = type_get(iu, lhs->iv_type)->it_code;
+
+  switch(binop) {
+  case BINOP_SDIV:
+  case BINOP_UDIV:
+  case BINOP_SREM:
+  case BINOP_UREM:
+    return 0;
+
+  case BINOP_LSHR:
+  case BINOP_ASHR:
+    if(typecode != IR_TYPE_INT32)
+      return 0;
+    break;
+  }
+
+  if(typecode != type_get(iu, rhs->iv_type)->it_code)
+    return 0;
+
+  switch(typecode) {
+  case IR_TYPE_INT8:
+  case IR_TYPE_INT16:
+  case IR_TYPE_INT32:
+  case IR_TYPE_POINTER:
+    break;
+  default:
+    return 0;
+  }
+
+  return is_rc(lhs) && is_rc(rhs);
+}
+
+
+/**
+ *
+ */
+static void
+jit_binop(ir_unit_t *iu, ir_instr_binary_t *ii)
+{
+  const int binop = ii->op;
+  const ir_value_t *lhs = value_get(iu, ii->lhs_value);
+  const ir_value_t *rhs = value_get(iu, ii->rhs_value);
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+
+  int Rd = jit_storevalue_reg(iu, ret, R_TMPA);
+
+  // x86 is two-operand so lhs is moved into the destination first.
+  // Don't do that if it would clobber rhs
+  if(rhs->iv_class == IR_VC_MACHINEREG && jit_mreg(rhs) == Rd &&
+     !(lhs->iv_class == IR_VC_MACHINEREG && jit_mreg(lhs) == Rd))
+    Rd = R_TMPA;
+
+  jit_movevalue(iu, lhs, Rd);
+
+  switch(binop) {
+  case BINOP_ADD:
+  case BINOP_SUB:
+  case BINOP_MUL:
+  case BINOP_AND:
+  case BINOP_OR:
+  case BINOP_XOR:
+    jit_arith(iu, binop, Rd, rhs);
+    break;
+
+  case BINOP_SHL:
+  case BINOP_LSHR:
+  case BINOP_ASHR:
+    {
+      const int ext = binop == BINOP_SHL ? 4 : binop == BINOP_LSHR ? 5 : 7;
+      if(rhs->iv_class == IR_VC_CONSTANT) {
+        // SHL/SHR/SAR r32, imm8
+        jit_op_rr(iu, 0xc1, ext, Rd);
+        jit_emit8(iu, value_get_const32(iu, rhs) & 0x1f);
+      } else {
+        // SHL/SHR/SAR r32, cl
+        jit_movevalue(iu, rhs, R_TMPC);
+        jit_op_rr(iu, 0xd3, ext, Rd);
+      }
+    }
+    break;
+  default:
+    abort();
+  }
+  jit_storevalue(iu, ret, Rd);
+}
+
+
+/**
+ *
+ */
+static int
+jit_move_check(ir_unit_t *iu, ir_instr_move_t *ii)
+{
+  return is_r32(iu, value_get(iu, ii->value));
+}
+
+
+/**
+ *
+ */
+static void
+jit_move(ir_unit_t *iu, ir_instr_move_t *ii)
+{
+  const ir_value_t *iv = value_get(iu, ii->value);
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+
+  if(ret->iv_class == IR_VC_REGFRAME &&
+     (iv->iv_class == IR_VC_CONSTANT || iv->iv_class == IR_VC_GLOBALVAR)) {
+    // MOV m32, imm32
+    jit_op_mem(iu, 0xc7, 0, R_VMSTACK, X86_NOREG, 0, ret->iv_reg);
+    jit_emit32(iu, value_get_const32(iu, iv));
+    return;
+  }
+
+  int Rd = jit_storevalue_reg(iu, ret, R_TMPA);
+  int Rn = jit_loadvalue(iu, iv, Rd);
+  jit_storevalue(iu, ret, Rn);
+}
+
+
+/**
+ *
+ */
+static int
+jit_load_check(ir_unit_t *iu, ir_instr_load_t *ii)
+{
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+  const ir_type_t *retty = type_get(iu, ret->iv_type);
+
+  if(!is_rc(value_get(iu, ii->ptr)))
+    return 0;
+
+  if(ii->value_offset >= 0 &&
+     !is_r32(iu, value_get(iu, ii->value_offset)))
+    return 0;
+
+  if(ii->cast != -1) {
+    const ir_type_t *pointee = type_get(iu, ii->load_type);
+
+    if(retty->it_code != IR_TYPE_INT32)
+      return 0;
+    if(ii->cast != CAST_ZEXT && ii->cast != CAST_SEXT)
+      return 0;
+    return pointee->it_code == IR_TYPE_INT8 ||
+      pointee->it_code == IR_TYPE_INT16;
+  }
+
+  switch(retty->it_code) {
+  case IR_TYPE_INT8:
+  case IR_TYPE_INT16:
+  case IR_TYPE_INT32:
+  case IR_TYPE_POINTER:
+  case IR_TYPE_FLOAT:
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+
+/**
+ * Compute effective address (offset relative to R_MEM)
+ */
+static int
+jit_compute_ea(ir_unit_t *iu, int baseptr, int value_offset,
+               int value_offset_multiply, int immediate_offset,
+               int preferred_reg)
+{
+  assert(preferred_reg != R_TMPB);
+
+  int index = X86_NOREG, scale = 0;
+  if(value_offset >= 0) {
+    const ir_value_t *roff = value_get(iu, value_offset);
+    index = jit_loadvalue(iu, roff, R_TMPB);
+
+    switch(value_offset_multiply) {
+    case 1: scale = 0; break;
+    case 2: scale = 1; break;
+    case 4: scale = 2; break;
+    case 8: scale = 3; break;
+    default:
+      // IMUL r32, r/m32, imm32
+      jit_op_rr(iu, 0x69, R_TMPB, index);
+      jit_emit32(iu, value_offset_multiply);
+      index = R_TMPB;
+      break;
+    }
+  }
+  const ir_value_t *src = value_get(iu, baseptr);
+
+  if(index == preferred_reg && src->iv_class != IR_VC_MACHINEREG) {
+    // Index lives in the register we're about to load base into
+    jit_op_rr(iu, 0x8b, R_TMPB, index);
+    index = R_TMPB;
+  }
+
+  int ea = jit_loadvalue(iu, src, preferred_reg);
+
+  if(index == X86_NOREG && immediate_offset == 0)
+    return ea;
+
+  // LEA r32, [ea + index << scale + disp]
+  jit_op_mem(iu, 0x8d, preferred_reg, ea, index, scale, immediate_offset);
+  return preferred_reg;
+}
+
+
+/**
+ *
+ */
+static int
+jit_lea_check(ir_unit_t *iu, ir_instr_lea_t *ii)
+{
+  if(!is_rc(value_get(iu, ii->baseptr)))
+    return 0;
+
+  if(ii->value_offset >= 0 &&
+     !is_r32(iu, value_get(iu, ii->value_offset)))
+    return 0;
+
+  return 1;
+}
+
+
+/**
+ *
+ */
+static void
+jit_lea(ir_unit_t *iu, ir_instr_lea_t *ii)
+{
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+
+  int ea = jit_compute_ea(iu, ii->baseptr, ii->value_offset,
+                          ii->value_offset_multiply, ii->immediate_offset,
+                          jit_storevalue_reg(iu, ret, R_TMPA));
+  jit_storevalue(iu, ret, ea);
+}
+
+
+/**
+ *
+ */
+static void
+jit_load(ir_unit_t *iu, ir_instr_load_t *ii)
+{
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+  int Rt = jit_storevalue_reg(iu, ret, R_TMPA);
+
+  int ea = jit_compute_ea(iu, ii->ptr, ii->value_offset,
+                          ii->value_offset_multiply, ii->immediate_offset,
+                          R_TMPA);
+  int opc;
+
+  if(ii->cast != -1) {
+    // Load + Cast
+    ir_type_t *pointee = type_get(iu, ii->load_type);
+    ir_type_t *retty = type_get(iu, ret->iv_type);
+
+    switch(COMBINE3(retty->it_code, pointee->it_code, ii->cast)) {
+    case COMBINE3(IR_TYPE_INT32, IR_TYPE_INT8, CAST_ZEXT):
+      opc = 0x0fb6; // MOVZX r32, m8
+      break;
+    case COMBINE3(IR_TYPE_INT32, IR_TYPE_INT8, CAST_SEXT):
+      opc = 0x0fbe; // MOVSX r32, m8
+      break;
+    case COMBINE3(IR_TYPE_INT32, IR_TYPE_INT16, CAST_ZEXT):
+      opc = 0x0fb7; // MOVZX r32, m16
+      break;
+    case COMBINE3(IR_TYPE_INT32, IR_TYPE_INT16, CAST_SEXT):
+      opc = 0x0fbf; // MOVSX r32, m16
+      break;
+    default:
+      abort();
+    }
+  } else {
+
+    ir_type_t *pointee = type_get(iu, ret->iv_type);
+
+    switch(pointee->it_code) {
+    default:
+      abort();
+    case IR_TYPE_INT32:
+    case IR_TYPE_POINTER:
+    case IR_TYPE_FLOAT:
+      opc = 0x8b;   // MOV r32, m32
+      break;
+    case IR_TYPE_INT16:
+      opc = 0x0fb7; // MOVZX r32, m16
+      break;
+    case IR_TYPE_INT8:
+      opc = 0x0fb6; // MOVZX r32, m8
+      break;
+    }
+  }
+  jit_op_mem(iu, opc, Rt, R_MEM, ea, 0, 0);
+  jit_storevalue(iu, ret, Rt);
+}
+
+
+/**
+ *
+ */
+static int
+jit_store_check(ir_unit_t *iu, ir_instr_store_t *ii)
+{
+  return is_rc(value_get(iu, ii->ptr)) &&
+    is_r32(iu, value_get(iu, ii->value));
+}
+
+
+/**
+ *
+ */
+static void
+jit_store(ir_unit_t *iu, ir_instr_store_t *ii)
+{
+  const ir_value_t *ptr = value_get(iu, ii->ptr);
+  const ir_value_t *val = value_get(iu, ii->value);
+  const ir_type_t *ty = type_get(iu, val->iv_type);
+
+  int ea = jit_loadvalue(iu, ptr, R_TMPA);
+
+  if(ii->offset) {
+    jit_op_mem(iu, 0x8d, R_TMPA, ea, X86_NOREG, 0, ii->offset);
+    ea = R_TMPA;
+  }
+
+  if(val->iv_class == IR_VC_CONSTANT || val->iv_class == IR_VC_GLOBALVAR) {
+    const uint32_t imm = value_get_const32(iu, val);
+    switch(ty->it_code) {
+    default:
+      abort();
+    case IR_TYPE_INT32:
+    case IR_TYPE_POINTER:
+    case IR_TYPE_FLOAT:
+      jit_op_mem(iu, 0xc7, 0, R_MEM, ea, 0, 0);
+      jit_emit32(iu, imm);
+      break;
+    case IR_TYPE_INT16:
+      jit_emit8(iu, 0x66);
+      jit_op_mem(iu, 0xc7, 0, R_MEM, ea, 0, 0);
+      jit_emit8(iu, imm);
+      jit_emit8(iu, imm >> 8);
+      break;
+    case IR_TYPE_INT8:
+      jit_op_mem(iu, 0xc6, 0, R_MEM, ea, 0, 0);
+      jit_emit8(iu, imm);
+      break;
+    }
+    return;
+  }
+
+  int Rt = jit_loadvalue(iu, val, R_TMPB);
+
+  switch(ty->it_code) {
+  default:
+    abort();
+  case IR_TYPE_INT32:
+  case IR_TYPE_POINTER:
+  case IR_TYPE_FLOAT:
+    jit_op_mem(iu, 0x89, Rt, R_MEM, ea, 0, 0);
+    break;
+  case IR_TYPE_INT16:
+    jit_emit8(iu, 0x66);
+    jit_op_mem(iu, 0x89, Rt, R_MEM, ea, 0, 0);
+    break;
+  case IR_TYPE_INT8:
+    // Without REX, 4-7 would encode AH, CH, DH, BH
+    assert(Rt < X86_RSP || Rt >= X86_R8);
+    jit_op_mem(iu, 0x88, Rt, R_MEM, ea, 0, 0);
+    break;
+  }
+}
+
+
+/**
+ *
+ */
+static int
+jit_mla_check(ir_unit_t *iu, ir_instr_ternary_t *ii)
+{
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+  int typecode = type_get(iu, ret->iv_type)->it_code;
+
+  switch(typecode) {
+  case IR_TYPE_INT8:
+  case IR_TYPE_INT16:
+  case IR_TYPE_INT32:
+  case IR_TYPE_POINTER:
+    break;
+  default:
+    return 0;
+  }
+  return
+    is_rc(value_get(iu, ii->arg1)) &&
+    is_rc(value_get(iu, ii->arg2)) &&
+    is_rc(value_get(iu, ii->arg3));
+}
+
+
+/**
+ *
+ */
+static void
+jit_mla(ir_unit_t *iu, ir_instr_ternary_t *ii)
+{
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+  const ir_value_t *a1 = value_get(iu, ii->arg1);
+  const ir_value_t *a2 = value_get(iu, ii->arg2);
+  const ir_value_t *a3 = value_get(iu, ii->arg3);
+
+  jit_movevalue(iu, a1, R_TMPA);
+  jit_arith(iu, BINOP_MUL, R_TMPA, a2);
+  jit_arith(iu, BINOP_ADD, R_TMPA, a3);
+  jit_storevalue(iu, ret, R_TMPA);
+}
+
+
+/**
+ *
+ */
+static int
+jit_br_check(ir_unit_t *iu, ir_instr_br_t *ii)
+{
+  // We can JIT unconditional branches
+  return ii->condition == -1;
+}
+
+
+/**
+ *
+ */
+static void
+jit_br(ir_unit_t *iu, ir_instr_br_t *ii)
+{
+  if(jit_bb_is_jit(iu, ii->true_branch)) {
+    // Jumping to another JITen instruction, emit a JMP rel32
+    jit_jump(iu, 0xe9, ii->true_branch);
+  } else {
+    // Jumping to non-JITed instruction, emit return + jump to VM location
+    int ptr = jit_exit_to_vm(iu, ii->true_branch);
+    VECTOR_PUSH_BACK(&iu->iu_jit_vmbb_fixups, ptr);
+  }
+}
+
+
+/**
+ *
+ */
+static int
+jit_cmp_branch_check(ir_unit_t *iu, ir_instr_cmp_branch_t *ii)
+{
+  const ir_value_t *lhs = value_get(iu, ii->lhs_value);
+  const ir_value_t *rhs = value_get(iu, ii->rhs_value);
+  int typecode = type_get(iu, lhs->iv_type)->it_code;
+
+  switch(typecode) {
+  case IR_TYPE_INT32:
+  case IR_TYPE_POINTER:
+    break;
+  default:
+    return 0;
+  }
+  return is_r(lhs) && is_rc(rhs);
+}
+
+
+/**
+ *
+ */
+static void
+jit_cmp_br(ir_unit_t *iu, ir_instr_cmp_branch_t *ii)
+{
+  const ir_value_t *lhs = value_get(iu, ii->lhs_value);
+  const ir_value_t *rhs = value_get(iu, ii->rhs_value);
+
+  int Rn = jit_loadvalue(iu, lhs, R_TMPA);
+  jit_arith(iu, -1, Rn, rhs);
+
+  int cc;
+  switch(ii->op) {
+  case ICMP_EQ:   cc = X86_CC_EQ;  break;
+  case ICMP_NE:   cc = X86_CC_NE;  break;
+  case ICMP_UGT:  cc = X86_CC_UGT; break;
+  case ICMP_UGE:  cc = X86_CC_UGE; break;
+  case ICMP_ULT:  cc = X86_CC_ULT; break;
+  case ICMP_ULE:  cc = X86_CC_ULE; break;
+  case ICMP_SGT:  cc = X86_CC_SGT; break;
+  case ICMP_SGE:  cc = X86_CC_SGE; break;
+  case ICMP_SLT:  cc = X86_CC_SLT; break;
+  case ICMP_SLE:  cc = X86_CC_SLE; break;
+  default:
+    abort();
+  }
+
+  int true_jit = jit_bb_is_jit(iu, ii->true_branch);
+  int false_jit = jit_bb_is_jit(iu, ii->false_branch);
+  int true_branch = ii->true_branch;
+  int false_branch = ii->false_branch;
+
+  if(!true_jit && false_jit) {
+    // Invert condition so we can jump directly on the JITed path
+    cc ^= 1;
+    true_branch = ii->false_branch;
+    false_branch = ii->true_branch;
+    true_jit = 1;
+    false_jit = 0;
+  }
+
+  int stub = -1;
+  if(true_jit) {
+    // Jcc rel32
+    jit_jump(iu, 0x0f80 | cc, true_branch);
+  } else {
+    // Jcc rel32 to exit stub emitted below
+    jit_opcode(iu, 0x0f80 | cc);
+    stub = iu->iu_jit_ptr;
+    jit_emit32(iu, 0);
+  }
+
+  if(false_jit) {
+    jit_jump(iu, 0xe9, false_branch);
+  } else {
+    int ptr = jit_exit_to_vm(iu, false_branch);
+    VECTOR_PUSH_BACK(&iu->iu_jit_vmbb_fixups, ptr);
+  }
+
+  if(stub != -1) {
+    *(int32_t *)(iu->iu_jit_wmem + stub) = iu->iu_jit_ptr - (stub + 4);
+    int ptr = jit_exit_to_vm(iu, true_branch);
+    VECTOR_PUSH_BACK(&iu->iu_jit_vmbb_fixups, ptr);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+jit_check(ir_unit_t *iu, ir_instr_t *ii)
+{
+  int r;
+  if(ii->ii_jit_checked)
+    return;
+  ii->ii_jit_checked = 1;
+
+  switch(ii->ii_class) {
+  case IR_IC_BINOP:
+    r = jit_binop_check(iu, (ir_instr_binary_t *)ii);
+    break;
+  case IR_IC_MOVE:
+    r = jit_move_check(iu, (ir_instr_move_t *)ii);
+    break;
+  case IR_IC_LOAD:
+    r = jit_load_check(iu, (ir_instr_load_t *)ii);
+    break;
+  case IR_IC_STORE:
+    r = jit_store_check(iu, (ir_instr_store_t *)ii);
+    break;
+  case IR_IC_MLA:
+    r = jit_mla_check(iu, (ir_instr_ternary_t *)ii);
+    break;
+  case IR_IC_BR:
+    r = jit_br_check(iu, (ir_instr_br_t *)ii);
+    break;
+  case IR_IC_CMP_BRANCH:
+    r = jit_cmp_branch_check(iu, (ir_instr_cmp_branch_t *)ii);
+    break;
+  case IR_IC_LEA:
+    r = jit_lea_check(iu, (ir_instr_lea_t *)ii);
+    break;
+  default:
+    return;
+  }
+
+  ii->ii_jit = r;
+}
+
+
+/**
+ *
+ */
+static ir_instr_t *
+jit_emit(ir_unit_t *iu, ir_instr_t *ii, int *codeptr, int retvalue)
+{
+  *codeptr = iu->iu_jit_ptr;
+
+  jit_push_prologue(iu);
+
+  if(ii == TAILQ_FIRST(&ii->ii_bb->ib_instrs))
+    ii->ii_bb->ib_jit_offset = iu->iu_jit_ptr;
+
+  while(ii != NULL && ii->ii_jit) {
+    switch(ii->ii_class) {
+    case IR_IC_BINOP:
+      jit_binop(iu, (ir_instr_binary_t *)ii);
+      break;
+    case IR_IC_MOVE:
+      jit_move(iu, (ir_instr_move_t *)ii);
+      break;
+    case IR_IC_LOAD:
+      jit_load(iu, (ir_instr_load_t *)ii);
+      break;
+    case IR_IC_STORE:
+      jit_store(iu, (ir_instr_store_t *)ii);
+      break;
+    case IR_IC_LEA:
+      jit_lea(iu, (ir_instr_lea_t *)ii);
+      break;
+    case IR_IC_MLA:
+      jit_mla(iu, (ir_instr_ternary_t *)ii);
+      break;
+    case IR_IC_BR:
+      jit_br(iu, (ir_instr_br_t *)ii);
+      return NULL;
+    case IR_IC_CMP_BRANCH:
+      jit_cmp_br(iu, (ir_instr_cmp_branch_t *)ii);
+      return NULL;
+    default:
+      abort();
+    }
+    ii = TAILQ_NEXT(ii, ii_link);
+  }
+
+  // Return to the VM instruction following the JIT_CALL
+  int ptr = jit_exit_to_vm(iu, retvalue);
+  VECTOR_PUSH_BACK(&iu->iu_jit_vmcode_fixups, ptr);
+  return ii;
+}
+
+
+/**
+ *
+ */
+static void
+jit_branch_fixup(ir_unit_t *iu, ir_function_t *f)
+{
+  const intptr_t vmtext = (intptr_t)f->if_vm_text;
+
+  int x = VECTOR_LEN(&iu->iu_jit_vmcode_fixups);
+  for(int i = 0; i < x; i++) {
+    int off = VECTOR_ITEM(&iu->iu_jit_vmcode_fixups, i);
+    int64_t *literal = iu->iu_jit_wmem + off;
+    *literal += vmtext;
+  }
+
+  x = VECTOR_LEN(&iu->iu_jit_vmbb_fixups);
+  for(int i = 0; i < x; i++) {
+    int off = VECTOR_ITEM(&iu->iu_jit_vmbb_fixups, i);
+    int64_t *literal = iu->iu_jit_wmem + off;
+    ir_bb_t *bb = bb_find(f, *literal);
+    assert(bb != NULL);
+    *literal = vmtext + bb->ib_text_offset;
+  }
+
+  x = VECTOR_LEN(&iu->iu_jit_branch_fixups);
+  for(int i = 0; i < x; i++) {
+    int off = VECTOR_ITEM(&iu->iu_jit_branch_fixups, i);
+    int32_t *rel32 = iu->iu_jit_wmem + off;
+    ir_bb_t *bb = bb_find(f, *rel32);
+    assert(bb != NULL);
+    *rel32 = bb->ib_jit_offset - (off + 4);
+  }
+}
+
+#define VMIR_VM_JIT
+#define JIT_MACHINE_REGS 8
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * VM text layout
+ *
+ * The VM text of all functions is allocated from the unit's code arena
+ * (iu_code). Functions compiled when loading are emitted in bitcode
+ * order, so at the end of vmir_load() their text is copied to a new
+ * arena in call graph order: Depth first from main(), each function
+ * followed by its callees, the ones called from most sites first.
+ * Functions main() doesn't reach by direct calls are cold or only
+ * called through pointers and are placed after the rest.
+ *
+ * Functions compiled after load (lazily or when tiering up) are
+ * appended to the arena as they are compiled, ie. in the order they
+ * are first called or get hot.
+ */
+
+
+/**
+ * Called for each direct call emitted
+ */
+static void
+layout_call(ir_unit_t *iu, const ir_function_t *f,
+            const ir_function_t *callee)
+{
+  // Only collected when loading
+  if(iu->iu_vm_funcs != NULL || callee == f)
+    return;
+  call_edge_t ce = {f->if_gfid, callee->if_gfid, 1};
+  VECTOR_PUSH_BACK(&iu->iu_call_edges, ce);
+}
+
+
+/**
+ * Sort on caller and callee
+ */
+static int
+call_edge_cmp(const call_edge_t *a, const call_edge_t *b)
+{
+  if(a->ce_caller != b->ce_caller)
+    return a->ce_caller - b->ce_caller;
+  return a->ce_callee - b->ce_callee;
+}
+
+
+/**
+ * Sort on caller and descending weight
+ */
+static int
+call_edge_weight_cmp(const call_edge_t *a, const call_edge_t *b)
+{
+  if(a->ce_caller != b->ce_caller)
+    return a->ce_caller - b->ce_caller;
+  if(a->ce_weight != b->ce_weight)
+    return b->ce_weight - a->ce_weight;
+  return a->ce_callee - b->ce_callee;
+}
+
+
+/**
+ * Place the functions reached from 'root' in 'order'. 'first' is
+ * indexed by caller and points to its edges in iu_call_edges.
+ * Returns the new length of 'order'
+ */
+static int
+layout_visit(ir_unit_t *iu, int root, const int *first, char *placed,
+             int *stack, int *order, int num_placed)
+{
+  int sp = 0;
+  stack[sp++] = root;
+
+  while(sp > 0) {
+    const int gfid = stack[--sp];
+    if(placed[gfid])
+      continue;
+    placed[gfid] = 1;
+    const ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, gfid);
+    if(f->if_vm_text != NULL)
+      order[num_placed++] = gfid;
+
+    // Pushed in reverse so the heaviest callee is placed next
+    for(int i = first[gfid + 1] - 1; i >= first[gfid]; i--) {
+      const int callee = VECTOR_ITEM(&iu->iu_call_edges, i).ce_callee;
+      if(!placed[callee])
+        stack[sp++] = callee;
+    }
+  }
+  return num_placed;
+}
+
+
+/**
+ * Copy the VM text of all functions to a new code arena in call graph
+ * order. Called when all functions are emitted, before anything refers
+ * to the text except the JIT code which is not sealed yet
+ */
+static void
+layout_text(ir_unit_t *iu)
+{
+  const int num_functions = VECTOR_LEN(&iu->iu_functions);
+  int num_edges = VECTOR_LEN(&iu->iu_call_edges);
+
+  // Merge the call sites of each caller/callee pair
+  VECTOR_SORT(&iu->iu_call_edges, call_edge_cmp);
+  int n = 0;
+  for(int i = 0; i < num_edges; i++) {
+    const call_edge_t *ce = &VECTOR_ITEM(&iu->iu_call_edges, i);
+    if(n > 0 && !call_edge_cmp(&VECTOR_ITEM(&iu->iu_call_edges, n - 1), ce))
+      VECTOR_ITEM(&iu->iu_call_edges, n - 1).ce_weight++;
+    else
+      VECTOR_ITEM(&iu->iu_call_edges, n++) = *ce;
+  }
+  VECTOR_RESIZE(&iu->iu_call_edges, n);
+  num_edges = n;
+  VECTOR_SORT(&iu->iu_call_edges, call_edge_weight_cmp);
+
+  int *first = calloc(num_functions + 1, sizeof(int));
+  for(int i = 0; i < num_edges; i++)
+    first[VECTOR_ITEM(&iu->iu_call_edges, i).ce_caller + 1]++;
+  for(int i = 0; i < num_functions; i++)
+    first[i + 1] += first[i];
+
+  char *placed = calloc(num_functions + 1, 1);
+  int *stack = malloc((num_edges + 1) * sizeof(int));
+  int *order = malloc((num_functions + 1) * sizeof(int));
+  int num_placed = 0;
+
+  ir_function_t *f = function_find(iu, "main");
+  if(f != NULL)
+    num_placed = layout_visit(iu, f->if_gfid, first, placed, stack, order,
+                              num_placed);
+  for(int i = 0; i < num_functions; i++)
+    num_placed = layout_visit(iu, i, first, placed, stack, order,
+                              num_placed);
+
+  size_t size = 0;
+  for(int i = 0; i < num_placed; i++) {
+    f = VECTOR_ITEM(&iu->iu_functions, order[i]);
+    size += VMIR_ALIGN(f->if_vm_text_size, CODE_ALIGN);
+  }
+
+  ir_code_arena_t code = {0};
+  if(num_placed > 0 && !code_arena_reserve(&code, size)) {
+    void **old_text = calloc(num_functions + 1, sizeof(void *));
+    for(int i = 0; i < num_placed; i++) {
+      f = VECTOR_ITEM(&iu->iu_functions, order[i]);
+      old_text[order[i]] = f->if_vm_text;
+      f->if_vm_text = code_alloc(&code, f->if_vm_text_size);
+      memcpy(f->if_vm_text, old_text[order[i]], f->if_vm_text_size);
+    }
+
+#ifdef VMIR_VM_JIT
+    for(int i = 0; i < VECTOR_LEN(&iu->iu_jit_relocs); i++) {
+      const jit_reloc_t *jr = &VECTOR_ITEM(&iu->iu_jit_relocs, i);
+      f = VECTOR_ITEM(&iu->iu_functions, jr->jr_gfid);
+      intptr_t literal;
+      memcpy(&literal, iu->iu_jit_wmem + jr->jr_offset, sizeof(literal));
+      literal += (intptr_t)f->if_vm_text - (intptr_t)old_text[jr->jr_gfid];
+      memcpy(iu->iu_jit_wmem + jr->jr_offset, &literal, sizeof(literal));
+    }
+#endif
+    free(old_text);
+    code_arena_destroy(&iu->iu_code);
+    iu->iu_code = code;
+  }
+
+  free(first);
+  free(placed);
+  free(stack);
+  free(order);
+}
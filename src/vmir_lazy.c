@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Lazy compilation
+ *
+ * When loading, the bitcode of each function body is saved (in
+ * if_body) and skipped. Functions without VM text get a stub in
+ * iu_vm_funcs that consists of a single VM_MATERIALIZE instruction.
+ * The stub is entered like the function itself so it compiles the
+ * function, installs its text in iu_vm_funcs and continues executing
+ * it in the same frame. Functions compiled after load may inline any
+ * function. Callees that are not compiled yet are parsed just to find
+ * out how large they are (see lazy_inline_size()).
+ *
+ * With VMIR_LAZY_REACHABLE the functions referenced while parsing
+ * main() and the functions it reaches are compiled when loading.
+ * Functions whose address is stored in global variables or taken by
+ * constant expressions are reachable as well. Anything missed is still
+ * compiled by its stub.
+ *
+ * Functions are compiled in the thread that calls them while the
+ * tiering thread may compile hot functions so iu_lazy_mutex
+ * serializes all use of the parser after load.
+ */
+
+#define LAZY_STUB_SIZE 3 // In 16 bit words
+
+
+/**
+ * Called for each value referenced by a function being parsed
+ */
+static unsigned int
+lazy_reference(ir_unit_t *iu, unsigned int val)
+{
+  if(iu->iu_lazy != VMIR_LAZY_REACHABLE || val >= iu->iu_first_func_value)
+    return val;
+
+  const ir_value_t *iv = value_get(iu, val);
+  if(iv->iv_class == IR_VC_FUNCTION)
+    lazy_reach(iu, iv->iv_func);
+  return val;
+}
+
+
+/**
+ * Mark 'f' as reachable
+ */
+static void
+lazy_reach(ir_unit_t *iu, ir_function_t *f)
+{
+  if(iu->iu_lazy != VMIR_LAZY_REACHABLE || f->if_lazy_queued)
+    return;
+  f->if_lazy_queued = 1;
+  VECTOR_PUSH_BACK(&iu->iu_lazy_queue, f->if_gfid);
+}
+
+
+/**
+ * Returns the inline size of 'f' which has not been compiled yet. The
+ * body is parsed into a scratch function after the values of the
+ * function being compiled and thrown away after inline_analyze()
+ */
+static int
+lazy_inline_size(ir_unit_t *iu, ir_function_t *f)
+{
+  const ir_type_t *it = type_get(iu, f->if_type);
+  const int num_values = iu->iu_next_value;
+  ir_function_t scratch = {0};
+  TAILQ_INIT(&scratch.if_bbs);
+  scratch.if_type = f->if_type;
+  scratch.if_name = f->if_name;
+  scratch.if_arena = arena_create(iu->iu_arena_pool);
+
+  int args[it->it_function.num_parameters];
+  for(int i = 0; i < it->it_function.num_parameters; i++)
+    args[i] = value_alloc_temporary(iu, it->it_function.parameters[i]);
+
+  function_parse_inline(iu, f, &scratch, args);
+
+  int size;
+  f->if_inline_size = inline_analyze(iu, &scratch, &size) ? size : 0;
+
+  value_resize(iu, num_values);
+  function_remove_bb(&scratch);
+  return f->if_inline_size;
+}
+
+
+/**
+ * Returns true if 'f' is declared but there is nothing to call. Bodies
+ * are not parsed when loading so it's not known which functions are
+ * called, but bitcode only declares functions that are referenced.
+ * Intrinsics are lowered to instructions
+ */
+static int
+lazy_undefined(const ir_function_t *f)
+{
+  return f->if_isproto && !f->if_vmop && f->if_ext_func == NULL &&
+    strncmp(f->if_name, "llvm.", 5);
+}
+
+
+/**
+ * Parse, transform and emit 'f' and point calls to it. Returns -1 if
+ * compiling fails
+ */
+static int
+lazy_compile(ir_unit_t *iu, ir_function_t *f)
+{
+  if(f->if_body == NULL)
+    return -1;
+
+  // Functions are compiled as when loading, ie. they are interpreted
+  // until they get hot if tiering
+  const int tier_up = iu->iu_tier_up;
+  iu->iu_tier_up = 0;
+
+  const int r = function_reparse(iu, f);
+
+#ifdef VMIR_VM_JIT
+  jit_seal_code(iu);
+#endif
+#ifdef VMIR_COPY_PATCH
+  cp_seal_code(iu);
+#endif
+  iu->iu_tier_up = tier_up;
+
+  if(r) {
+    iu->iu_stats.failed_compiles++;
+    return -1;
+  }
+
+  if(!iu->iu_tier_threshold && !f->if_inline_size) {
+    free(f->if_body);
+    f->if_body = NULL;
+  }
+  iu->iu_stats.lazy_functions++;
+
+  iu->iu_vm_frame_sizes[f->if_gfid] = f->if_regframe_size;
+  __atomic_store_n(&iu->iu_vm_funcs[f->if_gfid], f->if_vm_text,
+                   __ATOMIC_RELEASE);
+  // Flush the inline caches of indirect calls
+  __atomic_add_fetch(&iu->iu_vm_funcs_gen, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+/**
+ * Called from the VM_MATERIALIZE stub. Returns the VM text of the
+ * function which is compiled first unless another call got there. The
+ * VM stops if the function can't be compiled
+ */
+static const uint16_t *
+lazy_materialize(ir_unit_t *iu, uint32_t gfid)
+{
+  const uint16_t *stub = iu->iu_lazy_stubs + gfid * LAZY_STUB_SIZE;
+  const uint16_t *text;
+
+  pthread_mutex_lock(&iu->iu_lazy_mutex);
+  if(iu->iu_vm_funcs[gfid] == stub &&
+     lazy_compile(iu, VECTOR_ITEM(&iu->iu_functions, gfid))) {
+    pthread_mutex_unlock(&iu->iu_lazy_mutex);
+    vm_stop(iu, VM_STOP_BAD_FUNCTION, gfid);
+  }
+  text = iu->iu_vm_funcs[gfid];
+  pthread_mutex_unlock(&iu->iu_lazy_mutex);
+  return text;
+}
+
+
+/**
+ * Install stubs for all functions that are neither compiled nor
+ * external and compile the reachable ones if asked to. Called at the
+ * end of vmir_load()
+ */
+static void
+lazy_start(ir_unit_t *iu)
+{
+  const int num_functions = VECTOR_LEN(&iu->iu_functions);
+  const uint16_t op = vm_resolve(VM_MATERIALIZE);
+
+  pthread_mutex_init(&iu->iu_lazy_mutex, NULL);
+  iu->iu_lazy_stubs = malloc(num_functions * LAZY_STUB_SIZE *
+                             sizeof(uint16_t));
+
+  for(int i = 0; i < num_functions; i++) {
+    const ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, i);
+    uint16_t *stub = iu->iu_lazy_stubs + i * LAZY_STUB_SIZE;
+    const uint32_t gfid = i;
+    stub[0] = op;
+    memcpy(stub + 1, &gfid, sizeof(uint32_t));
+
+    if(f->if_vm_text == NULL && f->if_ext_func == NULL)
+      iu->iu_vm_funcs[i] = stub;
+  }
+
+  if(iu->iu_lazy != VMIR_LAZY_REACHABLE)
+    return;
+
+  ir_function_t *f = function_find(iu, "main");
+  if(f != NULL)
+    lazy_reach(iu, f);
+
+  // Compiling a function queues the functions it references. If that
+  // fails the stub tries again if the function is called
+  for(int i = 0; i < VECTOR_LEN(&iu->iu_lazy_queue); i++) {
+    f = VECTOR_ITEM(&iu->iu_functions, VECTOR_ITEM(&iu->iu_lazy_queue, i));
+    if(f->if_vm_text == NULL && f->if_body != NULL)
+      lazy_compile(iu, f);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+lazy_stop(ir_unit_t *iu)
+{
+  VECTOR_CLEAR(&iu->iu_lazy_queue);
+  if(iu->iu_lazy_stubs == NULL)
+    return;
+  free(iu->iu_lazy_stubs);
+  pthread_mutex_destroy(&iu->iu_lazy_mutex);
+}
@@ -1029,11 +1029,24 @@ vfile_alloc(ir_unit_t *iu, FILE *ext)
 
 
 /**
- *
+ * A stdin, stdout or stderr global variable
  */
-static void
-initialize_libc(ir_unit_t *iu)
+typedef struct libc_stdio {
+  uint32_t addr;
+  int fd;
+} libc_stdio_t;
+
+
+/**
+ * Find the stdio globals in the order they are defined. Returns the
+ * number found
+ */
+static int
+libc_stdio_globals(ir_unit_t *iu, libc_stdio_t *stdio)
 {
+  static const char *names[3] = {"stdin", "stdout", "stderr"};
+  int num = 0;
+
   for(int i = 0; i < iu->iu_next_value; i++) {
     ir_value_t *iv = value_get(iu, i);
     if(iv->iv_class != IR_VC_GLOBALVAR)
@@ -1043,13 +1056,37 @@ initialize_libc(ir_unit_t *iu)
     if(ig->ig_name == NULL)
       continue;
 
-    const char *name = ig->ig_name;
-    if(!strcmp(name, "stdin")) {
-      *(uint32_t *)(iu->iu_mem + ig->ig_addr) = vfile_alloc(iu, stdin);
-    } else if(!strcmp(name, "stdout")) {
-      *(uint32_t *)(iu->iu_mem + ig->ig_addr) = vfile_alloc(iu, stdout);
-    } else if(!strcmp(name, "stderr")) {
-      *(uint32_t *)(iu->iu_mem + ig->ig_addr) = vfile_alloc(iu, stderr);
+    for(int fd = 0; fd < 3 && num < 3; fd++) {
+      if(!strcmp(ig->ig_name, names[fd])) {
+        stdio[num].addr = ig->ig_addr;
+        stdio[num].fd = fd;
+        num++;
+      }
     }
   }
+  return num;
+}
+
+
+/**
+ *
+ */
+static void
+libc_stdio_bind(ir_unit_t *iu, const libc_stdio_t *stdio, int num)
+{
+  for(int i = 0; i < num; i++) {
+    FILE *fp = stdio[i].fd == 0 ? stdin : stdio[i].fd == 1 ? stdout : stderr;
+    *(uint32_t *)(iu->iu_mem + stdio[i].addr) = vfile_alloc(iu, fp);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+initialize_libc(ir_unit_t *iu)
+{
+  libc_stdio_t stdio[3];
+  libc_stdio_bind(iu, stdio, libc_stdio_globals(iu, stdio));
 }
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * SHA-256 (FIPS 180-4)
+ */
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct sha256 {
+  uint32_t s_state[8];
+  uint64_t s_length;   // Bytes hashed so far
+  uint8_t s_buf[64];
+} sha256_t;
+
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+/**
+ *
+ */
+static uint32_t
+sha256_ror(uint32_t x, int n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+
+/**
+ *
+ */
+static void
+sha256_block(sha256_t *s, const uint8_t *p)
+{
+  uint32_t w[64];
+  uint32_t v[8];
+
+  for(int i = 0; i < 16; i++)
+    w[i] = p[i * 4] << 24 | p[i * 4 + 1] << 16 | p[i * 4 + 2] << 8 |
+      p[i * 4 + 3];
+  for(int i = 16; i < 64; i++) {
+    const uint32_t s0 = sha256_ror(w[i - 15], 7) ^
+      sha256_ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = sha256_ror(w[i - 2], 17) ^
+      sha256_ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  memcpy(v, s->s_state, sizeof(v));
+  for(int i = 0; i < 64; i++) {
+    const uint32_t s1 = sha256_ror(v[4], 6) ^ sha256_ror(v[4], 11) ^
+      sha256_ror(v[4], 25);
+    const uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+    const uint32_t t1 = v[7] + s1 + ch + sha256_k[i] + w[i];
+    const uint32_t s0 = sha256_ror(v[0], 2) ^ sha256_ror(v[0], 13) ^
+      sha256_ror(v[0], 22);
+    const uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+    memmove(v + 1, v, 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0] = t1 + s0 + maj;
+  }
+  for(int i = 0; i < 8; i++)
+    s->s_state[i] += v[i];
+}
+
+
+/**
+ *
+ */
+static void
+sha256_init(sha256_t *s)
+{
+  static const uint32_t iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(s->s_state, iv, sizeof(iv));
+  s->s_length = 0;
+}
+
+
+/**
+ *
+ */
+static void
+sha256_update(sha256_t *s, const void *data, size_t len)
+{
+  const uint8_t *d = data;
+  int used = s->s_length & 63;
+
+  s->s_length += len;
+  if(used) {
+    const int n = len < 64 - used ? len : 64 - used;
+    memcpy(s->s_buf + used, d, n);
+    d += n;
+    len -= n;
+    if(used + n < 64)
+      return;
+    sha256_block(s, s->s_buf);
+  }
+  for(; len >= 64; d += 64, len -= 64)
+    sha256_block(s, d);
+  memcpy(s->s_buf, d, len);
+}
+
+
+/**
+ *
+ */
+static void
+sha256_final(sha256_t *s, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+  static const uint8_t pad[64] = {0x80};
+  const uint64_t bits = s->s_length * 8;
+  uint8_t length[8];
+
+  for(int i = 0; i < 8; i++)
+    length[i] = bits >> (56 - i * 8);
+  sha256_update(s, pad, 1 + ((55 - s->s_length) & 63));
+  sha256_update(s, length, sizeof(length));
+
+  for(int i = 0; i < 8; i++) {
+    digest[i * 4]     = s->s_state[i] >> 24;
+    digest[i * 4 + 1] = s->s_state[i] >> 16;
+    digest[i * 4 + 2] = s->s_state[i] >> 8;
+    digest[i * 4 + 3] = s->s_state[i];
+  }
+}
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Build time tool that converts the stencil object file (compiled from
+ * vmir_stencils.c) into vmir_stencils.h, the code and hole tables used
+ * by vmir_copy_patch.c
+ *
+ * Only x86-64 ELF relocatable objects are understood. Stencils that
+ * can't be expressed (unknown relocations, continuations that are not
+ * tail calls, calls to compiler runtime helpers, etc) are dropped with
+ * a warning and such instructions will stay in the interpreter.
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define MAX_HOLES   64
+#define MAX_SYMBOLS 256
+#define MAX_DATA    8
+
+static const uint8_t *obj;
+static const Elf64_Shdr *shdr;
+static int num_sections;
+static const Elf64_Sym *symtab;
+static int num_symbols;
+static const char *strtab;
+
+static const char *symbols[MAX_SYMBOLS];
+static int num_ext_symbols;
+
+typedef struct hole {
+  uint32_t offset;
+  const char *kind;
+  int operand;
+  const char *reloc;
+  int64_t addend;
+} hole_t;
+
+
+/**
+ *
+ */
+static const void *
+section_data(int idx)
+{
+  return obj + shdr[idx].sh_offset;
+}
+
+
+/**
+ *
+ */
+static const char *
+section_name(int idx)
+{
+  const char *shstrtab = section_data(((const Elf64_Ehdr *)obj)->e_shstrndx);
+  return shstrtab + shdr[idx].sh_name;
+}
+
+
+/**
+ *
+ */
+static int
+symbol_index(const char *name)
+{
+  for(int i = 0; i < num_ext_symbols; i++)
+    if(!strcmp(symbols[i], name))
+      return i;
+  if(num_ext_symbols == MAX_SYMBOLS) {
+    fprintf(stderr, "Too many external symbols\n");
+    exit(1);
+  }
+  symbols[num_ext_symbols] = name;
+  return num_ext_symbols++;
+}
+
+
+/**
+ *
+ */
+static const char *
+reloc_name(int type)
+{
+  switch(type) {
+  case R_X86_64_64:    return "VM_RELOC_ABS64";
+  case R_X86_64_32:    return "VM_RELOC_ABS32";
+  case R_X86_64_32S:   return "VM_RELOC_ABS32S";
+  case R_X86_64_PC32:
+  case R_X86_64_PLT32: return "VM_RELOC_REL32";
+  default:
+    return NULL;
+  }
+}
+
+
+/**
+ * A jump to another stencil must be a jmp or jcc with a rel32 operand
+ */
+static int
+is_jump(const uint8_t *code, uint32_t offset)
+{
+  if(offset >= 1 && code[offset - 1] == 0xe9)
+    return 1;
+  if(offset >= 2 && code[offset - 2] == 0x0f &&
+     (code[offset - 1] & 0xf0) == 0x80)
+    return 1;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static int
+find_oplen(const char *opname)
+{
+  char name[128];
+  snprintf(name, sizeof(name), "vm_stencil_oplen_%s", opname);
+  for(int i = 0; i < num_symbols; i++) {
+    const Elf64_Sym *s = &symtab[i];
+    if(strcmp(strtab + s->st_name, name))
+      continue;
+    const uint8_t *p = section_data(s->st_shndx);
+    return p[s->st_value];
+  }
+  return -1;
+}
+
+
+/**
+ * Emit code and holes for one stencil. Returns 0 if the stencil
+ * can't be used
+ */
+static int
+emit_stencil(const Elf64_Sym *fs, const char *opname)
+{
+  const int sec = fs->st_shndx;
+  const uint8_t *code = (const uint8_t *)section_data(sec) + fs->st_value;
+  const uint32_t codesize = fs->st_size;
+  hole_t holes[MAX_HOLES];
+  int num_holes = 0;
+  int data_sections[MAX_DATA];
+  uint32_t data_offsets[MAX_DATA];
+  int num_data = 0;
+  uint32_t size = codesize;
+  int oplen = find_oplen(opname);
+  int first_symbol = num_ext_symbols;
+
+  for(int r = 0; r < num_sections; r++) {
+    if(shdr[r].sh_type != SHT_RELA || shdr[r].sh_info != sec)
+      continue;
+
+    const Elf64_Rela *rela = section_data(r);
+    const int num_rela = shdr[r].sh_size / sizeof(Elf64_Rela);
+
+    for(int i = 0; i < num_rela; i++) {
+      const Elf64_Rela *re = &rela[i];
+      if(re->r_offset < fs->st_value ||
+         re->r_offset >= fs->st_value + codesize)
+        continue;
+
+      const uint32_t offset = re->r_offset - fs->st_value;
+      const Elf64_Sym *s = &symtab[ELF64_R_SYM(re->r_info)];
+      const char *name = strtab + s->st_name;
+      hole_t *h = &holes[num_holes];
+
+      if(num_holes == MAX_HOLES) {
+        fprintf(stderr, "%s: Too many holes\n", opname);
+        goto bad;
+      }
+
+      h->offset = offset;
+      h->operand = 0;
+      h->addend = re->r_addend;
+      h->reloc = reloc_name(ELF64_R_TYPE(re->r_info));
+      if(h->reloc == NULL) {
+        fprintf(stderr, "%s: Unsupported relocation %d\n",
+                opname, (int)ELF64_R_TYPE(re->r_info));
+        goto bad;
+      }
+
+      if(s->st_shndx == SHN_UNDEF) {
+
+        if(!strncmp(name, "_JIT_", 5)) {
+          const char *k = name + 5;
+          if(sscanf(k, "REG%d", &h->operand) == 1) {
+            h->kind = "VM_HOLE_REG";
+          } else if(sscanf(k, "U16_%d", &h->operand) == 1) {
+            h->kind = "VM_HOLE_U16";
+          } else if(sscanf(k, "U32_%d", &h->operand) == 1) {
+            h->kind = "VM_HOLE_U32";
+          } else if(sscanf(k, "U64HI_%d", &h->operand) == 1) {
+            h->kind = "VM_HOLE_U32";
+            h->operand += 2;
+          } else if(sscanf(k, "CONTINUE_%d", &h->operand) == 1) {
+            h->kind = "VM_HOLE_CONTINUE";
+            if(oplen != -1 && oplen != h->operand) {
+              fprintf(stderr, "%s: Inconsistent length\n", opname);
+              goto bad;
+            }
+            oplen = h->operand;
+          } else if(sscanf(k, "TARGET_%d", &h->operand) == 1) {
+            h->kind = "VM_HOLE_TARGET";
+          } else {
+            fprintf(stderr, "%s: Unknown hole %s\n", opname, name);
+            goto bad;
+          }
+
+          if((!strcmp(h->kind, "VM_HOLE_CONTINUE") ||
+              !strcmp(h->kind, "VM_HOLE_TARGET")) &&
+             (strcmp(h->reloc, "VM_RELOC_REL32") || !is_jump(code, offset))) {
+            fprintf(stderr, "%s: %s is not reached via a tail call\n",
+                    opname, name);
+            goto bad;
+          }
+
+        } else {
+          if(!strncmp(name, "__", 2)) {
+            fprintf(stderr, "%s: Depends on compiler runtime (%s)\n",
+                    opname, name);
+            goto bad;
+          }
+          h->kind = "VM_HOLE_SYMBOL";
+          h->operand = symbol_index(name);
+        }
+
+      } else {
+
+        // Reference to constant data (such as a float constant pool),
+        // copied right after the code
+        const int ds = s->st_shndx;
+        if(ds >= num_sections ||
+           (shdr[ds].sh_flags & (SHF_WRITE | SHF_EXECINSTR)) ||
+           shdr[ds].sh_type != SHT_PROGBITS) {
+          fprintf(stderr, "%s: Unsupported reference to %s\n",
+                  opname, section_name(ds));
+          goto bad;
+        }
+
+        int j;
+        for(j = 0; j < num_data; j++)
+          if(data_sections[j] == ds)
+            break;
+        if(j == num_data) {
+          if(num_data == MAX_DATA) {
+            fprintf(stderr, "%s: Too many data sections\n", opname);
+            goto bad;
+          }
+          int align = shdr[ds].sh_addralign ?: 1;
+          size = (size + align - 1) & ~(align - 1);
+          data_sections[num_data] = ds;
+          data_offsets[num_data] = size;
+          size += shdr[ds].sh_size;
+          num_data++;
+        }
+        h->kind = "VM_HOLE_DATA";
+        h->addend += data_offsets[j] + s->st_value;
+      }
+      num_holes++;
+    }
+  }
+
+  if(oplen == -1) {
+    fprintf(stderr, "%s: Unknown instruction length\n", opname);
+    goto bad;
+  }
+
+  // If the stencil ends with a jump to the next instruction, that jump
+  // can be omitted when the next stencil is placed right after it
+  int tail = 0;
+  if(num_data == 0 && codesize >= 5 && code[codesize - 5] == 0xe9) {
+    for(int i = 0; i < num_holes; i++) {
+      if(holes[i].offset == codesize - 4 &&
+         !strcmp(holes[i].kind, "VM_HOLE_CONTINUE"))
+        tail = 5;
+    }
+  }
+
+  printf("static const uint8_t vm_stencil_code_%s[] = {", opname);
+  uint8_t *blob = calloc(1, size);
+  memcpy(blob, code, codesize);
+  for(int i = 0; i < num_data; i++)
+    memcpy(blob + data_offsets[i], section_data(data_sections[i]),
+           shdr[data_sections[i]].sh_size);
+  for(uint32_t i = 0; i < size; i++)
+    printf("%s0x%02x,", i % 12 ? " " : "\n  ", blob[i]);
+  printf("\n};\n");
+  free(blob);
+
+  if(num_holes) {
+    printf("static const vm_stencil_hole_t vm_stencil_holes_%s[] = {\n",
+           opname);
+    for(int i = 0; i < num_holes; i++) {
+      const hole_t *h = &holes[i];
+      printf("  { %u, %s, %d, %s, %"PRId64" },\n",
+             h->offset, h->kind, h->operand, h->reloc, h->addend);
+    }
+    printf("};\n");
+  }
+  printf("\n");
+  return (num_holes << 24) | (oplen << 16) | tail << 8 | 1;
+
+ bad:
+  num_ext_symbols = first_symbol;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static uint8_t *
+load_file(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if(fp == NULL) {
+    perror(path);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  if(fread(buf, size, 1, fp) != 1) {
+    perror(path);
+    exit(1);
+  }
+  fclose(fp);
+  return buf;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  if(argc != 2) {
+    fprintf(stderr, "Usage: %s <vmir_stencils.o>\n", argv[0]);
+    exit(1);
+  }
+
+  obj = load_file(argv[1]);
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)obj;
+
+  if(memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+     eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+     eh->e_machine != EM_X86_64 || eh->e_type != ET_REL) {
+    fprintf(stderr, "%s: Not an x86-64 ELF object\n", argv[1]);
+    exit(1);
+  }
+
+  shdr = (const Elf64_Shdr *)(obj + eh->e_shoff);
+  num_sections = eh->e_shnum;
+
+  for(int i = 0; i < num_sections; i++) {
+    if(shdr[i].sh_type == SHT_SYMTAB) {
+      symtab = section_data(i);
+      num_symbols = shdr[i].sh_size / sizeof(Elf64_Sym);
+      strtab = section_data(shdr[i].sh_link);
+    }
+  }
+  if(symtab == NULL) {
+    fprintf(stderr, "%s: No symbol table\n", argv[1]);
+    exit(1);
+  }
+
+  printf("/* Generated by vmir_stencilgen from %s, do not edit */\n\n",
+         argv[1]);
+
+  const char **ops = calloc(num_symbols, sizeof(char *));
+  int *info = calloc(num_symbols, sizeof(int));
+  int num_ops = 0;
+
+  for(int i = 0; i < num_symbols; i++) {
+    const Elf64_Sym *s = &symtab[i];
+    const char *name = strtab + s->st_name;
+    if(ELF64_ST_TYPE(s->st_info) != STT_FUNC ||
+       ELF64_ST_BIND(s->st_info) != STB_GLOBAL ||
+       strncmp(name, "vm_stencil_", 11))
+      continue;
+
+    const char *opname = name + 11;
+    int r = emit_stencil(s, opname);
+    if(r) {
+      ops[num_ops] = opname;
+      info[num_ops] = r;
+      num_ops++;
+    }
+  }
+
+  printf("static const void *vm_stencil_symbols[] = {\n");
+  for(int i = 0; i < num_ext_symbols; i++)
+    printf("  (const void *)&%s,\n", symbols[i]);
+  printf("  NULL\n};\n\n");
+
+  printf("static const vm_stencil_t vm_stencils[] = {\n");
+  for(int i = 0; i < num_ops; i++) {
+    const int num_holes = info[i] >> 24;
+    printf("  [VM_%s] = { vm_stencil_code_%s, %s%s, "
+           "sizeof(vm_stencil_code_%s), %d, %d, %d },\n",
+           ops[i], ops[i],
+           num_holes ? "vm_stencil_holes_" : "NULL",
+           num_holes ? ops[i] : "",
+           ops[i], num_holes, (info[i] >> 16) & 0xff, (info[i] >> 8) & 0xff);
+  }
+  printf("};\n");
+  return 0;
+}
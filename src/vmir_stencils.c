@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Machine code templates ("stencils") for the copy-and-patch compiler
+ *
+ * This file is not part of the vmir translation unit. It is compiled
+ * separately and vmir_stencilgen turns the object file into
+ * vmir_stencils.h which is included by vmir_copy_patch.c.
+ *
+ * Every VMOP() becomes a function vm_stencil_<op>(rf, mem, vf).
+ * Everything vm_exec() reads from the instruction stream is instead
+ * taken from the address of an undefined symbol (a "hole") which is
+ * patched with the actual operand when the stencil is copied:
+ *
+ *   _JIT_REG<n>         Register frame offset in operand n
+ *   _JIT_U16_<n>        16 bit operand n
+ *   _JIT_U32_<n>        32 bit operand in n and n + 1
+ *   _JIT_U64HI_<n>      Upper half of a 64 bit operand starting at n
+ *   _JIT_CONTINUE_<n>   Next instruction (after n operands)
+ *   _JIT_TARGET_<n>     Branch target encoded in operand n
+ *
+ * Control is transferred by tail calling the continuation and branch
+ * target holes. All other undefined symbols are functions in vmir or
+ * libc which are resolved when vmir_stencils.h is compiled.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "vmir_vm.h"
+
+#ifndef __has_builtin
+#define __has_builtin(x) 0
+#endif
+
+#define VMIR_ALIGN(a, b) (((a) + (b) - 1) & ~((b) - 1))
+
+#define HOLE __attribute__((weak))
+
+#define DECLARE_OPERAND(n)                                             \
+  extern char _JIT_REG ## n[] HOLE;                                    \
+  extern char _JIT_U16_ ## n[] HOLE;                                   \
+  extern char _JIT_U32_ ## n[] HOLE;                                   \
+  extern char _JIT_U64HI_ ## n[] HOLE;                                 \
+  extern vm_native_t _JIT_CONTINUE_ ## n;                              \
+  extern vm_native_t _JIT_TARGET_ ## n;
+
+DECLARE_OPERAND(0)
+DECLARE_OPERAND(1)
+DECLARE_OPERAND(2)
+DECLARE_OPERAND(3)
+DECLARE_OPERAND(4)
+DECLARE_OPERAND(5)
+DECLARE_OPERAND(6)
+DECLARE_OPERAND(7)
+DECLARE_OPERAND(8)
+DECLARE_OPERAND(9)
+DECLARE_OPERAND(10)
+
+// JSR_R is followed by an inline cache
+extern vm_native_t _JIT_CONTINUE_16;
+
+extern uint32_t vm_strchr(uint32_t a, int b, void *mem);
+extern uint32_t vm_strrchr(uint32_t a, int b, void *mem);
+extern uint32_t vm_vaarg32(void *rf, void **ptr);
+extern uint64_t vm_vaarg64(void *rf, void **ptr);
+extern void vm_stop(struct ir_unit *iu, int reason, int code)
+  __attribute__((noreturn));
+
+extern void vm_native_jsr_vm(vm_frame_t *vf, int fid, void *rf, void *ret);
+extern void vm_native_jsr_ext(vm_frame_t *vf, int fid, void *rf, void *ret);
+extern void vm_native_jsr_r(vm_frame_t *vf, uint32_t fid, void *rf, void *ret);
+extern vm_native_t *vm_native_tail_vm(vm_frame_t *vf, int fid, void *rf,
+                                      int argoffset, int argsize);
+extern vm_native_t *vm_native_tail_r(vm_frame_t *vf, uint32_t fid, void *rf,
+                                     int argoffset, int argsize);
+extern void vm_native_tier_count(vm_frame_t *vf, int fid);
+
+
+#define OPERAND(sym) ((uintptr_t)(sym))
+
+static inline __attribute__((always_inline)) float
+imm_flt(uint32_t u)
+{
+  union { uint32_t u; float f; } x = { u };
+  return x.f;
+}
+
+static inline __attribute__((always_inline)) double
+imm_dbl(uint64_t u)
+{
+  union { uint64_t u; double d; } x = { u };
+  return x.d;
+}
+
+#define ACCPOS 8
+#define R32_ACC *(uint32_t *)(rf + ACCPOS)
+#define S32_ACC *(int32_t  *)(rf + ACCPOS)
+
+#define REG(r) (rf + OPERAND(_JIT_REG ## r))
+
+#define R8(r)  *(uint8_t  *)REG(r)
+#define S8(r)  *(int8_t   *)REG(r)
+#define R16(r) *(uint16_t *)REG(r)
+#define S16(r) *(int16_t  *)REG(r)
+#define R32(r) *(uint32_t *)REG(r)
+#define S32(r) *(int32_t  *)REG(r)
+#define R64(r) *(uint64_t *)REG(r)
+#define S64(r) *(int64_t  *)REG(r)
+#define RFLT(r)  *(float  *)REG(r)
+#define RDBL(r)  *(double *)REG(r)
+
+#define AR8(r, src)  R8(r) = src
+#define AS8(r, src)  S8(r) = src
+#define AR16(r, src) R16(r) = src
+#define AS16(r, src) S16(r) = src
+#define AR32(r, src) R32(r) = src
+#define AS32(r, src) S32(r) = src
+#define AR32_ACC(src) R32_ACC = src
+#define AS32_ACC(src) S32_ACC = src
+#define AR64(r, src) R64(r) = src
+#define AS64(r, src) S64(r) = src
+#define AFLT(r, src) RFLT(r) = src
+#define ADBL(r, src) RDBL(r) = src
+
+#define UIMM8(r)  ((uint8_t)OPERAND(_JIT_U16_ ## r))
+#define SIMM8(r)  ((int8_t)OPERAND(_JIT_U16_ ## r))
+#define UIMM16(r) ((uint16_t)OPERAND(_JIT_U16_ ## r))
+#define SIMM16(r) ((int16_t)OPERAND(_JIT_U16_ ## r))
+#define UIMM32(r) ((uint32_t)OPERAND(_JIT_U32_ ## r))
+#define SIMM32(r) ((int32_t)OPERAND(_JIT_U32_ ## r))
+#define UIMM64(r) ((uint64_t)OPERAND(_JIT_U64HI_ ## r) << 32 | UIMM32(r))
+#define SIMM64(r) ((int64_t)UIMM64(r))
+
+#define IMMFLT(r) imm_flt(UIMM32(r))
+#define IMMDBL(r) imm_dbl(UIMM64(r))
+
+#define MEM(x) ((mem) + (x))
+
+#define LOAD8(r, ea)   R8(r)  = *(uint8_t *)MEM(ea)
+#define LOAD8_ZEXT_32(r, ea)   R32(r)  = *(uint8_t *)MEM(ea)
+#define LOAD8_SEXT_32(r, ea)   S32(r)  = *(int8_t *)MEM(ea)
+#define LOAD16(r, ea)  R16(r) = *(uint16_t *)MEM(ea)
+#define LOAD16_ZEXT_32(r, ea)   R32(r)  = *(uint16_t *)MEM(ea)
+#define LOAD16_SEXT_32(r, ea)   S32(r)  = *(int16_t *)MEM(ea)
+#define LOAD32(r, ea)  R32(r) = *(uint32_t *)MEM(ea)
+#define LOAD64(r, ea)  R64(r) = *(uint64_t *)MEM(ea)
+#define STORE8(ea, v)   *(uint8_t *)MEM(ea) = v
+#define STORE16(ea, v)  *(uint16_t *)MEM(ea) = v
+#define STORE32(ea, v)  *(uint32_t *)MEM(ea) = v
+#define STORE64(ea, v)  *(uint64_t *)MEM(ea) = v
+
+#define allocaptr (vf->vf_allocaptr)
+
+/**
+ * Instructions that don't fall through to the next instruction need
+ * their length stated explicitly so the compiler can walk the text
+ */
+#define VMOP(x)                                                 \
+  }                                                             \
+  void vm_stencil_ ## x(void *rf, void *mem, vm_frame_t *vf) {
+
+#define VMOPN(x, n)                                             \
+  }                                                             \
+  const uint8_t vm_stencil_oplen_ ## x = n;                     \
+  void vm_stencil_ ## x(void *rf, void *mem, vm_frame_t *vf) {
+
+#define NEXT(n) do { _JIT_CONTINUE_ ## n(rf, mem, vf); return; } while(0)
+
+#define BRANCH(n) do { _JIT_TARGET_ ## n(rf, mem, vf); return; } while(0)
+
+#define RETURN() return
+
+
+static void __attribute__((unused))
+vm_stencils_begin(void)
+{
+
+#include "vmir_vm_ops.h"
+#include "vmir_vm_native_ops.h"
+
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Streaming load
+ *
+ * vmir_load_feed() appends the bytes to a buffer and parses as much of
+ * it as possible. Blocks nested in the module block (types, constants,
+ * function bodies, etc) are parsed once all of them has arrived, so a
+ * function is compiled as soon as its FUNCTION block is complete. The
+ * top level and the module block itself are parsed an item (record,
+ * abbreviation or block) at a time. Records are skipped without being
+ * decoded first to find out if all of them is there.
+ *
+ * Parsed bytes are dropped from the buffer (a multiple of 4 bytes at a
+ * time to keep the 32 bit alignment of blocks) so the buffer holds
+ * about as much as the largest block.
+ */
+
+typedef struct ir_stream {
+  bcbitstream_t is_bs;
+  uint8_t *is_data;
+  int is_capacity;
+  int is_started;      // Magic number read
+  int is_depth;        // 0 = top level, 1 = module block
+  int is_done;         // End of top level seen
+  int is_module_width; // Abbrev id width of the module block
+  const ir_blockinfo_t *is_module_ibi;
+} ir_stream_t;
+
+
+/**
+ *
+ */
+static void
+stream_skip_operand(bcbitstream_t *bs, const ir_abbrev_operand_t *iao)
+{
+  switch(iao->iao_type) {
+  case IAOT_FIXED_WIDTH:
+    read_bits(bs, iao->iao_data);
+    break;
+  case IAOT_VBR:
+    read_vbr64(bs, iao->iao_data);
+    break;
+  case IAOT_CHAR6:
+    read_bits(bs, 6);
+    break;
+  default:
+    break;
+  }
+}
+
+
+/**
+ * Skip the abbreviation definition or record with abbrev 'id'. Reads
+ * past the end (or an unknown abbrev id which is reported when parsing
+ * it for real) just stop early
+ */
+static void
+stream_skip_record(ir_unit_t *iu, unsigned int id, const ir_blockinfo_t *ibi)
+{
+  bcbitstream_t *bs = iu->iu_bs;
+
+  if(id == 2) { // DEFINE_ABBREV
+    const uint32_t numops = read_vbr(bs, 5);
+    for(int i = 0; i < numops && !bs->overrun; i++) {
+      if(read_bits(bs, 1)) {
+        read_vbr(bs, 8);
+        continue;
+      }
+      const int type = read_bits(bs, 3);
+      if(type == IAOT_FIXED_WIDTH || type == IAOT_VBR)
+        read_vbr(bs, 5);
+    }
+    return;
+  }
+
+  if(id == 3) { // UNABBREV_RECORD
+    read_vbr(bs, 6);
+    const uint32_t numops = read_vbr(bs, 6);
+    for(int i = 0; i < numops && !bs->overrun; i++)
+      read_vbr64(bs, 6);
+    return;
+  }
+
+  const ir_abbrev_t *ia = abbrev_find(iu, id, ibi);
+  if(ia == NULL)
+    return;
+
+  for(int i = ia->ia_num_literals; i < ia->ia_nops; i++)
+    stream_skip_operand(bs, &ia->ia_ops[i]);
+
+  if(ia->ia_tail == IAOT_ARRAY) {
+    const uint32_t arraysize = read_vbr(bs, 6);
+    for(int i = 0; i < arraysize && !bs->overrun; i++)
+      stream_skip_operand(bs, &ia->ia_element);
+  } else if(ia->ia_tail == IAOT_BLOB) {
+    const uint32_t size = read_vbr(bs, 6);
+    align_bits32(bs);
+    skip_bytes(bs, size);
+    align_bits32(bs);
+  }
+}
+
+
+/**
+ *
+ */
+static int
+stream_incomplete(const bcbitstream_t *bs)
+{
+  return bs->overrun || bs->bytes_offset > bs->bytes_length;
+}
+
+
+/**
+ * Parse the next item if all of it has arrived. Returns 0 if more data
+ * is needed
+ */
+static int
+stream_item(ir_unit_t *iu)
+{
+  ir_stream_t *is = iu->iu_stream;
+  bcbitstream_t *bs = &is->is_bs;
+  const bcbitstream_t saved = *bs;
+  const int width = is->is_depth ? is->is_module_width : 2;
+  const uint32_t id = read_bits(bs, width);
+  ir_block_t *ib;
+
+  switch(id) {
+  case 0: // END_BLOCK
+    align_bits32(bs);
+    if(stream_incomplete(bs))
+      break;
+
+    if(is->is_depth == 0) {
+      is->is_done = 1;
+      return 0;
+    }
+    is->is_depth = 0;
+    block_destroy(LIST_FIRST(&iu->iu_blocks));
+    return 1;
+
+  case 1: // ENTER_SUBBLOCK
+    {
+      const uint32_t blockid = read_vbr(bs, 8);
+      const uint32_t inner_id_width = read_vbr(bs, 4);
+      align_bits32(bs);
+      const uint32_t blocklen = read_bits(bs, 32) * 4;
+      if(stream_incomplete(bs))
+        break;
+
+      if(is->is_depth == 0 && blockid == 8) {
+        // The module block is parsed as it arrives
+        ib = calloc(1, sizeof(ir_block_t));
+        LIST_INSERT_HEAD(&iu->iu_blocks, ib, ib_link);
+        is->is_module_ibi = blockinfo_find(iu, blockid);
+        is->is_module_width = inner_id_width;
+        is->is_depth = 1;
+        return 1;
+      }
+
+      if(blocklen > bs->bytes_length - byte_offset(bs))
+        break;
+    }
+    *bs = saved;
+    read_bits(bs, width);
+    ir_enter_subblock(iu);
+    return 1;
+
+  default:
+    if(is->is_depth == 0)
+      parser_error(iu, "Record outside of module block");
+
+    stream_skip_record(iu, id, is->is_module_ibi);
+    if(stream_incomplete(bs))
+      break;
+
+    *bs = saved;
+    read_bits(bs, width);
+    switch(id) {
+    case 2:  ir_define_abbrev(iu);                                      break;
+    case 3:  ir_unabbrev_record(iu, module_rec_handler);                break;
+    default: ir_dispatch_abbrev(iu, id, module_rec_handler,
+                                is->is_module_ibi);                     break;
+    }
+    return 1;
+  }
+
+  *bs = saved;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+stream_begin(ir_unit_t *iu)
+{
+  ir_stream_t *is = calloc(1, sizeof(ir_stream_t));
+  iu->iu_stream = is;
+  iu->iu_bs = &is->is_bs;
+}
+
+
+/**
+ * Append 'len' bytes and parse everything that is complete
+ */
+static int
+stream_feed(ir_unit_t *iu, const uint8_t *data, int len)
+{
+  ir_stream_t *is = iu->iu_stream;
+  bcbitstream_t *bs = &is->is_bs;
+
+  if(is->is_done)
+    return 0;
+
+  if(bs->bytes_length + len > is->is_capacity) {
+    is->is_capacity = MAX(is->is_capacity * 2, bs->bytes_length + len);
+    is->is_data = realloc(is->is_data, is->is_capacity);
+    bs->rdata = is->is_data;
+  }
+  memcpy(is->is_data + bs->bytes_length, data, len);
+  bs->bytes_length += len;
+
+  if(!is->is_started) {
+    if(bs->bytes_length < 4)
+      return 0;
+    if(read_bits(bs, 32) != 0xdec04342)
+      return VMIR_ERR_NOT_BITCODE;
+    is->is_started = 1;
+  }
+
+  while(stream_item(iu)) {}
+
+  // Drop what has been parsed once it is more than what is left
+  const int pos = bs->bytes_offset - (bs->remain + 7) / 8;
+  const int drop = pos & ~3;
+  if(drop > bs->bytes_length - drop) {
+    memmove(is->is_data, is->is_data + drop, bs->bytes_length - drop);
+    bs->bytes_offset -= drop;
+    bs->bytes_length -= drop;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+stream_end(ir_unit_t *iu)
+{
+  const ir_stream_t *is = iu->iu_stream;
+  if(is->is_depth || !is->is_started)
+    parser_error(iu, "Bitcode is truncated");
+}
+
+
+/**
+ *
+ */
+static void
+stream_destroy(ir_unit_t *iu)
+{
+  ir_stream_t *is = iu->iu_stream;
+  if(is == NULL)
+    return;
+  free(is->is_data);
+  free(is);
+  iu->iu_stream = NULL;
+  iu->iu_bs = NULL;
+}
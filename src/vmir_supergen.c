@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Generates superinstructions (vmir_vm_super.h) from an opcode profile
+ *
+ * The profile is written by a vmir built with VMIR_VM_PROFILE and lists
+ * how many times each sequence of two or three opcodes was dispatched.
+ * For the most frequent sequences where all instructions are handled
+ * in vmir_vm_ops.h a fused handler is created by concatenating the
+ * handler bodies with the operand indices of the later instructions
+ * moved past the operands (and opcode) of the earlier ones.
+ *
+ * The operand layout of a superinstruction is thus identical to the
+ * original instructions. vm_superinstructions() in vmir_vm.c merely
+ * replaces the first opcode and the opcodes of the other instructions
+ * are kept intact, so branching into the middle of a superinstruction
+ * still works.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define MAX_HANDLERS 1024
+#define MAX_SEQUENCES 65536
+#define MAX_SEQ_LEN 3
+
+typedef struct handler {
+  char *name;
+  char *body;
+  int oplen;
+} handler_t;
+
+typedef struct sequence {
+  uint64_t count;
+  int len;
+  const handler_t *h[MAX_SEQ_LEN];
+} sequence_t;
+
+static handler_t handlers[MAX_HANDLERS];
+static int num_handlers;
+
+static sequence_t sequences[MAX_SEQUENCES];
+static int num_sequences;
+
+// Macros that take an operand index as their first argument
+static const char *operand_macros[] = {
+  "R8", "S8", "R16", "S16", "R32", "S32", "R64", "S64", "RFLT", "RDBL",
+  "AR8", "AS8", "AR16", "AS16", "AR32", "AS32", "AR64", "AS64",
+  "AFLT", "ADBL",
+  "UIMM8", "SIMM8", "UIMM16", "SIMM16", "UIMM32", "SIMM32",
+  "UIMM64", "SIMM64", "IMMFLT", "IMMDBL",
+  "LOAD8", "LOAD8_ZEXT_32", "LOAD8_SEXT_32",
+  "LOAD16", "LOAD16_ZEXT_32", "LOAD16_SEXT_32",
+  "LOAD32", "LOAD64",
+  NULL
+};
+
+
+/**
+ *
+ */
+static char *
+load_file(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if(fp == NULL) {
+    perror(path);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = malloc(size + 1);
+  if(size > 0 && fread(buf, size, 1, fp) != 1) {
+    perror(path);
+    exit(1);
+  }
+  buf[size] = 0;
+  fclose(fp);
+  return buf;
+}
+
+
+/**
+ * Replace comments with spaces so they don't confuse the parser
+ */
+static void
+strip_comments(char *s)
+{
+  while(*s) {
+    if(s[0] == '/' && s[1] == '/') {
+      while(*s && *s != '\n')
+        *s++ = ' ';
+    } else if(s[0] == '/' && s[1] == '*') {
+      while(*s && !(s[0] == '*' && s[1] == '/')) {
+        if(*s != '\n')
+          *s = ' ';
+        s++;
+      }
+      if(*s) {
+        s[0] = ' ';
+        s[1] = ' ';
+        s += 2;
+      }
+    } else {
+      s++;
+    }
+  }
+}
+
+
+/**
+ * Split vmir_vm_ops.h into handlers. Each handler must end with a
+ * single NEXT()
+ */
+static void
+parse_handlers(char *src)
+{
+  char *s = src;
+  while((s = strstr(s, "VMOP(")) != NULL) {
+    char *name = s + 5;
+    char *end = strchr(name, ')');
+    if(end == NULL)
+      break;
+    char *body = end + 1;
+    char *next = strstr(body, "NEXT(");
+    char *nextop = strstr(body, "VMOP(");
+    if(next == NULL || (nextop != NULL && nextop < next)) {
+      fprintf(stderr, "Handler %.*s has no NEXT()\n", (int)(end - name), name);
+      exit(1);
+    }
+
+    handler_t *h = &handlers[num_handlers++];
+    h->name = strndup(name, end - name);
+    h->oplen = atoi(next + 5);
+
+    // Braces that are open at NEXT() are closed after it
+    int depth = 0;
+    for(const char *p = body; p < next; p++)
+      depth += *p == '{' ? 1 : *p == '}' ? -1 : 0;
+
+    h->body = malloc(next - body + depth + 1);
+    memcpy(h->body, body, next - body);
+    memset(h->body + (next - body), '}', depth);
+    h->body[next - body + depth] = 0;
+
+    s = next;
+    if(num_handlers == MAX_HANDLERS)
+      break;
+  }
+}
+
+
+/**
+ *
+ */
+static const handler_t *
+find_handler(const char *name)
+{
+  for(int i = 0; i < num_handlers; i++)
+    if(!strcmp(handlers[i].name, name))
+      return &handlers[i];
+  return NULL;
+}
+
+
+/**
+ * Print handler body with all operand indices increased by 'offset'
+ */
+static void
+print_body(const char *s, int offset)
+{
+  while(*s) {
+    if(isalpha(*s) || *s == '_') {
+      const char *start = s;
+      while(isalnum(*s) || *s == '_')
+        s++;
+      int len = s - start;
+      printf("%.*s", len, start);
+
+      int is_operand = 0;
+      for(int i = 0; operand_macros[i] != NULL; i++) {
+        if(strlen(operand_macros[i]) == len &&
+           !memcmp(operand_macros[i], start, len))
+          is_operand = 1;
+      }
+      if(!is_operand || *s != '(')
+        continue;
+
+      printf("(");
+      s++;
+      while(*s == ' ')
+        s++;
+      if(!isdigit(*s)) {
+        fprintf(stderr, "Non constant operand in %.*s\n", len, start);
+        exit(1);
+      }
+      printf("%d", (int)strtol(s, (char **)&s, 10) + offset);
+    } else if(*s == '\n') {
+      // Drop trailing whitespace and empty lines
+      s++;
+    } else {
+      putchar(*s++);
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+print_name(const sequence_t *seq)
+{
+  printf("SUPER");
+  for(int i = 0; i < seq->len; i++)
+    printf("%s%s", i ? "__" : "_", seq->h[i]->name);
+}
+
+
+/**
+ * Sequences that save the most dispatches come first
+ */
+static int
+sequence_cmp(const void *A, const void *B)
+{
+  const sequence_t *a = A;
+  const sequence_t *b = B;
+  uint64_t sa = a->count * (a->len - 1);
+  uint64_t sb = b->count * (b->len - 1);
+  return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+
+/**
+ * Longer sequences must be tried first when emitting
+ */
+static int
+sequence_len_cmp(const void *A, const void *B)
+{
+  const sequence_t *a = A;
+  const sequence_t *b = B;
+  if(a->len != b->len)
+    return b->len - a->len;
+  return sequence_cmp(A, B);
+}
+
+
+/**
+ *
+ */
+static void
+parse_profile(char *profile)
+{
+  char *line, *saveptr = NULL;
+  for(line = strtok_r(profile, "\n", &saveptr); line != NULL;
+      line = strtok_r(NULL, "\n", &saveptr)) {
+    if(line[0] == '#')
+      continue;
+
+    char *tok, *saveptr2 = NULL;
+    sequence_t seq = {0};
+    int valid = 1;
+
+    tok = strtok_r(line, " \t", &saveptr2);
+    if(tok == NULL)
+      continue;
+    seq.count = strtoull(tok, NULL, 10);
+
+    while((tok = strtok_r(NULL, " \t", &saveptr2)) != NULL) {
+      if(seq.len == MAX_SEQ_LEN) {
+        valid = 0;
+        break;
+      }
+      // Only instructions handled by vmir_vm_ops.h can be fused
+      if((seq.h[seq.len++] = find_handler(tok)) == NULL)
+        valid = 0;
+    }
+
+    if(!valid || seq.len < 2)
+      continue;
+
+    // Profiles may be concatenated, merge duplicates
+    int i;
+    for(i = 0; i < num_sequences; i++) {
+      if(sequences[i].len == seq.len &&
+         !memcmp(sequences[i].h, seq.h, sizeof(seq.h[0]) * seq.len)) {
+        sequences[i].count += seq.count;
+        break;
+      }
+    }
+    if(i == num_sequences && num_sequences < MAX_SEQUENCES)
+      sequences[num_sequences++] = seq;
+  }
+}
+
+
+int
+main(int argc, char **argv)
+{
+  int count = 32;
+
+  if(argc >= 3 && !strcmp(argv[1], "-n")) {
+    count = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(argc != 3) {
+    fprintf(stderr,
+            "Usage: %s [-n COUNT] <vmir_vm_ops.h> <profile>\n", argv[0]);
+    exit(1);
+  }
+
+  char *src = load_file(argv[1]);
+  strip_comments(src);
+  parse_handlers(src);
+
+  parse_profile(load_file(argv[2]));
+
+  qsort(sequences, num_sequences, sizeof(sequence_t), sequence_cmp);
+  if(num_sequences > count)
+    num_sequences = count;
+  qsort(sequences, num_sequences, sizeof(sequence_t), sequence_len_cmp);
+
+  printf("/* Generated by vmir_supergen, do not edit */\n\n");
+
+  printf("#if defined(VM_SUPER_ENUM)\n\n");
+  for(int i = 0; i < num_sequences; i++) {
+    printf("  VM_");
+    print_name(&sequences[i]);
+    printf(",\n");
+  }
+
+  printf("\n#elif defined(VM_SUPER_RESOLVE)\n\n");
+  for(int i = 0; i < num_sequences; i++) {
+    printf("  case VM_");
+    print_name(&sequences[i]);
+    printf(": return &&");
+    print_name(&sequences[i]);
+    printf(" - &&opz; break;\n");
+  }
+
+  printf("\n#elif defined(VM_SUPER_HANDLERS)\n");
+  for(int i = 0; i < num_sequences; i++) {
+    const sequence_t *seq = &sequences[i];
+    int offset = 0;
+    printf("\n  // %"PRIu64" dispatches\n  VMOP(", seq->count);
+    print_name(seq);
+    printf(")\n  {\n");
+    for(int j = 0; j < seq->len; j++) {
+      printf("    {");
+      print_body(seq->h[j]->body, offset);
+      printf(" }\n");
+      offset += seq->h[j]->oplen + 1;
+    }
+    printf("  }\n  NEXT(%d);\n", offset - 1);
+  }
+
+  printf("\n#elif defined(VM_SUPER_PATTERNS)\n\n");
+  for(int i = 0; i < num_sequences; i++) {
+    const sequence_t *seq = &sequences[i];
+    printf("  { VM_");
+    print_name(seq);
+    printf(", %d, {", seq->len);
+    for(int j = 0; j < seq->len; j++)
+      printf(" VM_%s,", seq->h[j]->name);
+    printf(" }, {");
+    for(int j = 0; j < seq->len; j++)
+      printf(" %d,", seq->h[j]->oplen);
+    printf(" } },\n");
+  }
+
+  printf("\n#endif\n");
+  return 0;
+}
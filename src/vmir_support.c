@@ -138,14 +138,3 @@ bitchk(const uint32_t *bs, int v)
     return 1;
   return 0;
 }
-
-
-/**
- *
- */
-static void
-bitset_or(uint32_t *bs, const uint32_t *src, int words)
-{
-  for(int i = 0; i < words; i++)
-    bs[i] |= src[i];
-}
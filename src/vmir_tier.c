@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef VMIR_VM_JIT
+
+/**
+ * Compile a hot function again with the JIT enabled and redirect
+ * calls to the new code. Activations already running in the
+ * interpreted text continue there until they return. If compiling
+ * fails the function stays interpreted, it's never requested again as
+ * if_tier_queued is left set
+ */
+static void
+tier_compile(ir_unit_t *iu, ir_function_t *f)
+{
+  void *tier0_text = f->if_vm_text;
+  const int tier0_text_size = f->if_vm_text_size;
+
+  if(iu->iu_lazy)
+    pthread_mutex_lock(&iu->iu_lazy_mutex);
+  const int r = function_reparse(iu, f);
+  jit_seal_code(iu);
+  if(iu->iu_lazy)
+    pthread_mutex_unlock(&iu->iu_lazy_mutex);
+
+  if(r) {
+    iu->iu_stats.failed_compiles++;
+    return;
+  }
+
+  if(!f->if_inline_size) {
+    free(f->if_body);
+    f->if_body = NULL;
+  }
+  f->if_tier0_text = tier0_text;
+  f->if_tier0_text_size = tier0_text_size;
+
+  // Calls still running the tier 0 text keep using its frame
+  if(f->if_regframe_size > iu->iu_vm_frame_sizes[f->if_gfid])
+    iu->iu_vm_frame_sizes[f->if_gfid] = f->if_regframe_size;
+  __atomic_store_n(&iu->iu_vm_funcs[f->if_gfid], f->if_vm_text,
+                   __ATOMIC_RELEASE);
+  // Flush the inline caches of indirect calls
+  __atomic_add_fetch(&iu->iu_vm_funcs_gen, 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ *
+ */
+static void *
+tier_thread(void *aux)
+{
+  ir_unit_t *iu = aux;
+  ir_function_t *f;
+
+  pthread_mutex_lock(&iu->iu_tier_mutex);
+  while(!iu->iu_tier_stop) {
+    if((f = TAILQ_FIRST(&iu->iu_tier_queue)) == NULL) {
+      pthread_cond_wait(&iu->iu_tier_cond, &iu->iu_tier_mutex);
+      continue;
+    }
+    TAILQ_REMOVE(&iu->iu_tier_queue, f, if_tier_link);
+    pthread_mutex_unlock(&iu->iu_tier_mutex);
+    tier_compile(iu, f);
+    pthread_mutex_lock(&iu->iu_tier_mutex);
+  }
+  pthread_mutex_unlock(&iu->iu_tier_mutex);
+  return NULL;
+}
+
+
+/**
+ * Called from the VM when a function's counter hits the threshold
+ */
+static void
+tier_request(ir_unit_t *iu, int gfid)
+{
+  ir_function_t *f = VECTOR_ITEM(&iu->iu_functions, gfid);
+
+  pthread_mutex_lock(&iu->iu_tier_mutex);
+  if(!f->if_tier_queued) {
+    f->if_tier_queued = 1;
+    TAILQ_INSERT_TAIL(&iu->iu_tier_queue, f, if_tier_link);
+    pthread_cond_signal(&iu->iu_tier_cond);
+  }
+  pthread_mutex_unlock(&iu->iu_tier_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+tier_start(ir_unit_t *iu)
+{
+  iu->iu_tier_counters = calloc(VECTOR_LEN(&iu->iu_functions),
+                                sizeof(uint32_t));
+  iu->iu_tier_up = 1;
+  TAILQ_INIT(&iu->iu_tier_queue);
+  pthread_mutex_init(&iu->iu_tier_mutex, NULL);
+  pthread_cond_init(&iu->iu_tier_cond, NULL);
+
+  if(pthread_create(&iu->iu_tier_thread, NULL, tier_thread, iu))
+    parser_error(iu, "Unable to start tiering thread");
+  iu->iu_tier_thread_running = 1;
+}
+
+
+/**
+ *
+ */
+static void
+tier_stop(ir_unit_t *iu)
+{
+  if(!iu->iu_tier_thread_running)
+    return;
+
+  pthread_mutex_lock(&iu->iu_tier_mutex);
+  iu->iu_tier_stop = 1;
+  pthread_cond_signal(&iu->iu_tier_cond);
+  pthread_mutex_unlock(&iu->iu_tier_mutex);
+
+  pthread_join(iu->iu_tier_thread, NULL);
+  iu->iu_tier_thread_running = 0;
+
+  pthread_cond_destroy(&iu->iu_tier_cond);
+  pthread_mutex_destroy(&iu->iu_tier_mutex);
+  free(iu->iu_tier_counters);
+}
+
+#else
+
+/**
+ * Without JIT there is nothing to tier up to
+ */
+static void
+tier_request(ir_unit_t *iu, int gfid)
+{
+}
+
+#endif
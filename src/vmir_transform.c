@@ -599,10 +599,8 @@ bb_change_branch(ir_bb_t *from, ir_bb_t *to, ir_bb_t *nb, ir_function_t *f)
     abort();
   }
 
-  if(ii->ii_succ != NULL) {
-    free(ii->ii_succ);
+  if(ii->ii_succ != NULL)
     liveness_set_succ(f, ii);
-  }
 }
 
 
@@ -880,7 +878,7 @@ cfg_add_edge(ir_function_t *f, ir_bb_t *from, int bb, int mark)
       return;
     to->ib_mark = 1;
   }
-  ir_bb_edge_t *ibe = malloc(sizeof(ir_bb_edge_t));
+  ir_bb_edge_t *ibe = arena_alloc(f->if_arena, sizeof(ir_bb_edge_t));
   LIST_INSERT_HEAD(&f->if_edges,             ibe, ibe_function_link);
 
   ibe->ibe_from = from;
@@ -1052,7 +1050,8 @@ liveness_set_succ(ir_function_t *f, ir_instr_t *ii)
       ir_instr_switch_t *s = (ir_instr_switch_t *)ii;
 
       ii->ii_num_succ = 1 + s->num_paths;
-      ii->ii_succ = malloc(sizeof(ir_bb_t *) * ii->ii_num_succ);
+      ii->ii_succ = arena_alloc(f->if_arena,
+                                sizeof(ir_bb_t *) * ii->ii_num_succ);
       ii->ii_succ[0] = bb_find(f, s->defblock);
 
       for(int i = 0; i < s->num_paths; i++)
@@ -1068,7 +1067,8 @@ liveness_set_succ(ir_function_t *f, ir_instr_t *ii)
       if(b->condition != -1)
         ii->ii_num_succ = 2;
 
-      ii->ii_succ = malloc(sizeof(ir_bb_t *) * ii->ii_num_succ);
+      ii->ii_succ = arena_alloc(f->if_arena,
+                                sizeof(ir_bb_t *) * ii->ii_num_succ);
       ii->ii_succ[0] = bb_find(f, b->true_branch);
       if(b->condition != -1)
         ii->ii_succ[1] = bb_find(f, b->false_branch);
@@ -1080,7 +1080,8 @@ liveness_set_succ(ir_function_t *f, ir_instr_t *ii)
       ir_instr_cmp_branch_t *icb = (ir_instr_cmp_branch_t *)ii;
 
       ii->ii_num_succ = 2;
-      ii->ii_succ = malloc(sizeof(ir_bb_t *) * ii->ii_num_succ);
+      ii->ii_succ = arena_alloc(f->if_arena,
+                                sizeof(ir_bb_t *) * ii->ii_num_succ);
       ii->ii_succ[0] = bb_find(f, icb->true_branch);
       ii->ii_succ[1] = bb_find(f, icb->false_branch);
     }
@@ -1092,8 +1093,13 @@ liveness_set_succ(ir_function_t *f, ir_instr_t *ii)
   }
 }
 
+VECTOR_HEAD(liveness_vec, int);
+
+/**
+ *
+ */
 static void
-liveness_set_value(uint32_t *bs, ir_unit_t *iu, int value)
+liveness_add_value(struct liveness_vec *gen, ir_unit_t *iu, int value)
 {
   ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, value);
   if(iv->iv_class != IR_VC_TEMPORARY)
@@ -1102,11 +1108,16 @@ liveness_set_value(uint32_t *bs, ir_unit_t *iu, int value)
   value -= iu->iu_first_func_value;
   assert(value >= 0);
 
-  bitset(bs, value);
+  VECTOR_PUSH_BACK(gen, value);
 }
 
+
+/**
+ * Collect the temporaries read by an instruction (relative to the first
+ * function value). Values read more than once may be repeated
+ */
 static void
-liveness_set_gen(ir_instr_t *ii, ir_unit_t *iu, uint32_t *bs)
+liveness_gen(ir_instr_t *ii, ir_unit_t *iu, struct liveness_vec *gen)
 {
   switch(ii->ii_class) {
   case IR_IC_UNREACHABLE:
@@ -1115,94 +1126,337 @@ liveness_set_gen(ir_instr_t *ii, ir_unit_t *iu, uint32_t *bs)
 
   case IR_IC_RET:
     if(((ir_instr_unary_t *)ii)->value != -1)
-      liveness_set_value(bs, iu, ((ir_instr_unary_t *)ii)->value);
+      liveness_add_value(gen, iu, ((ir_instr_unary_t *)ii)->value);
     break;
 
   case IR_IC_CAST:
   case IR_IC_VAARG:
-    liveness_set_value(bs, iu, ((ir_instr_unary_t *)ii)->value);
+    liveness_add_value(gen, iu, ((ir_instr_unary_t *)ii)->value);
     break;
   case IR_IC_LOAD:
-    liveness_set_value(bs, iu, ((ir_instr_load_t *)ii)->ptr);
+    liveness_add_value(gen, iu, ((ir_instr_load_t *)ii)->ptr);
     if(((ir_instr_load_t *)ii)->value_offset >= 0)
-      liveness_set_value(bs, iu, ((ir_instr_load_t *)ii)->value_offset);
+      liveness_add_value(gen, iu, ((ir_instr_load_t *)ii)->value_offset);
     break;
 
   case IR_IC_BINOP:
   case IR_IC_CMP2:
-    liveness_set_value(bs, iu, ((ir_instr_binary_t *)ii)->lhs_value);
-    liveness_set_value(bs, iu, ((ir_instr_binary_t *)ii)->rhs_value);
+    liveness_add_value(gen, iu, ((ir_instr_binary_t *)ii)->lhs_value);
+    liveness_add_value(gen, iu, ((ir_instr_binary_t *)ii)->rhs_value);
     break;
   case IR_IC_CMP_BRANCH:
-    liveness_set_value(bs, iu, ((ir_instr_cmp_branch_t *)ii)->lhs_value);
-    liveness_set_value(bs, iu, ((ir_instr_cmp_branch_t *)ii)->rhs_value);
+    liveness_add_value(gen, iu, ((ir_instr_cmp_branch_t *)ii)->lhs_value);
+    liveness_add_value(gen, iu, ((ir_instr_cmp_branch_t *)ii)->rhs_value);
     break;
   case IR_IC_STORE:
-    liveness_set_value(bs, iu, ((ir_instr_store_t *)ii)->value);
-    liveness_set_value(bs, iu, ((ir_instr_store_t *)ii)->ptr);
+    liveness_add_value(gen, iu, ((ir_instr_store_t *)ii)->value);
+    liveness_add_value(gen, iu, ((ir_instr_store_t *)ii)->ptr);
     break;
   case IR_IC_BR:
     if(((ir_instr_br_t *)ii)->condition != -1)
-      liveness_set_value(bs, iu, ((ir_instr_br_t *)ii)->condition);
+      liveness_add_value(gen, iu, ((ir_instr_br_t *)ii)->condition);
     break;
   case IR_IC_ALLOCA:
-    liveness_set_value(bs, iu, ((ir_instr_alloca_t *)ii)->num_items_value);
+    liveness_add_value(gen, iu, ((ir_instr_alloca_t *)ii)->num_items_value);
     break;
   case IR_IC_SELECT:
-    liveness_set_value(bs, iu, ((ir_instr_select_t *)ii)->pred);
-    liveness_set_value(bs, iu, ((ir_instr_select_t *)ii)->true_value);
-    liveness_set_value(bs, iu, ((ir_instr_select_t *)ii)->false_value);
+    liveness_add_value(gen, iu, ((ir_instr_select_t *)ii)->pred);
+    liveness_add_value(gen, iu, ((ir_instr_select_t *)ii)->true_value);
+    liveness_add_value(gen, iu, ((ir_instr_select_t *)ii)->false_value);
     break;
   case IR_IC_LEA:
     {
       ir_instr_lea_t *lea = (ir_instr_lea_t *)ii;
-      liveness_set_value(bs, iu, lea->baseptr);
+      liveness_add_value(gen, iu, lea->baseptr);
       if(lea->value_offset != -1)
-        liveness_set_value(bs, iu, lea->value_offset);
+        liveness_add_value(gen, iu, lea->value_offset);
     }
     break;
   case IR_IC_CALL:
   case IR_IC_VMOP:
     {
       ir_instr_call_t *p = (ir_instr_call_t *)ii;
-      liveness_set_value(bs, iu, p->callee);
+      liveness_add_value(gen, iu, p->callee);
       for(int i = 0; i < p->argc; i++)
-        liveness_set_value(bs, iu, p->argv[i].value);
+        liveness_add_value(gen, iu, p->argv[i].value);
     }
     break;
   case IR_IC_SWITCH:
     {
       ir_instr_switch_t *s = (ir_instr_switch_t *)ii;
-      liveness_set_value(bs, iu, s->value);
+      liveness_add_value(gen, iu, s->value);
     }
     break;
   case IR_IC_MOVE:
     {
       ir_instr_move_t *p = (ir_instr_move_t *)ii;
-      liveness_set_value(bs, iu, p->value);
+      liveness_add_value(gen, iu, p->value);
     }
     break;
   case IR_IC_STACKCOPY:
     {
       ir_instr_stackcopy_t *sc = (ir_instr_stackcopy_t *)ii;
-      liveness_set_value(bs, iu, sc->value);
+      liveness_add_value(gen, iu, sc->value);
     }
     break;
   case IR_IC_MLA:
     {
-      liveness_set_value(bs, iu, ((ir_instr_ternary_t *)ii)->arg1);
-      liveness_set_value(bs, iu, ((ir_instr_ternary_t *)ii)->arg2);
-      liveness_set_value(bs, iu, ((ir_instr_ternary_t *)ii)->arg3);
+      liveness_add_value(gen, iu, ((ir_instr_ternary_t *)ii)->arg1);
+      liveness_add_value(gen, iu, ((ir_instr_ternary_t *)ii)->arg2);
+      liveness_add_value(gen, iu, ((ir_instr_ternary_t *)ii)->arg3);
     }
     break;
   default:
-    printf("liveness_set_gen: can't handle instruction class %d\n",
+    printf("liveness_gen: can't handle instruction class %d\n",
            ii->ii_class);
     abort();
   }
 }
 
 
+/**
+ * Liveness is computed per basic block. For each temporary the blocks
+ * where it is live-in are found by walking backwards from the blocks
+ * where it is used before being defined, stopping at blocks that define
+ * it. This only touches the blocks where the value is live so the sets
+ * are kept as sparse lists. Live-out sets of single instructions are
+ * derived when needed by walking backwards from the end of a block
+ */
+typedef struct liveness {
+  int lv_num_bbs;
+  ir_bb_t **lv_bbs;  // Blocks in function order, ib_mark is the index
+  int *lv_livein;    // Live-in set of block 'b' is lv_livein[b]..[b + 1]
+  int *lv_values;    // Temporaries relative to the first function value
+} liveness_t;
+
+
+/**
+ * Group (key, value) pairs on key. The values for key 'k' are returned
+ * between start[k] and start[k + 1]
+ */
+static int *
+liveness_group(const struct liveness_vec *pairs, int num_keys, int **startp)
+{
+  const int num_pairs = VECTOR_LEN(pairs) / 2;
+  int *start = calloc(num_keys + 1, sizeof(int));
+  int *pos = malloc((num_keys + 1) * sizeof(int));
+  int *values = malloc((num_pairs + 1) * sizeof(int));
+
+  for(int i = 0; i < num_pairs; i++)
+    start[VECTOR_ITEM(pairs, i * 2) + 1]++;
+  for(int k = 0; k < num_keys; k++)
+    start[k + 1] += start[k];
+  memcpy(pos, start, num_keys * sizeof(int));
+  for(int i = 0; i < num_pairs; i++)
+    values[pos[VECTOR_ITEM(pairs, i * 2)]++] = VECTOR_ITEM(pairs, i * 2 + 1);
+
+  free(pos);
+  *startp = start;
+  return values;
+}
+
+
+/**
+ *
+ */
+static void
+liveness_pair(struct liveness_vec *pairs, int key, int value)
+{
+  VECTOR_PUSH_BACK(pairs, key);
+  VECTOR_PUSH_BACK(pairs, value);
+}
+
+
+/**
+ *
+ */
+static void
+liveness_def(int *defined, struct liveness_vec *defs, int v, int b)
+{
+  if(defined[v] != b) {
+    defined[v] = b;
+    liveness_pair(defs, v, b);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+liveness_compute(ir_unit_t *iu, ir_function_t *f, int temp_values,
+                 liveness_t *lv)
+{
+  const int ffv = iu->iu_first_func_value;
+  struct liveness_vec gen = {0}, edges = {0}, uses = {0}, defs = {0};
+  struct liveness_vec livein = {0};
+  ir_bb_t *ib;
+  ir_instr_t *ii;
+  int n = 0;
+
+  TAILQ_FOREACH(ib, &f->if_bbs, ib_link)
+    ib->ib_mark = n++;
+
+  lv->lv_num_bbs = n;
+  lv->lv_bbs = malloc(n * sizeof(ir_bb_t *));
+
+  int *defined = malloc(temp_values * 2 * sizeof(int));
+  int *used = defined + temp_values;
+  memset(defined, 0xff, temp_values * 2 * sizeof(int));
+
+  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
+    const int b = ib->ib_mark;
+    lv->lv_bbs[b] = ib;
+
+    ii = TAILQ_LAST(&ib->ib_instrs, ir_instr_queue);
+    for(int i = 0; i < ii->ii_num_succ; i++)
+      liveness_pair(&edges, ii->ii_succ[i]->ib_mark, b);
+
+    // Values used before being defined in the block and defined values
+    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
+      VECTOR_RESIZE(&gen, 0);
+      liveness_gen(ii, iu, &gen);
+      for(int i = 0; i < VECTOR_LEN(&gen); i++) {
+        const int v = VECTOR_ITEM(&gen, i);
+        if(defined[v] != b && used[v] != b) {
+          used[v] = b;
+          liveness_pair(&uses, v, b);
+        }
+      }
+
+      if(ii->ii_ret_value < -1) {
+        // Multiple return values
+        for(int j = 0; j < -ii->ii_ret_value; j++)
+          liveness_def(defined, &defs, ii->ii_ret_values[j] - ffv, b);
+      } else if(ii->ii_ret_value >= 0) {
+        liveness_def(defined, &defs, ii->ii_ret_value - ffv, b);
+      }
+    }
+  }
+
+  int *pred_start, *use_start, *def_start;
+  int *preds = liveness_group(&edges, n, &pred_start);
+  int *use_bbs = liveness_group(&uses, temp_values, &use_start);
+  int *def_bbs = liveness_group(&defs, temp_values, &def_start);
+
+  int *defmark = malloc(n * 3 * sizeof(int));
+  int *inmark = defmark + n;
+  int *work = inmark + n;
+  memset(defmark, 0xff, n * 2 * sizeof(int));
+
+  for(int v = 0; v < temp_values; v++) {
+    int depth = 0;
+
+    for(int i = def_start[v]; i < def_start[v + 1]; i++)
+      defmark[def_bbs[i]] = v;
+
+    for(int i = use_start[v]; i < use_start[v + 1]; i++) {
+      inmark[use_bbs[i]] = v;
+      work[depth++] = use_bbs[i];
+    }
+
+    while(depth > 0) {
+      const int b = work[--depth];
+      liveness_pair(&livein, b, v);
+      for(int i = pred_start[b]; i < pred_start[b + 1]; i++) {
+        const int p = preds[i];
+        if(defmark[p] == v || inmark[p] == v)
+          continue;
+        inmark[p] = v;
+        work[depth++] = p;
+      }
+    }
+  }
+
+  lv->lv_values = liveness_group(&livein, n, &lv->lv_livein);
+
+  free(defmark);
+  free(preds);
+  free(pred_start);
+  free(use_bbs);
+  free(use_start);
+  free(def_bbs);
+  free(def_start);
+  free(defined);
+  VECTOR_CLEAR(&gen);
+  VECTOR_CLEAR(&edges);
+  VECTOR_CLEAR(&uses);
+  VECTOR_CLEAR(&defs);
+  VECTOR_CLEAR(&livein);
+}
+
+
+/**
+ *
+ */
+static void
+liveness_free(liveness_t *lv)
+{
+  free(lv->lv_bbs);
+  free(lv->lv_livein);
+  free(lv->lv_values);
+}
+
+
+/**
+ * Set 'bs' to the values live out of 'ib'
+ */
+static void
+liveness_out(const liveness_t *lv, const ir_bb_t *ib, uint32_t *bs,
+             int setwords)
+{
+  const ir_instr_t *ii = TAILQ_LAST(&ib->ib_instrs, ir_instr_queue);
+
+  memset(bs, 0, setwords * sizeof(uint32_t));
+  for(int i = 0; i < ii->ii_num_succ; i++) {
+    const int s = ii->ii_succ[i]->ib_mark;
+    for(int j = lv->lv_livein[s]; j < lv->lv_livein[s + 1]; j++)
+      bitset(bs, lv->lv_values[j]);
+  }
+}
+
+
+/**
+ * Turn the values live out of 'ii' in 'bs' into the values live into it
+ */
+static void
+liveness_step(ir_unit_t *iu, ir_instr_t *ii, uint32_t *bs,
+              struct liveness_vec *gen)
+{
+  const int ffv = iu->iu_first_func_value;
+
+  if(ii->ii_ret_value < -1) {
+    // Multiple return values
+    for(int j = 0; j < -ii->ii_ret_value; j++) {
+      bitclr(bs, ii->ii_ret_values[j] - ffv);
+    }
+  } else if(ii->ii_ret_value >= 0) {
+    bitclr(bs, ii->ii_ret_value - ffv);
+  }
+
+  VECTOR_RESIZE(gen, 0);
+  liveness_gen(ii, iu, gen);
+  for(int i = 0; i < VECTOR_LEN(gen); i++)
+    bitset(bs, VECTOR_ITEM(gen, i));
+}
+
+
+/**
+ *
+ */
+static void __attribute__((unused))
+print_livein(ir_unit_t *iu, const liveness_t *lv)
+{
+  const int ffv = iu->iu_first_func_value;
+
+  for(int b = 0; b < lv->lv_num_bbs; b++) {
+    printf(".%d:\n", lv->lv_bbs[b]->ib_id);
+    for(int i = lv->lv_livein[b]; i < lv->lv_livein[b + 1]; i++)
+      printf("\tLivein: %s\n", value_str_id(iu, lv->lv_values[i] + ffv));
+  }
+}
+
+
 /**
  *
  */
@@ -1298,6 +1552,13 @@ instr_replace_values(ir_instr_t *ii, ir_unit_t *iu, int from, int to)
       instr_replace_value(iu, &sc->value, from, to);
     }
     break;
+  case IR_IC_PHI:
+    {
+      ir_instr_phi_t *p = (ir_instr_phi_t *)ii;
+      for(int i = 0; i < p->num_nodes; i++)
+        instr_replace_value(iu, &p->nodes[i].value, from, to);
+    }
+    break;
   case IR_IC_MLA:
     instr_replace_value(iu, &((ir_instr_ternary_t *)ii)->arg1, from, to);
     instr_replace_value(iu, &((ir_instr_ternary_t *)ii)->arg2, from, to);
@@ -1382,106 +1643,39 @@ value_info_cmp(const void *A, const void *B)
 }
 
 
+#define LINEAR_SCAN_DEFAULT 4096 // Values in functions using linear scan
+
 #define RA_CLASSES 3
 #define RA_CLASS_MACHINEREG_32  0
 #define RA_CLASS_REGFRAME_32    1
 #define RA_CLASS_REGFRAME_64    2
 
 
-
 /**
  *
  */
-static void
-reg_alloc(ir_unit_t *iu, const uint32_t *mtx, int temp_values, int ffv,
-          ir_function_t *f)
+static int
+reg_class(ir_unit_t *iu, const ir_value_t *iv)
 {
-  int num_vertices = 0;
-  int graph_degree = 0;
-
-  value_info_t *vi = malloc(temp_values * sizeof(value_info_t));
-
-  for(int i = 0; i < temp_values; i++) {
-    const ir_value_t *iv = value_get(iu, i + ffv);
-    if(iv->iv_class != IR_VC_TEMPORARY)
-      continue;
-
-    int s = value_regframe_size(iu, iv->iv_type);
-    if(s == 8) {
-      vi[num_vertices].class = RA_CLASS_REGFRAME_64;
-    } else {
-      if(iv->iv_jit)
-        vi[num_vertices].class = RA_CLASS_MACHINEREG_32;
-      else
-        vi[num_vertices].class = RA_CLASS_REGFRAME_32;
-    }
-    int score = iv->iv_edges;
-
-    ir_value_instr_t *ivi;
-    LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
-      if(ivi->ivi_instr->ii_class == IR_IC_BINOP)
-        score--;
-    }
-
-    vi[num_vertices].value = i;
-    vi[num_vertices].score = score;
-    graph_degree = MAX(graph_degree, iv->iv_edges);
-    num_vertices++;
-  }
-
-  qsort(vi, num_vertices, sizeof(value_info_t), value_info_cmp);
-
-  // Color graph and use color to allocate register
-
-  uint32_t *colortab[RA_CLASSES];
-  int class_reg_size[RA_CLASSES];
-  const int degree_words = (graph_degree + 32) / 32;
-  for(int i = 0; i < RA_CLASSES; i++) {
-    colortab[i] = malloc(degree_words * sizeof(uint32_t));
-  }
-
-  class_reg_size[RA_CLASS_MACHINEREG_32] = 0;
-  class_reg_size[RA_CLASS_REGFRAME_32] = 4;
-  class_reg_size[RA_CLASS_REGFRAME_64] = 8;
-
-  int *colors = malloc(sizeof(int) * temp_values);
-  memset(colors, 0xff, sizeof(int) * temp_values);
-  for(int i = 0; i < num_vertices; i++) {
-    const int val_index = vi[i].value;
-    const int class = vi[i].class;
-
-    memset(colortab[class], 0xff, degree_words * sizeof(uint32_t));
-
-    int x = 0;
-    const int vivi = (val_index * val_index + val_index) / 2;
-
-    for(; x < val_index; x++) {
-      if(bitchk(mtx, vivi + x)) {
-        int c = colors[x];
-        if(c >= 0)
-          bitclr(colortab[class], c);
-      }
-    }
-
-    for(; x < temp_values; x++) {
-      int xx = (x * x + x) / 2;
-      if(bitchk(mtx, val_index + xx)) {
-        int c = colors[x];
-        if(c >= 0)
-          bitclr(colortab[class], c);
-      }
-    }
+  if(value_regframe_size(iu, iv->iv_type) == 8)
+    return RA_CLASS_REGFRAME_64;
+  return iv->iv_jit ? RA_CLASS_MACHINEREG_32 : RA_CLASS_REGFRAME_32;
+}
 
 
-    for(int j = 0 ; j < degree_words; j++) {
-      int c = __builtin_ffs(colortab[class][j]);
-      if(c == 0)
-        continue;
-      c = c - 1 + j * 32;
-      colors[val_index] = c;
-      break;
-    }
-  }
+/**
+ * Place values in machine registers or the register frame based on the
+ * colors (registers numbered per class) they were given
+ */
+static void
+reg_assign(ir_unit_t *iu, const value_info_t *vi, int num_vertices,
+           const int *colors, int temp_values, int ffv, ir_function_t *f)
+{
+  static const int class_reg_size[RA_CLASSES] = {
+    [RA_CLASS_MACHINEREG_32] = 0,
+    [RA_CLASS_REGFRAME_32] = 4,
+    [RA_CLASS_REGFRAME_64] = 8,
+  };
 
   if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_REGALLOC)
     printf("%s: Reg allocation, %d temporaries",
@@ -1546,105 +1740,233 @@ reg_alloc(ir_unit_t *iu, const uint32_t *mtx, int temp_values, int ffv,
 
   if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_REGALLOC)
     printf("\n");
-
-  for(int i = 0; i < RA_CLASSES; i++) {
-    free(colortab[i]);
-  }
-  free(vi);
 }
 
+
 /**
  *
  */
 static void
-liveness_update(ir_function_t *f, int setwords, int ffv)
+reg_alloc(ir_unit_t *iu, const uint32_t *mtx, int temp_values, int ffv,
+          ir_function_t *f)
 {
-  uint32_t *new_in  = alloca(setwords * sizeof(uint32_t));
-  uint32_t *new_out = alloca(setwords * sizeof(uint32_t));
-  ir_bb_t *ib;
-  ir_instr_t *ii;
-  int rounds = 0;
-  while(1) {
+  int num_vertices = 0;
+  int graph_degree = 0;
 
-    int stable = 1;
+  value_info_t *vi = malloc(temp_values * sizeof(value_info_t));
 
-    // Liveness analysis reach stable state a lot faster if iterating
-    // backwards
+  for(int i = 0; i < temp_values; i++) {
+    const ir_value_t *iv = value_get(iu, i + ffv);
+    if(iv->iv_class != IR_VC_TEMPORARY)
+      continue;
 
-    for(ib = TAILQ_LAST(&f->if_bbs, ir_bb_queue); ib != NULL;
-        ib = TAILQ_PREV(ib, ir_bb_queue, ib_link)) {
+    vi[num_vertices].class = reg_class(iu, iv);
+    int score = iv->iv_edges;
 
-      for(ii = TAILQ_LAST(&ib->ib_instrs, ir_instr_queue); ii != NULL;
-          ii = TAILQ_PREV(ii, ir_instr_queue, ii_link)) {
+    ir_value_instr_t *ivi;
+    LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+      if(ivi->ivi_instr->ii_class == IR_IC_BINOP)
+        score--;
+    }
 
-        const uint32_t *o;
+    vi[num_vertices].value = i;
+    vi[num_vertices].score = score;
+    graph_degree = MAX(graph_degree, iv->iv_edges);
+    num_vertices++;
+  }
 
-        if(ii->ii_num_succ == -1) {
-          ir_instr_t *succ = TAILQ_NEXT(ii, ii_link);
-          o = succ->ii_liveness + setwords * 2;
-        } else {
-          memset(new_out, 0, setwords * sizeof(uint32_t));
+  qsort(vi, num_vertices, sizeof(value_info_t), value_info_cmp);
 
-          for(int j = 0; j < ii->ii_num_succ; j++) {
-            ir_bb_t *ib = ii->ii_succ[j];
-            ir_instr_t *succ = TAILQ_FIRST(&ib->ib_instrs);
-            assert(succ != NULL);
-            const uint32_t *in = succ->ii_liveness + setwords * 2;
-            bitset_or(new_out, in, setwords);
-          }
-          o = new_out;
-        }
+  // Color graph and use color to allocate register
 
-        memcpy(new_in, o, setwords * sizeof(uint32_t));
-        if(ii->ii_ret_value < -1) {
-          // Multiple return values
-          for(int j = 0; j < -ii->ii_ret_value; j++) {
-            bitclr(new_in, ii->ii_ret_values[j] - ffv);
-          }
-        } else if(ii->ii_ret_value >= 0) {
-          bitclr(new_in, ii->ii_ret_value - ffv);
-        }
+  uint32_t *colortab[RA_CLASSES];
+  const int degree_words = (graph_degree + 32) / 32;
+  for(int i = 0; i < RA_CLASSES; i++) {
+    colortab[i] = malloc(degree_words * sizeof(uint32_t));
+  }
 
-        uint32_t       *out = ii->ii_liveness;
-        const uint32_t *gen = ii->ii_liveness + setwords;
-        uint32_t       *in  = ii->ii_liveness + setwords * 2;
+  int *colors = malloc(sizeof(int) * temp_values);
+  memset(colors, 0xff, sizeof(int) * temp_values);
+  for(int i = 0; i < num_vertices; i++) {
+    const int val_index = vi[i].value;
+    const int class = vi[i].class;
 
-        bitset_or(new_in, gen, setwords);
+    memset(colortab[class], 0xff, degree_words * sizeof(uint32_t));
 
-        if(!memcmp(out, o,       setwords * sizeof(uint32_t)) &&
-           !memcmp(in,  new_in,  setwords * sizeof(uint32_t)))
-          continue;
+    int x = 0;
+    const int vivi = (val_index * val_index + val_index) / 2;
 
-        stable = 0;
-        memcpy(out, o,       setwords * sizeof(uint32_t));
-        memcpy(in,  new_in,  setwords * sizeof(uint32_t));
+    for(; x < val_index; x++) {
+      if(bitchk(mtx, vivi + x)) {
+        int c = colors[x];
+        if(c >= 0)
+          bitclr(colortab[class], c);
       }
     }
-    rounds++;
-    if(stable)
+
+    for(; x < temp_values; x++) {
+      int xx = (x * x + x) / 2;
+      if(bitchk(mtx, val_index + xx)) {
+        int c = colors[x];
+        if(c >= 0)
+          bitclr(colortab[class], c);
+      }
+    }
+
+
+    for(int j = 0 ; j < degree_words; j++) {
+      int c = __builtin_ffs(colortab[class][j]);
+      if(c == 0)
+        continue;
+      c = c - 1 + j * 32;
+      colors[val_index] = c;
       break;
+    }
   }
-}
 
+  reg_assign(iu, vi, num_vertices, colors, temp_values, ffv, f);
+
+  for(int i = 0; i < RA_CLASSES; i++) {
+    free(colortab[i]);
+  }
+  free(colors);
+  free(vi);
+}
 
 
 /**
- *
+ * Rewrite all instructions using 'killed' to use 'saved' instead
  */
-static void __attribute__((unused))
-print_liveout(ir_unit_t *iu, ir_function_t *f, int temp_values, int ffv)
+static void
+coalesce_value(ir_unit_t *iu, ir_value_t *killed, ir_value_t *saved)
 {
-  ir_bb_t *ib;
-  ir_instr_t *ii;
+  ir_value_instr_t *ivi, *ivin;
+  for(ivi = LIST_FIRST(&killed->iv_instructions); ivi != NULL; ivi = ivin) {
+    ivin = LIST_NEXT(ivi, ivi_value_link);
 
-  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
-    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
-      instr_print(iu, ii, 0);
+    if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_REGALLOC) {
+      printf("\t Pre altering instruction ");
+      instr_print(iu, ivi->ivi_instr, 1);
       printf("\n");
-      for(int j = 0; j < temp_values; j++)
-        if(bitchk(ii->ii_liveness, j))
-          printf("\tLiveout: %s\n", value_str_id(iu, j + ffv));
     }
+
+    instr_replace_values(ivi->ivi_instr, iu, killed->iv_id, saved->iv_id);
+    LIST_REMOVE(ivi, ivi_value_link);
+    ivi->ivi_value = saved;
+    LIST_INSERT_HEAD(&saved->iv_instructions, ivi, ivi_value_link);
+
+    if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_REGALLOC) {
+      printf("\tPost altering instruction ");
+      instr_print(iu, ivi->ivi_instr, 1);
+      printf("\n");
+    }
+  }
+}
+
+
+#ifdef VMIR_VM_JIT
+/**
+ * JIT segments need the values live out of their last instruction.
+ * Liveness is recomputed as coalescing has renamed values and removed
+ * moves, and the live-out set is saved for the last instruction of
+ * each segment only
+ */
+static void
+jit_liveness(ir_unit_t *iu, ir_function_t *f, int setwords, int temp_values)
+{
+  struct liveness_vec gen = {0};
+  uint32_t *bs = malloc(setwords * sizeof(uint32_t));
+  liveness_t lv;
+  ir_instr_t *ii, *next;
+
+  liveness_compute(iu, f, temp_values, &lv);
+
+  for(int b = 0; b < lv.lv_num_bbs; b++) {
+    ir_bb_t *ib = lv.lv_bbs[b];
+
+    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link)
+      jit_check(iu, ii);
+
+    liveness_out(&lv, ib, bs, setwords);
+    for(ii = TAILQ_LAST(&ib->ib_instrs, ir_instr_queue), next = NULL;
+        ii != NULL; next = ii, ii = TAILQ_PREV(ii, ir_instr_queue, ii_link)) {
+      if(ii->ii_jit && (next == NULL || !next->ii_jit)) {
+        ii->ii_liveness = arena_alloc(f->if_arena,
+                                      setwords * sizeof(uint32_t));
+        memcpy(ii->ii_liveness, bs, setwords * sizeof(uint32_t));
+      }
+      liveness_step(iu, ii, bs, &gen);
+    }
+  }
+
+  liveness_free(&lv);
+  VECTOR_CLEAR(&gen);
+  free(bs);
+}
+#endif
+
+
+/**
+ * Called when moves have been coalesced, before registers are allocated
+ */
+static void
+coalesce_finish(ir_unit_t *iu, ir_function_t *f, int setwords,
+                int temp_values)
+{
+  remove_empty_bb(iu, f);
+
+#ifdef VMIR_VM_JIT
+  if(!(iu->iu_debug_flags_func & VMIR_DBG_DISABLE_JIT)) {
+    jit_liveness(iu, f, setwords, temp_values);
+    jit_analyze(iu, f);
+  }
+#endif
+}
+
+
+/**
+ * Add interference edges between the outputs of 'ii' and the values
+ * live out of it in 'out'
+ */
+static void
+coalesce_interfere(ir_unit_t *iu, uint32_t *mtx, ir_instr_t *ii,
+                   const uint32_t *out, int setwords, int ffv)
+{
+  int num_ret_values;
+  const int *ret_values;
+  if(ii->ii_ret_value < -1) {
+    ret_values = ii->ii_ret_values;
+    num_ret_values = -ii->ii_ret_value;
+  } else {
+    ret_values = &ii->ii_ret_value;
+    num_ret_values = 1;
+  }
+  int v = -1;
+
+  if(ii->ii_class == IR_IC_MOVE)
+    v = ((ir_instr_move_t *)ii)->value - ffv;
+
+  for(int a = 0; a < num_ret_values; a++) {
+    int x = ret_values[a];
+    ir_value_t *xval = value_get(iu, x);
+    x-= ffv;
+    int edges = 0;
+    for(int j = 0; j < setwords; j++) {
+      uint32_t w = out[j];
+      while(w) {
+        int b = ffs(w) - 1;
+        int y = (j << 5) + b;
+        w &= ~(1 << b);
+        if(y != x && y != v) {
+          if(!tribitmtx_get(mtx, x, y)) {
+            tribitmtx_set(mtx, x, y);
+            edges++;
+            iu->iu_values.vh_p[y + ffv]->iv_edges++;
+          }
+        }
+      }
+    }
+    xval->iv_edges += edges;
   }
 }
 
@@ -1653,12 +1975,14 @@ print_liveout(ir_unit_t *iu, ir_function_t *f, int temp_values, int ffv)
  *
  */
 static void
-coalesce(ir_unit_t *iu,
+coalesce(ir_unit_t *iu, const liveness_t *lv,
          int setwords, int temp_values,
          int ffv, ir_function_t *f)
 {
   // Interference Matrix
   uint32_t *mtx = tribitmtx_alloc(temp_values);
+  uint32_t *live = malloc(setwords * sizeof(uint32_t));
+  struct liveness_vec gen = {0};
   ir_bb_t *ib;
   ir_instr_t *ii, *iin;
 
@@ -1668,52 +1992,22 @@ coalesce(ir_unit_t *iu,
    *
    * Any move instruction a <- b add interference for (a, {liveout} - b)
    *
+   * The live-out set of each instruction is tracked while walking
+   * backwards from the end of its block
    */
-  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
-    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
-      if(ii->ii_ret_value == -1)
-        continue;
-
-      int num_ret_values;
-      const int *ret_values;
-      if(ii->ii_ret_value < -1) {
-        ret_values = ii->ii_ret_values;
-        num_ret_values = -ii->ii_ret_value;
-      } else {
-        ret_values = &ii->ii_ret_value;
-        num_ret_values = 1;
-      }
-      int v = -1;
-
-      if(ii->ii_class == IR_IC_MOVE)
-        v = ((ir_instr_move_t *)ii)->value - ffv;
-
-      const uint32_t *out = ii->ii_liveness;
-
-      for(int a = 0; a < num_ret_values; a++) {
-        int x = ret_values[a];
-        ir_value_t *xval = value_get(iu, x);
-        x-= ffv;
-        int edges = 0;
-        for(int j = 0; j < setwords; j++) {
-          uint32_t w = out[j];
-          while(w) {
-            int b = ffs(w) - 1;
-            int y = (j << 5) + b;
-            w &= ~(1 << b);
-            if(y != x && y != v) {
-              if(!tribitmtx_get(mtx, x, y)) {
-                tribitmtx_set(mtx, x, y);
-                edges++;
-                iu->iu_values.vh_p[y + ffv]->iv_edges++;
-              }
-            }
-          }
-        }
-        xval->iv_edges += edges;
-      }
+  for(int b = 0; b < lv->lv_num_bbs; b++) {
+    ib = lv->lv_bbs[b];
+    liveness_out(lv, ib, live, setwords);
+
+    for(ii = TAILQ_LAST(&ib->ib_instrs, ir_instr_queue); ii != NULL;
+        ii = TAILQ_PREV(ii, ir_instr_queue, ii_link)) {
+      if(ii->ii_ret_value != -1)
+        coalesce_interfere(iu, mtx, ii, live, setwords, ffv);
+      liveness_step(iu, ii, live, &gen);
     }
   }
+  free(live);
+  VECTOR_CLEAR(&gen);
 
   /*
    * Find values that can be coalesced.
@@ -1763,37 +2057,7 @@ coalesce(ir_unit_t *iu,
             printf("\n");
           }
 
-          ir_value_instr_t *ivi, *ivin;
-          for(ivi = LIST_FIRST(&killed->iv_instructions); ivi != NULL;
-              ivi = ivin) {
-            ivin = LIST_NEXT(ivi, ivi_value_link);
-
-            if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_REGALLOC) {
-              printf("\t Pre altering instruction ");
-              instr_print(iu, ivi->ivi_instr, 1);
-              printf("\n");
-            }
-
-            instr_replace_values(ivi->ivi_instr, iu, killed->iv_id,
-                                 saved->iv_id);
-            LIST_REMOVE(ivi, ivi_value_link);
-            ivi->ivi_value = saved;
-            LIST_INSERT_HEAD(&saved->iv_instructions, ivi, ivi_value_link);
-
-#ifdef VMIR_VM_JIT
-            if(!(iu->iu_debug_flags_func & VMIR_DBG_DISABLE_JIT)) {
-              memset(ivi->ivi_instr->ii_liveness + setwords,
-                     0, setwords * sizeof(uint32_t));
-              liveness_set_gen(ivi->ivi_instr, iu,
-                               ivi->ivi_instr->ii_liveness + setwords);
-            }
-#endif
-            if(iu->iu_debug_flags_func & VMIR_DBG_DUMP_REGALLOC) {
-              printf("\tPost altering instruction ");
-              instr_print(iu, ivi->ivi_instr, 1);
-              printf("\n");
-            }
-          }
+          coalesce_value(iu, killed, saved);
 
           // Merge nodes in interference matrix
           for(int i = 0; i < temp_values; i++) {
@@ -1818,17 +2082,7 @@ coalesce(ir_unit_t *iu,
     }
   }
 
-  remove_empty_bb(iu, f);
-
-#ifdef VMIR_VM_JIT
-  if(!(iu->iu_debug_flags_func & VMIR_DBG_DISABLE_JIT)) {
-    liveness_update(f, setwords, ffv);
-
-    if(0)
-      print_liveout(iu, f, temp_values, ffv);
-    jit_analyze(iu, f);
-  }
-#endif
+  coalesce_finish(iu, f, setwords, temp_values);
 
   reg_alloc(iu, mtx, temp_values, ffv, f);
   free(mtx);
@@ -1836,111 +2090,208 @@ coalesce(ir_unit_t *iu,
 
 
 /**
+ * Linear scan register allocation
+ *
+ * Used instead of coalesce() and reg_alloc() for large functions as the
+ * interference matrix grows with the square of the number of values.
+ * Instructions are numbered in block order with two points each, one
+ * where inputs are read and one where outputs are written. The live
+ * interval of a value is the sorted list of ranges of points where it
+ * is live, so values living in holes of each other can share register.
  *
+ * Moves are coalesced if the intervals of the source and destination
+ * don't overlap. Intervals are then allocated in order of their start,
+ * each getting the lowest register of its class that is not used by an
+ * active interval or an inactive interval (one in a hole) it overlaps
  */
-static void
-liveness_analysis(ir_unit_t *iu, ir_function_t *f)
-{
-  /* First function value is the value index for the first argument
-   * or first temporary in case of functions with no arguments
-   */
-  const int ffv = iu->iu_first_func_value;
-  int temp_values = iu->iu_next_value - ffv;
 
-  // words needed for the value sets
-  int setwords = (temp_values + 31) / 32;
+typedef struct lsra_range {
+  int lr_start;
+  int lr_end;   // Inclusive
+  int lr_next;  // Next range of the interval, -1 if last
+} lsra_range_t;
 
-  ir_bb_t *ib;
-  ir_instr_t *ii;
+typedef struct lsra {
+  VECTOR_HEAD(, lsra_range_t) ls_ranges;
+  int *ls_first;   // First range of each value, -1 if never live
+  int *ls_cursor;  // First range not ending before the current position
+} lsra_t;
 
-  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
-    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
-      ii->ii_liveness = calloc(1, sizeof(uint32_t) * setwords * 3);
-      liveness_set_gen(ii, iu, ii->ii_liveness + setwords);
-      liveness_set_succ(f, ii);
+#define LSRA_EXPIRED  0
+#define LSRA_ACTIVE   1
+#define LSRA_INACTIVE 2
+
+
+/**
+ * Ranges are built backwards so they must be added in reverse order of
+ * their start
+ */
+static void
+lsra_add_range(lsra_t *ls, int value, int start, int end)
+{
+  const int f = ls->ls_first[value];
+  if(f != -1) {
+    lsra_range_t *lr = &VECTOR_ITEM(&ls->ls_ranges, f);
+    if(lr->lr_start <= end + 1) {
+      lr->lr_start = MIN(lr->lr_start, start);
+      lr->lr_end = MAX(lr->lr_end, end);
+      return;
     }
   }
 
-  liveness_update(f, setwords, ffv);
+  const lsra_range_t lr = {start, end, f};
+  ls->ls_first[value] = VECTOR_LEN(&ls->ls_ranges);
+  VECTOR_PUSH_BACK(&ls->ls_ranges, lr);
+}
 
-  if(0)
-    print_liveout(iu, f, temp_values, ffv);
 
-  coalesce(iu, setwords, temp_values, ffv, f);
+/**
+ * 'value' is written at 'pos'. If it's live after that its first range
+ * starts here, otherwise it still occupies a register while written
+ */
+static void
+lsra_add_output(lsra_t *ls, ir_unit_t *iu, uint32_t *live, int value,
+                int ffv, int pos)
+{
+  if(value_get(iu, value)->iv_class != IR_VC_TEMPORARY)
+    return;
+  value -= ffv;
+  if(bitchk(live, value)) {
+    VECTOR_ITEM(&ls->ls_ranges, ls->ls_first[value]).lr_start = pos;
+    bitclr(live, value);
+  } else {
+    lsra_add_range(ls, value, pos, pos);
+  }
 }
 
 
 /**
- *
+ * Build intervals by walking blocks and instructions backwards, starting
+ * with ranges covering the whole block for values live out of it that
+ * are cut short where the values are written.
+ * Outputs are included even if they are never used as they are still
+ * written
  */
-static int
-prepare_call(ir_unit_t *iu, ir_function_t *f, ir_instr_call_t *ii)
+static void
+lsra_build(lsra_t *ls, ir_unit_t *iu, const liveness_t *lv, int setwords,
+           int ffv)
 {
-  int callpos = 0;
-  int stackgrowth = 0;
-  for(int i = 0; i < ii->argc; i++) {
-    ir_value_t *a = value_get(iu, ii->argv[i].value);
-    int size = value_regframe_size(iu, a->iv_type);
+  struct liveness_vec gen = {0};
+  uint32_t *live = malloc(setwords * sizeof(uint32_t));
+  int *bb_pos = malloc((lv->lv_num_bbs + 1) * sizeof(int));
+  ir_instr_t *ii;
+  int pos = 0;
 
-    callpos += size;
-    int ca_index = value_alloc_call_arg(iu, a->iv_type, -callpos);
+  for(int b = 0; b < lv->lv_num_bbs; b++) {
+    bb_pos[b] = pos;
+    TAILQ_FOREACH(ii, &lv->lv_bbs[b]->ib_instrs, ii_link)
+      pos += 2;
+  }
+  bb_pos[lv->lv_num_bbs] = pos;
+
+  for(int b = lv->lv_num_bbs - 1; b >= 0; b--) {
+    const ir_bb_t *ib = lv->lv_bbs[b];
+    const int from = bb_pos[b];
+    pos = bb_pos[b + 1] - 2;
+
+    liveness_out(lv, ib, live, setwords);
+    for(int j = 0; j < setwords; j++) {
+      uint32_t w = live[j];
+      while(w) {
+        const int x = ffs(w) - 1;
+        w &= ~(1 << x);
+        lsra_add_range(ls, (j << 5) + x, from, pos + 1);
+      }
+    }
 
-    if(ii->argv[i].copy_size) {
-      a = value_get(iu, ii->argv[i].value);
-      ir_instr_stackcopy_t *stackcopy =
-        instr_add_before(sizeof(ir_instr_stackcopy_t), IR_IC_STACKCOPY,
-                         &ii->super);
-      stackcopy->super.ii_ret_value = ca_index;
-      stackcopy->value = ii->argv[i].value;
-      stackcopy->size = ii->argv[i].copy_size;
-      stackgrowth += stackcopy->size;
+    for(ii = TAILQ_LAST(&ib->ib_instrs, ir_instr_queue); ii != NULL;
+        ii = TAILQ_PREV(ii, ir_instr_queue, ii_link), pos -= 2) {
 
-    } else {
-      ir_instr_move_t *move =
-        instr_add_before(sizeof(ir_instr_move_t), IR_IC_MOVE, &ii->super);
-      move->super.ii_ret_value = ca_index;
-      move->value = ii->argv[i].value;
-    }
+      if(ii->ii_ret_value < -1) {
+        for(int i = 0; i < -ii->ii_ret_value; i++)
+          lsra_add_output(ls, iu, live, ii->ii_ret_values[i], ffv, pos + 1);
+      } else if(ii->ii_ret_value >= 0) {
+        lsra_add_output(ls, iu, live, ii->ii_ret_value, ffv, pos + 1);
+      }
 
-    ii->argv[i].value = ca_index;
+      VECTOR_RESIZE(&gen, 0);
+      liveness_gen(ii, iu, &gen);
+      for(int i = 0; i < VECTOR_LEN(&gen); i++) {
+        const int v = VECTOR_ITEM(&gen, i);
+        lsra_add_range(ls, v, from, pos);
+        bitset(live, v);
+      }
+    }
   }
 
-  ir_function_t *callee = value_function(iu, ii->callee);
-  if(callee != NULL)
-    callee->if_used = 1;
+  free(bb_pos);
+  free(live);
+  VECTOR_CLEAR(&gen);
+}
 
-  if(stackgrowth > 0) {
-    ir_instr_stackshrink_t *ss =
-      instr_add_after(sizeof(ir_instr_stackshrink_t), IR_IC_STACKSHRINK,
-                      &ii->super);
-      ss->super.ii_ret_value = -1;
-      ss->size = stackgrowth;
+
+/**
+ * Returns true if the ranges starting at 'a' and 'b' overlap
+ */
+static int
+lsra_overlap(const lsra_t *ls, int a, int b)
+{
+  while(a != -1 && b != -1) {
+    const lsra_range_t *x = &VECTOR_ITEM(&ls->ls_ranges, a);
+    const lsra_range_t *y = &VECTOR_ITEM(&ls->ls_ranges, b);
+    if(x->lr_end < y->lr_start)
+      a = x->lr_next;
+    else if(y->lr_end < x->lr_start)
+      b = y->lr_next;
+    else
+      return 1;
   }
-  return callpos;
+  return 0;
 }
 
 
 /**
- *
+ * Merge the interval of 'from' into 'to'
  */
-static int
-prepare_calls(ir_unit_t *iu, ir_function_t *f)
+static void
+lsra_merge(lsra_t *ls, int to, int from)
 {
-  ir_bb_t *bb;
+  int a = ls->ls_first[to];
+  int b = ls->ls_first[from];
+  int last = -1;
+  ls->ls_first[to] = -1;
+  ls->ls_first[from] = -1;
+
+  while(a != -1 || b != -1) {
+    const lsra_range_t *x = a != -1 ? &VECTOR_ITEM(&ls->ls_ranges, a) : NULL;
+    const lsra_range_t *y = b != -1 ? &VECTOR_ITEM(&ls->ls_ranges, b) : NULL;
+    lsra_range_t lr;
+
+    if(y == NULL || (x != NULL && x->lr_start < y->lr_start)) {
+      lr = *x;
+      a = x->lr_next;
+    } else {
+      lr = *y;
+      b = y->lr_next;
+    }
 
-  iu->iu_first_call_arg = iu->iu_next_value;
-  int max_call_arg_size = 0;
-  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
-    ir_instr_t *ii;
-    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link) {
-      if(ii->ii_class == IR_IC_CALL) {
-        int s = prepare_call(iu, f, (ir_instr_call_t *)ii);
-        max_call_arg_size = MAX(max_call_arg_size, s);
+    if(last != -1) {
+      lsra_range_t *l = &VECTOR_ITEM(&ls->ls_ranges, last);
+      if(l->lr_end >= lr.lr_start - 1) {
+        l->lr_end = MAX(l->lr_end, lr.lr_end);
+        continue;
       }
     }
-  }
 
-  return max_call_arg_size;
+    const int r = VECTOR_LEN(&ls->ls_ranges);
+    lr.lr_next = -1;
+    VECTOR_PUSH_BACK(&ls->ls_ranges, lr);
+    if(last != -1)
+      VECTOR_ITEM(&ls->ls_ranges, last).lr_next = r;
+    else
+      ls->ls_first[to] = r;
+    last = r;
+  }
 }
 
 
@@ -1948,45 +2299,347 @@ prepare_calls(ir_unit_t *iu, ir_function_t *f)
  *
  */
 static void
-value_alloc_registers(ir_unit_t *iu, ir_function_t *f, int call_arg_size)
+lsra_coalesce(lsra_t *ls, ir_unit_t *iu, ir_function_t *f, int ffv)
 {
-#if 0
-  for(int i = iu->iu_first_func_value; i < iu->iu_next_value; i++) {
-    ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, i);
-    if(iv->iv_class != IR_VC_TEMPORARY)
-      continue;
-    value_make_regframe_space(iu, iv);
-    iv->iv_class = IR_VC_REGFRAME;
-  }
-#endif
+  ir_bb_t *ib;
+  ir_instr_t *ii, *iin;
 
-  f->if_regframe_size += call_arg_size;
+  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
+    for(ii = TAILQ_FIRST(&ib->ib_instrs); ii != NULL; ii = iin) {
+      iin = TAILQ_NEXT(ii, ii_link);
 
-  for(int i = iu->iu_first_func_value; i < iu->iu_next_value; i++) {
-    ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, i);
-    if(iv->iv_class != IR_VC_CALL_ARGUMENT)
-      continue;
-    iv->iv_reg += f->if_regframe_size;
-    iv->iv_class = IR_VC_REGFRAME;
+      if(ii->ii_class != IR_IC_MOVE)
+        continue;
+      const int v = ((ir_instr_move_t *)ii)->value;
+      if(v < ffv)
+        continue;
+      ir_value_t *src = VECTOR_ITEM(&iu->iu_values, v);
+      if(src->iv_class != IR_VC_TEMPORARY)
+        continue;
+      ir_value_t *dst = VECTOR_ITEM(&iu->iu_values, ii->ii_ret_value);
+
+      if(dst == src) {
+        instr_destroy(ii);
+        iu->iu_stats.moves_killed++;
+        continue;
+      }
+
+      assert(dst->iv_class == IR_VC_TEMPORARY);
+
+      if(lsra_overlap(ls, ls->ls_first[dst->iv_id - ffv],
+                      ls->ls_first[v - ffv]))
+        continue;
+
+      coalesce_value(iu, src, dst);
+      lsra_merge(ls, dst->iv_id - ffv, v - ffv);
+      src->iv_class = IR_VC_DEAD;
+      iu->iu_stats.moves_killed++;
+      instr_destroy(ii);
+    }
   }
 }
 
 
 /**
- *
+ * Returns the state of the interval of 'value' at 'pos'. Positions
+ * must be increasing
  */
-static ir_instr_t *
-combine_get_upstream_instruction(ir_unit_t *iu, int value, ir_instr_t *target)
+static int
+lsra_state(lsra_t *ls, int value, int pos)
 {
-  ir_value_t *iv = value_get(iu, value);
-  if(iv->iv_class != IR_VC_TEMPORARY)
-    return NULL;
+  int r = ls->ls_cursor[value];
+  while(r != -1 && VECTOR_ITEM(&ls->ls_ranges, r).lr_end < pos)
+    r = VECTOR_ITEM(&ls->ls_ranges, r).lr_next;
+  ls->ls_cursor[value] = r;
+
+  if(r == -1)
+    return LSRA_EXPIRED;
+  return VECTOR_ITEM(&ls->ls_ranges, r).lr_start <= pos ?
+    LSRA_ACTIVE : LSRA_INACTIVE;
+}
 
-  ir_instr_t *upstream = NULL;
-  ir_value_instr_t *ivi;
-  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
-    switch(ivi->ivi_relation) {
-    case IVI_OUTPUT:
+
+/**
+ *
+ */
+static void
+lsra_alloc(lsra_t *ls, ir_unit_t *iu, int temp_values, int ffv,
+           ir_function_t *f)
+{
+  value_info_t *vi = malloc(temp_values * sizeof(value_info_t));
+  int num_vertices = 0;
+
+  for(int i = 0; i < temp_values; i++) {
+    const ir_value_t *iv = value_get(iu, i + ffv);
+    if(iv->iv_class != IR_VC_TEMPORARY)
+      continue;
+    const int r = ls->ls_first[i];
+    vi[num_vertices].value = i;
+    vi[num_vertices].class = reg_class(iu, iv);
+    vi[num_vertices].score =
+      r == -1 ? 0 : VECTOR_ITEM(&ls->ls_ranges, r).lr_start;
+    num_vertices++;
+  }
+
+  qsort(vi, num_vertices, sizeof(value_info_t), value_info_cmp);
+
+  int *colors = malloc(sizeof(int) * temp_values);
+  int *active = malloc(sizeof(int) * num_vertices);
+  int *inactive = malloc(sizeof(int) * num_vertices);
+  const int words = num_vertices / 32 + 1;
+  uint32_t *used = calloc(words, sizeof(uint32_t));
+
+  for(int c = 0; c < RA_CLASSES; c++) {
+    int num_active = 0, num_inactive = 0;
+
+    for(int i = 0; i < num_vertices; i++) {
+      if(vi[i].class != c)
+        continue;
+      const int cur = vi[i].value;
+      const int pos = vi[i].score;
+
+      ls->ls_cursor[cur] = ls->ls_first[cur];
+      if(ls->ls_first[cur] == -1) {
+        colors[cur] = 0; // Never live
+        continue;
+      }
+
+      for(int j = 0; j < num_active; j++) {
+        const int v = active[j];
+        switch(lsra_state(ls, v, pos)) {
+        case LSRA_INACTIVE:
+          inactive[num_inactive++] = v;
+          // FALLTHRU
+        case LSRA_EXPIRED:
+          active[j--] = active[--num_active];
+          break;
+        }
+      }
+
+      for(int j = 0; j < num_inactive; j++) {
+        const int v = inactive[j];
+        switch(lsra_state(ls, v, pos)) {
+        case LSRA_ACTIVE:
+          active[num_active++] = v;
+          // FALLTHRU
+        case LSRA_EXPIRED:
+          inactive[j--] = inactive[--num_inactive];
+          break;
+        }
+      }
+
+      for(int j = 0; j < num_active; j++)
+        bitset(used, colors[active[j]]);
+      for(int j = 0; j < num_inactive; j++) {
+        const int v = inactive[j];
+        if(lsra_overlap(ls, ls->ls_cursor[v], ls->ls_first[cur]))
+          bitset(used, colors[v]);
+      }
+
+      int color = 0;
+      while(bitchk(used, color))
+        color++;
+      colors[cur] = color;
+      active[num_active++] = cur;
+
+      for(int j = 0; j < num_active; j++)
+        bitclr(used, colors[active[j]]);
+      for(int j = 0; j < num_inactive; j++)
+        bitclr(used, colors[inactive[j]]);
+    }
+  }
+
+  reg_assign(iu, vi, num_vertices, colors, temp_values, ffv, f);
+
+  free(used);
+  free(inactive);
+  free(active);
+  free(colors);
+  free(vi);
+}
+
+
+/**
+ *
+ */
+static void
+linear_scan(ir_unit_t *iu, const liveness_t *lv, int setwords,
+            int temp_values, int ffv, ir_function_t *f)
+{
+  lsra_t ls = {0};
+
+  ls.ls_first = malloc(sizeof(int) * temp_values * 2);
+  ls.ls_cursor = ls.ls_first + temp_values;
+  memset(ls.ls_first, 0xff, sizeof(int) * temp_values);
+
+  lsra_build(&ls, iu, lv, setwords, ffv);
+  lsra_coalesce(&ls, iu, f, ffv);
+  coalesce_finish(iu, f, setwords, temp_values);
+  lsra_alloc(&ls, iu, temp_values, ffv, f);
+
+  free(ls.ls_first);
+  VECTOR_CLEAR(&ls.ls_ranges);
+  iu->iu_stats.linear_scan_functions++;
+}
+
+
+/**
+ *
+ */
+static void
+liveness_analysis(ir_unit_t *iu, ir_function_t *f)
+{
+  /* First function value is the value index for the first argument
+   * or first temporary in case of functions with no arguments
+   */
+  const int ffv = iu->iu_first_func_value;
+  int temp_values = iu->iu_next_value - ffv;
+
+  // words needed for the value sets
+  int setwords = (temp_values + 31) / 32;
+
+  ir_bb_t *ib;
+  ir_instr_t *ii;
+  liveness_t lv;
+
+  TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
+    TAILQ_FOREACH(ii, &ib->ib_instrs, ii_link) {
+      liveness_set_succ(f, ii);
+    }
+  }
+
+  liveness_compute(iu, f, temp_values, &lv);
+
+  if(0)
+    print_livein(iu, &lv);
+
+  if(iu->iu_linear_scan_threshold >= 0 &&
+     temp_values >= iu->iu_linear_scan_threshold)
+    linear_scan(iu, &lv, setwords, temp_values, ffv, f);
+  else
+    coalesce(iu, &lv, setwords, temp_values, ffv, f);
+
+  liveness_free(&lv);
+}
+
+
+/**
+ *
+ */
+static int
+prepare_call(ir_unit_t *iu, ir_function_t *f, ir_instr_call_t *ii)
+{
+  int callpos = 0;
+  int stackgrowth = 0;
+  for(int i = 0; i < ii->argc; i++) {
+    ir_value_t *a = value_get(iu, ii->argv[i].value);
+    int size = value_regframe_size(iu, a->iv_type);
+
+    callpos += size;
+    int ca_index = value_alloc_call_arg(iu, a->iv_type, -callpos);
+
+    if(ii->argv[i].copy_size) {
+      a = value_get(iu, ii->argv[i].value);
+      ir_instr_stackcopy_t *stackcopy =
+        instr_add_before(sizeof(ir_instr_stackcopy_t), IR_IC_STACKCOPY,
+                         &ii->super);
+      stackcopy->super.ii_ret_value = ca_index;
+      stackcopy->value = ii->argv[i].value;
+      stackcopy->size = ii->argv[i].copy_size;
+      stackgrowth += stackcopy->size;
+
+    } else {
+      ir_instr_move_t *move =
+        instr_add_before(sizeof(ir_instr_move_t), IR_IC_MOVE, &ii->super);
+      move->super.ii_ret_value = ca_index;
+      move->value = ii->argv[i].value;
+    }
+
+    ii->argv[i].value = ca_index;
+  }
+
+  ir_function_t *callee = value_function(iu, ii->callee);
+  if(callee != NULL)
+    callee->if_used = 1;
+
+  if(stackgrowth > 0) {
+    ir_instr_stackshrink_t *ss =
+      instr_add_after(sizeof(ir_instr_stackshrink_t), IR_IC_STACKSHRINK,
+                      &ii->super);
+      ss->super.ii_ret_value = -1;
+      ss->size = stackgrowth;
+  }
+  return callpos;
+}
+
+
+/**
+ *
+ */
+static int
+prepare_calls(ir_unit_t *iu, ir_function_t *f)
+{
+  ir_bb_t *bb;
+
+  iu->iu_first_call_arg = iu->iu_next_value;
+  int max_call_arg_size = 0;
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
+    ir_instr_t *ii;
+    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link) {
+      if(ii->ii_class == IR_IC_CALL) {
+        int s = prepare_call(iu, f, (ir_instr_call_t *)ii);
+        max_call_arg_size = MAX(max_call_arg_size, s);
+      }
+    }
+  }
+
+  return max_call_arg_size;
+}
+
+
+/**
+ *
+ */
+static void
+value_alloc_registers(ir_unit_t *iu, ir_function_t *f, int call_arg_size)
+{
+#if 0
+  for(int i = iu->iu_first_func_value; i < iu->iu_next_value; i++) {
+    ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, i);
+    if(iv->iv_class != IR_VC_TEMPORARY)
+      continue;
+    value_make_regframe_space(iu, iv);
+    iv->iv_class = IR_VC_REGFRAME;
+  }
+#endif
+
+  f->if_regframe_size += call_arg_size;
+
+  for(int i = iu->iu_first_func_value; i < iu->iu_next_value; i++) {
+    ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, i);
+    if(iv->iv_class != IR_VC_CALL_ARGUMENT)
+      continue;
+    iv->iv_reg += f->if_regframe_size;
+    iv->iv_class = IR_VC_REGFRAME;
+  }
+}
+
+
+/**
+ *
+ */
+static ir_instr_t *
+combine_get_upstream_instruction(ir_unit_t *iu, int value, ir_instr_t *target)
+{
+  ir_value_t *iv = value_get(iu, value);
+  if(iv->iv_class != IR_VC_TEMPORARY)
+    return NULL;
+
+  ir_instr_t *upstream = NULL;
+  ir_value_instr_t *ivi;
+  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+    switch(ivi->ivi_relation) {
+    case IVI_OUTPUT:
       if(upstream != NULL)
         parser_error(iu, "Multiplte writes to temporary in instr-combine");
       upstream = ivi->ivi_instr;
@@ -2214,7 +2867,7 @@ combine_instructions(ir_unit_t *iu, ir_function_t *f)
       iin = TAILQ_NEXT(ii, ii_link);
       if(ii->ii_class == IR_IC_BINOP)
         combine_binop(iu, (ir_instr_binary_t *)ii);
-      if(ii->ii_class == IR_IC_CAST)
+      else if(ii->ii_class == IR_IC_CAST)
         combine_binop_cast(iu, (ir_instr_unary_t *)ii);
     }
   }
@@ -2240,7 +2893,8 @@ registrate_aggregate(ir_unit_t *iu, ir_value_t *iv, int num_values)
     switch(rel) {
     case IVI_OUTPUT:
       // Instructions writing to this value get a multiple return value array
-      ii->ii_ret_values = malloc(sizeof(int) * num_values);
+      ii->ii_ret_values = arena_alloc(ii->ii_bb->ib_arena,
+                                      sizeof(int) * num_values);
       memcpy(ii->ii_ret_values, values, sizeof(int) * num_values);
       ii->ii_ret_value = -num_values;
 
@@ -2360,16 +3014,3586 @@ legalize_values(ir_unit_t *iu, ir_function_t *f)
 
 
 /**
+ * Inlining
  *
+ * Calls to small functions are replaced with a copy of the callee's
+ * body. The body is parsed again from the bitcode saved at load time
+ * (see function_parse_inline()) so only callees that appear before the
+ * caller in the bitcode can be inlined, unless the caller is compiled
+ * again when tiering up or compiled lazily. This runs before anything else in
+ * transform_function() so the inlined blocks are still in SSA form and
+ * all later passes see them as part of the caller.
  */
-static void
-transform_function(ir_unit_t *iu, ir_function_t *f)
+
+#define INLINE_SIZE_DEFAULT 16 // Max instructions of inlined functions
+#define INLINE_HOT_FACTOR   4  // Size limit multiplier for hot callees
+#define INLINE_GROWTH       4  // Max growth of function by inlining
+#define INLINE_MAX_GROWTH   1024 // Max instructions added to a function
+#define INLINE_MAX_CALLS    64 // Max calls inlined into a function
+
+
+/**
+ * Returns number of instructions in function in 'sizep' and if the
+ * function can be inlined
+ */
+static int
+inline_analyze(ir_unit_t *iu, ir_function_t *f, int *sizep)
 {
-  replace_instructions(iu, f);
+  const ir_type_t *it = type_get(iu, f->if_type);
+  int ok = !it->it_function.varargs;
 
-  function_bind_instr_inputs(iu, f);
+  switch(type_get(iu, it->it_function.return_type)->it_code) {
+  case IR_TYPE_STRUCT:
+  case IR_TYPE_ARRAY:
+    ok = 0;
+    break;
+  default:
+    break;
+  }
 
-  construct_cfg(f);
+  int size = 0;
+  int returns = 0;
+  ir_bb_t *bb;
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
+    ir_instr_t *ii;
+    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link) {
+      switch(ii->ii_class) {
+      case IR_IC_ALLOCA:
+      case IR_IC_VAARG:
+        ok = 0;
+        break;
+      case IR_IC_RET:
+        returns++;
+        break;
+      default:
+        break;
+      }
+      size++;
+    }
+  }
+  *sizep = size;
+  return ok && returns;
+}
+
+
+/**
+ * Returns the callee if 'call' can be inlined into 'f'
+ */
+static ir_function_t *
+inline_candidate(ir_unit_t *iu, ir_function_t *f, ir_instr_call_t *call)
+{
+  ir_function_t *callee = value_function(iu, call->callee);
+  if(callee == NULL || callee == f)
+    return NULL;
+
+  // When loading, functions after 'f' may be being parsed by another
+  // thread (see vmir_compile.c)
+  if(!iu->iu_tier_up && !iu->iu_lazy && callee->if_gfid > f->if_gfid)
+    return NULL;
+
+  if(callee->if_body == NULL ||
+     callee->if_inline_size == 0 || callee->if_ext_func != NULL ||
+     callee->if_vmop)
+    return NULL;
+
+  if(call->argc != type_get(iu, callee->if_type)->it_function.num_parameters)
+    return NULL;
+
+  for(int i = 0; i < call->argc; i++) {
+    if(call->argv[i].copy_size)
+      return NULL; // byval
+
+    switch(value_get(iu, call->argv[i].value)->iv_class) {
+    case IR_VC_TEMPORARY:
+    case IR_VC_REGFRAME:
+    case IR_VC_GLOBALVAR:
+    case IR_VC_CONSTANT:
+      break;
+    default:
+      return NULL;
+    }
+  }
+
+  if(callee->if_inline_size < 0 && lazy_inline_size(iu, callee) == 0)
+    return NULL;
+
+  int limit = iu->iu_inline_size;
+  if(iu->iu_tier_counters != NULL &&
+     iu->iu_tier_counters[callee->if_gfid] >= iu->iu_tier_threshold)
+    limit *= INLINE_HOT_FACTOR;
+
+  return callee->if_inline_size <= limit ? callee : NULL;
+}
+
+
+/**
+ *
+ */
+static void
+inline_relocate_bb(ir_instr_t *ii, int first_bb)
+{
+  ir_instr_br_t *br;
+  ir_instr_switch_t *s;
+  ir_instr_phi_t *phi;
+
+  switch(ii->ii_class) {
+  case IR_IC_BR:
+    br = (ir_instr_br_t *)ii;
+    br->true_branch += first_bb;
+    if(br->condition != -1)
+      br->false_branch += first_bb;
+    break;
+  case IR_IC_SWITCH:
+    s = (ir_instr_switch_t *)ii;
+    s->defblock += first_bb;
+    for(int i = 0; i < s->num_paths; i++)
+      s->paths[i].block += first_bb;
+    break;
+  case IR_IC_PHI:
+    phi = (ir_instr_phi_t *)ii;
+    for(int i = 0; i < phi->num_nodes; i++)
+      phi->nodes[i].predecessor += first_bb;
+    break;
+  default:
+    break;
+  }
+}
+
+
+/**
+ * Successor 'succ' of 'bb' is now reached from 'cont', update its phis
+ */
+static void
+inline_move_phis(ir_function_t *f, int succ, const ir_bb_t *bb,
+                 const ir_bb_t *cont)
+{
+  ir_instr_t *ii;
+  TAILQ_FOREACH(ii, &bb_find(f, succ)->ib_instrs, ii_link) {
+    ir_instr_phi_t *p = (ir_instr_phi_t *)instr_isa(ii, IR_IC_PHI);
+    if(p == NULL)
+      break;
+    for(int i = 0; i < p->num_nodes; i++)
+      if(p->nodes[i].predecessor == bb->ib_id)
+        p->nodes[i].predecessor = cont->ib_id;
+    qsort(p->nodes, p->num_nodes, sizeof(ir_phi_node_t), phi_sort);
+  }
+}
+
+
+/**
+ * Replace 'call' (in block 'bb') with the body of 'callee'
+ *
+ * The instructions following the call are moved to a new block which
+ * the callee's returns branch to. If the call returns a value it's
+ * assigned by a phi in that block. Returns the block where scanning
+ * for calls should continue
+ */
+static ir_bb_t *
+inline_call(ir_unit_t *iu, ir_function_t *f, ir_bb_t *bb,
+            ir_instr_call_t *call, ir_function_t *callee)
+{
+  ir_function_t scratch = {0};
+  TAILQ_INIT(&scratch.if_bbs);
+  scratch.if_type = callee->if_type;
+  scratch.if_name = callee->if_name;
+  scratch.if_num_bbs = f->if_num_bbs;
+  scratch.if_arena = f->if_arena; // The blocks are moved to 'f'
+  const int first_bb = f->if_num_bbs;
+
+  // The callee's instructions may not handle all of their operands
+  // being constant so constants are moved to registers first
+  int args[call->argc];
+  for(int i = 0; i < call->argc; i++) {
+    args[i] = call->argv[i].value;
+    registerify(iu, &call->super, &args[i]);
+  }
+
+  function_parse_inline(iu, callee, &scratch, args);
+  f->if_num_bbs = scratch.if_num_bbs;
+
+  ir_instr_t *ii = TAILQ_NEXT(&call->super, ii_link);
+  ir_instr_unary_t *ret = (ir_instr_unary_t *)instr_isa(ii, IR_IC_RET);
+  ir_bb_t *cont = NULL;
+  ir_instr_phi_t *phi = NULL;
+  ir_bb_t *b;
+
+  if(ret != NULL && ret->value == call->super.ii_ret_value) {
+    // The call is returned so the callee's returns are kept as is,
+    // this also keeps tail calls in the callee in tail position
+    instr_destroy(&ret->super);
+  } else {
+    cont = bb_add(f, bb);
+    while((ii = TAILQ_NEXT(&call->super, ii_link)) != NULL) {
+      TAILQ_REMOVE(&bb->ib_instrs, ii, ii_link);
+      TAILQ_INSERT_TAIL(&cont->ib_instrs, ii, ii_link);
+      ii->ii_bb = cont;
+    }
+
+    // Successors of 'bb' are now reached from 'cont'
+    ii = TAILQ_LAST(&cont->ib_instrs, ir_instr_queue);
+    if(ii->ii_class == IR_IC_BR) {
+      const ir_instr_br_t *b = (ir_instr_br_t *)ii;
+      inline_move_phis(f, b->true_branch, bb, cont);
+      if(b->condition != -1)
+        inline_move_phis(f, b->false_branch, bb, cont);
+    } else if(ii->ii_class == IR_IC_SWITCH) {
+      const ir_instr_switch_t *s = (ir_instr_switch_t *)ii;
+      inline_move_phis(f, s->defblock, bb, cont);
+      for(int i = 0; i < s->num_paths; i++)
+        inline_move_phis(f, s->paths[i].block, bb, cont);
+    }
+
+    if(call->super.ii_ret_value != -1) {
+      int num_returns = 0;
+      TAILQ_FOREACH(b, &scratch.if_bbs, ib_link)
+        if(instr_isa(TAILQ_LAST(&b->ib_instrs, ir_instr_queue), IR_IC_RET))
+          num_returns++;
+
+      phi = (ir_instr_phi_t *)
+        instr_create(cont, sizeof(ir_instr_phi_t) +
+                     num_returns * sizeof(ir_phi_node_t), IR_IC_PHI);
+      TAILQ_INSERT_HEAD(&cont->ib_instrs, &phi->super, ii_link);
+    }
+  }
+
+  ir_bb_t *after = bb;
+  while((b = TAILQ_FIRST(&scratch.if_bbs)) != NULL) {
+    TAILQ_REMOVE(&scratch.if_bbs, b, ib_link);
+    TAILQ_INSERT_AFTER(&f->if_bbs, after, b, ib_link);
+    after = b;
+
+    ir_instr_t *next;
+    for(ii = TAILQ_FIRST(&b->ib_instrs); ii != NULL; ii = next) {
+      next = TAILQ_NEXT(ii, ii_link);
+      inline_relocate_bb(ii, first_bb);
+
+      if(cont == NULL || ii->ii_class != IR_IC_RET)
+        continue;
+
+      ret = (ir_instr_unary_t *)ii;
+      if(phi != NULL) {
+        phi->nodes[phi->num_nodes].predecessor = b->ib_id;
+        phi->nodes[phi->num_nodes].value = ret->value;
+        phi->num_nodes++;
+      }
+      ir_instr_br_t *br = instr_add_after(sizeof(ir_instr_br_t),
+                                          IR_IC_BR, ii);
+      br->condition = -1;
+      br->true_branch = cont->ib_id;
+      instr_destroy(ii);
+    }
+  }
+
+  ir_instr_br_t *br = instr_add(bb, sizeof(ir_instr_br_t), IR_IC_BR);
+  br->condition = -1;
+  br->true_branch = first_bb;
+
+  const int ret_value = call->super.ii_ret_value;
+  instr_destroy(&call->super);
+  if(phi != NULL) {
+    phi->super.ii_ret_value = ret_value;
+    value_bind_return_value(iu, &phi->super);
+  }
+  iu->iu_stats.inlined_calls++;
+  return cont != NULL ? cont : bb;
+}
+
+
+/**
+ * Decide if 'f' can be inlined into functions compiled after it. Done
+ * before the function is transformed, or handed to a compile thread
+ */
+static void
+inline_prepare(ir_unit_t *iu, ir_function_t *f)
+{
+  int size;
+  if(iu->iu_inline_size)
+    f->if_inline_size = inline_analyze(iu, f, &size) ? size : 0;
+}
+
+
+/**
+ * Inline calls in 'f'. Calls in inlined bodies are not considered so
+ * at most one level of calls are inlined. Each inlined call splits a
+ * block so large functions only get a fixed number of them
+ */
+static void
+inline_calls(ir_unit_t *iu, ir_function_t *f, int size)
+{
+  int budget = MIN(MAX(size, iu->iu_inline_size) * INLINE_GROWTH,
+                   INLINE_MAX_GROWTH);
+  int calls = INLINE_MAX_CALLS;
+  ir_bb_t *bb, *next;
+
+  for(bb = TAILQ_FIRST(&f->if_bbs); bb != NULL; bb = next) {
+    // Blocks are only inserted after 'bb' so this is the next block
+    // as parsed
+    next = TAILQ_NEXT(bb, ib_link);
+
+    ir_instr_t *ii = TAILQ_FIRST(&bb->ib_instrs);
+    while(ii != NULL) {
+      ir_instr_call_t *call = (ir_instr_call_t *)instr_isa(ii, IR_IC_CALL);
+      ir_function_t *callee;
+      if(call == NULL ||
+         (callee = inline_candidate(iu, f, call)) == NULL ||
+         callee->if_inline_size > budget) {
+        ii = TAILQ_NEXT(ii, ii_link);
+        continue;
+      }
+      budget -= callee->if_inline_size;
+      bb = inline_call(iu, f, bb, call, callee);
+      if(--calls == 0)
+        return;
+      ii = TAILQ_FIRST(&bb->ib_instrs);
+    }
+  }
+}
+
+
+/**
+ * Dominator tree
+ *
+ * Blocks reachable from the entry are numbered in reverse postorder and
+ * the immediate dominators are found with the iterative algorithm by
+ * Cooper, Harvey and Kennedy. Only valid as long as the CFG is not
+ * modified
+ */
+typedef struct domtree {
+  int dt_num_bbs;     // Number of reachable blocks
+  ir_bb_t **dt_bbs;   // Reachable blocks in reverse postorder
+  int *dt_index;      // Block id to reverse postorder index, -1 if unreachable
+  int *dt_idom;       // Immediate dominator, the entry is its own
+  int *dt_child;      // First child in the tree, -1 if none
+  int *dt_sibling;    // Next child of the same parent, -1 if none
+} domtree_t;
+
+
+/**
+ *
+ */
+static int
+domtree_intersect(const domtree_t *dt, int a, int b)
+{
+  while(a != b) {
+    while(a > b)
+      a = dt->dt_idom[a];
+    while(b > a)
+      b = dt->dt_idom[b];
+  }
+  return a;
+}
+
+
+/**
+ *
+ */
+static void
+domtree_build(ir_function_t *f, domtree_t *dt)
+{
+  const int n = f->if_num_bbs;
+  ir_bb_t **stack = malloc(n * sizeof(ir_bb_t *));
+  ir_bb_edge_t **edges = malloc(n * sizeof(ir_bb_edge_t *));
+  ir_bb_edge_t *ibe;
+  int depth = 0, num = 0;
+
+  dt->dt_bbs = malloc(n * sizeof(ir_bb_t *));
+  dt->dt_index = malloc(n * sizeof(int));
+  for(int i = 0; i < n; i++)
+    dt->dt_index[i] = -1;
+
+  // Depth first search, blocks are added to dt_bbs in postorder
+  ir_bb_t *bb = TAILQ_FIRST(&f->if_bbs);
+  dt->dt_index[bb->ib_id] = 0;
+  stack[0] = bb;
+  edges[0] = LIST_FIRST(&bb->ib_outgoing_edges);
+  while(depth >= 0) {
+    ibe = edges[depth];
+    if(ibe == NULL) {
+      dt->dt_bbs[num++] = stack[depth--];
+      continue;
+    }
+    edges[depth] = LIST_NEXT(ibe, ibe_from_link);
+    bb = ibe->ibe_to;
+    if(dt->dt_index[bb->ib_id] != -1)
+      continue;
+    dt->dt_index[bb->ib_id] = 0;
+    depth++;
+    stack[depth] = bb;
+    edges[depth] = LIST_FIRST(&bb->ib_outgoing_edges);
+  }
+  free(stack);
+  free(edges);
+
+  dt->dt_num_bbs = num;
+  for(int i = 0; i < num / 2; i++) {
+    bb = dt->dt_bbs[i];
+    dt->dt_bbs[i] = dt->dt_bbs[num - 1 - i];
+    dt->dt_bbs[num - 1 - i] = bb;
+  }
+  for(int i = 0; i < num; i++)
+    dt->dt_index[dt->dt_bbs[i]->ib_id] = i;
+
+  dt->dt_idom = malloc(num * sizeof(int));
+  dt->dt_idom[0] = 0;
+  for(int i = 1; i < num; i++)
+    dt->dt_idom[i] = -1;
+
+  int changed = 1;
+  while(changed) {
+    changed = 0;
+    for(int i = 1; i < num; i++) {
+      int idom = -1;
+      LIST_FOREACH(ibe, &dt->dt_bbs[i]->ib_incoming_edges, ibe_to_link) {
+        const int p = dt->dt_index[ibe->ibe_from->ib_id];
+        if(p == -1 || dt->dt_idom[p] == -1)
+          continue;
+        idom = idom == -1 ? p : domtree_intersect(dt, idom, p);
+      }
+      if(dt->dt_idom[i] != idom) {
+        dt->dt_idom[i] = idom;
+        changed = 1;
+      }
+    }
+  }
+
+  dt->dt_child = malloc(num * sizeof(int));
+  dt->dt_sibling = malloc(num * sizeof(int));
+  for(int i = 0; i < num; i++)
+    dt->dt_child[i] = -1;
+  for(int i = num - 1; i > 0; i--) {
+    const int idom = dt->dt_idom[i];
+    dt->dt_sibling[i] = dt->dt_child[idom];
+    dt->dt_child[idom] = i;
+  }
+  dt->dt_sibling[0] = -1;
+}
+
+
+/**
+ *
+ */
+static void
+domtree_free(domtree_t *dt)
+{
+  free(dt->dt_bbs);
+  free(dt->dt_index);
+  free(dt->dt_idom);
+  free(dt->dt_child);
+  free(dt->dt_sibling);
+}
+
+
+/**
+ * Returns true if 'a' dominates 'b', both are reverse postorder indices
+ */
+static int
+domtree_dominates(const domtree_t *dt, int a, int b)
+{
+  while(b > a)
+    b = dt->dt_idom[b];
+  return a == b;
+}
+
+
+/**
+ * Loop nest
+ *
+ * An edge to a block that dominates its source is a back edge and its
+ * target is the header of a natural loop. All back edges to a header form
+ * one loop, its body is found by walking predecessors backwards from the
+ * sources of the back edges until the header is reached.
+ *
+ * Loops are numbered in reverse postorder of their headers so a loop
+ * always comes after the loops enclosing it. Just as the dominator tree
+ * this is only valid as long as the CFG is not modified
+ */
+typedef struct loop {
+  int l_header;     // Reverse postorder index of the header
+  int l_preheader;  // Single block entering the loop, -1 if none
+  int l_parent;     // Enclosing loop, -1 if outermost
+  int l_depth;      // 1 for outermost loops
+  int l_first_bb;   // Blocks of the loop in ln_bbs, in reverse postorder
+  int l_num_bbs;
+} loop_t;
+
+typedef struct loopnest {
+  domtree_t ln_dt;
+  int ln_num_loops;
+  loop_t *ln_loops;
+  int *ln_bbs;
+  int *ln_innermost;  // Innermost loop of each block, -1 if in no loop
+} loopnest_t;
+
+
+/**
+ * Returns true if block 'bb' (reverse postorder index) is in loop 'l'
+ */
+static int
+loop_contains(const loopnest_t *ln, int l, int bb)
+{
+  int x = ln->ln_innermost[bb];
+  while(x > l)
+    x = ln->ln_loops[x].l_parent;
+  return x == l;
+}
+
+
+/**
+ *
+ */
+static void
+loopnest_build(ir_function_t *f, loopnest_t *ln)
+{
+  domtree_t *dt = &ln->ln_dt;
+  domtree_build(f, dt);
+
+  const int n = dt->dt_num_bbs;
+  int *mark = malloc(n * sizeof(int));
+  int *work = malloc(n * sizeof(int));
+  VECTOR_HEAD(, loop_t) loops = {0};
+  VECTOR_HEAD(, int) bbs = {0};
+  ir_bb_edge_t *ibe;
+
+  ln->ln_innermost = malloc(n * sizeof(int));
+  for(int i = 0; i < n; i++) {
+    ln->ln_innermost[i] = -1;
+    mark[i] = -1;
+  }
+
+  for(int h = 0; h < n; h++) {
+    const int id = VECTOR_LEN(&loops);
+    int num_work = 0;
+    int is_header = 0;
+
+    mark[h] = id;
+    LIST_FOREACH(ibe, &dt->dt_bbs[h]->ib_incoming_edges, ibe_to_link) {
+      const int p = dt->dt_index[ibe->ibe_from->ib_id];
+      if(p == -1 || !domtree_dominates(dt, h, p))
+        continue;
+      is_header = 1;
+      if(mark[p] != id) {
+        mark[p] = id;
+        work[num_work++] = p;
+      }
+    }
+
+    if(!is_header) {
+      mark[h] = -1;
+      continue;
+    }
+
+    while(num_work > 0) {
+      const int b = work[--num_work];
+      LIST_FOREACH(ibe, &dt->dt_bbs[b]->ib_incoming_edges, ibe_to_link) {
+        const int p = dt->dt_index[ibe->ibe_from->ib_id];
+        if(p != -1 && mark[p] != id) {
+          mark[p] = id;
+          work[num_work++] = p;
+        }
+      }
+    }
+
+    loop_t l;
+    l.l_header = h;
+    l.l_parent = ln->ln_innermost[h];
+    l.l_depth = l.l_parent == -1 ? 1 :
+      VECTOR_ITEM(&loops, l.l_parent).l_depth + 1;
+    l.l_first_bb = VECTOR_LEN(&bbs);
+
+    // The header dominates all blocks in the loop so they come after it
+    for(int i = h; i < n; i++) {
+      if(mark[i] != id)
+        continue;
+      VECTOR_PUSH_BACK(&bbs, i);
+      ln->ln_innermost[i] = id;
+    }
+    l.l_num_bbs = VECTOR_LEN(&bbs) - l.l_first_bb;
+
+    int entry = -1, num_entries = 0;
+    LIST_FOREACH(ibe, &dt->dt_bbs[h]->ib_incoming_edges, ibe_to_link) {
+      const int p = dt->dt_index[ibe->ibe_from->ib_id];
+      if(p != -1 && mark[p] != id) {
+        entry = p;
+        num_entries++;
+      }
+    }
+
+    l.l_preheader = -1;
+    if(num_entries == 1) {
+      ir_bb_t *pb = dt->dt_bbs[entry];
+      ibe = LIST_FIRST(&pb->ib_outgoing_edges);
+      if(LIST_NEXT(ibe, ibe_from_link) == NULL)
+        l.l_preheader = entry;
+    }
+    VECTOR_PUSH_BACK(&loops, l);
+  }
+
+  free(mark);
+  free(work);
+  ln->ln_num_loops = VECTOR_LEN(&loops);
+  ln->ln_loops = loops.vh_p;
+  ln->ln_bbs = bbs.vh_p;
+}
+
+
+/**
+ *
+ */
+static void
+loopnest_free(loopnest_t *ln)
+{
+  domtree_free(&ln->ln_dt);
+  free(ln->ln_loops);
+  free(ln->ln_bbs);
+  free(ln->ln_innermost);
+}
+
+
+/**
+ * Promotion of allocas to registers
+ *
+ * Allocas in the entry block whose address is only used by loads and
+ * stores at constant offsets are split into slots, one per offset. Each
+ * slot must always be accessed with the same type and slots may not
+ * overlap, so small structs and arrays are scalar replaced as well.
+ *
+ * Phis are placed at the iterated dominance frontier of the stores and
+ * loads are then replaced with the reaching stored value while walking
+ * the dominator tree. Phis that end up unused are removed again
+ */
+
+#define PROMOTE_MAX_SLOTS 16
+
+VECTOR_HEAD(promote_int_vec, int);
+
+typedef struct promote_slot {
+  int ps_alloca;      // Value of the alloca
+  int ps_offset;
+  int ps_type;
+  int ps_undef;       // Constant used for loads before any store, or -1
+  struct promote_int_vec ps_defs;   // Blocks with stores
+  struct promote_int_vec ps_stack;  // Reaching stores during renaming
+} promote_slot_t;
+
+typedef struct promote {
+  ir_unit_t *iu;
+  VECTOR_HEAD(, promote_slot_t) slots;
+  int *first_slot;    // Per value, first slot of alloca or -1
+  int num_values;
+  int num_allocas;
+  VECTOR_HEAD(, ir_instr_phi_t *) phis;
+  struct promote_int_vec phi_slots;
+  int *phi_slot;      // Per value, slot of inserted phi or -1
+  int phi_slot_size;  // Values that existed when the phis were inserted
+  struct promote_int_vec log;  // Slots pushed to, for unwinding
+} promote_t;
+
+
+/**
+ *
+ */
+static int
+promote_type_ok(ir_unit_t *iu, int type)
+{
+  switch(type_get(iu, type)->it_code) {
+  case IR_TYPE_INT1:
+  case IR_TYPE_INT8:
+  case IR_TYPE_INT16:
+  case IR_TYPE_INT32:
+  case IR_TYPE_INT64:
+  case IR_TYPE_FLOAT:
+  case IR_TYPE_DOUBLE:
+  case IR_TYPE_POINTER:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * Add an access at 'offset' of 'type' to 'slots', returns 0 if it's
+ * not compatible with the previous ones
+ */
+static int
+promote_add_access(ir_unit_t *iu, promote_slot_t *slots, int *num_slots,
+                   const ir_instr_alloca_t *ai, int offset, int type)
+{
+  const ir_type_t *it = type_get(iu, type);
+  const int size = type_sizeof(iu, type);
+
+  if(!promote_type_ok(iu, type))
+    return 0;
+
+  for(int i = 0; i < *num_slots; i++) {
+    const int o = slots[i].ps_offset;
+    if(o == offset) {
+      const ir_type_t *st = type_get(iu, slots[i].ps_type);
+      return st->it_code == it->it_code;
+    }
+    if(offset < o + type_sizeof(iu, slots[i].ps_type) && o < offset + size)
+      return 0;
+  }
+
+  if(*num_slots == PROMOTE_MAX_SLOTS || offset < 0 ||
+     offset + size > ai->size)
+    return 0;
+
+  promote_slot_t *ps = &slots[(*num_slots)++];
+  memset(ps, 0, sizeof(promote_slot_t));
+  ps->ps_alloca = ai->super.ii_ret_value;
+  ps->ps_offset = offset;
+  ps->ps_type = type;
+  ps->ps_undef = -1;
+  return 1;
+}
+
+
+/**
+ * Check if all uses of the alloca can be promoted and if so add its
+ * slots
+ */
+static void
+promote_analyze(promote_t *p, ir_instr_alloca_t *ai)
+{
+  ir_unit_t *iu = p->iu;
+  const int av = ai->super.ii_ret_value;
+  ir_value_t *iv = value_get(iu, av);
+  const ir_value_t *n = value_get(iu, ai->num_items_value);
+  promote_slot_t slots[PROMOTE_MAX_SLOTS];
+  int num_slots = 0;
+  ir_value_instr_t *ivi;
+
+  if(n->iv_class != IR_VC_CONSTANT || value_get_const32(iu, n) != 1)
+    return;
+
+  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+    if(ivi->ivi_relation != IVI_INPUT)
+      continue;
+    ir_instr_t *ii = ivi->ivi_instr;
+    ir_instr_load_t *ld;
+    ir_instr_store_t *st;
+    const ir_value_t *v;
+    int ok = 0;
+
+    switch(ii->ii_class) {
+    case IR_IC_LOAD:
+      ld = (ir_instr_load_t *)ii;
+      ok = ld->ptr == av && ld->value_offset == -1 && ld->cast == -1 &&
+        promote_add_access(iu, slots, &num_slots, ai, ld->immediate_offset,
+                           value_get_type(iu, ii->ii_ret_value));
+      break;
+
+    case IR_IC_STORE:
+      st = (ir_instr_store_t *)ii;
+      v = value_get(iu, st->value);
+      ok = st->ptr == av && st->value != av &&
+        (v->iv_class == IR_VC_TEMPORARY || v->iv_class == IR_VC_REGFRAME ||
+         v->iv_class == IR_VC_CONSTANT || v->iv_class == IR_VC_GLOBALVAR) &&
+        promote_add_access(iu, slots, &num_slots, ai, st->offset,
+                           v->iv_type);
+      break;
+
+    case IR_IC_LEA:
+      // Leftovers from merging into loads and stores
+      ok = !value_has_users(value_get(iu, ii->ii_ret_value));
+      break;
+
+    default:
+      break;
+    }
+    if(!ok)
+      return;
+  }
+
+  p->first_slot[av - iu->iu_first_func_value] = VECTOR_LEN(&p->slots);
+  p->num_allocas++;
+  for(int i = 0; i < num_slots; i++)
+    VECTOR_PUSH_BACK(&p->slots, slots[i]);
+}
+
+
+/**
+ * Returns the slot accessed by a load or store, or -1
+ */
+static int
+promote_find_slot(promote_t *p, int ptr, int offset)
+{
+  const int idx = ptr - p->iu->iu_first_func_value;
+  if(idx < 0 || idx >= p->num_values || p->first_slot[idx] == -1)
+    return -1;
+  for(int i = p->first_slot[idx]; i < VECTOR_LEN(&p->slots); i++) {
+    const promote_slot_t *ps = &VECTOR_ITEM(&p->slots, i);
+    if(ps->ps_alloca == ptr && ps->ps_offset == offset)
+      return i;
+  }
+  abort();
+}
+
+
+/**
+ *
+ */
+static void
+promote_insert_phis(promote_t *p, const domtree_t *dt)
+{
+  ir_unit_t *iu = p->iu;
+  const int n = dt->dt_num_bbs;
+  struct promote_int_vec *df = calloc(n, sizeof(struct promote_int_vec));
+  int *stamp = malloc(n * sizeof(int));
+  int *has_phi = malloc(n * sizeof(int));
+  struct promote_int_vec work = {0};
+  ir_bb_edge_t *ibe;
+
+  // Dominance frontiers
+  for(int i = 0; i < n; i++)
+    stamp[i] = -1;
+  for(int i = 1; i < n; i++) {
+    ir_bb_t *bb = dt->dt_bbs[i];
+    LIST_FOREACH(ibe, &bb->ib_incoming_edges, ibe_to_link) {
+      int runner = dt->dt_index[ibe->ibe_from->ib_id];
+      if(runner == -1)
+        continue;
+      while(runner != dt->dt_idom[i] && stamp[runner] != i) {
+        stamp[runner] = i;
+        VECTOR_PUSH_BACK(&df[runner], i);
+        runner = dt->dt_idom[runner];
+      }
+    }
+  }
+
+  for(int i = 0; i < n; i++)
+    stamp[i] = has_phi[i] = -1;
+
+  for(int s = 0; s < VECTOR_LEN(&p->slots); s++) {
+    promote_slot_t *ps = &VECTOR_ITEM(&p->slots, s);
+
+    for(int i = 0; i < VECTOR_LEN(&ps->ps_defs); i++) {
+      const int b = dt->dt_index[VECTOR_ITEM(&ps->ps_defs, i)];
+      if(b == -1 || stamp[b] == s)
+        continue;
+      stamp[b] = s;
+      VECTOR_PUSH_BACK(&work, b);
+    }
+
+    while(VECTOR_LEN(&work)) {
+      const int x = VECTOR_ITEM(&work, VECTOR_LEN(&work) - 1);
+      VECTOR_RESIZE(&work, VECTOR_LEN(&work) - 1);
+
+      for(int i = 0; i < VECTOR_LEN(&df[x]); i++) {
+        const int y = VECTOR_ITEM(&df[x], i);
+        if(has_phi[y] == s)
+          continue;
+        has_phi[y] = s;
+
+        ir_bb_t *bb = dt->dt_bbs[y];
+        int num_preds = 0;
+        LIST_FOREACH(ibe, &bb->ib_incoming_edges, ibe_to_link)
+          num_preds++;
+
+        ir_instr_phi_t *phi = (ir_instr_phi_t *)
+          instr_create(bb, sizeof(ir_instr_phi_t) +
+                       num_preds * sizeof(ir_phi_node_t), IR_IC_PHI);
+        TAILQ_INSERT_HEAD(&bb->ib_instrs, &phi->super, ii_link);
+        value_alloc_instr_ret(iu, ps->ps_type, &phi->super);
+        VECTOR_PUSH_BACK(&p->phis, phi);
+        VECTOR_PUSH_BACK(&p->phi_slots, s);
+
+        if(stamp[y] != s) {
+          stamp[y] = s;
+          VECTOR_PUSH_BACK(&work, y);
+        }
+      }
+    }
+  }
+
+  const int num_values = iu->iu_next_value - iu->iu_first_func_value;
+  p->phi_slot = malloc(num_values * sizeof(int));
+  p->phi_slot_size = num_values;
+  for(int i = 0; i < num_values; i++)
+    p->phi_slot[i] = -1;
+  for(int i = 0; i < VECTOR_LEN(&p->phis); i++) {
+    const ir_instr_phi_t *phi = VECTOR_ITEM(&p->phis, i);
+    p->phi_slot[phi->super.ii_ret_value - iu->iu_first_func_value] =
+      VECTOR_ITEM(&p->phi_slots, i);
+  }
+
+  for(int i = 0; i < n; i++)
+    VECTOR_CLEAR(&df[i]);
+  free(df);
+  free(stamp);
+  free(has_phi);
+  VECTOR_CLEAR(&work);
+}
+
+
+/**
+ * Value reaching the current point in the renaming walk
+ */
+static int
+promote_current(promote_t *p, int slot)
+{
+  promote_slot_t *ps = &VECTOR_ITEM(&p->slots, slot);
+  const int len = VECTOR_LEN(&ps->ps_stack);
+  if(len)
+    return VECTOR_ITEM(&ps->ps_stack, len - 1);
+
+  if(ps->ps_undef == -1) {
+    ir_value_t *iv = value_append_and_get(p->iu);
+    iv->iv_class = IR_VC_CONSTANT;
+    iv->iv_type = ps->ps_type;
+    ps->ps_undef = iv->iv_id;
+  }
+  return ps->ps_undef;
+}
+
+
+/**
+ *
+ */
+static void
+promote_push(promote_t *p, int slot, int value)
+{
+  VECTOR_PUSH_BACK(&VECTOR_ITEM(&p->slots, slot).ps_stack, value);
+  VECTOR_PUSH_BACK(&p->log, slot);
+}
+
+
+/**
+ * Replace the output of an instruction with 'value'. Registers are
+ * substituted directly into the users, anything else is moved into the
+ * instruction's output
+ */
+static void
+instr_replace_output(ir_unit_t *iu, ir_instr_t *ii, int value)
+{
+  const int out = ii->ii_ret_value;
+  ir_value_t *iv = value_get(iu, out);
+  const ir_value_t *v = value_get(iu, value);
+  ir_value_instr_t *ivi;
+
+  if(v->iv_class != IR_VC_TEMPORARY && v->iv_class != IR_VC_REGFRAME) {
+    ir_instr_move_t *move =
+      instr_add_before(sizeof(ir_instr_move_t), IR_IC_MOVE, ii);
+    move->value = value;
+    instr_destroy(ii);
+    move->super.ii_ret_value = out;
+    value_bind_return_value(iu, &move->super);
+    return;
+  }
+
+ again:
+  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+    if(ivi->ivi_relation != IVI_INPUT)
+      continue;
+    ir_instr_t *user = ivi->ivi_instr;
+    instr_replace_values(user, iu, out, value);
+    for(int n = instr_unbind_input(user, iv); n > 0; n--)
+      instr_bind_input(iu, value, user);
+    goto again;
+  }
+  instr_destroy(ii);
+  iv->iv_class = IR_VC_DEAD;
+}
+
+
+/**
+ * Rewrite the loads and stores of promoted slots in 'bb' and fill in
+ * the phi nodes of its successors
+ */
+static void
+promote_rename_bb(promote_t *p, ir_bb_t *bb)
+{
+  ir_unit_t *iu = p->iu;
+  ir_instr_t *ii, *next;
+  ir_bb_edge_t *ibe;
+  int s;
+
+  for(ii = TAILQ_FIRST(&bb->ib_instrs); ii != NULL; ii = next) {
+    next = TAILQ_NEXT(ii, ii_link);
+
+    if(ii->ii_class == IR_IC_PHI) {
+      s = p->phi_slot[ii->ii_ret_value - iu->iu_first_func_value];
+      if(s != -1)
+        promote_push(p, s, ii->ii_ret_value);
+
+    } else if(ii->ii_class == IR_IC_LOAD) {
+      ir_instr_load_t *ld = (ir_instr_load_t *)ii;
+      s = promote_find_slot(p, ld->ptr, ld->immediate_offset);
+      if(s != -1)
+        instr_replace_output(iu, &ld->super, promote_current(p, s));
+
+    } else if(ii->ii_class == IR_IC_STORE) {
+      ir_instr_store_t *st = (ir_instr_store_t *)ii;
+      s = promote_find_slot(p, st->ptr, st->offset);
+      if(s != -1) {
+        promote_push(p, s, st->value);
+        instr_destroy(ii);
+      }
+    }
+  }
+
+  LIST_FOREACH(ibe, &bb->ib_outgoing_edges, ibe_from_link) {
+    TAILQ_FOREACH(ii, &ibe->ibe_to->ib_instrs, ii_link) {
+      if(ii->ii_class != IR_IC_PHI)
+        break;
+      s = p->phi_slot[ii->ii_ret_value - iu->iu_first_func_value];
+      if(s == -1)
+        continue;
+      ir_instr_phi_t *phi = (ir_instr_phi_t *)ii;
+      const int value = promote_current(p, s);
+      phi->nodes[phi->num_nodes].predecessor = bb->ib_id;
+      phi->nodes[phi->num_nodes].value = value;
+      phi->num_nodes++;
+      instr_bind_input(iu, value, ii);
+    }
+  }
+}
+
+
+/**
+ * Walk the dominator tree in preorder, the values pushed by a block
+ * are popped once all blocks it dominates are done
+ */
+static void
+promote_rename(promote_t *p, const domtree_t *dt)
+{
+  const int n = dt->dt_num_bbs;
+  int *work = malloc(2 * n * sizeof(int));
+  int *logpos = malloc(n * sizeof(int));
+  int depth = 0;
+
+  work[depth++] = 0;
+  while(depth > 0) {
+    const int i = work[--depth];
+    if(i < 0) {
+      const int pos = logpos[~i];
+      while(VECTOR_LEN(&p->log) > pos) {
+        const int s = VECTOR_ITEM(&p->log, VECTOR_LEN(&p->log) - 1);
+        promote_slot_t *ps = &VECTOR_ITEM(&p->slots, s);
+        VECTOR_RESIZE(&ps->ps_stack, VECTOR_LEN(&ps->ps_stack) - 1);
+        VECTOR_RESIZE(&p->log, VECTOR_LEN(&p->log) - 1);
+      }
+      continue;
+    }
+    logpos[i] = VECTOR_LEN(&p->log);
+    promote_rename_bb(p, dt->dt_bbs[i]);
+    work[depth++] = ~i;
+    for(int c = dt->dt_child[i]; c != -1; c = dt->dt_sibling[c])
+      work[depth++] = c;
+  }
+  free(work);
+  free(logpos);
+}
+
+
+/**
+ * Remove inserted phis that don't reach any other instruction
+ */
+static void
+promote_prune_phis(promote_t *p)
+{
+  ir_unit_t *iu = p->iu;
+  const int num_phis = VECTOR_LEN(&p->phis);
+  char *live = calloc(num_phis, 1);
+  int *index = malloc((iu->iu_next_value - iu->iu_first_func_value) *
+                      sizeof(int));
+  struct promote_int_vec work = {0};
+  ir_value_instr_t *ivi;
+
+  for(int i = 0; i < num_phis; i++) {
+    ir_instr_phi_t *phi = VECTOR_ITEM(&p->phis, i);
+    index[phi->super.ii_ret_value - iu->iu_first_func_value] = i;
+  }
+
+  for(int i = 0; i < num_phis; i++) {
+    ir_instr_phi_t *phi = VECTOR_ITEM(&p->phis, i);
+    ir_value_t *iv = value_get(iu, phi->super.ii_ret_value);
+    LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+      const ir_instr_t *user = ivi->ivi_instr;
+      if(ivi->ivi_relation != IVI_INPUT ||
+         (user->ii_class == IR_IC_PHI &&
+          p->phi_slot[user->ii_ret_value - iu->iu_first_func_value] != -1))
+        continue;
+      live[i] = 1;
+      VECTOR_PUSH_BACK(&work, i);
+      break;
+    }
+  }
+
+  while(VECTOR_LEN(&work)) {
+    ir_instr_phi_t *phi =
+      VECTOR_ITEM(&p->phis, VECTOR_ITEM(&work, VECTOR_LEN(&work) - 1));
+    VECTOR_RESIZE(&work, VECTOR_LEN(&work) - 1);
+    for(int i = 0; i < phi->num_nodes; i++) {
+      const int idx = phi->nodes[i].value - iu->iu_first_func_value;
+      if(idx < 0 || idx >= p->phi_slot_size ||
+         p->phi_slot[idx] == -1 || live[index[idx]])
+        continue;
+      live[index[idx]] = 1;
+      VECTOR_PUSH_BACK(&work, index[idx]);
+    }
+  }
+
+  for(int i = 0; i < num_phis; i++) {
+    ir_instr_phi_t *phi = VECTOR_ITEM(&p->phis, i);
+    if(live[i]) {
+      qsort(phi->nodes, phi->num_nodes, sizeof(ir_phi_node_t), phi_sort);
+      continue;
+    }
+    value_get(iu, phi->super.ii_ret_value)->iv_class = IR_VC_DEAD;
+    instr_destroy(&phi->super);
+  }
+
+  free(live);
+  free(index);
+  VECTOR_CLEAR(&work);
+}
+
+
+/**
+ *
+ */
+static void
+promote_allocas(ir_unit_t *iu, ir_function_t *f)
+{
+  promote_t p = {iu};
+  ir_bb_t *bb;
+  ir_instr_t *ii, *next;
+
+  p.num_values = iu->iu_next_value - iu->iu_first_func_value;
+  p.first_slot = malloc(p.num_values * sizeof(int));
+  for(int i = 0; i < p.num_values; i++)
+    p.first_slot[i] = -1;
+
+  bb = TAILQ_FIRST(&f->if_bbs);
+  TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link)
+    if(ii->ii_class == IR_IC_ALLOCA)
+      promote_analyze(&p, (ir_instr_alloca_t *)ii);
+
+  if(p.num_allocas == 0) {
+    free(p.first_slot);
+    return;
+  }
+
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
+    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link) {
+      if(ii->ii_class != IR_IC_STORE)
+        continue;
+      ir_instr_store_t *st = (ir_instr_store_t *)ii;
+      const int s = promote_find_slot(&p, st->ptr, st->offset);
+      if(s != -1)
+        VECTOR_PUSH_BACK(&VECTOR_ITEM(&p.slots, s).ps_defs, bb->ib_id);
+    }
+  }
+
+  domtree_t dt;
+  domtree_build(f, &dt);
+  promote_insert_phis(&p, &dt);
+  promote_rename(&p, &dt);
+
+  // Loads in unreachable blocks are just given the undefined value
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link)
+    if(dt.dt_index[bb->ib_id] == -1)
+      promote_rename_bb(&p, bb);
+
+  promote_prune_phis(&p);
+  domtree_free(&dt);
+
+  // Remove the allocas and any unused LEAs still pointing to them
+  bb = TAILQ_FIRST(&f->if_bbs);
+  for(ii = TAILQ_FIRST(&bb->ib_instrs); ii != NULL; ii = next) {
+    next = TAILQ_NEXT(ii, ii_link);
+    if(ii->ii_class != IR_IC_ALLOCA ||
+       p.first_slot[ii->ii_ret_value - iu->iu_first_func_value] == -1)
+      continue;
+
+    ir_value_t *iv = value_get(iu, ii->ii_ret_value);
+    ir_value_instr_t *ivi;
+    while(1) {
+      LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link)
+        if(ivi->ivi_relation == IVI_INPUT)
+          break;
+      if(ivi == NULL)
+        break;
+      ir_instr_t *lea = ivi->ivi_instr;
+      assert(lea->ii_class == IR_IC_LEA);
+      if(lea == next)
+        next = TAILQ_NEXT(lea, ii_link);
+      value_get(iu, lea->ii_ret_value)->iv_class = IR_VC_DEAD;
+      instr_destroy(lea);
+    }
+    instr_destroy(ii);
+    iv->iv_class = IR_VC_DEAD;
+    iu->iu_stats.allocas_promoted++;
+  }
+
+  for(int i = 0; i < VECTOR_LEN(&p.slots); i++) {
+    VECTOR_CLEAR(&VECTOR_ITEM(&p.slots, i).ps_defs);
+    VECTOR_CLEAR(&VECTOR_ITEM(&p.slots, i).ps_stack);
+  }
+  VECTOR_CLEAR(&p.slots);
+  VECTOR_CLEAR(&p.phis);
+  VECTOR_CLEAR(&p.phi_slots);
+  VECTOR_CLEAR(&p.log);
+  free(p.first_slot);
+  free(p.phi_slot);
+}
+
+
+/**
+ * Sparse conditional constant propagation
+ *
+ * Temporaries start out as undefined and blocks as unreachable. Values
+ * are lowered to constant or overdefined as blocks are found to be
+ * executable, and only the edges a branch can take on its condition
+ * are followed. Once stable, constants are substituted into their
+ * users, branches on constants are made unconditional and blocks that
+ * can't be reached are removed.
+ *
+ * Runs on the SSA form once the CFG is constructed. Pointers are never
+ * tracked as constants.
+ */
+
+#define SCCP_UNDEF       0
+#define SCCP_CONSTANT    1
+#define SCCP_OVERDEFINED 2
+
+typedef struct sccp_value {
+  int state;
+  uint64_t bits;  // Constant, masked to the width of its type
+} sccp_value_t;
+
+typedef struct sccp {
+  ir_unit_t *iu;
+  sccp_value_t *values;  // Indexed from iu_first_func_value
+  int num_values;
+  VECTOR_HEAD(, ir_bb_t *) blocks;  // Blocks that became executable
+  VECTOR_HEAD(, int) changed;       // Values that were lowered
+} sccp_t;
+
+
+/**
+ * Width of types that are tracked, 0 if not tracked
+ */
+static int
+sccp_width(ir_unit_t *iu, int type)
+{
+  switch(type_get(iu, type)->it_code) {
+  case IR_TYPE_INT1:
+    return 1;
+  case IR_TYPE_INT8:
+    return 8;
+  case IR_TYPE_INT16:
+    return 16;
+  case IR_TYPE_INT32:
+  case IR_TYPE_FLOAT:
+    return 32;
+  case IR_TYPE_INT64:
+  case IR_TYPE_DOUBLE:
+    return 64;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ *
+ */
+static uint64_t
+sccp_mask(uint64_t v, int width)
+{
+  return width == 64 ? v : v & ((1ULL << width) - 1);
+}
+
+
+/**
+ *
+ */
+static int64_t
+sccp_sext(uint64_t v, int width)
+{
+  return (int64_t)(v << (64 - width)) >> (64 - width);
+}
+
+
+/**
+ *
+ */
+static int
+sccp_is_fp(ir_unit_t *iu, int type)
+{
+  const ir_type_code_t tc = type_get(iu, type)->it_code;
+  return tc == IR_TYPE_FLOAT || tc == IR_TYPE_DOUBLE;
+}
+
+
+/**
+ *
+ */
+static double
+sccp_get_fp(ir_unit_t *iu, int type, uint64_t bits)
+{
+  if(type_get(iu, type)->it_code == IR_TYPE_FLOAT) {
+    const uint32_t u32 = bits;
+    float f;
+    memcpy(&f, &u32, sizeof(f));
+    return f;
+  }
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+
+/**
+ * Rounding a double to float is exact for the results of add, sub, mul
+ * and div of two floats, so float arithmetic can be done in double
+ */
+static uint64_t
+sccp_set_fp(ir_unit_t *iu, int type, double d)
+{
+  if(type_get(iu, type)->it_code == IR_TYPE_FLOAT) {
+    const float f = d;
+    uint32_t u32;
+    memcpy(&u32, &f, sizeof(u32));
+    return u32;
+  }
+  uint64_t u64;
+  memcpy(&u64, &d, sizeof(u64));
+  return u64;
+}
+
+
+/**
+ *
+ */
+static sccp_value_t
+sccp_get(sccp_t *s, int value)
+{
+  ir_unit_t *iu = s->iu;
+  const ir_value_t *iv = value_get(iu, value);
+  sccp_value_t r = {SCCP_OVERDEFINED};
+  const int idx = value - iu->iu_first_func_value;
+  int width;
+
+  switch(iv->iv_class) {
+  case IR_VC_TEMPORARY:
+    if(idx >= 0 && idx < s->num_values)
+      r = s->values[idx];
+    break;
+  case IR_VC_CONSTANT:
+    width = sccp_width(iu, iv->iv_type);
+    if(width == 0)
+      break;
+    r.state = SCCP_CONSTANT;
+    r.bits = sccp_mask(width <= 32 ? iv->iv_u32 : iv->iv_u64, width);
+    break;
+  default:
+    break;
+  }
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+sccp_set(sccp_t *s, int value, sccp_value_t v)
+{
+  ir_unit_t *iu = s->iu;
+  const int idx = value - iu->iu_first_func_value;
+  if(idx < 0 || idx >= s->num_values)
+    return;
+
+  sccp_value_t *cur = &s->values[idx];
+
+  if(v.state == SCCP_CONSTANT &&
+     (sccp_width(iu, value_get_type(iu, value)) == 0 ||
+      (cur->state == SCCP_CONSTANT && cur->bits != v.bits)))
+    v.state = SCCP_OVERDEFINED;
+
+  if(v.state <= cur->state)
+    return; // Values only move down the lattice
+
+  *cur = v;
+  VECTOR_PUSH_BACK(&s->changed, value);
+}
+
+
+/**
+ *
+ */
+static void
+sccp_meet(sccp_value_t *acc, sccp_value_t v)
+{
+  if(v.state == SCCP_UNDEF || acc->state == SCCP_OVERDEFINED)
+    return;
+  if(acc->state == SCCP_UNDEF || v.state == SCCP_OVERDEFINED)
+    *acc = v;
+  else if(acc->bits != v.bits)
+    acc->state = SCCP_OVERDEFINED;
+}
+
+
+/**
+ *
+ */
+static sccp_value_t
+sccp_binop(ir_unit_t *iu, int op, int type, uint64_t a, uint64_t b)
+{
+  sccp_value_t r = {SCCP_OVERDEFINED};
+  const int width = sccp_width(iu, type);
+  uint64_t v;
+
+  if(sccp_is_fp(iu, type)) {
+    const double x = sccp_get_fp(iu, type, a);
+    const double y = sccp_get_fp(iu, type, b);
+    double z;
+    switch(op) {
+    case BINOP_ADD:  z = x + y; break;
+    case BINOP_SUB:  z = x - y; break;
+    case BINOP_MUL:  z = x * y; break;
+    case BINOP_SDIV: z = x / y; break;
+    default:
+      return r;
+    }
+    r.state = SCCP_CONSTANT;
+    r.bits = sccp_set_fp(iu, type, z);
+    return r;
+  }
+
+  const int64_t sa = sccp_sext(a, width);
+  const int64_t sb = sccp_sext(b, width);
+  const int64_t smin = sccp_sext(1ULL << (width - 1), width);
+
+  switch(op) {
+  case BINOP_ADD:  v = a + b; break;
+  case BINOP_SUB:  v = a - b; break;
+  case BINOP_MUL:  v = a * b; break;
+  case BINOP_AND:  v = a & b; break;
+  case BINOP_OR:   v = a | b; break;
+  case BINOP_XOR:  v = a ^ b; break;
+
+  case BINOP_UDIV:
+  case BINOP_UREM:
+    if(b == 0)
+      return r;
+    v = op == BINOP_UDIV ? a / b : a % b;
+    break;
+
+  case BINOP_SDIV:
+  case BINOP_SREM:
+    if(sb == 0 || (sb == -1 && sa == smin))
+      return r;
+    v = op == BINOP_SDIV ? sa / sb : sa % sb;
+    break;
+
+  case BINOP_SHL:
+  case BINOP_LSHR:
+  case BINOP_ASHR:
+    if(b >= width)
+      return r;
+    v = op == BINOP_SHL ? a << b : op == BINOP_LSHR ? a >> b : sa >> b;
+    break;
+
+  default:
+    return r;
+  }
+  r.state = SCCP_CONSTANT;
+  r.bits = sccp_mask(v, width);
+  return r;
+}
+
+
+/**
+ * Returns -1 if the compare can't be evaluated
+ */
+static int
+sccp_compare(ir_unit_t *iu, int pred, int type, uint64_t a, uint64_t b)
+{
+  if(pred <= FCMP_TRUE) {
+    if(!sccp_is_fp(iu, type))
+      return -1;
+    const double x = sccp_get_fp(iu, type, a);
+    const double y = sccp_get_fp(iu, type, b);
+    if(x != x || y != y)
+      return !!(pred & 8);
+    return ((pred & 4) && x < y) || ((pred & 2) && x > y) ||
+      ((pred & 1) && x == y);
+  }
+
+  const int width = sccp_width(iu, type);
+  const int64_t sa = sccp_sext(a, width);
+  const int64_t sb = sccp_sext(b, width);
+
+  switch(pred) {
+  case ICMP_EQ:  return a == b;
+  case ICMP_NE:  return a != b;
+  case ICMP_UGT: return a >  b;
+  case ICMP_UGE: return a >= b;
+  case ICMP_ULT: return a <  b;
+  case ICMP_ULE: return a <= b;
+  case ICMP_SGT: return sa >  sb;
+  case ICMP_SGE: return sa >= sb;
+  case ICMP_SLT: return sa <  sb;
+  case ICMP_SLE: return sa <= sb;
+  default:
+    return -1;
+  }
+}
+
+
+/**
+ *
+ */
+static sccp_value_t
+sccp_cast(ir_unit_t *iu, int op, int srctype, int dsttype, uint64_t a)
+{
+  sccp_value_t r = {SCCP_OVERDEFINED};
+  const int sw = sccp_width(iu, srctype);
+  const int dw = sccp_width(iu, dsttype);
+  const int dst_float = type_get(iu, dsttype)->it_code == IR_TYPE_FLOAT;
+  double x;
+  uint64_t v;
+
+  if(sw == 0 || dw == 0)
+    return r;
+
+  switch(op) {
+  case CAST_TRUNC:
+  case CAST_ZEXT:
+    v = a;
+    break;
+  case CAST_SEXT:
+    v = sccp_sext(a, sw);
+    break;
+  case CAST_BITCAST:
+    if(sw != dw)
+      return r;
+    v = a;
+    break;
+  case CAST_FPTRUNC:
+  case CAST_FPEXT:
+    v = sccp_set_fp(iu, dsttype, sccp_get_fp(iu, srctype, a));
+    break;
+  case CAST_UITOFP:
+    v = dst_float ? sccp_set_fp(iu, dsttype, (float)a) :
+      sccp_set_fp(iu, dsttype, (double)a);
+    break;
+  case CAST_SITOFP:
+    v = dst_float ? sccp_set_fp(iu, dsttype, (float)sccp_sext(a, sw)) :
+      sccp_set_fp(iu, dsttype, (double)sccp_sext(a, sw));
+    break;
+  case CAST_FPTOUI:
+    // Out of range conversions are undefined, leave them to runtime
+    x = sccp_get_fp(iu, srctype, a);
+    if(!(x > -1.0 && x < 2.0 * (double)(1ULL << (dw - 1))))
+      return r;
+    v = (uint64_t)x;
+    break;
+  case CAST_FPTOSI:
+    x = sccp_get_fp(iu, srctype, a);
+    if(!(x > -(double)(1ULL << (dw - 1)) - 1.0 &&
+         x < (double)(1ULL << (dw - 1))))
+      return r;
+    v = (int64_t)x;
+    break;
+  default:
+    return r;
+  }
+  r.state = SCCP_CONSTANT;
+  r.bits = sccp_mask(v, dw);
+  return r;
+}
+
+
+/**
+ *
+ */
+static int
+sccp_edge_executable(ir_bb_t *to, int from)
+{
+  ir_bb_edge_t *ibe;
+  LIST_FOREACH(ibe, &to->ib_incoming_edges, ibe_to_link)
+    if(ibe->ibe_from->ib_id == from)
+      return ibe->ibe_executable;
+  return 0;
+}
+
+
+static void sccp_visit(sccp_t *s, ir_instr_t *ii);
+
+/**
+ *
+ */
+static void
+sccp_mark_edge(sccp_t *s, ir_bb_t *from, int to)
+{
+  ir_bb_edge_t *ibe;
+  LIST_FOREACH(ibe, &from->ib_outgoing_edges, ibe_from_link) {
+    if(ibe->ibe_to->ib_id != to)
+      continue;
+    if(ibe->ibe_executable)
+      return;
+    ibe->ibe_executable = 1;
+
+    ir_bb_t *bb = ibe->ibe_to;
+    if(!bb->ib_mark) {
+      bb->ib_mark = 1;
+      VECTOR_PUSH_BACK(&s->blocks, bb);
+      return;
+    }
+    // Phis of an already executable block see a new predecessor
+    ir_instr_t *ii;
+    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link) {
+      if(ii->ii_class != IR_IC_PHI)
+        break;
+      sccp_visit(s, ii);
+    }
+    return;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+sccp_visit(sccp_t *s, ir_instr_t *ii)
+{
+  ir_unit_t *iu = s->iu;
+  sccp_value_t r = {SCCP_OVERDEFINED};
+  sccp_value_t a, b;
+  ir_instr_br_t *br;
+  ir_instr_switch_t *sw;
+  ir_instr_phi_t *phi;
+  ir_instr_binary_t *bin;
+  ir_instr_unary_t *un;
+  ir_instr_select_t *sel;
+
+  switch(ii->ii_class) {
+  case IR_IC_BR:
+    br = (ir_instr_br_t *)ii;
+    if(br->condition == -1) {
+      sccp_mark_edge(s, ii->ii_bb, br->true_branch);
+      return;
+    }
+    a = sccp_get(s, br->condition);
+    if(a.state == SCCP_UNDEF)
+      return;
+    if(a.state == SCCP_OVERDEFINED || a.bits)
+      sccp_mark_edge(s, ii->ii_bb, br->true_branch);
+    if(a.state == SCCP_OVERDEFINED || !a.bits)
+      sccp_mark_edge(s, ii->ii_bb, br->false_branch);
+    return;
+
+  case IR_IC_SWITCH:
+    sw = (ir_instr_switch_t *)ii;
+    a = sccp_get(s, sw->value);
+    if(a.state == SCCP_UNDEF)
+      return;
+    if(a.state == SCCP_OVERDEFINED) {
+      sccp_mark_edge(s, ii->ii_bb, sw->defblock);
+      for(int i = 0; i < sw->num_paths; i++)
+        sccp_mark_edge(s, ii->ii_bb, sw->paths[i].block);
+      return;
+    }
+    for(int i = 0; i < sw->num_paths; i++) {
+      if(sccp_mask(sw->paths[i].v64, sw->width) == a.bits) {
+        sccp_mark_edge(s, ii->ii_bb, sw->paths[i].block);
+        return;
+      }
+    }
+    sccp_mark_edge(s, ii->ii_bb, sw->defblock);
+    return;
+
+  case IR_IC_PHI:
+    phi = (ir_instr_phi_t *)ii;
+    r.state = SCCP_UNDEF;
+    for(int i = 0; i < phi->num_nodes; i++)
+      if(sccp_edge_executable(ii->ii_bb, phi->nodes[i].predecessor))
+        sccp_meet(&r, sccp_get(s, phi->nodes[i].value));
+    break;
+
+  case IR_IC_MOVE:
+    r = sccp_get(s, ((ir_instr_move_t *)ii)->value);
+    break;
+
+  case IR_IC_BINOP:
+  case IR_IC_CMP2:
+    bin = (ir_instr_binary_t *)ii;
+    a = sccp_get(s, bin->lhs_value);
+    b = sccp_get(s, bin->rhs_value);
+    if(a.state == SCCP_OVERDEFINED || b.state == SCCP_OVERDEFINED)
+      break;
+    if(a.state == SCCP_UNDEF || b.state == SCCP_UNDEF) {
+      r.state = SCCP_UNDEF;
+      break;
+    }
+    if(ii->ii_class == IR_IC_BINOP) {
+      r = sccp_binop(iu, bin->op, value_get_type(iu, ii->ii_ret_value),
+                     a.bits, b.bits);
+    } else {
+      const int c = sccp_compare(iu, bin->op,
+                                 value_get_type(iu, bin->lhs_value),
+                                 a.bits, b.bits);
+      if(c != -1) {
+        r.state = SCCP_CONSTANT;
+        r.bits = c;
+      }
+    }
+    break;
+
+  case IR_IC_CAST:
+    un = (ir_instr_unary_t *)ii;
+    a = sccp_get(s, un->value);
+    if(a.state != SCCP_CONSTANT)
+      r = a;
+    else
+      r = sccp_cast(iu, un->op, value_get_type(iu, un->value),
+                    value_get_type(iu, ii->ii_ret_value), a.bits);
+    break;
+
+  case IR_IC_SELECT:
+    sel = (ir_instr_select_t *)ii;
+    a = sccp_get(s, sel->pred);
+    if(a.state == SCCP_CONSTANT) {
+      r = sccp_get(s, a.bits ? sel->true_value : sel->false_value);
+    } else if(a.state == SCCP_UNDEF) {
+      r = a;
+    } else {
+      r = sccp_get(s, sel->true_value);
+      sccp_meet(&r, sccp_get(s, sel->false_value));
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  if(ii->ii_ret_value >= 0) {
+    sccp_set(s, ii->ii_ret_value, r);
+  } else if(ii->ii_ret_value < -1) {
+    for(int i = 0; i < -ii->ii_ret_value; i++)
+      sccp_set(s, ii->ii_ret_values[i], (sccp_value_t){SCCP_OVERDEFINED});
+  }
+}
+
+
+/**
+ *
+ */
+static void
+sccp_solve(sccp_t *s)
+{
+  while(VECTOR_LEN(&s->blocks) || VECTOR_LEN(&s->changed)) {
+
+    while(VECTOR_LEN(&s->blocks)) {
+      const int n = VECTOR_LEN(&s->blocks) - 1;
+      ir_bb_t *bb = VECTOR_ITEM(&s->blocks, n);
+      VECTOR_RESIZE(&s->blocks, n);
+      ir_instr_t *ii;
+      TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link)
+        sccp_visit(s, ii);
+    }
+
+    while(VECTOR_LEN(&s->changed)) {
+      const int n = VECTOR_LEN(&s->changed) - 1;
+      ir_value_t *iv = value_get(s->iu, VECTOR_ITEM(&s->changed, n));
+      VECTOR_RESIZE(&s->changed, n);
+      ir_value_instr_t *ivi;
+      LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link)
+        if(ivi->ivi_relation == IVI_INPUT && ivi->ivi_instr->ii_bb->ib_mark)
+          sccp_visit(s, ivi->ivi_instr);
+    }
+  }
+}
+
+
+/**
+ * Branches in executable blocks that still depend on undefined values
+ * (only possible with undef in the bitcode) are assumed to take all
+ * their edges. Returns 1 if any such branch was found
+ */
+static int
+sccp_resolve_undefs(sccp_t *s, ir_function_t *f)
+{
+  int found = 0;
+  ir_bb_t *bb;
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
+    if(!bb->ib_mark)
+      continue;
+    ir_instr_t *ii = TAILQ_LAST(&bb->ib_instrs, ir_instr_queue);
+    int cond;
+    if(ii->ii_class == IR_IC_BR)
+      cond = ((ir_instr_br_t *)ii)->condition;
+    else if(ii->ii_class == IR_IC_SWITCH)
+      cond = ((ir_instr_switch_t *)ii)->value;
+    else
+      continue;
+    if(cond == -1 || sccp_get(s, cond).state != SCCP_UNDEF)
+      continue;
+
+    s->values[cond - s->iu->iu_first_func_value].state = SCCP_OVERDEFINED;
+    sccp_visit(s, ii);
+    found = 1;
+  }
+  return found;
+}
+
+
+/**
+ *
+ */
+static int
+sccp_is_folded(sccp_t *s, const ir_instr_t *ii)
+{
+  return ii->ii_ret_value >= 0 &&
+    sccp_get(s, ii->ii_ret_value).state == SCCP_CONSTANT;
+}
+
+
+/**
+ * Check if 'value' used by 'user' can be replaced with a constant.
+ * Instructions that are not folded themselves must keep at least one
+ * operand in a register
+ */
+static int
+sccp_can_substitute(sccp_t *s, ir_instr_t *user, int value)
+{
+  ir_instr_binary_t *bin;
+  int other;
+
+  switch(user->ii_class) {
+  case IR_IC_RET:
+  case IR_IC_STORE:
+  case IR_IC_PHI:
+  case IR_IC_MOVE:
+  case IR_IC_CALL:
+  case IR_IC_SELECT:
+    return 1;
+
+  case IR_IC_BINOP:
+  case IR_IC_CMP2:
+    if(sccp_is_folded(s, user))
+      return 1;
+    bin = (ir_instr_binary_t *)user;
+    other = bin->lhs_value == value ? bin->rhs_value : bin->lhs_value;
+    return sccp_get(s, other).state != SCCP_CONSTANT;
+
+  case IR_IC_CAST:
+    return sccp_is_folded(s, user);
+
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ *
+ */
+static int
+sccp_make_constant(ir_unit_t *iu, int type, uint64_t bits)
+{
+  const int width = sccp_width(iu, type);
+  const int value = value_append(iu);
+  ir_value_t *iv = VECTOR_ITEM(&iu->iu_values, value);
+  iv->iv_class = IR_VC_CONSTANT;
+  iv->iv_type = type;
+  if(width > 32)
+    iv->iv_u64 = bits;
+  else if(width == 8 || width == 16)
+    iv->iv_u32 = sccp_sext(bits, width); // Same as the bitcode parser
+  else
+    iv->iv_u32 = bits;
+  return value;
+}
+
+
+/**
+ * Replace the output of 'ii' with a constant in all users that can
+ * take it. If anyone still needs the value in a register the
+ * instruction is replaced with a move of the constant
+ */
+static void
+sccp_substitute(sccp_t *s, ir_instr_t *ii)
+{
+  ir_unit_t *iu = s->iu;
+  const int value = ii->ii_ret_value;
+  ir_value_t *iv = value_get(iu, value);
+  ir_value_instr_t *ivi;
+  const int is_move = ii->ii_class == IR_IC_MOVE &&
+    value_get(iu, ((ir_instr_move_t *)ii)->value)->iv_class ==
+    IR_VC_CONSTANT;
+  const int c = is_move ? ((ir_instr_move_t *)ii)->value :
+    sccp_make_constant(iu, iv->iv_type, sccp_get(s, value).bits);
+  int used, changed = 0;
+
+ again:
+  used = 0;
+  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+    ir_instr_t *user = ivi->ivi_instr;
+    if(ivi->ivi_relation != IVI_INPUT || !user->ii_bb->ib_mark)
+      continue; // Unreachable users are removed later
+    if(!sccp_can_substitute(s, user, value)) {
+      used = 1;
+      continue;
+    }
+
+    instr_replace_values(user, iu, value, c);
+    instr_unbind_input(user, iv);
+
+    if(user->ii_class == IR_IC_BINOP && !sccp_is_folded(s, user)) {
+      ir_instr_binary_t *bin = (ir_instr_binary_t *)user;
+      if(bin->lhs_value == c) {
+        registerify(iu, user, &bin->lhs_value);
+        instr_bind_input(iu, bin->lhs_value, user);
+      }
+    }
+    changed = 1;
+    goto again;
+  }
+
+  if(!used) {
+    instr_destroy(ii);
+    iv->iv_class = IR_VC_DEAD;
+  } else if(!is_move) {
+    ir_instr_move_t *move =
+      instr_add_before(sizeof(ir_instr_move_t), IR_IC_MOVE, ii);
+    move->value = c;
+    instr_destroy(ii);
+    move->super.ii_ret_value = value;
+    value_bind_return_value(iu, &move->super);
+  } else if(!changed) {
+    return;
+  }
+  iu->iu_stats.sccp_constants++;
+}
+
+
+/**
+ * Rewrite terminators that only take one of their edges
+ */
+static void
+sccp_rewrite_branch(sccp_t *s, ir_bb_t *bb)
+{
+  ir_unit_t *iu = s->iu;
+  ir_instr_t *ii = TAILQ_LAST(&bb->ib_instrs, ir_instr_queue);
+  ir_instr_br_t *br;
+  sccp_value_t v;
+
+  if(ii->ii_class == IR_IC_BR) {
+    br = (ir_instr_br_t *)ii;
+    if(br->condition == -1)
+      return;
+    v = sccp_get(s, br->condition);
+    if(v.state != SCCP_CONSTANT)
+      return;
+    instr_unbind_input(ii, value_get(iu, br->condition));
+    if(!v.bits)
+      br->true_branch = br->false_branch;
+    br->condition = -1;
+
+  } else if(ii->ii_class == IR_IC_SWITCH) {
+    ir_instr_switch_t *sw = (ir_instr_switch_t *)ii;
+    v = sccp_get(s, sw->value);
+    if(v.state != SCCP_CONSTANT)
+      return;
+    br = instr_add_before(sizeof(ir_instr_br_t), IR_IC_BR, ii);
+    br->condition = -1;
+    br->true_branch = sw->defblock;
+    for(int i = 0; i < sw->num_paths; i++)
+      if(sccp_mask(sw->paths[i].v64, sw->width) == v.bits)
+        br->true_branch = sw->paths[i].block;
+    instr_destroy(ii);
+
+  } else {
+    return;
+  }
+  iu->iu_stats.sccp_branches++;
+}
+
+
+/**
+ *
+ */
+static void
+propagate_constants(ir_unit_t *iu, ir_function_t *f)
+{
+  sccp_t s = {iu};
+  ir_bb_t *bb, *next;
+  ir_bb_edge_t *ibe, *ibe_next;
+  ir_instr_t *ii, *ii_next;
+
+  s.num_values = iu->iu_next_value - iu->iu_first_func_value;
+  s.values = calloc(s.num_values, sizeof(sccp_value_t));
+
+  LIST_FOREACH(ibe, &f->if_edges, ibe_function_link)
+    ibe->ibe_executable = 0;
+
+  bb = TAILQ_FIRST(&f->if_bbs);
+  bb->ib_mark = 1;
+  VECTOR_PUSH_BACK(&s.blocks, bb);
+
+  do {
+    sccp_solve(&s);
+  } while(sccp_resolve_undefs(&s, f));
+
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
+    if(!bb->ib_mark)
+      continue;
+
+    sccp_rewrite_branch(&s, bb);
+
+    // Drop phi nodes from edges that are never taken
+    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link) {
+      if(ii->ii_class != IR_IC_PHI)
+        break;
+      ir_instr_phi_t *phi = (ir_instr_phi_t *)ii;
+      int n = 0;
+      for(int i = 0; i < phi->num_nodes; i++)
+        if(sccp_edge_executable(bb, phi->nodes[i].predecessor))
+          phi->nodes[n++] = phi->nodes[i];
+      if(n == phi->num_nodes)
+        continue;
+      instr_bind_clear(ii);
+      phi->num_nodes = n;
+      value_bind_return_value(iu, ii);
+      for(int i = 0; i < n; i++)
+        instr_bind_input(iu, phi->nodes[i].value, ii);
+    }
+  }
+
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link) {
+    if(!bb->ib_mark)
+      continue;
+    for(ibe = LIST_FIRST(&bb->ib_outgoing_edges); ibe != NULL;
+        ibe = ibe_next) {
+      ibe_next = LIST_NEXT(ibe, ibe_from_link);
+      if(!ibe->ibe_executable)
+        ibe_destroy(ibe);
+    }
+
+    for(ii = TAILQ_FIRST(&bb->ib_instrs); ii != NULL; ii = ii_next) {
+      ii_next = TAILQ_NEXT(ii, ii_link);
+
+      if(sccp_is_folded(&s, ii)) {
+        sccp_substitute(&s, ii);
+        continue;
+      }
+
+      if(ii->ii_class == IR_IC_SELECT) {
+        ir_instr_select_t *sel = (ir_instr_select_t *)ii;
+        sccp_value_t pred = sccp_get(&s, sel->pred);
+        if(pred.state != SCCP_CONSTANT)
+          continue;
+        ir_instr_move_t *move =
+          instr_add_before(sizeof(ir_instr_move_t), IR_IC_MOVE, ii);
+        move->value = pred.bits ? sel->true_value : sel->false_value;
+        move->super.ii_ret_value = ii->ii_ret_value;
+        instr_destroy(ii);
+        value_bind_return_value(iu, &move->super);
+        instr_bind_input(iu, move->value, &move->super);
+
+      } else if(ii->ii_class == IR_IC_PHI) {
+        ir_instr_t *move = replace_single_path_phi(iu, (ir_instr_phi_t *)ii);
+        if(move != ii)
+          instr_bind_input(iu, ((ir_instr_move_t *)move)->value, move);
+      }
+    }
+  }
+
+  for(bb = TAILQ_FIRST(&f->if_bbs); bb != NULL; bb = next) {
+    next = TAILQ_NEXT(bb, ib_link);
+    if(bb->ib_mark) {
+      bb->ib_mark = 0;
+      continue;
+    }
+    while((ii = TAILQ_FIRST(&bb->ib_instrs)) != NULL) {
+      if(ii->ii_ret_value >= 0)
+        value_get(iu, ii->ii_ret_value)->iv_class = IR_VC_DEAD;
+      instr_destroy(ii);
+    }
+    TAILQ_REMOVE(&f->if_bbs, bb, ib_link);
+    bb_destroy(bb);
+  }
+
+  free(s.values);
+  VECTOR_CLEAR(&s.blocks);
+  VECTOR_CLEAR(&s.changed);
+}
+
+
+/**
+ * Loop invariant code motion
+ *
+ * Instructions whose inputs are all defined outside of a loop are moved
+ * to the end of its preheader. Each instruction left in a loop costs a
+ * dispatch per iteration so this pays off even for cheap instructions
+ * such as LEAs and casts. Inner loops are processed first so invariants
+ * can move out through several levels of loops.
+ *
+ * Instructions that might fault (divisions, loads and VM ops reading
+ * strings) are only moved if they are executed before every exit of the
+ * loop. Unless they read constant globals the loop must also not write
+ * to memory
+ */
+
+#define LICM_NO           0
+#define LICM_SPECULATE    1  // May be executed even if the loop is not
+#define LICM_GUARANTEED   2  // Must be executed on every trip
+#define LICM_READS_MEMORY 3  // As above and memory must not be written
+
+
+/**
+ *
+ */
+static int
+licm_vmop(int op)
+{
+  switch(op) {
+  case VM_ABS:
+  case VM_FLOOR:
+  case VM_SIN:
+  case VM_COS:
+  case VM_POW:
+  case VM_FABS:
+  case VM_FMOD:
+  case VM_LOG10:
+  case VM_FLOORF:
+  case VM_SINF:
+  case VM_COSF:
+  case VM_POWF:
+  case VM_FABSF:
+  case VM_FMODF:
+  case VM_LOG10F:
+  case VM_CTZ32:
+  case VM_CLZ32:
+  case VM_POP32:
+  case VM_CTZ64:
+  case VM_CLZ64:
+  case VM_POP64:
+    return LICM_SPECULATE;
+
+  case VM_STRLEN:
+  case VM_STRCMP:
+  case VM_STRNCMP:
+  case VM_STRCHR:
+  case VM_STRRCHR:
+  case VM_MEMCMP:
+    return LICM_READS_MEMORY;
+
+  default:
+    return LICM_NO;
+  }
+}
+
+
+/**
+ * Loads from constant globals at a constant offset can be executed
+ * speculatively. With a variable offset they are still not affected by
+ * stores
+ */
+static int
+licm_load(ir_unit_t *iu, const ir_instr_load_t *ii)
+{
+  ir_value_t *ptr = value_get(iu, ii->ptr);
+  if(ptr->iv_class == IR_VC_TEMPORARY) {
+    // Base pointer moved into a register by registerify()
+    ir_instr_move_t *move =
+      (ir_instr_move_t *)instr_isa(value_get_assigning_instr(iu, ptr),
+                                   IR_IC_MOVE);
+    if(move != NULL)
+      ptr = value_get(iu, move->value);
+  }
+
+  if(ptr->iv_class != IR_VC_CONSTANT && ptr->iv_class != IR_VC_GLOBALVAR)
+    return LICM_READS_MEMORY;
+
+  const uint32_t addr = value_get_const32(iu, ptr) + ii->immediate_offset;
+  const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
+  const uint32_t end = addr + type_sizeof(iu, ret->iv_type);
+
+  // Find the last constant global starting at or before the address
+  int lo = 0, hi = VECTOR_LEN(&iu->iu_constant_globals);
+  while(lo < hi) {
+    const int mid = (lo + hi) / 2;
+    const int gv = VECTOR_ITEM(&iu->iu_constant_globals, mid);
+    if(value_get(iu, gv)->iv_gvar->ig_addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo == 0)
+    return LICM_READS_MEMORY;
+
+  const int gv = VECTOR_ITEM(&iu->iu_constant_globals, lo - 1);
+  const ir_globalvar_t *ig = value_get(iu, gv)->iv_gvar;
+  const uint32_t gend = ig->ig_addr + type_sizeof(iu, ig->ig_type);
+  if(addr >= gend)
+    return LICM_READS_MEMORY;
+  if(ii->value_offset != -1)
+    return LICM_GUARANTEED;
+  return ii->cast == -1 && end <= gend ? LICM_SPECULATE : LICM_GUARANTEED;
+}
+
+
+/**
+ *
+ */
+static int
+licm_candidate(ir_unit_t *iu, ir_instr_t *ii)
+{
+  if(ii->ii_ret_value < 0)
+    return LICM_NO;
+
+  switch(ii->ii_class) {
+  case IR_IC_LEA:
+  case IR_IC_CAST:
+  case IR_IC_CMP2:
+  case IR_IC_SELECT:
+  case IR_IC_MOVE:
+    return LICM_SPECULATE;
+
+  case IR_IC_BINOP:
+    switch(((ir_instr_binary_t *)ii)->op) {
+    case BINOP_UDIV:
+    case BINOP_SDIV:
+    case BINOP_UREM:
+    case BINOP_SREM:
+      return LICM_GUARANTEED;
+    default:
+      return LICM_SPECULATE;
+    }
+
+  case IR_IC_LOAD:
+    return licm_load(iu, (ir_instr_load_t *)ii);
+
+  case IR_IC_VMOP:
+    return licm_vmop(value_function(iu, ((ir_instr_call_t *)ii)->callee)->
+                     if_vmop);
+
+  default:
+    return LICM_NO;
+  }
+}
+
+
+/**
+ *
+ */
+static int
+licm_writes_memory(ir_unit_t *iu, ir_instr_t *ii)
+{
+  switch(ii->ii_class) {
+  case IR_IC_STORE:
+  case IR_IC_CALL:
+  case IR_IC_VAARG:
+  case IR_IC_STACKCOPY:
+    return 1;
+  case IR_IC_VMOP:
+    return licm_candidate(iu, ii) == LICM_NO;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * Returns true if all inputs of the instruction are defined outside
+ * of loop 'l'
+ */
+static int
+licm_invariant(ir_unit_t *iu, const loopnest_t *ln, int l, ir_instr_t *ii)
+{
+  ir_value_instr_t *ivi;
+  LIST_FOREACH(ivi, &ii->ii_values, ivi_instr_link) {
+    if(ivi->ivi_relation != IVI_INPUT ||
+       ivi->ivi_value->iv_class != IR_VC_TEMPORARY)
+      continue;
+    ir_instr_t *def = value_get_assigning_instr(iu, ivi->ivi_value);
+    if(def == NULL)
+      return 0;
+    const int bb = ln->ln_dt.dt_index[def->ii_bb->ib_id];
+    if(bb == -1 || loop_contains(ln, l, bb))
+      return 0;
+  }
+  return 1;
+}
+
+
+/**
+ * Returns true if block 'bb' is executed before every exit of loop 'l'
+ */
+static int
+licm_guaranteed(const loopnest_t *ln, int l, int bb)
+{
+  const domtree_t *dt = &ln->ln_dt;
+  const loop_t *lp = &ln->ln_loops[l];
+  int exits = 0;
+
+  for(int i = 0; i < lp->l_num_bbs; i++) {
+    const int b = ln->ln_bbs[lp->l_first_bb + i];
+    const ir_bb_t *ib = dt->dt_bbs[b];
+    const ir_bb_edge_t *ibe;
+    int exiting = LIST_FIRST(&ib->ib_outgoing_edges) == NULL;
+
+    LIST_FOREACH(ibe, &ib->ib_outgoing_edges, ibe_from_link)
+      if(!loop_contains(ln, l, dt->dt_index[ibe->ibe_to->ib_id]))
+        exiting = 1;
+
+    if(!exiting)
+      continue;
+    if(!domtree_dominates(dt, bb, b))
+      return 0;
+    exits++;
+  }
+  return exits > 0;
+}
+
+
+/**
+ *
+ */
+static void
+licm_loop(ir_unit_t *iu, const loopnest_t *ln, int l)
+{
+  const domtree_t *dt = &ln->ln_dt;
+  const loop_t *lp = &ln->ln_loops[l];
+  const int *bbs = ln->ln_bbs + lp->l_first_bb;
+  ir_instr_t *ii, *next;
+
+  if(lp->l_preheader == -1)
+    return;
+
+  ir_bb_t *ph = dt->dt_bbs[lp->l_preheader];
+  ir_instr_t *term = TAILQ_LAST(&ph->ib_instrs, ir_instr_queue);
+
+  int writes_memory = 0;
+  for(int i = 0; i < lp->l_num_bbs; i++)
+    TAILQ_FOREACH(ii, &dt->dt_bbs[bbs[i]]->ib_instrs, ii_link)
+      writes_memory |= licm_writes_memory(iu, ii);
+
+  // Definitions are visited before their uses as blocks are in reverse
+  // postorder, so instructions depending on hoisted ones are moved too
+  for(int i = 0; i < lp->l_num_bbs; i++) {
+    ir_bb_t *bb = dt->dt_bbs[bbs[i]];
+    int guaranteed = -1;
+
+    for(ii = TAILQ_FIRST(&bb->ib_instrs); ii != NULL; ii = next) {
+      next = TAILQ_NEXT(ii, ii_link);
+
+      const int c = licm_candidate(iu, ii);
+      if(c == LICM_NO)
+        continue;
+
+      if(c == LICM_READS_MEMORY && writes_memory)
+        continue;
+
+      if(c != LICM_SPECULATE) {
+        if(guaranteed == -1)
+          guaranteed = licm_guaranteed(ln, l, bbs[i]);
+        if(!guaranteed)
+          continue;
+      }
+
+      if(!licm_invariant(iu, ln, l, ii))
+        continue;
+
+      TAILQ_REMOVE(&bb->ib_instrs, ii, ii_link);
+      TAILQ_INSERT_BEFORE(term, ii, ii_link);
+      ii->ii_bb = ph;
+      iu->iu_stats.licm_hoisted++;
+    }
+  }
+}
+
+
+/**
+ * Loops whose header have a single predecessor outside the loop that
+ * also branches elsewhere get a new preheader on that edge. Loops
+ * entered from several blocks are left alone
+ */
+static int
+licm_make_preheaders(ir_function_t *f, const loopnest_t *ln)
+{
+  int created = 0;
+
+  for(int l = 0; l < ln->ln_num_loops; l++) {
+    const loop_t *lp = &ln->ln_loops[l];
+    if(lp->l_preheader != -1)
+      continue;
+
+    ir_bb_t *h = ln->ln_dt.dt_bbs[lp->l_header];
+    ir_bb_edge_t *ibe, *entry = NULL;
+    int num_entries = 0;
+    LIST_FOREACH(ibe, &h->ib_incoming_edges, ibe_to_link) {
+      const int p = ln->ln_dt.dt_index[ibe->ibe_from->ib_id];
+      if(p != -1 && !loop_contains(ln, l, p)) {
+        entry = ibe;
+        num_entries++;
+      }
+    }
+    if(num_entries != 1)
+      continue;
+
+    break_critical_edge(f, entry);
+    created++;
+  }
+  return created;
+}
+
+
+/**
+ *
+ */
+static void
+hoist_loop_invariants(ir_unit_t *iu, ir_function_t *f)
+{
+  loopnest_t ln;
+  loopnest_build(f, &ln);
+
+  if(ln.ln_num_loops > 0 && licm_make_preheaders(f, &ln)) {
+    loopnest_free(&ln);
+    loopnest_build(f, &ln);
+  }
+
+  for(int l = ln.ln_num_loops - 1; l >= 0; l--)
+    licm_loop(iu, &ln, l);
+
+  loopnest_free(&ln);
+}
+
+
+/**
+ * Induction variable strength reduction
+ *
+ * A basic induction variable is an i32 phi in a loop header that is
+ * stepped by a constant on the single back edge. Loads and LEAs that
+ * address 'base + (i + k) * scale' with a loop invariant base are
+ * rewritten to use a pointer that is stepped along with the induction
+ * variable instead, with 'k * scale' folded into the immediate offset.
+ * One pointer is created for each base and scale, LEAs left with only
+ * an immediate offset are folded into the loads and stores using them.
+ *
+ * If the induction variable is then only needed by EQ/NE tests these
+ * compare the pointer with 'base + n * scale' computed in the preheader
+ * and the induction variable is removed. Unless the scale is one this
+ * requires the test to control the only exit of the loop and memory to
+ * be accessed through the pointer on every trip, so the pointer can't
+ * wrap around before reaching the limit.
+ *
+ * Each pointer costs an LEA per iteration so a loop is only rewritten
+ * if at least as many instructions are removed
+ */
+
+#define IV_MAX_VALUES   16
+#define IV_MAX_ACCESSES 32
+#define IV_MAX_GROUPS   4
+#define IV_MAX_TESTS    4
+
+typedef struct iv_access {
+  ir_instr_t *ia_instr;  // LOAD or LEA indexed by one of the values
+  int ia_value;          // Index in ind_values
+  int ia_group;
+  int ia_fold;           // LEA can be folded into all its users
+} iv_access_t;
+
+typedef struct indvar {
+  ir_instr_phi_t *ind_phi;
+  ir_instr_binary_t *ind_inc;
+  int ind_init;    // Value entering from the preheader
+  int ind_step;
+
+  // The induction variable, its increment and values derived from those
+  // by adding constants. ind_offset is the difference to the induction
+  // variable
+  int ind_num_values;
+  int ind_values[IV_MAX_VALUES];
+  int ind_offset[IV_MAX_VALUES];
+  int ind_parent[IV_MAX_VALUES];
+  int ind_kept[IV_MAX_VALUES];  // Used by something that isn't rewritten
+
+  int ind_num_accesses;
+  iv_access_t ind_accesses[IV_MAX_ACCESSES];
+
+  // Accesses are grouped on base pointer and scale
+  int ind_num_groups;
+  int ind_base[IV_MAX_GROUPS];
+  int ind_scale[IV_MAX_GROUPS];
+  int ind_every_trip[IV_MAX_GROUPS];  // Memory is accessed on every trip
+
+  int ind_num_tests;
+  ir_instr_binary_t *ind_tests[IV_MAX_TESTS];
+  int ind_test_value[IV_MAX_TESTS];
+} indvar_t;
+
+
+/**
+ * Returns true if 'value' is not defined in loop 'l'
+ */
+static int
+loop_invariant_value(ir_unit_t *iu, const loopnest_t *ln, int l, int value)
+{
+  ir_value_t *iv = value_get(iu, value);
+  if(iv->iv_class != IR_VC_TEMPORARY)
+    return 1;
+  ir_instr_t *def = value_get_assigning_instr(iu, iv);
+  if(def == NULL)
+    return 0;
+  const int bb = ln->ln_dt.dt_index[def->ii_bb->ib_id];
+  return bb != -1 && !loop_contains(ln, l, bb);
+}
+
+
+/**
+ *
+ */
+static int
+loop_contains_instr(const loopnest_t *ln, int l, const ir_instr_t *ii)
+{
+  const int bb = ln->ln_dt.dt_index[ii->ii_bb->ib_id];
+  return bb != -1 && loop_contains(ln, l, bb);
+}
+
+
+/**
+ * Returns true if 'ii' is executed on every trip through the loop
+ * ending in 'latch'
+ */
+static int
+indvar_every_trip(const loopnest_t *ln, int latch, const ir_instr_t *ii)
+{
+  const int bb = ln->ln_dt.dt_index[ii->ii_bb->ib_id];
+  return bb != -1 && domtree_dominates(&ln->ln_dt, bb, latch);
+}
+
+
+/**
+ * Return 1 if instruction 'a' is executed before 'b' in every trip that
+ * reaches 'b'
+ */
+static int
+indvar_dominates(const loopnest_t *ln, const ir_instr_t *a,
+                 const ir_instr_t *b)
+{
+  if(a->ii_bb == b->ii_bb) {
+    for(const ir_instr_t *ii = TAILQ_NEXT(a, ii_link); ii != NULL;
+        ii = TAILQ_NEXT(ii, ii_link))
+      if(ii == b)
+        return 1;
+    return 0;
+  }
+  const domtree_t *dt = &ln->ln_dt;
+  return domtree_dominates(dt, dt->dt_index[a->ii_bb->ib_id],
+                           dt->dt_index[b->ii_bb->ib_id]);
+}
+
+
+/**
+ *
+ */
+static int
+indvar_base(ir_unit_t *iu, const loopnest_t *ln, int l, int value)
+{
+  const ir_value_t *iv = value_get(iu, value);
+  if(iv->iv_class != IR_VC_TEMPORARY && iv->iv_class != IR_VC_REGFRAME)
+    return 0;
+  return loop_invariant_value(iu, ln, l, value);
+}
+
+
+/**
+ * An LEA that is left with only an immediate offset can be folded into
+ * its users if they are all loads and stores through it
+ */
+static int
+indvar_lea_fold(ir_unit_t *iu, const loopnest_t *ln, int latch,
+                ir_instr_lea_t *lea, int64_t offset, int *every_trip)
+{
+  const int ret = lea->super.ii_ret_value;
+  const ir_value_t *iv = value_get(iu, ret);
+  const ir_value_instr_t *ivi;
+  int users = 0, et = 0;
+
+  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link) {
+    if(ivi->ivi_relation != IVI_INPUT)
+      continue;
+
+    ir_instr_store_t *st = instr_isa(ivi->ivi_instr, IR_IC_STORE);
+    ir_instr_load_t *ld = instr_isa(ivi->ivi_instr, IR_IC_LOAD);
+    int64_t o;
+
+    if(st != NULL && st->ptr == ret && st->value != ret)
+      o = st->offset + offset;
+    else if(ld != NULL && ld->ptr == ret && ld->value_offset == -1)
+      o = ld->immediate_offset + offset;
+    else
+      return 0;
+
+    if(o < INT16_MIN || o > INT16_MAX)
+      return 0;
+
+    et |= indvar_every_trip(ln, latch, ivi->ivi_instr);
+    users++;
+  }
+  *every_trip = et;
+  return users > 0;
+}
+
+
+/**
+ *
+ */
+static int
+indvar_add_access(indvar_t *ind, ir_instr_t *ii, int q, int base, int scale,
+                  int fold, int every_trip)
+{
+  int g;
+  for(g = 0; g < ind->ind_num_groups; g++)
+    if(ind->ind_base[g] == base && ind->ind_scale[g] == scale)
+      break;
+
+  if(g == ind->ind_num_groups) {
+    if(g == IV_MAX_GROUPS)
+      return 0;
+    ind->ind_base[g] = base;
+    ind->ind_scale[g] = scale;
+    ind->ind_every_trip[g] = 0;
+    ind->ind_num_groups++;
+  }
+
+  if(ind->ind_num_accesses == IV_MAX_ACCESSES)
+    return 0;
+
+  iv_access_t *ia = &ind->ind_accesses[ind->ind_num_accesses++];
+  ia->ia_instr = ii;
+  ia->ia_value = q;
+  ia->ia_group = g;
+  ia->ia_fold = fold;
+  ind->ind_every_trip[g] |= every_trip;
+  return 1;
+}
+
+
+/**
+ * Classify a use of value 'q'. Returns false if the use can't be
+ * rewritten and thus needs the value
+ */
+static int
+indvar_use(ir_unit_t *iu, const loopnest_t *ln, int l, int latch,
+           indvar_t *ind, int q, ir_instr_t *ii)
+{
+  const int value = ind->ind_values[q];
+  const int64_t k = ind->ind_offset[q];
+  ir_instr_binary_t *bin;
+  ir_instr_load_t *ld;
+  ir_instr_lea_t *lea;
+  int64_t o;
+  uint32_t c;
+  int x, other, fold, every_trip = 0;
+
+  if(ii == &ind->ind_phi->super || ii == &ind->ind_inc->super)
+    return 1;
+
+  if(!loop_contains_instr(ln, l, ii))
+    return 0;
+
+  switch(ii->ii_class) {
+  case IR_IC_BINOP:
+    bin = (ir_instr_binary_t *)ii;
+    if(bin->lhs_value != value ||
+       value_get(iu, bin->rhs_value)->iv_class != IR_VC_CONSTANT ||
+       (bin->op != BINOP_ADD && bin->op != BINOP_SUB) ||
+       ind->ind_num_values == IV_MAX_VALUES)
+      return 0;
+
+    c = value_get_const32(iu, value_get(iu, bin->rhs_value));
+    x = ind->ind_num_values++;
+    ind->ind_values[x] = ii->ii_ret_value;
+    ind->ind_offset[x] = bin->op == BINOP_ADD ? (uint32_t)k + c :
+      (uint32_t)k - c;
+    ind->ind_parent[x] = q;
+    ind->ind_kept[x] = 0;
+    return 1;
+
+  case IR_IC_LOAD:
+    ld = (ir_instr_load_t *)ii;
+    if(ld->value_offset != value || ld->ptr == value ||
+       !indvar_base(iu, ln, l, ld->ptr))
+      return 0;
+    o = ld->immediate_offset + k * ld->value_offset_multiply;
+    if(o < INT16_MIN || o > INT16_MAX)
+      return 0;
+    return indvar_add_access(ind, ii, q, ld->ptr, ld->value_offset_multiply,
+                             0, indvar_every_trip(ln, latch, ii));
+
+  case IR_IC_LEA:
+    lea = (ir_instr_lea_t *)ii;
+    if(lea->value_offset != value || lea->baseptr == value ||
+       !indvar_base(iu, ln, l, lea->baseptr))
+      return 0;
+    o = lea->immediate_offset + k * lea->value_offset_multiply;
+    fold = indvar_lea_fold(iu, ln, latch, lea, o, &every_trip);
+    return indvar_add_access(ind, ii, q, lea->baseptr,
+                             lea->value_offset_multiply,
+                             fold, fold && every_trip);
+
+  case IR_IC_CMP2:
+    bin = (ir_instr_binary_t *)ii;
+    if(q > 1 || (bin->op != ICMP_EQ && bin->op != ICMP_NE) ||
+       ind->ind_num_tests == IV_MAX_TESTS)
+      return 0;
+    other = bin->lhs_value == value ? bin->rhs_value : bin->lhs_value;
+    if(other == value || !loop_invariant_value(iu, ln, l, other))
+      return 0;
+    switch(value_get(iu, other)->iv_class) {
+    case IR_VC_CONSTANT:
+    case IR_VC_TEMPORARY:
+    case IR_VC_REGFRAME:
+      break;
+    default:
+      return 0;
+    }
+    ind->ind_tests[ind->ind_num_tests] = bin;
+    ind->ind_test_value[ind->ind_num_tests] = q;
+    ind->ind_num_tests++;
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * Find the induction variable defined by 'phi' in the header of loop 'l'
+ * and all its uses. Returns false if the phi is not one
+ */
+static int
+indvar_analyze(ir_unit_t *iu, const loopnest_t *ln, int l, int latch,
+               ir_instr_phi_t *phi, indvar_t *ind)
+{
+  const domtree_t *dt = &ln->ln_dt;
+  const int ph = dt->dt_bbs[ln->ln_loops[l].l_preheader]->ib_id;
+  const int lb = dt->dt_bbs[latch]->ib_id;
+  int init = -1, next = -1;
+
+  if(phi->num_nodes != 2 ||
+     type_get(iu, value_get_type(iu, phi->super.ii_ret_value))->it_code !=
+     IR_TYPE_INT32)
+    return 0;
+
+  for(int i = 0; i < 2; i++) {
+    if(phi->nodes[i].predecessor == ph)
+      init = phi->nodes[i].value;
+    else if(phi->nodes[i].predecessor == lb)
+      next = phi->nodes[i].value;
+  }
+  if(init == -1 || next == -1)
+    return 0;
+
+  switch(value_get(iu, init)->iv_class) {
+  case IR_VC_CONSTANT:
+  case IR_VC_TEMPORARY:
+  case IR_VC_REGFRAME:
+    break;
+  default:
+    return 0;
+  }
+
+  ir_instr_binary_t *inc =
+    instr_isa(value_get_assigning_instr(iu, value_get(iu, next)),
+              IR_IC_BINOP);
+  if(inc == NULL || inc->lhs_value != phi->super.ii_ret_value ||
+     !loop_contains_instr(ln, l, &inc->super))
+    return 0;
+
+  const ir_value_t *c = value_get(iu, inc->rhs_value);
+  if(c->iv_class != IR_VC_CONSTANT)
+    return 0;
+  if(inc->op == BINOP_ADD)
+    ind->ind_step = value_get_const32(iu, c);
+  else if(inc->op == BINOP_SUB)
+    ind->ind_step = -value_get_const32(iu, c);
+  else
+    return 0;
+
+  ind->ind_phi = phi;
+  ind->ind_inc = inc;
+  ind->ind_init = init;
+  ind->ind_values[0] = phi->super.ii_ret_value;
+  ind->ind_offset[0] = 0;
+  ind->ind_parent[0] = -1;
+  ind->ind_values[1] = next;
+  ind->ind_offset[1] = ind->ind_step;
+  ind->ind_parent[1] = 0;
+  ind->ind_num_values = 2;
+
+  // Derived values are appended as they are found
+  for(int q = 0; q < ind->ind_num_values; q++) {
+    const ir_value_instr_t *ivi;
+    ind->ind_kept[q] = 0;
+    LIST_FOREACH(ivi, &value_get(iu, ind->ind_values[q])->iv_instructions,
+                 ivi_value_link) {
+      if(ivi->ivi_relation == IVI_INPUT &&
+         !indvar_use(iu, ln, l, latch, ind, q, ivi->ivi_instr))
+        ind->ind_kept[q] = 1;
+    }
+  }
+
+  for(int q = ind->ind_num_values - 1; q > 0; q--)
+    if(ind->ind_kept[q])
+      ind->ind_kept[ind->ind_parent[q]] = 1;
+
+  return ind->ind_num_groups > 0;
+}
+
+
+/**
+ * Returns true if the only exit of loop 'l' is a branch on 'cmp'
+ */
+static int
+indvar_exit_test(const loopnest_t *ln, int l, const ir_instr_binary_t *cmp)
+{
+  const domtree_t *dt = &ln->ln_dt;
+  const loop_t *lp = &ln->ln_loops[l];
+  int exits = 0, tested = 0;
+
+  for(int i = 0; i < lp->l_num_bbs; i++) {
+    const ir_bb_t *ib = dt->dt_bbs[ln->ln_bbs[lp->l_first_bb + i]];
+    const ir_bb_edge_t *ibe;
+
+    if(LIST_FIRST(&ib->ib_outgoing_edges) == NULL)
+      return 0;
+
+    LIST_FOREACH(ibe, &ib->ib_outgoing_edges, ibe_from_link) {
+      if(loop_contains(ln, l, dt->dt_index[ibe->ibe_to->ib_id]))
+        continue;
+      exits++;
+      ir_instr_br_t *br =
+        instr_isa(TAILQ_LAST(&ib->ib_instrs, ir_instr_queue), IR_IC_BR);
+      tested = br != NULL && br->condition == cmp->super.ii_ret_value;
+    }
+  }
+  return exits == 1 && tested;
+}
+
+
+/**
+ * Returns the group whose pointer replaces the induction variable in
+ * tests, -1 if it can't be removed
+ */
+static int
+indvar_replacement(const loopnest_t *ln, int l, const indvar_t *ind)
+{
+  if(ind->ind_kept[0] || ind->ind_kept[1])
+    return -1;
+
+  int g;
+  for(g = 0; g < ind->ind_num_groups; g++)
+    if(ind->ind_scale[g] == 1)
+      return g;
+
+  if(ind->ind_num_tests == 0)
+    return 0;
+
+  if(ind->ind_num_tests > 1 || !indvar_exit_test(ln, l, ind->ind_tests[0]))
+    return -1;
+
+  for(g = 0; g < ind->ind_num_groups; g++)
+    if(ind->ind_every_trip[g])
+      return g;
+  return -1;
+}
+
+
+/**
+ *
+ */
+static void
+indvar_lea_init(ir_unit_t *iu, ir_instr_lea_t *lea, int base, int index,
+                int scale)
+{
+  const ir_value_t *iv = value_get(iu, index);
+  lea->baseptr = base;
+  if(iv->iv_class == IR_VC_CONSTANT) {
+    lea->immediate_offset = value_get_const32(iu, iv) * (uint32_t)scale;
+    lea->value_offset = -1;
+  } else {
+    lea->immediate_offset = 0;
+    lea->value_offset = index;
+    lea->value_offset_multiply = scale;
+  }
+  instr_bind_input(iu, lea->baseptr, &lea->super);
+  instr_bind_input(iu, lea->value_offset, &lea->super);
+}
+
+
+/**
+ *
+ */
+static void
+indvar_rebind(ir_unit_t *iu, ir_instr_t *ii, int from, int to)
+{
+  instr_unbind_input(ii, value_get(iu, from));
+  instr_bind_input(iu, to, ii);
+}
+
+
+/**
+ * Create the pointer for group 'g', returns its increment
+ */
+static ir_instr_lea_t *
+indvar_make_pointer(ir_unit_t *iu, const loopnest_t *ln, int l, int latch,
+                    const indvar_t *ind, int g, ir_instr_t *before)
+{
+  const domtree_t *dt = &ln->ln_dt;
+  ir_bb_t *ph = dt->dt_bbs[ln->ln_loops[l].l_preheader];
+  ir_bb_t *header = dt->dt_bbs[ln->ln_loops[l].l_header];
+  const int type = value_get_type(iu, ind->ind_base[g]);
+  const int scale = ind->ind_scale[g];
+
+  ir_instr_lea_t *start =
+    instr_add_before(sizeof(ir_instr_lea_t), IR_IC_LEA,
+                     TAILQ_LAST(&ph->ib_instrs, ir_instr_queue));
+  value_alloc_instr_ret(iu, type, &start->super);
+  indvar_lea_init(iu, start, ind->ind_base[g], ind->ind_init, scale);
+
+  ir_instr_phi_t *phi = (ir_instr_phi_t *)
+    instr_create(header, sizeof(ir_instr_phi_t) + 2 * sizeof(ir_phi_node_t),
+                 IR_IC_PHI);
+  TAILQ_INSERT_HEAD(&header->ib_instrs, &phi->super, ii_link);
+  value_alloc_instr_ret(iu, type, &phi->super);
+
+  ir_instr_lea_t *next =
+    instr_add_before(sizeof(ir_instr_lea_t), IR_IC_LEA, before);
+  value_alloc_instr_ret(iu, type, &next->super);
+  next->baseptr = phi->super.ii_ret_value;
+  next->immediate_offset = (uint32_t)ind->ind_step * scale;
+  next->value_offset = -1;
+  instr_bind_input(iu, next->baseptr, &next->super);
+
+  phi->num_nodes = 2;
+  phi->nodes[0].predecessor = ph->ib_id;
+  phi->nodes[0].value = start->super.ii_ret_value;
+  phi->nodes[1].predecessor = dt->dt_bbs[latch]->ib_id;
+  phi->nodes[1].value = next->super.ii_ret_value;
+  qsort(phi->nodes, 2, sizeof(ir_phi_node_t), phi_sort);
+  instr_bind_input(iu, start->super.ii_ret_value, &phi->super);
+  instr_bind_input(iu, next->super.ii_ret_value, &phi->super);
+  return next;
+}
+
+
+/**
+ *
+ */
+static void
+indvar_fold_lea(ir_unit_t *iu, ir_instr_lea_t *lea)
+{
+  ir_value_t *iv = value_get(iu, lea->super.ii_ret_value);
+  ir_value_instr_t *ivi, *next;
+
+  for(ivi = LIST_FIRST(&iv->iv_instructions); ivi != NULL; ivi = next) {
+    next = LIST_NEXT(ivi, ivi_value_link);
+    if(ivi->ivi_relation != IVI_INPUT)
+      continue;
+    ir_instr_t *ii = ivi->ivi_instr;
+    ir_instr_store_t *st = instr_isa(ii, IR_IC_STORE);
+    if(st != NULL) {
+      st->ptr = lea->baseptr;
+      st->offset += lea->immediate_offset;
+    } else {
+      ir_instr_load_t *ld = (ir_instr_load_t *)ii;
+      ld->ptr = lea->baseptr;
+      ld->immediate_offset += lea->immediate_offset;
+    }
+    indvar_rebind(iu, ii, iv->iv_id, lea->baseptr);
+  }
+  iv->iv_class = IR_VC_DEAD;
+  instr_destroy(&lea->super);
+}
+
+
+/**
+ *
+ */
+static void
+indvar_reduce(ir_unit_t *iu, const loopnest_t *ln, int l, int latch,
+              indvar_t *ind, int rg)
+{
+  const domtree_t *dt = &ln->ln_dt;
+  ir_bb_t *ph = dt->dt_bbs[ln->ln_loops[l].l_preheader];
+  ir_instr_lea_t *incs[IV_MAX_GROUPS];
+  ir_instr_t *inc = &ind->ind_inc->super;
+
+  // Pointer increments go right before a kept increment of the induction
+  // variable as that is usually followed by a compare and branch on it.
+  // Otherwise the pointer used by the tests goes last for the same reason
+  ir_instr_t *before = rg == -1 ? inc : TAILQ_NEXT(inc, ii_link);
+
+  for(int i = 0; i < ind->ind_num_groups; i++) {
+    const int g = rg == -1 ? i : (rg + 1 + i) % ind->ind_num_groups;
+    incs[g] = indvar_make_pointer(iu, ln, l, latch, ind, g, before);
+  }
+
+  for(int i = 0; i < ind->ind_num_accesses; i++) {
+    const iv_access_t *ia = &ind->ind_accesses[i];
+    const int g = ia->ia_group;
+    const int value = ind->ind_values[ia->ia_value];
+    int64_t off = (int64_t)ind->ind_offset[ia->ia_value] * ind->ind_scale[g];
+    int ptr = incs[g]->baseptr;
+
+    // Accesses after the increment use the incremented pointer so the
+    // phi does not stay live across it
+    const int64_t next_off = off - (int64_t)ind->ind_step * ind->ind_scale[g];
+    const int after = indvar_dominates(ln, &incs[g]->super, ia->ia_instr);
+    int et;
+
+    if(ia->ia_instr->ii_class == IR_IC_LOAD) {
+      ir_instr_load_t *ld = (ir_instr_load_t *)ia->ia_instr;
+      const int64_t o = ld->immediate_offset + next_off;
+      if(after && o >= INT16_MIN && o <= INT16_MAX) {
+        ptr = incs[g]->super.ii_ret_value;
+        off = next_off;
+      }
+      instr_unbind_input(&ld->super, value_get(iu, value));
+      indvar_rebind(iu, &ld->super, ld->ptr, ptr);
+      ld->ptr = ptr;
+      ld->immediate_offset += off;
+      ld->value_offset = -1;
+      ld->value_offset_multiply = 0;
+    } else {
+      ir_instr_lea_t *lea = (ir_instr_lea_t *)ia->ia_instr;
+      if(after && (!ia->ia_fold ||
+                   indvar_lea_fold(iu, ln, latch, lea,
+                                   lea->immediate_offset + next_off, &et))) {
+        ptr = incs[g]->super.ii_ret_value;
+        off = next_off;
+      }
+      instr_unbind_input(&lea->super, value_get(iu, value));
+      indvar_rebind(iu, &lea->super, lea->baseptr, ptr);
+      lea->baseptr = ptr;
+      lea->immediate_offset = (uint32_t)(lea->immediate_offset + off);
+      lea->value_offset = -1;
+      if(ia->ia_fold)
+        indvar_fold_lea(iu, lea);
+    }
+  }
+
+  for(int q = ind->ind_num_values - 1; q > 1; q--) {
+    ir_value_t *iv = value_get(iu, ind->ind_values[q]);
+    if(value_has_users(iv))
+      continue;
+    instr_destroy(value_get_assigning_instr(iu, iv));
+    iv->iv_class = IR_VC_DEAD;
+  }
+
+  iu->iu_stats.ivs_reduced += ind->ind_num_groups;
+
+  if(rg == -1)
+    return;
+
+  for(int i = 0; i < ind->ind_num_tests; i++) {
+    ir_instr_binary_t *cmp = ind->ind_tests[i];
+    const int q = ind->ind_test_value[i];
+    const int value = ind->ind_values[q];
+    const int n = cmp->lhs_value == value ? cmp->rhs_value : cmp->lhs_value;
+
+    ir_instr_lea_t *limit =
+      instr_add_before(sizeof(ir_instr_lea_t), IR_IC_LEA,
+                       TAILQ_LAST(&ph->ib_instrs, ir_instr_queue));
+    value_alloc_instr_ret(iu, value_get_type(iu, ind->ind_base[rg]),
+                          &limit->super);
+    indvar_lea_init(iu, limit, ind->ind_base[rg], n, ind->ind_scale[rg]);
+
+    instr_unbind_input(&cmp->super, value_get(iu, value));
+    instr_unbind_input(&cmp->super, value_get(iu, n));
+    cmp->lhs_value = q == 0 ? incs[rg]->baseptr :
+      incs[rg]->super.ii_ret_value;
+    cmp->rhs_value = limit->super.ii_ret_value;
+    instr_bind_input(iu, cmp->lhs_value, &cmp->super);
+    instr_bind_input(iu, cmp->rhs_value, &cmp->super);
+  }
+
+  // The induction variable and its increment only use each other now
+  ir_value_t *i = value_get(iu, ind->ind_values[0]);
+  ir_value_t *next = value_get(iu, ind->ind_values[1]);
+  instr_destroy(&ind->ind_phi->super);
+  instr_destroy(&ind->ind_inc->super);
+  assert(!value_has_users(i) && !value_has_users(next));
+  i->iv_class = IR_VC_DEAD;
+  next->iv_class = IR_VC_DEAD;
+}
+
+
+/**
+ *
+ */
+static void
+reduce_induction_variables(ir_unit_t *iu, ir_function_t *f)
+{
+  loopnest_t ln;
+  loopnest_build(f, &ln);
+
+  for(int l = 0; l < ln.ln_num_loops; l++) {
+    const loop_t *lp = &ln.ln_loops[l];
+    if(lp->l_preheader == -1)
+      continue;
+
+    ir_bb_t *header = ln.ln_dt.dt_bbs[lp->l_header];
+    ir_bb_edge_t *ibe;
+    int latch = -1, num_latches = 0;
+    LIST_FOREACH(ibe, &header->ib_incoming_edges, ibe_to_link) {
+      const int p = ln.ln_dt.dt_index[ibe->ibe_from->ib_id];
+      if(p != -1 && loop_contains(&ln, l, p)) {
+        latch = p;
+        num_latches++;
+      }
+    }
+    if(num_latches != 1)
+      continue;
+
+    // Reducing a variable destroys its phi and may destroy other
+    // instructions in the header, so collect the phis up front
+    ir_instr_t *ii;
+    int num_phis = 0;
+    TAILQ_FOREACH(ii, &header->ib_instrs, ii_link) {
+      if(ii->ii_class != IR_IC_PHI)
+        break;
+      num_phis++;
+    }
+    ir_instr_t **phis = malloc(sizeof(ir_instr_t *) * num_phis);
+    num_phis = 0;
+    TAILQ_FOREACH(ii, &header->ib_instrs, ii_link) {
+      if(ii->ii_class != IR_IC_PHI)
+        break;
+      phis[num_phis++] = ii;
+    }
+
+    for(int p = 0; p < num_phis; p++) {
+      ii = phis[p];
+
+      indvar_t ind;
+      memset(&ind, 0, sizeof(ind));
+      if(!indvar_analyze(iu, &ln, l, latch, (ir_instr_phi_t *)ii, &ind))
+        continue;
+
+      const int rg = indvar_replacement(&ln, l, &ind);
+      int gain = rg != -1;
+      for(int q = 2; q < ind.ind_num_values; q++)
+        gain += !ind.ind_kept[q];
+      for(int i = 0; i < ind.ind_num_accesses; i++)
+        gain += ind.ind_accesses[i].ia_fold;
+
+      if(gain > 0 && gain >= ind.ind_num_groups)
+        indvar_reduce(iu, &ln, l, latch, &ind, rg);
+    }
+    free(phis);
+  }
+  loopnest_free(&ln);
+}
+
+
+/**
+ * Global value numbering
+ *
+ * Walks the dominator tree with a scoped table of the instructions
+ * computed so far. An instruction that computes the same thing as one
+ * in a dominating position is removed and its users are rewritten to
+ * use the earlier result. Operands are compared by value number, which
+ * is simply the value index as replaced values are substituted in all
+ * users, and constants compare by type and contents.
+ *
+ * Loads and VM ops reading memory also include a memory generation in
+ * the key which is bumped by every instruction that may write memory.
+ * A block continues the generation of its immediate dominator only if
+ * that is its single predecessor, so only trivially redundant loads
+ * are removed
+ */
+
+#define GVN_MAX_OPERANDS 8
+
+typedef struct gvn_key {
+  int gk_class;
+  int gk_type;
+  int gk_memory;   // Memory generation, 0 if memory is not read
+  int gk_imm[4];
+  int gk_num_operands;
+  int gk_operands[GVN_MAX_OPERANDS];
+} gvn_key_t;
+
+typedef struct gvn_entry {
+  ir_instr_t *ge_instr;
+  gvn_key_t ge_key;
+  uint32_t ge_hash;
+  int ge_next;     // Next entry in the same bucket
+} gvn_entry_t;
+
+typedef struct gvn {
+  ir_unit_t *g_iu;
+  int *g_buckets;
+  uint32_t g_mask;
+  // Entries are removed in reverse order when leaving a dominator
+  // subtree so they are also used as an undo log
+  VECTOR_HEAD(, gvn_entry_t) g_entries;
+  int g_memory;
+  int g_generations;
+} gvn_t;
+
+
+/**
+ *
+ */
+static uint32_t
+gvn_value_hash(ir_unit_t *iu, int value)
+{
+  if(value < 0)
+    return value;
+  const ir_value_t *iv = value_get(iu, value);
+  if(iv->iv_class != IR_VC_CONSTANT)
+    return value;
+  const uint64_t bits = type_sizeof(iu, iv->iv_type) > 4 ?
+    iv->iv_u64 : iv->iv_u32;
+  return (bits * 0x9e3779b97f4a7c15ULL >> 32) ^ iv->iv_type;
+}
+
+
+/**
+ *
+ */
+static int
+gvn_same_value(ir_unit_t *iu, int a, int b)
+{
+  if(a == b)
+    return 1;
+  if(a < 0 || b < 0)
+    return 0;
+  const ir_value_t *x = value_get(iu, a);
+  const ir_value_t *y = value_get(iu, b);
+  if(x->iv_class != IR_VC_CONSTANT || y->iv_class != IR_VC_CONSTANT ||
+     x->iv_type != y->iv_type)
+    return 0;
+  if(type_sizeof(iu, x->iv_type) > 4)
+    return x->iv_u64 == y->iv_u64;
+  return x->iv_u32 == y->iv_u32;
+}
+
+
+/**
+ *
+ */
+static int
+gvn_commutative(const ir_instr_t *ii)
+{
+  const ir_instr_binary_t *b = (const ir_instr_binary_t *)ii;
+  if(ii->ii_class == IR_IC_CMP2)
+    return b->op == ICMP_EQ || b->op == ICMP_NE;
+
+  switch(b->op) {
+  case BINOP_ADD:
+  case BINOP_MUL:
+  case BINOP_AND:
+  case BINOP_OR:
+  case BINOP_XOR:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * Build the key of an instruction. Returns 0 if it can't be numbered,
+ * 1 if it is pure and 2 if it reads memory that may be written
+ */
+static int
+gvn_key(ir_unit_t *iu, ir_instr_t *ii, gvn_key_t *k)
+{
+  const ir_instr_load_t *ld;
+  const ir_instr_lea_t *lea;
+  const ir_instr_binary_t *b;
+  const ir_instr_select_t *s;
+  const ir_instr_call_t *c;
+  int r = 1;
+
+  if(ii->ii_ret_value < 0)
+    return 0;
+
+  memset(k, 0, sizeof(gvn_key_t));
+  k->gk_class = ii->ii_class;
+  k->gk_type = value_get_type(iu, ii->ii_ret_value);
+
+  switch(ii->ii_class) {
+  case IR_IC_LOAD:
+    ld = (const ir_instr_load_t *)ii;
+    if(licm_load(iu, ld) == LICM_READS_MEMORY)
+      r = 2;
+    k->gk_imm[0] = ld->immediate_offset;
+    k->gk_imm[1] = ld->value_offset_multiply;
+    k->gk_imm[2] = ld->cast;
+    k->gk_imm[3] = ld->cast != -1 ? ld->load_type : 0;
+    k->gk_operands[0] = ld->ptr;
+    k->gk_operands[1] = ld->value_offset;
+    k->gk_num_operands = 2;
+    break;
+
+  case IR_IC_LEA:
+    lea = (const ir_instr_lea_t *)ii;
+    k->gk_imm[0] = lea->immediate_offset;
+    k->gk_imm[1] = lea->value_offset_multiply;
+    k->gk_operands[0] = lea->baseptr;
+    k->gk_operands[1] = lea->value_offset;
+    k->gk_num_operands = 2;
+    break;
+
+  case IR_IC_BINOP:
+  case IR_IC_CMP2:
+    b = (const ir_instr_binary_t *)ii;
+    k->gk_imm[0] = b->op;
+    k->gk_operands[0] = b->lhs_value;
+    k->gk_operands[1] = b->rhs_value;
+    k->gk_num_operands = 2;
+    if(gvn_commutative(ii) &&
+       gvn_value_hash(iu, b->lhs_value) > gvn_value_hash(iu, b->rhs_value)) {
+      k->gk_operands[0] = b->rhs_value;
+      k->gk_operands[1] = b->lhs_value;
+    }
+    break;
+
+  case IR_IC_CAST:
+    k->gk_imm[0] = ((const ir_instr_unary_t *)ii)->op;
+    // FALLTHRU
+  case IR_IC_MOVE:
+    k->gk_operands[0] = ((const ir_instr_unary_t *)ii)->value;
+    k->gk_num_operands = 1;
+    break;
+
+  case IR_IC_SELECT:
+    s = (const ir_instr_select_t *)ii;
+    k->gk_operands[0] = s->pred;
+    k->gk_operands[1] = s->true_value;
+    k->gk_operands[2] = s->false_value;
+    k->gk_num_operands = 3;
+    break;
+
+  case IR_IC_VMOP:
+    c = (const ir_instr_call_t *)ii;
+    switch(licm_vmop(value_function(iu, c->callee)->if_vmop)) {
+    case LICM_NO:
+      return 0;
+    case LICM_READS_MEMORY:
+      r = 2;
+      break;
+    }
+    if(c->argc > GVN_MAX_OPERANDS)
+      return 0;
+    k->gk_imm[0] = c->callee;
+    for(int i = 0; i < c->argc; i++) {
+      if(c->argv[i].copy_size)
+        return 0;
+      k->gk_operands[i] = c->argv[i].value;
+    }
+    k->gk_num_operands = c->argc;
+    break;
+
+  default:
+    return 0;
+  }
+  return r;
+}
+
+
+/**
+ *
+ */
+static uint32_t
+gvn_hash(ir_unit_t *iu, const gvn_key_t *k)
+{
+  uint32_t h = k->gk_class * 31 + k->gk_type;
+  h = h * 31 + k->gk_memory;
+  for(int i = 0; i < 4; i++)
+    h = h * 31 + k->gk_imm[i];
+  for(int i = 0; i < k->gk_num_operands; i++)
+    h = h * 31 + gvn_value_hash(iu, k->gk_operands[i]);
+  return h ^ (h >> 15);
+}
+
+
+/**
+ *
+ */
+static int
+gvn_key_equal(ir_unit_t *iu, const gvn_key_t *a, const gvn_key_t *b)
+{
+  if(a->gk_class != b->gk_class || a->gk_type != b->gk_type ||
+     a->gk_memory != b->gk_memory ||
+     memcmp(a->gk_imm, b->gk_imm, sizeof(a->gk_imm)) ||
+     a->gk_num_operands != b->gk_num_operands)
+    return 0;
+  for(int i = 0; i < a->gk_num_operands; i++)
+    if(!gvn_same_value(iu, a->gk_operands[i], b->gk_operands[i]))
+      return 0;
+  return 1;
+}
+
+
+/**
+ * Number the instructions in 'bb'. Returns the memory generation at
+ * the end of it
+ */
+static int
+gvn_bb(gvn_t *g, ir_bb_t *bb)
+{
+  ir_unit_t *iu = g->g_iu;
+  ir_instr_t *ii, *next;
+  gvn_key_t k;
+
+  for(ii = TAILQ_FIRST(&bb->ib_instrs); ii != NULL; ii = next) {
+    next = TAILQ_NEXT(ii, ii_link);
+
+    const int r = gvn_key(iu, ii, &k);
+    if(r == 0) {
+      if(licm_writes_memory(iu, ii))
+        g->g_memory = ++g->g_generations;
+      continue;
+    }
+    if(r == 2)
+      k.gk_memory = g->g_memory;
+
+    const uint32_t hash = gvn_hash(iu, &k);
+    int e;
+    for(e = g->g_buckets[hash & g->g_mask]; e != -1;
+        e = VECTOR_ITEM(&g->g_entries, e).ge_next) {
+      const gvn_entry_t *ge = &VECTOR_ITEM(&g->g_entries, e);
+      if(ge->ge_hash == hash && gvn_key_equal(iu, &ge->ge_key, &k))
+        break;
+    }
+
+    if(e != -1) {
+      instr_replace_output(iu, ii,
+                           VECTOR_ITEM(&g->g_entries, e).
+                           ge_instr->ii_ret_value);
+      iu->iu_stats.gvn_eliminated++;
+      continue;
+    }
+
+    gvn_entry_t ge = {ii, k, hash, g->g_buckets[hash & g->g_mask]};
+    g->g_buckets[hash & g->g_mask] = VECTOR_LEN(&g->g_entries);
+    VECTOR_PUSH_BACK(&g->g_entries, ge);
+  }
+  return g->g_memory;
+}
+
+
+/**
+ * Returns true if the only way into 'bb' is from its immediate dominator
+ */
+static int
+gvn_single_predecessor(const ir_bb_t *bb)
+{
+  const ir_bb_edge_t *ibe = LIST_FIRST(&bb->ib_incoming_edges);
+  return ibe != NULL && LIST_NEXT(ibe, ibe_to_link) == NULL;
+}
+
+
+/**
+ *
+ */
+static void
+eliminate_common_subexpressions(ir_unit_t *iu, ir_function_t *f)
+{
+  domtree_t dt;
+  gvn_t g = {iu};
+  const ir_bb_t *bb;
+  const ir_instr_t *ii;
+  int num_instrs = 0;
+
+  TAILQ_FOREACH(bb, &f->if_bbs, ib_link)
+    TAILQ_FOREACH(ii, &bb->ib_instrs, ii_link)
+      num_instrs++;
+
+  int size = 64;
+  while(size < num_instrs * 2)
+    size *= 2;
+  g.g_mask = size - 1;
+  g.g_buckets = malloc(size * sizeof(int));
+  memset(g.g_buckets, 0xff, size * sizeof(int));
+
+  domtree_build(f, &dt);
+
+  const int n = dt.dt_num_bbs;
+  int *work = malloc(2 * n * sizeof(int));
+  int *logpos = malloc(n * sizeof(int));
+  int *memory = malloc(n * sizeof(int));
+  int depth = 0;
+
+  work[depth++] = 0;
+  while(depth > 0) {
+    const int i = work[--depth];
+    if(i < 0) {
+      while(VECTOR_LEN(&g.g_entries) > logpos[~i]) {
+        const int e = VECTOR_LEN(&g.g_entries) - 1;
+        const gvn_entry_t *ge = &VECTOR_ITEM(&g.g_entries, e);
+        g.g_buckets[ge->ge_hash & g.g_mask] = ge->ge_next;
+        VECTOR_RESIZE(&g.g_entries, e);
+      }
+      continue;
+    }
+
+    if(i > 0 && gvn_single_predecessor(dt.dt_bbs[i]))
+      g.g_memory = memory[dt.dt_idom[i]];
+    else
+      g.g_memory = ++g.g_generations;
+
+    logpos[i] = VECTOR_LEN(&g.g_entries);
+    memory[i] = gvn_bb(&g, dt.dt_bbs[i]);
+    work[depth++] = ~i;
+    for(int c = dt.dt_child[i]; c != -1; c = dt.dt_sibling[c])
+      work[depth++] = c;
+  }
+
+  free(work);
+  free(logpos);
+  free(memory);
+  free(g.g_buckets);
+  VECTOR_CLEAR(&g.g_entries);
+  domtree_free(&dt);
+}
+
+
+/**
+ *
+ */
+static void
+transform_function(ir_unit_t *iu, ir_function_t *f)
+{
+  if(iu->iu_inline_size) {
+    int size;
+    inline_analyze(iu, f, &size);
+    inline_calls(iu, f, size);
+  }
+
+  replace_instructions(iu, f);
+
+  function_bind_instr_inputs(iu, f);
+
+  construct_cfg(f);
+
+  promote_allocas(iu, f);
+
+  propagate_constants(iu, f);
+
+  hoist_loop_invariants(iu, f);
+
+  reduce_induction_variables(iu, f);
+
+  eliminate_common_subexpressions(iu, f);
 
   break_crtitical_edges(f);
 
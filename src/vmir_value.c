@@ -128,7 +128,8 @@ static const char *value_str_id(ir_unit_t *iu, int id);
 static void
 value_bind_instr(ir_value_t *iv, ir_instr_t *ii, int relation)
 {
-  ir_value_instr_t *ivi = malloc(sizeof(ir_value_instr_t));
+  ir_value_instr_t *ivi = arena_alloc(ii->ii_bb->ib_arena,
+                                      sizeof(ir_value_instr_t));
   ivi->ivi_instr = ii;
   ivi->ivi_value = iv;
   ivi->ivi_relation = relation;
@@ -159,7 +160,6 @@ ivi_destroy(ir_value_instr_t *ivi)
 {
   LIST_REMOVE(ivi, ivi_instr_link);
   LIST_REMOVE(ivi, ivi_value_link);
-  free(ivi);
 }
 
 /**
@@ -174,6 +174,40 @@ instr_bind_clear(ir_instr_t *ii)
 }
 
 
+/**
+ * Returns 1 if any instruction uses 'iv' as input
+ */
+static int
+value_has_users(const ir_value_t *iv)
+{
+  const ir_value_instr_t *ivi;
+  LIST_FOREACH(ivi, &iv->iv_instructions, ivi_value_link)
+    if(ivi->ivi_relation == IVI_INPUT)
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Remove all bindings of 'iv' as input to 'ii', returns how many there
+ * were
+ */
+static int
+instr_unbind_input(ir_instr_t *ii, ir_value_t *iv)
+{
+  ir_value_instr_t *ivi, *next;
+  int cnt = 0;
+  for(ivi = LIST_FIRST(&ii->ii_values); ivi != NULL; ivi = next) {
+    next = LIST_NEXT(ivi, ivi_instr_link);
+    if(ivi->ivi_value == iv && ivi->ivi_relation == IVI_INPUT) {
+      ivi_destroy(ivi);
+      cnt++;
+    }
+  }
+  return cnt;
+}
+
+
 /**
  *
  */
@@ -787,6 +821,7 @@ eval_constexpr(ir_unit_t *iu, ir_value_t *iv, ir_constexpr_t *ic)
 
       case COMBINE3(IR_TYPE_INT32, CAST_PTRTOINT, IR_VC_FUNCTION):
         iv->iv_u32 = value_function_addr(src);
+        lazy_reach(iu, src->iv_func);
         break;
 
       default:
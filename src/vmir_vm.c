@@ -55,6 +55,98 @@ vm_stop(ir_unit_t *iu, int reason, int code)
 }
 
 
+#ifdef VMIR_VM_PROFILE
+
+#include "vmir_vm_opnames.h"
+
+#define VM_NUM_OPNAMES (sizeof(vm_opnames) / sizeof(vm_opnames[0]))
+
+/**
+ * Number of times each sequence of two and three opcodes has been
+ * dispatched. Keys are the resolved opcodes, the length of the
+ * sequence is stored in bit 48 and up so a key is never 0
+ */
+typedef struct vm_op_count {
+  uint64_t key;
+  uint64_t count;
+} vm_op_count_t;
+
+typedef struct vm_op_profile {
+  vm_op_count_t *vop_entries;
+  int vop_size;
+  int vop_used;
+} vm_op_profile_t;
+
+
+/**
+ *
+ */
+static void
+vm_profile_insert(vm_op_profile_t *vop, uint64_t key, uint64_t count)
+{
+  const int mask = vop->vop_size - 1;
+  int i = (key * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+  while(vop->vop_entries[i].key != key) {
+    if(vop->vop_entries[i].key == 0) {
+      vop->vop_entries[i].key = key;
+      vop->vop_used++;
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  vop->vop_entries[i].count += count;
+}
+
+
+/**
+ *
+ */
+static void
+vm_profile_count(ir_unit_t *iu, uint64_t key)
+{
+  vm_op_profile_t *vop = iu->iu_op_profile;
+  if(vop == NULL)
+    vop = iu->iu_op_profile = calloc(1, sizeof(vm_op_profile_t));
+
+  if(vop->vop_used * 2 >= vop->vop_size) {
+    vm_op_count_t *entries = vop->vop_entries;
+    const int size = vop->vop_size;
+    vop->vop_size = size ? size * 2 : 4096;
+    vop->vop_entries = calloc(vop->vop_size, sizeof(vm_op_count_t));
+    vop->vop_used = 0;
+    for(int i = 0; i < size; i++)
+      if(entries[i].key)
+        vm_profile_insert(vop, entries[i].key, entries[i].count);
+    free(entries);
+  }
+  vm_profile_insert(vop, key, 1);
+}
+
+
+/**
+ * Called for every dispatched opcode. 'hist' is the two previous
+ * opcodes of the current vm_exec() activation
+ */
+static void
+vm_profile_op(ir_unit_t *iu, int32_t *hist, int16_t opc)
+{
+  const uint16_t op = opc;
+  if(hist[1] != -1) {
+    vm_profile_count(iu, 2ULL << 48 | (uint64_t)hist[1] << 16 | op);
+    if(hist[0] != -1)
+      vm_profile_count(iu, 3ULL << 48 | (uint64_t)hist[0] << 32 |
+                       (uint64_t)hist[1] << 16 | op);
+  }
+  hist[0] = hist[1];
+  hist[1] = op;
+}
+
+#define VM_PROFILE_OP(opc) vm_profile_op(iu, prof_hist, opc)
+#else
+#define VM_PROFILE_OP(opc)
+#endif
+
+
 static uint32_t
 vm_arg32(const void **rfp)
 {
@@ -468,22 +560,221 @@ do_jit_call(void *rf, void *mem, void *(*code)(void *, void *))
   return r;
 }
 
+
+/**
+ * Inline cache stored in the VM text right after the operands of
+ * JSR_R and JSR_R_TAIL. Each entry maps a function index to the VM
+ * text it resolved to, or to the external function for entries where
+ * the index is stored inverted. The first targets seen at a call site
+ * are kept, once both entries are taken other VM functions are looked
+ * up in iu_vm_funcs directly.
+ *
+ * Tier-up replaces VM text while we run so all entries are flushed
+ * when iu_vm_funcs_gen has moved since they were filled
+ */
+#define VM_IC_ENTRIES 2
+#define VM_IC_EMPTY   0x80000000 // Neither a function index nor inverted one
+#define VM_IC_SIZE    13         // In 16 bit words
+
+typedef struct vm_ic {
+  uint16_t vic_gen;
+  struct {
+    uint32_t fid;
+    uint64_t target;
+  } __attribute__((packed)) vic_entries[VM_IC_ENTRIES];
+} __attribute__((packed)) vm_ic_t;
+
+
+/**
+ *
+ */
+static void
+vm_ic_init(ir_unit_t *iu, vm_ic_t *ic)
+{
+  ic->vic_gen = iu->iu_vm_funcs_gen;
+  for(int i = 0; i < VM_IC_ENTRIES; i++) {
+    ic->vic_entries[i].fid = VM_IC_EMPTY;
+    ic->vic_entries[i].target = 0;
+  }
+}
+
+
+/**
+ * Inline cache miss. Returns the VM text of the callee, external
+ * functions are called from here and NULL is returned
+ */
+static const uint16_t * __attribute__((noinline))
+vm_ic_miss(ir_unit_t *iu, vm_ic_t *ic, uint32_t fid, void *ret, void *args)
+{
+  const uint16_t gen = __atomic_load_n(&iu->iu_vm_funcs_gen,
+                                       __ATOMIC_ACQUIRE);
+  vm_ext_function_t *ext = NULL;
+  int i;
+
+  if(ic->vic_gen != gen) {
+    ic->vic_gen = gen;
+    for(i = 0; i < VM_IC_ENTRIES; i++)
+      ic->vic_entries[i].fid = VM_IC_EMPTY;
+  }
+
+  for(i = 0; i < VM_IC_ENTRIES; i++)
+    if(ic->vic_entries[i].fid == ~fid)
+      ext = (vm_ext_function_t *)(intptr_t)ic->vic_entries[i].target;
+
+  const uint16_t *text = NULL;
+  if(ext == NULL) {
+    if(fid >= VECTOR_LEN(&iu->iu_functions))
+      vm_stop(iu, VM_STOP_BAD_FUNCTION, fid);
+    text = iu->iu_vm_funcs[fid];
+    if(text == NULL && (ext = iu->iu_ext_funcs[fid]) == NULL)
+      vm_stop(iu, VM_STOP_BAD_FUNCTION, fid);
+
+    for(i = 0; i < VM_IC_ENTRIES; i++) {
+      if(ic->vic_entries[i].fid == VM_IC_EMPTY) {
+        ic->vic_entries[i].fid = text ? fid : ~fid;
+        ic->vic_entries[i].target = text ? (intptr_t)text : (intptr_t)ext;
+        break;
+      }
+    }
+  }
+
+  if(ext != NULL)
+    ext(ret, args, iu);
+  return text;
+}
+
+
+/**
+ * Resolve the VM text of the callee of an indirect call. External
+ * functions are called directly and NULL is returned
+ */
+static inline const uint16_t *
+vm_ic_lookup(ir_unit_t *iu, const uint16_t *I, uint32_t fid,
+             void *ret, void *args)
+{
+  vm_ic_t *ic = (vm_ic_t *)I;
+  if(__builtin_expect(ic->vic_gen == (uint16_t)iu->iu_vm_funcs_gen, 1)) {
+    if(__builtin_expect(ic->vic_entries[0].fid == fid, 1))
+      return (const uint16_t *)(intptr_t)ic->vic_entries[0].target;
+    if(ic->vic_entries[1].fid == fid)
+      return (const uint16_t *)(intptr_t)ic->vic_entries[1].target;
+    if(ic->vic_entries[1].fid != VM_IC_EMPTY &&
+       fid < VECTOR_LEN(&iu->iu_functions) && iu->iu_vm_funcs[fid])
+      return iu->iu_vm_funcs[fid]; // Megamorphic
+  }
+  return vm_ic_miss(iu, ic, fid, ret, args);
+}
+
+
+/**
+ * Return address and caller state of a guest call made inside
+ * vm_exec(). These live in host memory (iu_vm_frames) so the guest
+ * can't rewrite them. Each vm_exec() activation owns the frames above
+ * the depth it was entered at
+ */
+typedef struct vm_call_frame {
+  const uint16_t *vcf_I;
+  void *vcf_ret;
+  void *vcf_rf;
+  uint32_t vcf_allocaptr;
+} vm_call_frame_t;
+
+
+/**
+ * Push a frame on the return stack, growing it if needed. Every call
+ * uses at least a few bytes of the register area so the depth is
+ * bounded by that as well
+ */
+static vm_call_frame_t *
+vm_push_frame(ir_unit_t *iu)
+{
+  if(__builtin_expect(iu->iu_vm_depth == iu->iu_vm_frames_size, 0)) {
+    if(iu->iu_vm_frames_size >= iu->iu_rsize / 8)
+      vm_stop(iu, VM_STOP_STACK_OVERFLOW, 0);
+    iu->iu_vm_frames_size = iu->iu_vm_frames_size * 2 ?: 64;
+    iu->iu_vm_frames = realloc(iu->iu_vm_frames, iu->iu_vm_frames_size *
+                               sizeof(vm_call_frame_t));
+  }
+  return &iu->iu_vm_frames[iu->iu_vm_depth++];
+}
+
+
+/**
+ * Stop the VM unless a register frame of 'size' bytes at 'rf' fits in
+ * the register area
+ */
+#define VM_CHECK_FRAME(rf, size) do {                                   \
+    if(__builtin_expect((rf) - mem + (size) > iu->iu_rsize, 0))         \
+      vm_stop(iu, VM_STOP_STACK_OVERFLOW, 0);                           \
+  } while(0)
+
+
+/**
+ * Enter a VM function without recursing on the host stack
+ */
+#define VM_CALL(text, callee_rf, callee_ret, callee_size, skip) do {     \
+    const uint16_t *ctext = (text);                                     \
+    void *crf = (callee_rf);                                            \
+    void *cret = (callee_ret);                                          \
+    VM_CHECK_FRAME(crf, callee_size);                                   \
+    vm_call_frame_t *vcf = vm_push_frame(iu);                           \
+    vcf->vcf_I = I + (skip);                                            \
+    vcf->vcf_ret = ret;                                                 \
+    vcf->vcf_rf = rf;                                                   \
+    vcf->vcf_allocaptr = allocaptr;                                     \
+    I = ctext;                                                          \
+    rf = crf;                                                           \
+    ret = cret;                                                         \
+  } while(0)
+
+
+/**
+ * Replace the current function with the callee. The arguments are
+ * moved to where the caller placed ours and allocas are released
+ */
+#define VM_TAIL_CALL(text, argoffset, argsize, callee_size) do {        \
+    const uint16_t *ctext = (text);                                     \
+    VM_CHECK_FRAME(rf, callee_size);                                    \
+    memmove(rf - (argsize), rf + (argoffset) - (argsize), (argsize));   \
+    allocaptr = iu->iu_vm_depth == depth_base ? allocaptr_base :        \
+      iu->iu_vm_frames[iu->iu_vm_depth - 1].vcf_allocaptr;              \
+    I = ctext;                                                          \
+  } while(0)
+
+
 static int __attribute__((noinline))
 vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
         uint32_t allocaptr, vm_op_t op)
 {
   int16_t opc;
+#ifdef VMIR_VM_PROFILE
+  int32_t prof_hist[2] = {-1, -1};
+#endif
 
 #ifdef VM_USE_COMPUTED_GOTO
   if((int)op != -1)
     goto resolve;
   void *mem = iu->iu_mem;
+  const int depth_base = iu->iu_vm_depth;
+  const uint32_t allocaptr_base = allocaptr;
 
+#ifdef VMIR_VM_PROFILE
+  // Dispatch from one place to keep the handlers within 16 bit offsets
+#define NEXT(skip) I+=skip; goto dispatch
+#else
 #define NEXT(skip) I+=skip; opc = *I++; goto *(&&opz + opc)
+#endif
 #define VMOP(x) x:
 
   NEXT(0);
 
+#ifdef VMIR_VM_PROFILE
+ dispatch:
+  opc = *I++;
+  VM_PROFILE_OP(opc);
+  goto *(&&opz + opc);
+#endif
+
   while(1) {
 
   opz:
@@ -493,8 +784,10 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
   if((int)op != -1)
     return op; // Resolve to itself when we use switch() { case ... }
   void *mem = iu->iu_mem;
+  const int depth_base = iu->iu_vm_depth;
+  const uint32_t allocaptr_base = allocaptr;
 
-#define NEXT(skip) I+=skip; opc = *I++; goto reswitch
+#define NEXT(skip) I+=skip; opc = *I++; VM_PROFILE_OP(opc); goto reswitch
 
 #ifdef VM_TRACE
 #define VMOP(x) case VM_ ## x : printf("%s %04x %04x %04x %04x %04x %04x %04x %04x\n", #x, \
@@ -514,7 +807,7 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
     NEXT(0);
 
   VMOP(RET_VOID)
-    return 0;
+    goto vm_return;
 
   VMOP(JIT_CALL)
   {
@@ -525,35 +818,36 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
 
   VMOP(RET_R8)
     *(uint32_t *)ret = R8(0);
-    return 0;
+    goto vm_return;
 
   VMOP(RET_R16)
     *(uint16_t *)ret = R16(0);
-    return 0;
+    goto vm_return;
 
   VMOP(RET_R32)
     *(uint32_t *)ret = R32(0);
-    return 0;
+    goto vm_return;
 
   VMOP(RET_R64)
     *(uint64_t *)ret = R64(0);
-    return 0;
+    goto vm_return;
 
   VMOP(RET_R32C)
     *(uint32_t *)ret = UIMM32(0);
-    return 0;
+    goto vm_return;
   VMOP(RET_R64C)
     *(uint64_t *)ret = UIMM64(0);
-    return 0;
+    goto vm_return;
 
   VMOP(B)     I = (void *)I + (int16_t)I[0]; NEXT(0);
+  VMOP(BL)    I = (void *)I + SIMM32(0); NEXT(0);
   VMOP(BCOND) I = (void *)I + (int16_t)(R32(0) ? I[1] : I[2]); NEXT(0);
   VMOP(JSR_VM)
     vm_printf(">>>>>>>>>>>>>>>>>>>\n");
     vm_printf("Calling %s\n", vm_funcname(I[0], iu));
-    vm_exec(iu->iu_vm_funcs[I[0]], rf + I[1], iu, rf + I[2], allocaptr, -1);
-    vm_printf("<<<<<<<<<<<<<<<<<<\n");
-    NEXT(3);
+    VM_CALL(iu->iu_vm_funcs[I[0]], rf + I[1], rf + I[2],
+            iu->iu_vm_frame_sizes[I[0]], 3);
+    NEXT(0);
 
   VMOP(JSR_EXT)
     vm_printf(">>>>>>>>>>>>>>>>>>>");
@@ -563,443 +857,43 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
     NEXT(3);
 
   VMOP(JSR_R)
+  {
     vm_printf(">>>>>>>>>>>>>>>>>>>");
     vm_printf("Calling indirect %s (%d)\n", vm_funcname(R32(0), iu), R32(0));
-    if(iu->iu_vm_funcs[R32(0)])
-      vm_exec(iu->iu_vm_funcs[R32(0)], rf + I[1], iu, rf + I[2], allocaptr, -1);
-    else if(iu->iu_ext_funcs[R32(0)])
-      iu->iu_ext_funcs[R32(0)](rf + I[2], rf + I[1], iu);
-    else
-      vm_stop(iu, VM_STOP_BAD_FUNCTION, R32(0));
+    const uint16_t *text = vm_ic_lookup(iu, I + 3, R32(0),
+                                        rf + I[2], rf + I[1]);
+    if(text != NULL) {
+      VM_CALL(text, rf + I[1], rf + I[2], iu->iu_vm_frame_sizes[R32(0)],
+              3 + VM_IC_SIZE);
+      NEXT(0);
+    }
     vm_printf("<<<<<<<<<<<<<<<<<<");
-    NEXT(3);
-
-
-  VMOP(ADD_R8)  AR8(0,  R8(1) +  R8(2)); NEXT(3);
-  VMOP(SUB_R8)  AR8(0,  R8(1) -  R8(2)); NEXT(3);
-  VMOP(MUL_R8)  AR8(0,  R8(1) *  R8(2)); NEXT(3);
-  VMOP(UDIV_R8) AR8(0,  R8(1) /  R8(2)); NEXT(3);
-  VMOP(SDIV_R8) AS8(0,  S8(1) /  S8(2)); NEXT(3);
-  VMOP(UREM_R8) AR8(0,  R8(1) %  R8(2)); NEXT(3);
-  VMOP(SREM_R8) AS8(0,  S8(1) %  S8(2)); NEXT(3);
-  VMOP(SHL_R8)  AR8(0,  R8(1) << R8(2)); NEXT(3);
-  VMOP(LSHR_R8) AR8(0,  R8(1) >> R8(2)); NEXT(3);
-  VMOP(ASHR_R8) AS8(0,  S8(1) >> R8(2)); NEXT(3);
-  VMOP(AND_R8)  AR8(0,  R8(1) &  R8(2)); NEXT(3);
-  VMOP(OR_R8)   AR8(0,  R8(1) |  R8(2)); NEXT(3);
-  VMOP(XOR_R8)  AR8(0,  R8(1) ^  R8(2)); NEXT(3);
-
-  VMOP(ADD_R8C)  AR8(0, R8(1) +  UIMM8(2)); NEXT(3);
-  VMOP(SUB_R8C)  AR8(0, R8(1) -  UIMM8(2)); NEXT(3);
-  VMOP(MUL_R8C)  AR8(0, R8(1) *  UIMM8(2)); NEXT(3);
-  VMOP(UDIV_R8C) AR8(0, R8(1) /  UIMM8(2)); NEXT(3);
-  VMOP(SDIV_R8C) AS8(0, S8(1) /  SIMM8(2)); NEXT(3);
-  VMOP(UREM_R8C) AR8(0, R8(1) %  UIMM8(2)); NEXT(3);
-  VMOP(SREM_R8C) AS8(0, S8(1) %  SIMM8(2)); NEXT(3);
-  VMOP(SHL_R8C)  AR8(0, R8(1) << UIMM8(2)); NEXT(3);
-  VMOP(LSHR_R8C) AR8(0, R8(1) >> UIMM8(2)); NEXT(3);
-  VMOP(ASHR_R8C) AS8(0, S8(1) >> UIMM8(2)); NEXT(3);
-  VMOP(AND_R8C)  AR8(0, R8(1) &  UIMM8(2)); NEXT(3);
-  VMOP(OR_R8C)   AR8(0, R8(1) |  UIMM8(2)); NEXT(3);
-  VMOP(XOR_R8C)  AR8(0, R8(1) ^  UIMM8(2)); NEXT(3);
-
-
-
-  VMOP(ADD_R16)  AR16(0, R16(1) +  R16(2)); NEXT(3);
-  VMOP(SUB_R16)  AR16(0, R16(1) -  R16(2)); NEXT(3);
-  VMOP(MUL_R16)  AR16(0, R16(1) *  R16(2)); NEXT(3);
-  VMOP(UDIV_R16) AR16(0, R16(1) /  R16(2)); NEXT(3);
-  VMOP(SDIV_R16) AS16(0, S16(1) /  S16(2)); NEXT(3);
-  VMOP(UREM_R16) AR16(0, R16(1) %  R16(2)); NEXT(3);
-  VMOP(SREM_R16) AS16(0, S16(1) %  S16(2)); NEXT(3);
-  VMOP(SHL_R16)  AR16(0, R16(1) << R16(2)); NEXT(3);
-  VMOP(LSHR_R16) AR16(0, R16(1) >> R16(2)); NEXT(3);
-  VMOP(ASHR_R16) AS16(0, S16(1) >> R16(2)); NEXT(3);
-  VMOP(AND_R16)  AR16(0, R16(1) &  R16(2)); NEXT(3);
-  VMOP(OR_R16)   AR16(0, R16(1) |  R16(2)); NEXT(3);
-  VMOP(XOR_R16)  AR16(0, R16(1) ^  R16(2)); NEXT(3);
-
-  VMOP(ADD_R16C)  AR16(0, R16(1) +  UIMM16(2)); NEXT(3);
-  VMOP(SUB_R16C)  AR16(0, R16(1) -  UIMM16(2)); NEXT(3);
-  VMOP(MUL_R16C)  AR16(0, R16(1) *  UIMM16(2)); NEXT(3);
-  VMOP(UDIV_R16C) AR16(0, R16(1) /  UIMM16(2)); NEXT(3);
-  VMOP(SDIV_R16C) AS16(0, S16(1) /  SIMM16(2)); NEXT(3);
-  VMOP(UREM_R16C) AR16(0, R16(1) %  UIMM16(2)); NEXT(3);
-  VMOP(SREM_R16C) AS16(0, S16(1) %  SIMM16(2)); NEXT(3);
-  VMOP(SHL_R16C)  AR16(0, R16(1) << UIMM16(2)); NEXT(3);
-  VMOP(LSHR_R16C) AR16(0, R16(1) >> UIMM16(2)); NEXT(3);
-  VMOP(ASHR_R16C) AS16(0, S16(1) >> UIMM16(2)); NEXT(3);
-  VMOP(AND_R16C)  AR16(0, R16(1) &  UIMM16(2)); NEXT(3);
-  VMOP(OR_R16C)   AR16(0, R16(1) |  UIMM16(2)); NEXT(3);
-  VMOP(XOR_R16C)  AR16(0, R16(1) ^  UIMM16(2)); NEXT(3);
-
-
-
-
-
-  VMOP(ADD_ACC_R32)  AR32(0, R32_ACC +  R32(1)); NEXT(2);
-  VMOP(SUB_ACC_R32)  AR32(0, R32_ACC -  R32(1)); NEXT(2);
-  VMOP(MUL_ACC_R32)  AR32(0, R32_ACC *  R32(1)); NEXT(2);
-  VMOP(UDIV_ACC_R32) AR32(0, R32_ACC /  R32(1)); NEXT(2);
-  VMOP(SDIV_ACC_R32) AS32(0, S32_ACC /  S32(1)); NEXT(2);
-  VMOP(UREM_ACC_R32) AR32(0, R32_ACC %  R32(1)); NEXT(2);
-  VMOP(SREM_ACC_R32) AS32(0, S32_ACC %  S32(1)); NEXT(2);
-  VMOP(SHL_ACC_R32)  AR32(0, R32_ACC << R32(1)); NEXT(2);
-  VMOP(LSHR_ACC_R32) AR32(0, R32_ACC >> R32(1)); NEXT(2);
-  VMOP(ASHR_ACC_R32) AS32(0, S32_ACC >> R32(1)); NEXT(2);
-  VMOP(AND_ACC_R32)  AR32(0, R32_ACC &  R32(1)); NEXT(2);
-  VMOP(OR_ACC_R32)   AR32(0, R32_ACC |  R32(1)); NEXT(2);
-  VMOP(XOR_ACC_R32)  AR32(0, R32_ACC ^  R32(1)); NEXT(2);
-
-  VMOP(INC_ACC_R32)  AR32(0, R32_ACC + 1); NEXT(1);
-  VMOP(DEC_ACC_R32)  AR32(0, R32_ACC - 1); NEXT(1);
-
-  VMOP(ADD_ACC_R32C)  AR32(0, R32_ACC +  UIMM32(1)); NEXT(3);
-  VMOP(SUB_ACC_R32C)  AR32(0, R32_ACC -  UIMM32(1)); NEXT(3);
-  VMOP(MUL_ACC_R32C)  AR32(0, R32_ACC *  UIMM32(1)); NEXT(3);
-  VMOP(UDIV_ACC_R32C) AR32(0, R32_ACC /  UIMM32(1)); NEXT(3);
-  VMOP(SDIV_ACC_R32C) AS32(0, S32_ACC /  SIMM32(1)); NEXT(3);
-  VMOP(UREM_ACC_R32C) AR32(0, R32_ACC %  UIMM32(1)); NEXT(3);
-  VMOP(SREM_ACC_R32C) AS32(0, S32_ACC %  SIMM32(1)); NEXT(3);
-  VMOP(SHL_ACC_R32C)  AR32(0, R32_ACC << UIMM32(1)); NEXT(3);
-  VMOP(LSHR_ACC_R32C) AR32(0, R32_ACC >> UIMM32(1)); NEXT(3);
-  VMOP(ASHR_ACC_R32C) AS32(0, S32_ACC >> UIMM32(1)); NEXT(3);
-  VMOP(AND_ACC_R32C)  AR32(0, R32_ACC &  UIMM32(1)); NEXT(3);
-  VMOP(OR_ACC_R32C)   AR32(0, R32_ACC |  UIMM32(1)); NEXT(3);
-  VMOP(XOR_ACC_R32C)  AR32(0, R32_ACC ^  UIMM32(1)); NEXT(3);
-
-  VMOP(ADD_2ACC_R32)  AR32_ACC(R32_ACC +  R32(0)); NEXT(1);
-  VMOP(SUB_2ACC_R32)  AR32_ACC(R32_ACC -  R32(0)); NEXT(1);
-  VMOP(MUL_2ACC_R32)  AR32_ACC(R32_ACC *  R32(0)); NEXT(1);
-  VMOP(UDIV_2ACC_R32) AR32_ACC(R32_ACC /  R32(0)); NEXT(1);
-  VMOP(SDIV_2ACC_R32) AS32_ACC(S32_ACC /  S32(0)); NEXT(1);
-  VMOP(UREM_2ACC_R32) AR32_ACC(R32_ACC %  R32(0)); NEXT(1);
-  VMOP(SREM_2ACC_R32) AS32_ACC(S32_ACC %  S32(0)); NEXT(1);
-  VMOP(SHL_2ACC_R32)  AR32_ACC(R32_ACC << R32(0)); NEXT(1);
-  VMOP(LSHR_2ACC_R32) AR32_ACC(R32_ACC >> R32(0)); NEXT(1);
-  VMOP(ASHR_2ACC_R32) AS32_ACC(S32_ACC >> R32(0)); NEXT(1);
-  VMOP(AND_2ACC_R32)  AR32_ACC(R32_ACC &  R32(0)); NEXT(1);
-  VMOP(OR_2ACC_R32)   AR32_ACC(R32_ACC |  R32(0)); NEXT(1);
-  VMOP(XOR_2ACC_R32)  AR32_ACC(R32_ACC ^  R32(0)); NEXT(1);
-
-  VMOP(INC_2ACC_R32)  AR32_ACC(R32_ACC + 1); NEXT(0);
-  VMOP(DEC_2ACC_R32)  AR32_ACC(R32_ACC - 1); NEXT(0);
-
-  VMOP(ADD_2ACC_R32C)  AR32_ACC(R32_ACC +  UIMM32(0)); NEXT(2);
-  VMOP(SUB_2ACC_R32C)  AR32_ACC(R32_ACC -  UIMM32(0)); NEXT(2);
-  VMOP(MUL_2ACC_R32C)  AR32_ACC(R32_ACC *  UIMM32(0)); NEXT(2);
-  VMOP(UDIV_2ACC_R32C) AR32_ACC(R32_ACC /  UIMM32(0)); NEXT(2);
-  VMOP(SDIV_2ACC_R32C) AS32_ACC(S32_ACC /  SIMM32(0)); NEXT(2);
-  VMOP(UREM_2ACC_R32C) AR32_ACC(R32_ACC %  UIMM32(0)); NEXT(2);
-  VMOP(SREM_2ACC_R32C) AS32_ACC(S32_ACC %  SIMM32(0)); NEXT(2);
-  VMOP(SHL_2ACC_R32C)  AR32_ACC(R32_ACC << UIMM32(0)); NEXT(2);
-  VMOP(LSHR_2ACC_R32C) AR32_ACC(R32_ACC >> UIMM32(0)); NEXT(2);
-  VMOP(ASHR_2ACC_R32C) AS32_ACC(S32_ACC >> UIMM32(0)); NEXT(2);
-  VMOP(AND_2ACC_R32C)  AR32_ACC(R32_ACC &  UIMM32(0)); NEXT(2);
-  VMOP(OR_2ACC_R32C)   AR32_ACC(R32_ACC |  UIMM32(0)); NEXT(2);
-  VMOP(XOR_2ACC_R32C)  AR32_ACC(R32_ACC ^  UIMM32(0)); NEXT(2);
-
-
-  VMOP(ADD_R32)  AR32(0, R32(1) +  R32(2)); NEXT(3);
-  VMOP(SUB_R32)  AR32(0, R32(1) -  R32(2)); NEXT(3);
-  VMOP(MUL_R32)  AR32(0, R32(1) *  R32(2)); NEXT(3);
-  VMOP(UDIV_R32) AR32(0, R32(1) /  R32(2)); NEXT(3);
-  VMOP(SDIV_R32) AS32(0, S32(1) /  S32(2)); NEXT(3);
-  VMOP(UREM_R32) AR32(0, R32(1) %  R32(2)); NEXT(3);
-  VMOP(SREM_R32) AS32(0, S32(1) %  S32(2)); NEXT(3);
-  VMOP(SHL_R32)  AR32(0, R32(1) << R32(2)); NEXT(3);
-  VMOP(LSHR_R32) AR32(0, R32(1) >> R32(2)); NEXT(3);
-  VMOP(ASHR_R32) AS32(0, S32(1) >> R32(2)); NEXT(3);
-  VMOP(AND_R32)  AR32(0, R32(1) &  R32(2)); NEXT(3);
-  VMOP(OR_R32)   AR32(0, R32(1) |  R32(2)); NEXT(3);
-  VMOP(XOR_R32)  AR32(0, R32(1) ^  R32(2)); NEXT(3);
-
-  VMOP(INC_R32)  AR32(0, R32(1) + 1); NEXT(2);
-  VMOP(DEC_R32)  AR32(0, R32(1) - 1); NEXT(2);
-
-  VMOP(ADD_R32C)  AR32(0, R32(1) +  UIMM32(2)); NEXT(4);
-  VMOP(SUB_R32C)  AR32(0, R32(1) -  UIMM32(2)); NEXT(4);
-  VMOP(MUL_R32C)  AR32(0, R32(1) *  UIMM32(2)); NEXT(4);
-  VMOP(UDIV_R32C) AR32(0, R32(1) /  UIMM32(2)); NEXT(4);
-  VMOP(SDIV_R32C) AS32(0, S32(1) /  SIMM32(2)); NEXT(4);
-  VMOP(UREM_R32C) AR32(0, R32(1) %  UIMM32(2)); NEXT(4);
-  VMOP(SREM_R32C) AS32(0, S32(1) %  SIMM32(2)); NEXT(4);
-  VMOP(SHL_R32C)  AR32(0, R32(1) << UIMM32(2)); NEXT(4);
-  VMOP(LSHR_R32C) AR32(0, R32(1) >> UIMM32(2)); NEXT(4);
-  VMOP(ASHR_R32C) AS32(0, S32(1) >> UIMM32(2)); NEXT(4);
-  VMOP(AND_R32C)  AR32(0, R32(1) &  UIMM32(2)); NEXT(4);
-  VMOP(OR_R32C)   AR32(0, R32(1) |  UIMM32(2)); NEXT(4);
-  VMOP(XOR_R32C)  AR32(0, R32(1) ^  UIMM32(2)); NEXT(4);
-
-
-
-
-  VMOP(ADD_R64)  AR64(0, R64(1) +  R64(2)); NEXT(3);
-  VMOP(SUB_R64)  AR64(0, R64(1) -  R64(2)); NEXT(3);
-  VMOP(MUL_R64)  AR64(0, R64(1) *  R64(2)); NEXT(3);
-  VMOP(UDIV_R64) AR64(0, R64(1) /  R64(2)); NEXT(3);
-  VMOP(SDIV_R64) AS64(0, S64(1) /  S64(2)); NEXT(3);
-  VMOP(UREM_R64) AR64(0, R64(1) %  R64(2)); NEXT(3);
-  VMOP(SREM_R64) AS64(0, S64(1) %  S64(2)); NEXT(3);
-  VMOP(SHL_R64)  AR64(0, R64(1) << R64(2)); NEXT(3);
-  VMOP(LSHR_R64) AR64(0, R64(1) >> R64(2)); NEXT(3);
-  VMOP(ASHR_R64) AS64(0, S64(1) >> R64(2)); NEXT(3);
-  VMOP(AND_R64)  AR64(0, R64(1) &  R64(2)); NEXT(3);
-  VMOP(OR_R64)   AR64(0, R64(1) |  R64(2)); NEXT(3);
-  VMOP(XOR_R64)  AR64(0, R64(1) ^  R64(2)); NEXT(3);
-
-  VMOP(ADD_R64C)  AR64(0, R64(1) +  UIMM64(2)); NEXT(6);
-  VMOP(SUB_R64C)  AR64(0, R64(1) -  UIMM64(2)); NEXT(6);
-  VMOP(MUL_R64C)  AR64(0, R64(1) *  UIMM64(2)); NEXT(6);
-  VMOP(UDIV_R64C) AR64(0, R64(1) /  UIMM64(2)); NEXT(6);
-  VMOP(SDIV_R64C) AS64(0, S64(1) /  SIMM64(2)); NEXT(6);
-  VMOP(UREM_R64C) AR64(0, R64(1) %  UIMM64(2)); NEXT(6);
-  VMOP(SREM_R64C) AS64(0, S64(1) %  SIMM64(2)); NEXT(6);
-  VMOP(SHL_R64C)  AR64(0, R64(1) << UIMM64(2)); NEXT(6);
-  VMOP(LSHR_R64C) AR64(0, R64(1) >> UIMM64(2)); NEXT(6);
-  VMOP(ASHR_R64C) AS64(0, S64(1) >> UIMM64(2)); NEXT(6);
-  VMOP(AND_R64C)  AR64(0, R64(1) &  UIMM64(2)); NEXT(6);
-  VMOP(OR_R64C)   AR64(0, R64(1) |  UIMM64(2)); NEXT(6);
-  VMOP(XOR_R64C)  AR64(0, R64(1) ^  UIMM64(2)); NEXT(6);
-
-  VMOP(MLA32)     AR32(0, R32(1) * R32(2) + R32(3)); NEXT(4);
-
-  VMOP(ADD_DBL) ADBL(0, RDBL(1) +  RDBL(2)); NEXT(3);
-  VMOP(SUB_DBL) ADBL(0, RDBL(1) -  RDBL(2)); NEXT(3);
-  VMOP(MUL_DBL) ADBL(0, RDBL(1) *  RDBL(2)); NEXT(3);
-  VMOP(DIV_DBL) ADBL(0, RDBL(1) /  RDBL(2)); NEXT(3);
-
-  VMOP(ADD_DBLC) ADBL(0, RDBL(1) +  IMMDBL(2)); NEXT(6);
-  VMOP(SUB_DBLC) ADBL(0, RDBL(1) -  IMMDBL(2)); NEXT(6);
-  VMOP(MUL_DBLC) ADBL(0, RDBL(1) *  IMMDBL(2)); NEXT(6);
-  VMOP(DIV_DBLC) ADBL(0, RDBL(1) /  IMMDBL(2)); NEXT(6);
-
-  VMOP(ADD_FLT) AFLT(0, RFLT(1) +  RFLT(2)); NEXT(3);
-  VMOP(SUB_FLT) AFLT(0, RFLT(1) -  RFLT(2)); NEXT(3);
-  VMOP(MUL_FLT) AFLT(0, RFLT(1) *  RFLT(2)); NEXT(3);
-  VMOP(DIV_FLT) AFLT(0, RFLT(1) /  RFLT(2)); NEXT(3);
-
-  VMOP(ADD_FLTC) AFLT(0, RFLT(1) +  IMMFLT(2)); NEXT(4);
-  VMOP(SUB_FLTC) AFLT(0, RFLT(1) -  IMMFLT(2)); NEXT(4);
-  VMOP(MUL_FLTC) AFLT(0, RFLT(1) *  IMMFLT(2)); NEXT(4);
-  VMOP(DIV_FLTC) AFLT(0, RFLT(1) /  IMMFLT(2)); NEXT(4);
-
-    // Integer compare
-
-  VMOP(EQ8)    AR32(0, R8(1) == R8(2)); NEXT(3);
-  VMOP(NE8)    AR32(0, R8(1) != R8(2)); NEXT(3);
-  VMOP(UGT8)   AR32(0, R8(1) >  R8(2)); NEXT(3);
-  VMOP(UGE8)   AR32(0, R8(1) >= R8(2)); NEXT(3);
-  VMOP(ULT8)   AR32(0, R8(1) <  R8(2)); NEXT(3);
-  VMOP(ULE8)   AR32(0, R8(1) <= R8(2)); NEXT(3);
-  VMOP(SGT8)   AR32(0, S8(1) >  S8(2)); NEXT(3);
-  VMOP(SGE8)   AR32(0, S8(1) >= S8(2)); NEXT(3);
-  VMOP(SLT8)   AR32(0, S8(1) <  S8(2)); NEXT(3);
-  VMOP(SLE8)   AR32(0, S8(1) <= S8(2)); NEXT(3);
-
-  VMOP(EQ8_C)  AR32(0, R8(1) == UIMM8(2)); NEXT(3);
-  VMOP(NE8_C)  AR32(0, R8(1) != UIMM8(2)); NEXT(3);
-  VMOP(UGT8_C) AR32(0, R8(1) >  UIMM8(2)); NEXT(3);
-  VMOP(UGE8_C) AR32(0, R8(1) >= UIMM8(2)); NEXT(3);
-  VMOP(ULT8_C) AR32(0, R8(1) <  UIMM8(2)); NEXT(3);
-  VMOP(ULE8_C) AR32(0, R8(1) <= UIMM8(2)); NEXT(3);
-  VMOP(SGT8_C) AR32(0, S8(1) >  SIMM8(2)); NEXT(3);
-  VMOP(SGE8_C) AR32(0, S8(1) >= SIMM8(2)); NEXT(3);
-  VMOP(SLT8_C) AR32(0, S8(1) <  SIMM8(2)); NEXT(3);
-  VMOP(SLE8_C) AR32(0, S8(1) <= SIMM8(2)); NEXT(3);
-
-  VMOP(EQ16)    AR32(0, R16(1) == R16(2)); NEXT(3);
-  VMOP(NE16)    AR32(0, R16(1) != R16(2)); NEXT(3);
-  VMOP(UGT16)   AR32(0, R16(1) >  R16(2)); NEXT(3);
-  VMOP(UGE16)   AR32(0, R16(1) >= R16(2)); NEXT(3);
-  VMOP(ULT16)   AR32(0, R16(1) <  R16(2)); NEXT(3);
-  VMOP(ULE16)   AR32(0, R16(1) <= R16(2)); NEXT(3);
-  VMOP(SGT16)   AR32(0, S16(1) >  S16(2)); NEXT(3);
-  VMOP(SGE16)   AR32(0, S16(1) >= S16(2)); NEXT(3);
-  VMOP(SLT16)   AR32(0, S16(1) <  S16(2)); NEXT(3);
-  VMOP(SLE16)   AR32(0, S16(1) <= S16(2)); NEXT(3);
-
-  VMOP(EQ16_C)  AR32(0, R16(1) == UIMM16(2)); NEXT(3);
-  VMOP(NE16_C)  AR32(0, R16(1) != UIMM16(2)); NEXT(3);
-  VMOP(UGT16_C) AR32(0, R16(1) >  UIMM16(2)); NEXT(3);
-  VMOP(UGE16_C) AR32(0, R16(1) >= UIMM16(2)); NEXT(3);
-  VMOP(ULT16_C) AR32(0, R16(1) <  UIMM16(2)); NEXT(3);
-  VMOP(ULE16_C) AR32(0, R16(1) <= UIMM16(2)); NEXT(3);
-  VMOP(SGT16_C) AR32(0, S16(1) >  SIMM16(2)); NEXT(3);
-  VMOP(SGE16_C) AR32(0, S16(1) >= SIMM16(2)); NEXT(3);
-  VMOP(SLT16_C) AR32(0, S16(1) <  SIMM16(2)); NEXT(3);
-  VMOP(SLE16_C) AR32(0, S16(1) <= SIMM16(2)); NEXT(3);
-
-  VMOP(EQ32)    AR32(0, R32(1) == R32(2)); NEXT(3);
-  VMOP(NE32)    AR32(0, R32(1) != R32(2)); NEXT(3);
-  VMOP(UGT32)   AR32(0, R32(1) >  R32(2)); NEXT(3);
-  VMOP(UGE32)   AR32(0, R32(1) >= R32(2)); NEXT(3);
-  VMOP(ULT32)   AR32(0, R32(1) <  R32(2)); NEXT(3);
-  VMOP(ULE32)   AR32(0, R32(1) <= R32(2)); NEXT(3);
-  VMOP(SGT32)   AR32(0, S32(1) >  S32(2)); NEXT(3);
-  VMOP(SGE32)   AR32(0, S32(1) >= S32(2)); NEXT(3);
-  VMOP(SLT32)   AR32(0, S32(1) <  S32(2)); NEXT(3);
-  VMOP(SLE32)   AR32(0, S32(1) <= S32(2)); NEXT(3);
-
-  VMOP(EQ32_C)  AR32(0, R32(1) == UIMM32(2)); NEXT(4);
-  VMOP(NE32_C)  AR32(0, R32(1) != UIMM32(2)); NEXT(4);
-  VMOP(UGT32_C) AR32(0, R32(1) >  UIMM32(2)); NEXT(4);
-  VMOP(UGE32_C) AR32(0, R32(1) >= UIMM32(2)); NEXT(4);
-  VMOP(ULT32_C) AR32(0, R32(1) <  UIMM32(2)); NEXT(4);
-  VMOP(ULE32_C) AR32(0, R32(1) <= UIMM32(2)); NEXT(4);
-  VMOP(SGT32_C) AR32(0, S32(1) >  SIMM32(2)); NEXT(4);
-  VMOP(SGE32_C) AR32(0, S32(1) >= SIMM32(2)); NEXT(4);
-  VMOP(SLT32_C) AR32(0, S32(1) <  SIMM32(2)); NEXT(4);
-  VMOP(SLE32_C) AR32(0, S32(1) <= SIMM32(2)); NEXT(4);
-
-  VMOP(EQ64)    AR32(0, R64(1) == R64(2)); NEXT(3);
-  VMOP(NE64)    AR32(0, R64(1) != R64(2)); NEXT(3);
-  VMOP(UGT64)   AR32(0, R64(1) >  R64(2)); NEXT(3);
-  VMOP(UGE64)   AR32(0, R64(1) >= R64(2)); NEXT(3);
-  VMOP(ULT64)   AR32(0, R64(1) <  R64(2)); NEXT(3);
-  VMOP(ULE64)   AR32(0, R64(1) <= R64(2)); NEXT(3);
-  VMOP(SGT64)   AR32(0, S64(1) >  S64(2)); NEXT(3);
-  VMOP(SGE64)   AR32(0, S64(1) >= S64(2)); NEXT(3);
-  VMOP(SLT64)   AR32(0, S64(1) <  S64(2)); NEXT(3);
-  VMOP(SLE64)   AR32(0, S64(1) <= S64(2)); NEXT(3);
-
-  VMOP(EQ64_C)  AR32(0, R64(1) == UIMM64(2)); NEXT(6);
-  VMOP(NE64_C)  AR32(0, R64(1) != UIMM64(2)); NEXT(6);
-  VMOP(UGT64_C) AR32(0, R64(1) >  UIMM64(2)); NEXT(6);
-  VMOP(UGE64_C) AR32(0, R64(1) >= UIMM64(2)); NEXT(6);
-  VMOP(ULT64_C) AR32(0, R64(1) <  UIMM64(2)); NEXT(6);
-  VMOP(ULE64_C) AR32(0, R64(1) <= UIMM64(2)); NEXT(6);
-  VMOP(SGT64_C) AR32(0, S64(1) >  SIMM64(2)); NEXT(6);
-  VMOP(SGE64_C) AR32(0, S64(1) >= SIMM64(2)); NEXT(6);
-  VMOP(SLT64_C) AR32(0, S64(1) <  SIMM64(2)); NEXT(6);
-  VMOP(SLE64_C) AR32(0, S64(1) <= SIMM64(2)); NEXT(6);
-
-
-  VMOP(OEQ_DBL) AR32(0, RDBL(1) == RDBL(2)); NEXT(3);
-  VMOP(OGT_DBL) AR32(0, RDBL(1) >  RDBL(2)); NEXT(3);
-  VMOP(OGE_DBL) AR32(0, RDBL(1) >= RDBL(2)); NEXT(3);
-  VMOP(OLT_DBL) AR32(0, RDBL(1) <  RDBL(2)); NEXT(3);
-  VMOP(OLE_DBL) AR32(0, RDBL(1) <= RDBL(2)); NEXT(3);
-
-  VMOP(ONE_DBL) AR32(0, !__builtin_isnan(RDBL(1))
-                      && !__builtin_isnan(RDBL(2))
-                      && RDBL(1) != RDBL(2)); NEXT(3);
-
-  VMOP(ORD_DBL) AR32(0, !__builtin_isnan(RDBL(1))
-                      && !__builtin_isnan(RDBL(2))); NEXT(3);
-
-  VMOP(UNO_DBL) AR32(0, __builtin_isnan(RDBL(1))
-                      || __builtin_isnan(RDBL(1))); NEXT(3);
-
-  VMOP(UEQ_DBL) AR32(0, __builtin_isnan(RDBL(1))
-                      || __builtin_isnan(RDBL(2))
-                      || RDBL(1) == RDBL(2)); NEXT(3);
-
-  VMOP(UGT_DBL) AR32(0, __builtin_isnan(RDBL(1))
-                      || __builtin_isnan(RDBL(2))
-                      || RDBL(1) >  RDBL(2)); NEXT(3);
-
-  VMOP(UGE_DBL) AR32(0, __builtin_isnan(RDBL(1))
-                      || __builtin_isnan(RDBL(2))
-                      || RDBL(1) <= RDBL(2)); NEXT(3);
-
-  VMOP(ULT_DBL) AR32(0, __builtin_isnan(RDBL(1))
-                      || __builtin_isnan(RDBL(2))
-                      || RDBL(1) <  RDBL(2)); NEXT(3);
-
-  VMOP(ULE_DBL) AR32(0, __builtin_isnan(RDBL(1))
-                      || __builtin_isnan(RDBL(2))
-                      || RDBL(1) <= RDBL(2)); NEXT(3);
-
-  VMOP(UNE_DBL) AR32(0, RDBL(1) != RDBL(2)); NEXT(3);
-
-
-
-  VMOP(OEQ_DBL_C) AR32(0, RDBL(1) == IMMDBL(2)); NEXT(6);
-  VMOP(OGT_DBL_C) AR32(0, RDBL(1) >  IMMDBL(2)); NEXT(6);
-  VMOP(OGE_DBL_C) AR32(0, RDBL(1) >= IMMDBL(2)); NEXT(6);
-  VMOP(OLT_DBL_C) AR32(0, RDBL(1) <  IMMDBL(2)); NEXT(6);
-  VMOP(OLE_DBL_C) AR32(0, RDBL(1) <= IMMDBL(2)); NEXT(6);
-
-  VMOP(ONE_DBL_C) AR32(0, !__builtin_isnan(RDBL(1)) &&
-                        RDBL(1) != IMMDBL(2)); NEXT(6);
-  VMOP(ORD_DBL_C) AR32(0, !__builtin_isnan(RDBL(1))); NEXT(6);
-  VMOP(UNO_DBL_C) AR32(0,  __builtin_isnan(RDBL(1))); NEXT(6);
-  VMOP(UEQ_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
-                        RDBL(1) == IMMDBL(2)); NEXT(6);
-  VMOP(UGT_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
-                        RDBL(1) >  IMMDBL(2)); NEXT(6);
-  VMOP(UGE_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
-                        RDBL(1) <= IMMDBL(2)); NEXT(6);
-  VMOP(ULT_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
-                        RDBL(1) <  IMMDBL(2)); NEXT(6);
-  VMOP(ULE_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
-                        RDBL(1) <= IMMDBL(2)); NEXT(6);
-  VMOP(UNE_DBL_C) AR32(0, RDBL(1) != IMMDBL(2)); NEXT(6);
-
-
-
-  VMOP(OEQ_FLT) AR32(0, RFLT(1) == RFLT(2)); NEXT(3);
-  VMOP(OGT_FLT) AR32(0, RFLT(1) >  RFLT(2)); NEXT(3);
-  VMOP(OGE_FLT) AR32(0, RFLT(1) >= RFLT(2)); NEXT(3);
-  VMOP(OLT_FLT) AR32(0, RFLT(1) <  RFLT(2)); NEXT(3);
-  VMOP(OLE_FLT) AR32(0, RFLT(1) <= RFLT(2)); NEXT(3);
-
-  VMOP(ONE_FLT) AR32(0, !__builtin_isnan(RFLT(1))
-                      && !__builtin_isnan(RFLT(2))
-                      && RFLT(1) != RFLT(2)); NEXT(3);
-
-  VMOP(ORD_FLT) AR32(0, !__builtin_isnan(RFLT(1))
-                      && !__builtin_isnan(RFLT(2))); NEXT(3);
-
-  VMOP(UNO_FLT) AR32(0, __builtin_isnan(RFLT(1))
-                      || __builtin_isnan(RFLT(1))); NEXT(3);
-
-  VMOP(UEQ_FLT) AR32(0, __builtin_isnan(RFLT(1))
-                      || __builtin_isnan(RFLT(2))
-                      || RFLT(1) == RFLT(2)); NEXT(3);
-
-  VMOP(UGT_FLT) AR32(0, __builtin_isnan(RFLT(1))
-                      || __builtin_isnan(RFLT(2))
-                      || RFLT(1) >  RFLT(2)); NEXT(3);
-
-  VMOP(UGE_FLT) AR32(0, __builtin_isnan(RFLT(1))
-                      || __builtin_isnan(RFLT(2))
-                      || RFLT(1) <= RFLT(2)); NEXT(3);
-
-  VMOP(ULT_FLT) AR32(0, __builtin_isnan(RFLT(1))
-                      || __builtin_isnan(RFLT(2))
-                      || RFLT(1) <  RFLT(2)); NEXT(3);
-
-  VMOP(ULE_FLT) AR32(0, __builtin_isnan(RFLT(1))
-                      || __builtin_isnan(RFLT(2))
-                      || RFLT(1) <= RFLT(2)); NEXT(3);
+    NEXT(3 + VM_IC_SIZE);
+  }
 
-  VMOP(UNE_FLT) AR32(0, RFLT(1) != RFLT(2)); NEXT(3);
+  VMOP(JSR_VM_TAIL)
+    vm_printf("Tail calling %s\n", vm_funcname(I[0], iu));
+    VM_TAIL_CALL(iu->iu_vm_funcs[I[0]], I[1], I[2],
+                 iu->iu_vm_frame_sizes[I[0]]);
+    NEXT(0);
 
+  VMOP(JSR_R_TAIL)
+  {
+    vm_printf("Tail calling indirect %s (%d)\n", vm_funcname(R32(0), iu),
+              R32(0));
+    const uint16_t *text = vm_ic_lookup(iu, I + 3, R32(0), ret, rf + I[1]);
+    if(text == NULL)
+      goto vm_return;
+    VM_TAIL_CALL(text, I[1], I[2], iu->iu_vm_frame_sizes[R32(0)]);
+    NEXT(0);
+  }
 
 
-  VMOP(OEQ_FLT_C) AR32(0, RFLT(1) == IMMFLT(2)); NEXT(4);
-  VMOP(OGT_FLT_C) AR32(0, RFLT(1) >  IMMFLT(2)); NEXT(4);
-  VMOP(OGE_FLT_C) AR32(0, RFLT(1) >= IMMFLT(2)); NEXT(4);
-  VMOP(OLT_FLT_C) AR32(0, RFLT(1) <  IMMFLT(2)); NEXT(4);
-  VMOP(OLE_FLT_C) AR32(0, RFLT(1) <= IMMFLT(2)); NEXT(4);
+#include "vmir_vm_ops.h"
 
-  VMOP(ONE_FLT_C) AR32(0, !__builtin_isnan(RFLT(1)) &&
-                        RFLT(1) != IMMFLT(2)); NEXT(4);
-  VMOP(ORD_FLT_C) AR32(0, !__builtin_isnan(RFLT(1))); NEXT(4);
-  VMOP(UNO_FLT_C) AR32(0,  __builtin_isnan(RFLT(1))); NEXT(4);
-  VMOP(UEQ_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
-                        RFLT(1) == IMMFLT(2)); NEXT(4);
-  VMOP(UGT_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
-                        RFLT(1) >  IMMFLT(2)); NEXT(4);
-  VMOP(UGE_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
-                        RFLT(1) <= IMMFLT(2)); NEXT(4);
-  VMOP(ULT_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
-                        RFLT(1) <  IMMFLT(2)); NEXT(4);
-  VMOP(ULE_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
-                        RFLT(1) <= IMMFLT(2)); NEXT(4);
-  VMOP(UNE_FLT_C) AR32(0, RFLT(1) != IMMFLT(2)); NEXT(4);
+#define VM_SUPER_HANDLERS
+#include "vmir_vm_super.h"
+#undef VM_SUPER_HANDLERS
 
 
   VMOP(EQ8_BR)    I = (void *)I + (int16_t)(R8(2) == R8(3) ? I[0] : I[1]); NEXT(0);
@@ -1046,198 +940,34 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
   VMOP(SLT32_C_BR) I = (void *)I + (int16_t)(S32(2) <  SIMM32(3) ? I[0] : I[1]); NEXT(0);
   VMOP(SLE32_C_BR) I = (void *)I + (int16_t)(S32(2) <= SIMM32(3) ? I[0] : I[1]); NEXT(0);
 
+  VMOP(ADD_EQ32_BR)    AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) == R32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_NE32_BR)    AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) != R32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_UGT32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) >  R32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_UGE32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) >= R32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_ULT32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) <  R32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_ULE32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) <= R32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SGT32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) >  S32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SGE32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) >= S32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SLT32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) <  S32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SLE32_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) <= S32(5) ? I[0] : I[1]); NEXT(0);
+
+  VMOP(ADD_EQ32_C_BR)    AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) == UIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_NE32_C_BR)    AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) != UIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_UGT32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) >  UIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_UGE32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) >= UIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_ULT32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) <  UIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_ULE32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(R32(2) <= UIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SGT32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) >  SIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SGE32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) >= SIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SLT32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) <  SIMM32(5) ? I[0] : I[1]); NEXT(0);
+  VMOP(ADD_SLE32_C_BR)   AR32(2, R32(3) + SIMM16(4)); I = (void *)I + (int16_t)(S32(2) <= SIMM32(5) ? I[0] : I[1]); NEXT(0);
 
-  VMOP(ABS)       AR32(0, abs(S32(1)));  NEXT(2);
-
-  VMOP(FLOOR)     ADBL(0, floor(RDBL(1)));          NEXT(2);
-  VMOP(SIN)       ADBL(0,   sin(RDBL(1)));          NEXT(2);
-  VMOP(COS)       ADBL(0,   cos(RDBL(1)));          NEXT(2);
-  VMOP(POW)       ADBL(0,   pow(RDBL(1), RDBL(2))); NEXT(3);
-  VMOP(FABS)      ADBL(0,  fabs(RDBL(1)));          NEXT(2);
-  VMOP(FMOD)      ADBL(0,  fmod(RDBL(1), RDBL(2))); NEXT(3);
-  VMOP(LOG10)     ADBL(0, log10(RDBL(1)));          NEXT(2);
-
-  VMOP(FLOORF)    AFLT(0, floorf(RFLT(1)));          NEXT(2);
-  VMOP(SINF)      AFLT(0,   sinf(RFLT(1)));          NEXT(2);
-  VMOP(COSF)      AFLT(0,   cosf(RFLT(1)));          NEXT(2);
-  VMOP(POWF)      AFLT(0,   powf(RFLT(1), RFLT(2))); NEXT(3);
-  VMOP(FABSF)     AFLT(0,  fabsf(RFLT(1)));          NEXT(2);
-  VMOP(FMODF)     AFLT(0,  fmodf(RFLT(1), RFLT(2))); NEXT(3);
-  VMOP(LOG10F)    AFLT(0, log10f(RFLT(1)));          NEXT(2);
-
-    // ---
-
-  VMOP(LOAD8)        LOAD8(0, R32(1));             NEXT(2);
-  VMOP(LOAD8_G)      LOAD8(0, SIMM32(1));          NEXT(3);
-
-  VMOP(LOAD8_OFF)
-    LOAD8(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD8_ZEXT_32_OFF)
-    LOAD8_ZEXT_32(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD8_SEXT_32_OFF)
-    LOAD8_SEXT_32(0, R32(1) + SIMM16(2));
-    NEXT(3);
-
-  VMOP(LOAD8_ROFF)
-    LOAD8(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD8_ZEXT_32_ROFF)
-    LOAD8_ZEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD8_SEXT_32_ROFF)
-    LOAD8_SEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-
-
-  VMOP(STORE8_G)     STORE8(SIMM32(1), R32(0));             NEXT(3);
-  VMOP(STORE8C_OFF)  STORE8(R32(0) + SIMM16(1), SIMM8(2));  NEXT(3);
-  VMOP(STORE8_OFF)   STORE8(R32(0) + SIMM16(2), R8(1));     NEXT(3);
-  VMOP(STORE8)       STORE8(R32(0),             R8(1));     NEXT(2);
 
-    // ---
-
-  VMOP(LOAD16)       LOAD16(0, R32(1));             NEXT(2);
-  VMOP(LOAD16_OFF)
-    LOAD16(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD16_ZEXT_32_OFF)
-    LOAD16_ZEXT_32(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD16_SEXT_32_OFF)
-    LOAD16_SEXT_32(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD16_ROFF)
-    LOAD16(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD16_ZEXT_32_ROFF)
-    LOAD16_ZEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD16_SEXT_32_ROFF)
-    LOAD16_SEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD16_G)     LOAD16(0, SIMM32(1));          NEXT(3);
-
-  VMOP(STORE16_G)    STORE16(SIMM32(1), R32(0));             NEXT(3);
-  VMOP(STORE16C_OFF) STORE16(R32(0) + SIMM16(1), SIMM16(2)); NEXT(3);
-  VMOP(STORE16_OFF)  STORE16(R32(0) + SIMM16(2), R16(1));    NEXT(3);
-  VMOP(STORE16)      STORE16(R32(0),             R16(1));    NEXT(2);
-
-    // ---
-
-  VMOP(LOAD32)     LOAD32(0, R32(1));                NEXT(2);
-  VMOP(LOAD32_OFF)
-    LOAD32(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD32_ROFF)
-    LOAD32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD32_G)   LOAD32(0, SIMM32(1));             NEXT(3);
-
-  VMOP(STORE32_G)    STORE32(SIMM32(1), R32(0));             NEXT(3);
-  VMOP(STORE32C_OFF) STORE32(R32(0) + SIMM16(1), UIMM32(2)); NEXT(4);
-  VMOP(STORE32_OFF)  STORE32(R32(0) + SIMM16(2), R32(1));    NEXT(3);
-  VMOP(STORE32)      STORE32(R32(0),             R32(1));    NEXT(2);
-
-    // ---
-
-  VMOP(LOAD64)     LOAD64(0, R32(1)            ); NEXT(2);
-  VMOP(LOAD64_OFF)
-    LOAD64(0, R32(1) + SIMM16(2));
-    NEXT(3);
-  VMOP(LOAD64_ROFF)
-    LOAD64(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
-    NEXT(5);
-  VMOP(LOAD64_G)   LOAD64(0, SIMM32(1)         ); NEXT(3);
-
-  VMOP(STORE64_G)    STORE64(SIMM32(1),          R64(0));    NEXT(3);
-  VMOP(STORE64C_OFF) STORE64(R32(0) + SIMM16(1), UIMM64(2)); NEXT(6);
-  VMOP(STORE64_OFF)  STORE64(R32(0) + SIMM16(2), R64(1));    NEXT(3);
-  VMOP(STORE64)      STORE64(R32(0),             R64(1));    NEXT(2);
-
-
-  VMOP(MOV8)    AR8(0,  R8(1));   NEXT(2);
-  VMOP(MOV32)   AR32(0, R32(1));   NEXT(2);
-  VMOP(MOV64)   AR64(0, R64(1));   NEXT(2);
-
-  VMOP(MOV8_C)  AR8(0,  UIMM8(1)); NEXT(2);
-  VMOP(MOV16_C) AR16(0, UIMM16(1)); NEXT(2);
-  VMOP(MOV32_C) AR32(0, UIMM32(1)); NEXT(3);
-  VMOP(MOV64_C) AR64(0, UIMM64(1)); NEXT(5);
-
-  VMOP(LEA_R32_SHL)     AR32(0, R32(1) + (R32(2) << I[3])); NEXT(4);
-  VMOP(LEA_R32_SHL2)    AR32(0, R32(1) + (R32(2) << 2)); NEXT(3);
-  VMOP(LEA_R32_SHL_OFF) AR32(0, R32(1) + (R32(2) << I[3]) + SIMM32(4)); NEXT(6);
-  VMOP(LEA_R32_MUL_OFF) AR32(0, R32(1) + R32(2) * UIMM32(3) + SIMM32(5)); NEXT(7);
-
-  VMOP(CAST_1_TRUNC_8)   AR32(0, !!R8(1)); NEXT(2);
-  VMOP(CAST_1_TRUNC_16)   AR32(0, !!R16(1)); NEXT(2);
-
-  VMOP(CAST_8_ZEXT_1)    AR8(0, R32(1)); NEXT(2);
-  VMOP(CAST_8_TRUNC_16)  AR8(0, R16(1)); NEXT(2);
-  VMOP(CAST_8_TRUNC_32)  AR8(0, R32(1)); NEXT(2);
-  VMOP(CAST_8_TRUNC_64)  AR8(0, R64(1)); NEXT(2);
-
-  VMOP(CAST_16_ZEXT_1)   AR16(0, R32(1)); NEXT(2);
-  VMOP(CAST_16_ZEXT_8)   AR16(0, R8(1)); NEXT(2);
-  VMOP(CAST_16_SEXT_8)   AS16(0, S8(1)); NEXT(2);
-  VMOP(CAST_16_TRUNC_32) AR16(0, R32(1)); NEXT(2);
-  VMOP(CAST_16_TRUNC_64) AR16(0, R64(1)); NEXT(2);
-  VMOP(CAST_16_FPTOSI_FLT) AS16(0, RFLT(1)); NEXT(2);
-  VMOP(CAST_16_FPTOUI_FLT) AR16(0, RFLT(1)); NEXT(2);
-  VMOP(CAST_16_FPTOSI_DBL) AS16(0, RDBL(1)); NEXT(2);
-  VMOP(CAST_16_FPTOUI_DBL) AR16(0, RDBL(1)); NEXT(2);
-
-  VMOP(CAST_32_SEXT_1)   AR32(0, R32(1) ? -1 : 0); NEXT(2);
-  VMOP(CAST_32_ZEXT_8)   AR32(0, R8(1)); NEXT(2);
-  VMOP(CAST_32_SEXT_8)   AS32(0, S8(1)); NEXT(2);
-  VMOP(CAST_32_ZEXT_16)  AR32(0, R16(1)); NEXT(2);
-  VMOP(CAST_32_SEXT_16)  AS32(0, S16(1)); NEXT(2);
-  VMOP(CAST_32_TRUNC_64) AR32(0, R64(1)); NEXT(2);
-
-  VMOP(CAST_32_FPTOSI_FLT) AS32(0, RFLT(1)); NEXT(2);
-  VMOP(CAST_32_FPTOUI_FLT) AR32(0, RFLT(1)); NEXT(2);
-  VMOP(CAST_32_FPTOSI_DBL) AS32(0, RDBL(1)); NEXT(2);
-  VMOP(CAST_32_FPTOUI_DBL) AR32(0, RDBL(1)); NEXT(2);
-
-
-  VMOP(CAST_64_ZEXT_1) AR64(0, R32(1)); NEXT(2);
-  VMOP(CAST_64_SEXT_1) AS64(0, R32(1) ? (int64_t)-1LL : 0); NEXT(2);
-  VMOP(CAST_64_ZEXT_8) AR64(0, R8(1)); NEXT(2);
-  VMOP(CAST_64_SEXT_8) AS64(0, S8(1)); NEXT(2);
-  VMOP(CAST_64_ZEXT_16) AR64(0, R16(1)); NEXT(2);
-  VMOP(CAST_64_SEXT_16) AS64(0, S16(1)); NEXT(2);
-  VMOP(CAST_64_ZEXT_32) AR64(0, R32(1)); NEXT(2);
-  VMOP(CAST_64_SEXT_32) AS64(0, S32(1)); NEXT(2);
-  VMOP(CAST_64_FPTOSI_FLT) AS64(0, RFLT(1)); NEXT(2);
-  VMOP(CAST_64_FPTOUI_FLT) AR64(0, RFLT(1)); NEXT(2);
-  VMOP(CAST_64_FPTOSI_DBL) AS64(0, RDBL(1)); NEXT(2);
-  VMOP(CAST_64_FPTOUI_DBL) AR64(0, RDBL(1)); NEXT(2);
-
-  VMOP(CAST_DBL_FPEXT_FLT)   ADBL(0, RFLT(1)); NEXT(2);
-
-  VMOP(CAST_FLT_FPTRUNC_DBL) AFLT(0, RDBL(1)); NEXT(2);
-  VMOP(CAST_FLT_SITOFP_8)    AFLT(0, S8(1)); NEXT(2);
-  VMOP(CAST_FLT_UITOFP_8)    AFLT(0, R8(1)); NEXT(2);
-  VMOP(CAST_FLT_SITOFP_16)   AFLT(0, S16(1)); NEXT(2);
-  VMOP(CAST_FLT_UITOFP_16)   AFLT(0, R16(1)); NEXT(2);
-  VMOP(CAST_FLT_SITOFP_32)   AFLT(0, S32(1)); NEXT(2);
-  VMOP(CAST_FLT_UITOFP_32)   AFLT(0, R32(1)); NEXT(2);
-  VMOP(CAST_FLT_SITOFP_64)   AFLT(0, S64(1)); NEXT(2);
-  VMOP(CAST_FLT_UITOFP_64)   AFLT(0, R64(1)); NEXT(2);
-
-  VMOP(CAST_DBL_SITOFP_8)    ADBL(0, S8(1)); NEXT(2);
-  VMOP(CAST_DBL_UITOFP_8)    ADBL(0, R8(1)); NEXT(2);
-  VMOP(CAST_DBL_SITOFP_16)   ADBL(0, S16(1)); NEXT(2);
-  VMOP(CAST_DBL_UITOFP_16)   ADBL(0, R16(1)); NEXT(2);
-  VMOP(CAST_DBL_SITOFP_32)   ADBL(0, S32(1)); NEXT(2);
-  VMOP(CAST_DBL_UITOFP_32)   ADBL(0, R32(1)); NEXT(2);
-  VMOP(CAST_DBL_SITOFP_64)   ADBL(0, S64(1)); NEXT(2);
-  VMOP(CAST_DBL_UITOFP_64)   ADBL(0, R64(1)); NEXT(2);
 
   VMOP(JUMPTABLE)
-    I = (void *)I + (int16_t)I[2 + R8(0)]; NEXT(0);
+    // The table size is a power of two, masked so a value wider than
+    // the switch type can't index past it
+    I = (void *)I + (int16_t)I[2 + (R8(0) & (I[1] - 1))]; NEXT(0);
 
   VMOP(SWITCH8_BS) {
       const uint8_t u8 = R8(0);
@@ -1305,163 +1035,10 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
     }
 
 
-  VMOP(SELECT8RR) AR8(0, R32(1) ? R8(2)    : R8(3));    NEXT(4);
-  VMOP(SELECT8RC) AR8(0, R32(1) ? R8(2)    : UIMM8(3)); NEXT(4);
-  VMOP(SELECT8CR) AR8(0, R32(1) ? UIMM8(3) : R8(2));    NEXT(4);
-  VMOP(SELECT8CC) AR8(0, R32(1) ? UIMM8(2) : UIMM8(4)); NEXT(4);
-
-  VMOP(SELECT16RR) AR16(0, R32(1) ? R16(2)    : R16(3));    NEXT(4);
-  VMOP(SELECT16RC) AR16(0, R32(1) ? R16(2)    : UIMM16(3)); NEXT(4);
-  VMOP(SELECT16CR) AR16(0, R32(1) ? UIMM16(3) : R16(2));    NEXT(4);
-  VMOP(SELECT16CC) AR16(0, R32(1) ? UIMM16(2) : UIMM16(4)); NEXT(4);
-
-  VMOP(SELECT32RR) AR32(0, R32(1) ? R32(2)    : R32(3));    NEXT(4);
-  VMOP(SELECT32RC) AR32(0, R32(1) ? R32(2)    : UIMM32(3)); NEXT(5);
-  VMOP(SELECT32CR) AR32(0, R32(1) ? UIMM32(3) : R32(2));    NEXT(5);
-  VMOP(SELECT32CC) AR32(0, R32(1) ? UIMM32(2) : UIMM32(4)); NEXT(6);
-
-  VMOP(SELECT64RR) AR64(0, R32(1) ? R64(2)    : R64(3));    NEXT(4);
-  VMOP(SELECT64RC) AR64(0, R32(1) ? R64(2)    : UIMM64(3)); NEXT(7);
-  VMOP(SELECT64CR) AR64(0, R32(1) ? UIMM64(3) : R64(2));    NEXT(7);
-  VMOP(SELECT64CC) AR64(0, R32(1) ? UIMM64(2) : UIMM64(6)); NEXT(10);
-
-
-  VMOP(ALLOCA) {
-      allocaptr = VMIR_ALIGN(allocaptr, I[1]);
-      AR32(0, allocaptr);
-      allocaptr += UIMM32(2);
-      NEXT(4);
-    }
-
-  VMOP(ALLOCAD) {
-      allocaptr = VMIR_ALIGN(allocaptr, I[1]);
-      uint32_t r = allocaptr;
-      allocaptr += UIMM32(3) * R32(2);
-      AR32(0, r);
-      NEXT(5);
-    }
-
-  VMOP(STACKSHRINK)
-    allocaptr -= UIMM32(0);
-    NEXT(2);
-
-  VMOP(STACKSAVE)
-    AR32(0, allocaptr);
-    NEXT(1);
-
-  VMOP(STACKRESTORE)
-    allocaptr = R32(0);
-    NEXT(1);
-
-  VMOP(STACKCOPYR)
-    allocaptr = VMIR_ALIGN(allocaptr, 4);
-    AR32(0, allocaptr);
-    memcpy(MEM(allocaptr), MEM(R32(1)), UIMM32(2));
-    allocaptr += UIMM32(2);
-    NEXT(4);
-
-  VMOP(STACKCOPYC)
-    allocaptr = VMIR_ALIGN(allocaptr, 4);
-    AR32(0, allocaptr);
-    memcpy(MEM(allocaptr), MEM(UIMM32(1)), UIMM32(3));
-    allocaptr += UIMM32(3);
-    NEXT(5);
 
   VMOP(UNREACHABLE) vm_stop(iu, VM_STOP_UNREACHABLE, 0);
 
 
-  VMOP(MEMCPY) {
-      uint32_t r = R32(1);
-      memcpy(MEM(R32(1)), MEM(R32(2)), R32(3));
-      AR32(0, r);
-      NEXT(4);
-    }
-
-  VMOP(MEMSET) {
-      uint32_t r = R32(1);
-      memset(MEM(R32(1)), R32(2), R32(3));
-      AR32(0, r);
-      NEXT(4);
-    }
-
-  VMOP(MEMMOVE) {
-      uint32_t r = R32(1);
-      memmove(MEM(R32(1)), MEM(R32(2)), R32(3));
-      AR32(0, r);
-      NEXT(4);
-    }
-
-  VMOP(LLVM_MEMCPY)
-    memcpy(MEM(R32(0)), MEM(R32(1)), R32(2)); NEXT(3);
-  VMOP(LLVM_MEMSET)
-    memset(MEM(R32(0)), R8(1), R32(2)); NEXT(3);
-  VMOP(LLVM_MEMSET64)
-    memset(MEM(R32(0)), R8(1), R64(2)); NEXT(3);
-
-  VMOP(MEMCMP)
-    AR32(0, memcmp(MEM(R32(1)), MEM(R32(2)), R32(3))); NEXT(4);
-
-  VMOP(STRCPY) {
-      uint32_t r = R32(1);
-      strcpy(MEM(R32(1)), MEM(R32(2)));
-      AR32(0, r);
-      NEXT(3);
-    }
-
-  VMOP(STRNCPY) {
-      uint32_t r = R32(1);
-      strncpy(MEM(R32(1)), MEM(R32(2)), R32(3));
-      AR32(0, r);
-      NEXT(4);
-    }
-
-  VMOP(STRCMP)
-    AR32(0, strcmp(MEM(R32(1)), MEM(R32(2)))); NEXT(3);
-  VMOP(STRNCMP)
-    AR32(0, strncmp(MEM(R32(1)), MEM(R32(2)), R32(3))); NEXT(4);
-  VMOP(STRCHR)
-    AR32(0, vm_strchr(R32(1), R32(2), mem)); NEXT(3);
-  VMOP(STRRCHR)
-    AR32(0, vm_strrchr(R32(1), R32(2), mem)); NEXT(3);
-  VMOP(STRLEN)
-    AR32(0, strlen(MEM(R32(1)))); NEXT(2);
-
-  VMOP(VAARG32)
-    AR32(0, vm_vaarg32(rf, MEM(R32(1)))); NEXT(2);
-
-  VMOP(VAARG64)
-    AR64(0, vm_vaarg64(rf, MEM(R32(1)))); NEXT(2);
-
-  VMOP(VASTART)
-    *(void **)MEM(R32(0)) = rf + S32(1);
-    NEXT(2);
-
-  VMOP(VACOPY)
-    *(void **)MEM(R32(0)) = *(void **)MEM(R32(1));
-    NEXT(2);
-
-  VMOP(CTZ32) AR32(0, __builtin_ctz(R32(1))); NEXT(2);
-  VMOP(CLZ32) AR32(0, __builtin_clz(R32(1))); NEXT(2);
-  VMOP(POP32) AR32(0, __builtin_popcount(R32(1))); NEXT(2);
-
-  VMOP(CTZ64) AR64(0, __builtin_ctzll(R64(1))); NEXT(2);
-  VMOP(CLZ64) AR64(0, __builtin_clzll(R64(1))); NEXT(2);
-  VMOP(POP64) AR64(0, __builtin_popcountll(R64(1))); NEXT(2);
-
-  VMOP(UADDO32)
-  {
-    uint32_t r;
-#if __has_builtin(__builtin_uadd_overflow)
-    AR32(1, __builtin_uadd_overflow(R32(2), R32(3), &r));
-#else
-    uint32_t a = R32(2);
-    uint32_t b = R32(3);
-    AR32(1, UINT32_MAX - a < b);
-    r = a + b;
-#endif
-    AR32(0, r);
-    NEXT(4);
-  }
 
   VMOP(INSTRUMENT_COUNT)
 #ifdef VM_TRACE
@@ -1472,6 +1049,40 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
 #endif
     VECTOR_ITEM(&iu->iu_instrumentation, UIMM32(0)).ii_count++;
     NEXT(2);
+
+  VMOP(TIER_COUNT)
+    if(++iu->iu_tier_counters[UIMM32(0)] == iu->iu_tier_threshold)
+      tier_request(iu, UIMM32(0));
+    NEXT(2);
+
+  VMOP(NATIVE)
+  {
+    vm_frame_t vf = {ret, iu, allocaptr};
+    vm_native_t *code = (vm_native_t *)(intptr_t)UIMM64(0);
+    code(rf, mem, &vf);
+    goto vm_return;
+  }
+
+  VMOP(MATERIALIZE)
+  {
+    // The caller couldn't check the frame before the function was compiled
+    const uint32_t gfid = UIMM32(0);
+    I = lazy_materialize(iu, gfid);
+    VM_CHECK_FRAME(rf, iu->iu_vm_frame_sizes[gfid]);
+    NEXT(0);
+  }
+
+  vm_return:
+    if(iu->iu_vm_depth == depth_base)
+      return 0;
+    {
+      const vm_call_frame_t *vcf = &iu->iu_vm_frames[--iu->iu_vm_depth];
+      I = vcf->vcf_I;
+      ret = vcf->vcf_ret;
+      rf = vcf->vcf_rf;
+      allocaptr = vcf->vcf_allocaptr;
+    }
+    NEXT(0);
   }
 
 #ifdef VM_USE_COMPUTED_GOTO
@@ -1946,6 +1557,28 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
   case VM_ULT32_C_BR:     return &&ULT32_C_BR    - &&opz;     break;
   case VM_ULE32_C_BR:     return &&ULE32_C_BR    - &&opz;     break;
 
+  case VM_ADD_EQ32_BR:       return &&ADD_EQ32_BR     - &&opz; break;
+  case VM_ADD_NE32_BR:       return &&ADD_NE32_BR     - &&opz; break;
+  case VM_ADD_UGT32_BR:      return &&ADD_UGT32_BR    - &&opz; break;
+  case VM_ADD_UGE32_BR:      return &&ADD_UGE32_BR    - &&opz; break;
+  case VM_ADD_ULT32_BR:      return &&ADD_ULT32_BR    - &&opz; break;
+  case VM_ADD_ULE32_BR:      return &&ADD_ULE32_BR    - &&opz; break;
+  case VM_ADD_SGT32_BR:      return &&ADD_SGT32_BR    - &&opz; break;
+  case VM_ADD_SGE32_BR:      return &&ADD_SGE32_BR    - &&opz; break;
+  case VM_ADD_SLT32_BR:      return &&ADD_SLT32_BR    - &&opz; break;
+  case VM_ADD_SLE32_BR:      return &&ADD_SLE32_BR    - &&opz; break;
+
+  case VM_ADD_EQ32_C_BR:     return &&ADD_EQ32_C_BR   - &&opz; break;
+  case VM_ADD_NE32_C_BR:     return &&ADD_NE32_C_BR   - &&opz; break;
+  case VM_ADD_UGT32_C_BR:    return &&ADD_UGT32_C_BR  - &&opz; break;
+  case VM_ADD_UGE32_C_BR:    return &&ADD_UGE32_C_BR  - &&opz; break;
+  case VM_ADD_ULT32_C_BR:    return &&ADD_ULT32_C_BR  - &&opz; break;
+  case VM_ADD_ULE32_C_BR:    return &&ADD_ULE32_C_BR  - &&opz; break;
+  case VM_ADD_SGT32_C_BR:    return &&ADD_SGT32_C_BR  - &&opz; break;
+  case VM_ADD_SGE32_C_BR:    return &&ADD_SGE32_C_BR  - &&opz; break;
+  case VM_ADD_SLT32_C_BR:    return &&ADD_SLT32_C_BR  - &&opz; break;
+  case VM_ADD_SLE32_C_BR:    return &&ADD_SLE32_C_BR  - &&opz; break;
+
 
   case VM_SELECT8RR: return &&SELECT8RR - &&opz;     break;
   case VM_SELECT8RC: return &&SELECT8RC - &&opz;     break;
@@ -1968,10 +1601,13 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
   case VM_SELECT64CC: return &&SELECT64CC - &&opz;     break;
 
   case VM_B:         return &&B        - &&opz;     break;
+  case VM_BL:        return &&BL       - &&opz;     break;
   case VM_BCOND:     return &&BCOND    - &&opz;     break;
   case VM_JSR_VM:    return &&JSR_VM   - &&opz;     break;
   case VM_JSR_EXT:   return &&JSR_EXT  - &&opz;     break;
   case VM_JSR_R:     return &&JSR_R    - &&opz;     break;
+  case VM_JSR_VM_TAIL: return &&JSR_VM_TAIL - &&opz; break;
+  case VM_JSR_R_TAIL: return &&JSR_R_TAIL - &&opz;  break;
 
   case VM_MOV8:      return &&MOV8     - &&opz;     break;
   case VM_MOV32:     return &&MOV32    - &&opz;     break;
@@ -2099,6 +1735,13 @@ vm_exec(const uint16_t *I, void *rf, ir_unit_t *iu, void *ret,
   case VM_UNREACHABLE: return &&UNREACHABLE - &&opz; break;
 
   case VM_INSTRUMENT_COUNT: return &&INSTRUMENT_COUNT - &&opz; break;
+  case VM_TIER_COUNT: return &&TIER_COUNT - &&opz; break;
+  case VM_NATIVE: return &&NATIVE - &&opz; break;
+  case VM_MATERIALIZE: return &&MATERIALIZE - &&opz; break;
+
+#define VM_SUPER_RESOLVE
+#include "vmir_vm_super.h"
+#undef VM_SUPER_RESOLVE
 
   default:
     printf("Can't emit op %d\n", op);
@@ -2117,14 +1760,252 @@ vm_resolve(int op)
   return o;
 }
 
+
+#ifdef VMIR_VM_PROFILE
+
+/**
+ * Sort on count, descending
+ */
+static int
+vm_profile_cmp(const void *A, const void *B)
+{
+  const uint64_t a = ((const vm_op_count_t *)A)->count;
+  const uint64_t b = ((const vm_op_count_t *)B)->count;
+  return a < b ? 1 : a > b ? -1 : 0;
+}
+
+
+/**
+ * Write the opcode profile in the format read by vmir_supergen and
+ * release it
+ */
+static void
+vm_profile_destroy(ir_unit_t *iu)
+{
+  vm_op_profile_t *vop = iu->iu_op_profile;
+  if(vop != NULL && iu->iu_op_profile_path != NULL) {
+    FILE *fp = fopen(iu->iu_op_profile_path, "w");
+    if(fp == NULL) {
+      perror(iu->iu_op_profile_path);
+    } else {
+      const char **names = calloc(65536, sizeof(const char *));
+      for(int i = 0; i < VM_NUM_OPNAMES; i++)
+        if(vm_opnames[i] != NULL)
+          names[(uint16_t)vm_resolve(i)] = vm_opnames[i];
+
+      int n = 0;
+      for(int i = 0; i < vop->vop_size; i++)
+        if(vop->vop_entries[i].key)
+          vop->vop_entries[n++] = vop->vop_entries[i];
+      qsort(vop->vop_entries, n, sizeof(vm_op_count_t), vm_profile_cmp);
+
+      fprintf(fp, "# count op op [op]\n");
+      for(int i = 0; i < n; i++) {
+        const uint64_t key = vop->vop_entries[i].key;
+        const int len = key >> 48;
+        fprintf(fp, "%"PRIu64, vop->vop_entries[i].count);
+        for(int j = len - 1; j >= 0; j--) {
+          const char *name = names[(key >> (j * 16)) & 0xffff];
+          fprintf(fp, " %s", name ?: "?");
+        }
+        fprintf(fp, "\n");
+      }
+      free(names);
+      fclose(fp);
+    }
+  }
+
+  if(vop != NULL) {
+    free(vop->vop_entries);
+    free(vop);
+  }
+  free(iu->iu_op_profile_path);
+}
+
+#endif
+
+#define VM_HOST_STACK_MARGIN (256 * 1024) // Left for helpers and the host
+#define VM_HOST_STACK_SIZE (4 * 1024 * 1024) // Used if stack size is unknown
+
+/**
+ * Natively compiled code recurses on the host stack, so find out how far
+ * the calling thread's stack actually goes. The bounds are kept until we
+ * are called on a different stack
+ */
+static void
+vm_host_stack_init(ir_unit_t *iu)
+{
+  const char *sp = __builtin_frame_address(0);
+  if(sp >= iu->iu_vm_host_stack_lo && sp < iu->iu_vm_host_stack_hi)
+    return;
+
+  iu->iu_vm_host_stack_lo = sp - VM_HOST_STACK_SIZE;
+  iu->iu_vm_host_stack_hi = sp + 1;
+#ifdef __linux__
+  pthread_attr_t attr;
+  void *addr;
+  size_t size;
+  if(!pthread_getattr_np(pthread_self(), &attr)) {
+    if(!pthread_attr_getstack(&attr, &addr, &size) &&
+       sp > (const char *)addr && sp < (const char *)addr + size) {
+      iu->iu_vm_host_stack_lo = addr;
+      iu->iu_vm_host_stack_hi = (const char *)addr + size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+#endif
+  iu->iu_vm_host_stack_limit = iu->iu_vm_host_stack_lo + VM_HOST_STACK_MARGIN;
+}
+
+/**
+ * Helpers called from natively compiled code
+ */
+static void __attribute__((used))
+vm_native_check_frame(vm_frame_t *vf, int fid, void *rf)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  // Native code recurses on the host stack
+  const char *sp = __builtin_frame_address(0);
+  if(rf - iu->iu_mem + iu->iu_vm_frame_sizes[fid] > iu->iu_rsize ||
+     sp < iu->iu_vm_host_stack_limit)
+    vm_stop(iu, VM_STOP_STACK_OVERFLOW, 0);
+}
+
+static void __attribute__((used))
+vm_native_jsr_vm(vm_frame_t *vf, int fid, void *rf, void *ret)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  vm_native_check_frame(vf, fid, rf);
+  vm_exec(iu->iu_vm_funcs[fid], rf, iu, ret, vf->vf_allocaptr, -1);
+}
+
+static void __attribute__((used))
+vm_native_jsr_ext(vm_frame_t *vf, int fid, void *rf, void *ret)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  iu->iu_ext_funcs[fid](ret, rf, iu);
+}
+
+static void __attribute__((used))
+vm_native_jsr_r(vm_frame_t *vf, uint32_t fid, void *rf, void *ret)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  if(fid >= VECTOR_LEN(&iu->iu_functions))
+    vm_stop(iu, VM_STOP_BAD_FUNCTION, fid);
+  if(iu->iu_vm_funcs[fid]) {
+    vm_native_check_frame(vf, fid, rf);
+    vm_exec(iu->iu_vm_funcs[fid], rf, iu, ret, vf->vf_allocaptr, -1);
+  } else if(iu->iu_ext_funcs[fid])
+    iu->iu_ext_funcs[fid](ret, rf, iu);
+  else
+    vm_stop(iu, VM_STOP_BAD_FUNCTION, fid);
+}
+
+/**
+ * Tail calls from native code. If the callee is native code it's
+ * returned for the caller to jump to, otherwise the callee is run and
+ * NULL is returned
+ */
+static vm_native_t * __attribute__((used))
+vm_native_tail_vm(vm_frame_t *vf, int fid, void *rf, int argoffset,
+                  int argsize)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  const uint16_t *text = iu->iu_vm_funcs[fid];
+  vm_native_check_frame(vf, fid, rf);
+  memmove(rf - argsize, rf + argoffset - argsize, argsize);
+  if(text[0] == (uint16_t)vm_resolve(VM_NATIVE)) {
+    uint64_t entry;
+    memcpy(&entry, text + 1, sizeof(uint64_t));
+    return (vm_native_t *)(intptr_t)entry;
+  }
+  vm_exec(text, rf, iu, vf->vf_ret, vf->vf_allocaptr, -1);
+  return NULL;
+}
+
+static vm_native_t * __attribute__((used))
+vm_native_tail_r(vm_frame_t *vf, uint32_t fid, void *rf, int argoffset,
+                 int argsize)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  if(fid >= VECTOR_LEN(&iu->iu_functions))
+    vm_stop(iu, VM_STOP_BAD_FUNCTION, fid);
+  if(iu->iu_vm_funcs[fid])
+    return vm_native_tail_vm(vf, fid, rf, argoffset, argsize);
+  else if(iu->iu_ext_funcs[fid])
+    iu->iu_ext_funcs[fid](vf->vf_ret, rf + argoffset, iu);
+  else
+    vm_stop(iu, VM_STOP_BAD_FUNCTION, fid);
+  return NULL;
+}
+
+static void __attribute__((used))
+vm_native_tier_count(vm_frame_t *vf, int fid)
+{
+  ir_unit_t *iu = vf->vf_iu;
+  if(++iu->iu_tier_counters[fid] == iu->iu_tier_threshold)
+    tier_request(iu, fid);
+}
+
+/**
+ * Allocate VM text from the code arena
+ */
+static void *
+vm_text_alloc(ir_unit_t *iu, int size)
+{
+  void *text = code_alloc(&iu->iu_code, size);
+  if(text == NULL)
+    parser_error(iu, "Unable to map memory for VM text");
+  return text;
+}
+
+
+/**
+ * Replace the VM text of a function with a single VM_NATIVE
+ * instruction that calls the given native code
+ */
+static void __attribute__((unused))
+vm_set_native(ir_unit_t *iu, ir_function_t *f, vm_native_t *code)
+{
+  const int size = sizeof(uint16_t) + sizeof(uint64_t);
+  uint64_t entry = (intptr_t)code;
+
+  code_release(&iu->iu_code, f->if_vm_text, f->if_vm_text_size);
+  uint16_t *stub = vm_text_alloc(iu, size);
+  stub[0] = vm_resolve(VM_NATIVE);
+  memcpy(stub + 1, &entry, sizeof(uint64_t));
+
+  f->if_vm_text = stub;
+  f->if_vm_text_size = size;
+}
+
+
+/**
+ * Make room for 'size' more bytes in the text being emitted
+ */
+static void
+emit_reserve(ir_unit_t *iu, int size)
+{
+  const size_t used = iu->iu_text_ptr - iu->iu_text_alloc;
+  if(__builtin_expect(used + size <= iu->iu_text_alloc_memsize, 1))
+    return;
+
+  if(used + size > INT32_MAX)
+    parser_error(iu, "Function too big");
+  while(used + size > iu->iu_text_alloc_memsize)
+    iu->iu_text_alloc_memsize *= 2;
+  iu->iu_text_alloc = realloc(iu->iu_text_alloc, iu->iu_text_alloc_memsize);
+  iu->iu_text_ptr = iu->iu_text_alloc + used;
+}
+
+
 /**
  *
  */
 static void
 emit_i16(ir_unit_t *iu, uint16_t i16)
 {
-  if(iu->iu_text_ptr + 2 >= iu->iu_text_alloc + iu->iu_text_alloc_memsize)
-    parser_error(iu, "Function too big");
+  emit_reserve(iu, 2);
   *(uint16_t *)iu->iu_text_ptr = i16;
   iu->iu_text_ptr += 2;
 }
@@ -2135,8 +2016,7 @@ emit_i16(ir_unit_t *iu, uint16_t i16)
 static void
 emit_i8(ir_unit_t *iu, uint8_t i8)
 {
-  if(iu->iu_text_ptr + 2 >= iu->iu_text_alloc + iu->iu_text_alloc_memsize)
-    parser_error(iu, "Function too big");
+  emit_reserve(iu, 2);
   *(uint8_t *)iu->iu_text_ptr = i8;
   iu->iu_text_ptr += 2; // We always align to 16 bits
 }
@@ -2147,8 +2027,7 @@ emit_i8(ir_unit_t *iu, uint8_t i8)
 static void
 emit_i32(ir_unit_t *iu, uint32_t i32)
 {
-  if(iu->iu_text_ptr + 4 >= iu->iu_text_alloc + iu->iu_text_alloc_memsize)
-    parser_error(iu, "Function too big");
+  emit_reserve(iu, 4);
   *(uint32_t *)iu->iu_text_ptr = i32;
   iu->iu_text_ptr += 4;
 }
@@ -2159,8 +2038,7 @@ emit_i32(ir_unit_t *iu, uint32_t i32)
 static void
 emit_i64(ir_unit_t *iu, uint64_t i64)
 {
-  if(iu->iu_text_ptr + 8 >= iu->iu_text_alloc + iu->iu_text_alloc_memsize)
-    parser_error(iu, "Function too big");
+  emit_reserve(iu, 8);
   *(uint64_t *)iu->iu_text_ptr = i64;
   iu->iu_text_ptr += 8;
 }
@@ -2171,8 +2049,7 @@ emit_i64(ir_unit_t *iu, uint64_t i64)
 static void *
 emit_data(ir_unit_t *iu, int size)
 {
-  if(iu->iu_text_ptr + size >= iu->iu_text_alloc + iu->iu_text_alloc_memsize)
-    parser_error(iu, "Function too big");
+  emit_reserve(iu, size);
   void *r = iu->iu_text_ptr;
   iu->iu_text_ptr += size;
   return r;
@@ -2185,6 +2062,10 @@ emit_data(ir_unit_t *iu, int size)
 static void
 emit_op(ir_unit_t *iu, vm_op_t op)
 {
+  if(iu->iu_vm_record_insns) {
+    vm_insn_t vi = {iu->iu_text_ptr - iu->iu_text_alloc, op};
+    VECTOR_PUSH_BACK(&iu->iu_vm_insns, vi);
+  }
   emit_i16(iu, vm_resolve(op));
 }
 
@@ -2195,7 +2076,7 @@ emit_op(ir_unit_t *iu, vm_op_t op)
 static void
 emit_op1(ir_unit_t *iu, vm_op_t op, uint16_t arg)
 {
-  emit_i16(iu, vm_resolve(op));
+  emit_op(iu, op);
   emit_i16(iu, arg);
 }
 
@@ -2207,7 +2088,7 @@ static void __attribute__((unused))
 emit_op2(ir_unit_t *iu, vm_op_t op,
          uint16_t a1, uint16_t a2)
 {
-  emit_i16(iu, vm_resolve(op));
+  emit_op(iu, op);
   emit_i16(iu, a1);
   emit_i16(iu, a2);
 }
@@ -2219,7 +2100,7 @@ static void
 emit_op3(ir_unit_t *iu, vm_op_t op,
          uint16_t a1, uint16_t a2, uint16_t a3)
 {
-  emit_i16(iu, vm_resolve(op));
+  emit_op(iu, op);
   emit_i16(iu, a1);
   emit_i16(iu, a2);
   emit_i16(iu, a3);
@@ -2232,7 +2113,7 @@ static void
 emit_op4(ir_unit_t *iu, vm_op_t op,
          uint16_t a1, uint16_t a2, uint16_t a3, uint16_t a4)
 {
-  emit_i16(iu, vm_resolve(op));
+  emit_op(iu, op);
   emit_i16(iu, a1);
   emit_i16(iu, a2);
   emit_i16(iu, a3);
@@ -3198,6 +3079,89 @@ emit_cmp_branch(ir_unit_t *iu, ir_instr_cmp_branch_t *ii)
 }
 
 
+/**
+ * An add of a constant directly followed by a compare and branch on its
+ * result is emitted as a single instruction. This is how most counted
+ * loops end. Returns false if not possible
+ */
+static int
+emit_loop_branch(ir_unit_t *iu, ir_instr_t *ii)
+{
+  ir_instr_cmp_branch_t *icb =
+    instr_isa(TAILQ_NEXT(ii, ii_link), IR_IC_CMP_BRANCH);
+  int64_t step;
+  int src;
+
+  if(icb == NULL || icb->lhs_value != ii->ii_ret_value ||
+     ii->ii_jit || icb->super.ii_jit ||
+     icb->op < ICMP_EQ || icb->op > ICMP_SLE)
+    return 0;
+
+  if(ii->ii_class == IR_IC_LEA) {
+    const ir_instr_lea_t *lea = (const ir_instr_lea_t *)ii;
+    if(lea->value_offset != -1)
+      return 0;
+    src = lea->baseptr;
+    step = lea->immediate_offset;
+  } else {
+    const ir_instr_binary_t *bin = (const ir_instr_binary_t *)ii;
+    const ir_value_t *c = value_get(iu, bin->rhs_value);
+    if(c->iv_class != IR_VC_CONSTANT)
+      return 0;
+    step = (int32_t)value_get_const32(iu, c);
+    if(bin->op == BINOP_SUB)
+      step = -step;
+    else if(bin->op != BINOP_ADD)
+      return 0;
+    src = bin->lhs_value;
+  }
+
+  if(step < INT16_MIN || step > INT16_MAX)
+    return 0;
+
+  const ir_value_t *ret = value_get(iu, ii->ii_ret_value);
+  const ir_value_t *lhs = value_get(iu, src);
+  const ir_value_t *rhs = value_get(iu, icb->rhs_value);
+  const int code = type_get(iu, ret->iv_type)->it_code;
+
+  if(ret->iv_class != IR_VC_REGFRAME || lhs->iv_class != IR_VC_REGFRAME ||
+     (code != IR_TYPE_INT32 && code != IR_TYPE_POINTER))
+    return 0;
+
+  int textpos = iu->iu_text_ptr - iu->iu_text_alloc;
+
+  switch(rhs->iv_class) {
+  case IR_VC_REGFRAME:
+    VECTOR_PUSH_BACK(&iu->iu_branch_fixups, textpos);
+    emit_i16(iu, icb->op - ICMP_EQ + VM_ADD_EQ32_BR);
+    emit_i16(iu, icb->true_branch);
+    emit_i16(iu, icb->false_branch);
+    emit_i16(iu, value_reg(ret));
+    emit_i16(iu, value_reg(lhs));
+    emit_i16(iu, step);
+    emit_i16(iu, value_reg(rhs));
+    break;
+
+  case IR_VC_CONSTANT:
+  case IR_VC_GLOBALVAR:
+    VECTOR_PUSH_BACK(&iu->iu_branch_fixups, textpos);
+    emit_i16(iu, icb->op - ICMP_EQ + VM_ADD_EQ32_C_BR);
+    emit_i16(iu, icb->true_branch);
+    emit_i16(iu, icb->false_branch);
+    emit_i16(iu, value_reg(ret));
+    emit_i16(iu, value_reg(lhs));
+    emit_i16(iu, step);
+    emit_i32(iu, value_get_const32(iu, rhs));
+    break;
+
+  default:
+    return 0;
+  }
+  iu->iu_stats.vm_loop_branches++;
+  return 1;
+}
+
+
 /**
  *
  */
@@ -3752,6 +3716,43 @@ emit_cast(ir_unit_t *iu, ir_instr_unary_t *ii)
 }
 
 
+/**
+ * A call marked tail can reuse the frame of the caller if it's
+ * immediately returned and its arguments fit where the caller's
+ * arguments are. Returns the size of the arguments or -1
+ */
+static int
+call_tail_argsize(ir_unit_t *iu, ir_instr_call_t *ii, ir_function_t *f)
+{
+  if(!ii->tail)
+    return -1;
+
+  const ir_instr_t *next = TAILQ_NEXT(&ii->super, ii_link);
+  if(next == NULL || next->ii_class != IR_IC_RET ||
+     ((const ir_instr_unary_t *)next)->value != ii->super.ii_ret_value)
+    return -1;
+
+  int argsize = 0;
+  for(int i = 0; i < ii->argc; i++) {
+    if(ii->argv[i].copy_size)
+      return -1; // Byval arguments live in the caller's alloca area
+    const ir_value_t *iv = value_get(iu, ii->argv[i].value);
+    argsize += value_regframe_size(iu, iv->iv_type);
+  }
+  return argsize <= -f->if_callarg_size ? argsize : -1;
+}
+
+
+/**
+ * Empty inline cache for JSR_R and JSR_R_TAIL
+ */
+static void
+emit_ic(ir_unit_t *iu)
+{
+  vm_ic_init(iu, emit_data(iu, sizeof(vm_ic_t)));
+}
+
+
 /**
  *
  */
@@ -3760,6 +3761,7 @@ emit_call(ir_unit_t *iu, ir_instr_call_t *ii, ir_function_t *f)
 {
   int rf_offset = f->if_regframe_size;
   int return_reg;
+  const int tail_argsize = call_tail_argsize(iu, ii, f);
 
   if(ii->super.ii_ret_value != -1) {
     const ir_value_t *ret = value_get(iu, ii->super.ii_ret_value);
@@ -3771,10 +3773,17 @@ emit_call(ir_unit_t *iu, ir_instr_call_t *ii, ir_function_t *f)
   if(callee != NULL) {
     vm_op_t op;
 
-    if(callee->if_ext_func != NULL)
+    if(callee->if_ext_func != NULL) {
       op = VM_JSR_EXT;
-    else
+    } else if(tail_argsize >= 0) {
+      emit_op3(iu, VM_JSR_VM_TAIL, callee->if_gfid, rf_offset, tail_argsize);
+      iu->iu_stats.tail_calls++;
+      layout_call(iu, f, callee);
+      return;
+    } else {
       op = VM_JSR_VM;
+      layout_call(iu, f, callee);
+    }
 
     emit_op3(iu, op, callee->if_gfid, rf_offset, return_reg);
 
@@ -3785,7 +3794,13 @@ emit_call(ir_unit_t *iu, ir_instr_call_t *ii, ir_function_t *f)
     if(iv->iv_class != IR_VC_REGFRAME)
       parser_error(iu, "Call via incompatible value class %d",
                    iv->iv_class);
-    emit_op3(iu, VM_JSR_R, value_reg(iv), rf_offset, return_reg);
+    if(tail_argsize >= 0) {
+      emit_op3(iu, VM_JSR_R_TAIL, value_reg(iv), rf_offset, tail_argsize);
+      iu->iu_stats.tail_calls++;
+    } else {
+      emit_op3(iu, VM_JSR_R, value_reg(iv), rf_offset, return_reg);
+    }
+    emit_ic(iu);
   }
 }
 
@@ -4083,6 +4098,10 @@ instr_emit(ir_unit_t *iu, ir_bb_t *bb, ir_function_t *f)
       emit_ret(iu, (ir_instr_unary_t *)ii);
       break;
     case IR_IC_BINOP:
+      if(emit_loop_branch(iu, ii)) {
+        ii = TAILQ_NEXT(ii, ii_link);
+        break;
+      }
       emit_binop(iu, (ir_instr_binary_t *)ii);
       break;
     case IR_IC_LOAD:
@@ -4101,6 +4120,10 @@ instr_emit(ir_unit_t *iu, ir_bb_t *bb, ir_function_t *f)
       emit_store(iu, (ir_instr_store_t *)ii);
       break;
     case IR_IC_LEA:
+      if(emit_loop_branch(iu, ii)) {
+        ii = TAILQ_NEXT(ii, ii_link);
+        break;
+      }
       emit_lea(iu, (ir_instr_lea_t *)ii);
       break;
     case IR_IC_CAST:
@@ -4147,9 +4170,10 @@ instr_emit(ir_unit_t *iu, ir_bb_t *bb, ir_function_t *f)
 
 
 /**
- *
+ * Branch deltas are relative to the operands which start right after
+ * the opcode at 'off'
  */
-static int16_t
+static int
 bb_to_offset_delta(ir_function_t *f, int bbi, int off)
 {
   ir_bb_t *bb = bb_find(f, bbi);
@@ -4157,13 +4181,100 @@ bb_to_offset_delta(ir_function_t *f, int bbi, int off)
     printf("bb .%d not found\n", bbi);
     abort();
   }
-  // The 2 is here because we need to compensate that the instruction
-  // stream is past the opcode when the branch is executed
-  int o = bb->ib_text_offset - (off + 2);
+  return bb->ib_text_offset - (off + 2);
+}
 
-  assert(o >= INT16_MIN);
-  assert(o <= INT16_MAX);
-  return o;
+
+/**
+ * Returns the number of branch targets of the (temporary) branch
+ * instruction 'I' and stores the position of the first in 'first'. The
+ * targets are consecutive operands
+ */
+static int
+branch_targets(ir_unit_t *iu, const uint16_t *I, int *first)
+{
+  const int p = I[2];
+
+  switch(I[0]) {
+  case VM_B:
+    *first = 1;
+    return 1;
+  case VM_BCOND:
+    *first = 2;
+    return 2;
+  case VM_EQ8_BR ... VM_ADD_SLE32_C_BR:
+    *first = 1;
+    return 2;
+  case VM_JUMPTABLE:
+    *first = 3;
+    return p;
+  case VM_SWITCH8_BS:
+    *first = 3 + p;
+    return p + 1;
+  case VM_SWITCH32_BS:
+    *first = 3 + p * 2;
+    return p + 1;
+  case VM_SWITCH64_BS:
+    *first = 3 + p * 4;
+    return p + 1;
+  default:
+    parser_error(iu, "Bad branch temporary opcode %d", I[0]);
+  }
+}
+
+
+/**
+ * Emit a VM_BL for each target of the branches emitted since fixup
+ * 'first_fixup'. Placed after the last instruction of a basic block
+ * so they are only reached by branching to them
+ */
+static void
+emit_veneers(ir_unit_t *iu, int first_fixup)
+{
+  const int num_fixups = VECTOR_LEN(&iu->iu_branch_fixups);
+  const int first_veneer = VECTOR_LEN(&iu->iu_branch_veneers);
+
+  for(int i = first_fixup; i < num_fixups; i++) {
+    const int off = VECTOR_ITEM(&iu->iu_branch_fixups, i);
+    int first;
+    const int n = branch_targets(iu, iu->iu_text_alloc + off, &first);
+
+    for(int j = first; j < first + n; j++) {
+      const uint16_t *I = iu->iu_text_alloc + off;
+      const uint32_t target = I[j];
+      vm_veneer_t vv = {off + j * 2, -1};
+
+      // Branches of the same basic block to the same target share it
+      for(int k = first_veneer; k < VECTOR_LEN(&iu->iu_branch_veneers); k++) {
+        const int veneer = VECTOR_ITEM(&iu->iu_branch_veneers, k).vv_veneer;
+        uint32_t veneer_target;
+        memcpy(&veneer_target, iu->iu_text_alloc + veneer + 2,
+               sizeof(uint32_t));
+        if(veneer_target == target) {
+          vv.vv_veneer = veneer;
+          break;
+        }
+      }
+
+      if(vv.vv_veneer == -1) {
+        vv.vv_veneer = iu->iu_text_ptr - iu->iu_text_alloc;
+        VECTOR_PUSH_BACK(&iu->iu_branch_fixups, vv.vv_veneer);
+        emit_i16(iu, VM_BL);
+        emit_i32(iu, target);
+      }
+      VECTOR_PUSH_BACK(&iu->iu_branch_veneers, vv);
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static int
+vm_veneer_cmp(const void *key, const void *elem)
+{
+  return *(const int *)key - ((const vm_veneer_t *)elem)->vv_operand;
 }
 
 
@@ -4171,57 +4282,161 @@ bb_to_offset_delta(ir_function_t *f, int bbi, int off)
  * Finalize branch instructions.
  *
  * At time when we emitted them we didn't know where all basic blocks
- * started and ends, so we fix that now
+ * started and ends, so we fix that now. Targets further away than an
+ * int16_t delta can reach are branched to via a veneer if there is
+ * one. Returns -1 if there isn't, the function must then be emitted
+ * again with veneers
  */
-static void
+static int
 branch_fixup(ir_unit_t *iu)
 {
   ir_function_t *f = iu->iu_current_function;
   int x = VECTOR_LEN(&iu->iu_branch_fixups);
-  int p;
   for(int i = 0; i < x; i++) {
     int off = VECTOR_ITEM(&iu->iu_branch_fixups, i);
 
-    uint16_t *I = f->if_vm_text + off;
-    switch(I[0]) {
-    case VM_B:
-      I[1] = bb_to_offset_delta(f, I[1], off);
-      break;
-    case VM_BCOND:
-      I[2] = bb_to_offset_delta(f, I[2], off);
-      I[3] = bb_to_offset_delta(f, I[3], off);
-      break;
-    case VM_EQ8_BR ... VM_SLE32_C_BR:
-      I[1] = bb_to_offset_delta(f, I[1], off);
-      I[2] = bb_to_offset_delta(f, I[2], off);
-      break;
-    case VM_JUMPTABLE:
-      for(int j = 0; j < I[2]; j++)
-        I[3 + j] = bb_to_offset_delta(f, I[3 + j], off);
-      break;
+    uint16_t *I = iu->iu_text_alloc + off;
 
-    case VM_SWITCH8_BS:
-      p = I[2];
-      for(int j = 0; j < p + 1; j++)
-        I[3 + p + j] = bb_to_offset_delta(f, I[3 + p + j], off);
-      break;
-    case VM_SWITCH32_BS:
-      p = I[2];
-      for(int j = 0; j < p + 1; j++)
-        I[3 + p * 2 + j] = bb_to_offset_delta(f, I[3 + p * 2 + j], off);
-      break;
-    case VM_SWITCH64_BS:
-      p = I[2];
-      for(int j = 0; j < p + 1; j++)
-        I[3 + p * 4 + j] = bb_to_offset_delta(f, I[3 + p * 4 + j], off);
-      break;
-    default:
-      parser_error(iu, "Bad branch temporary opcode %d", I[0]);
+    if(iu->iu_vm_record_insns) {
+      vm_insn_t vi = {off, I[0]};
+      VECTOR_PUSH_BACK(&iu->iu_vm_insns, vi);
+    }
+
+    if(I[0] == VM_BL) {
+      uint32_t bbi;
+      memcpy(&bbi, I + 1, sizeof(uint32_t));
+      const int32_t o = bb_to_offset_delta(f, bbi, off);
+      memcpy(I + 1, &o, sizeof(int32_t));
+    } else {
+      int first;
+      const int n = branch_targets(iu, I, &first);
+      for(int j = first; j < first + n; j++) {
+        int o = bb_to_offset_delta(f, I[j], off);
+        if(o < INT16_MIN || o > INT16_MAX) {
+          const int operand = off + j * 2;
+          const vm_veneer_t *vv =
+            bsearch(&operand, iu->iu_branch_veneers.vh_p,
+                    VECTOR_LEN(&iu->iu_branch_veneers),
+                    sizeof(vm_veneer_t), vm_veneer_cmp);
+          if(vv == NULL)
+            return -1;
+          o = vv->vv_veneer - (off + 2);
+          if(o < INT16_MIN || o > INT16_MAX)
+            parser_error(iu, "Function too big, branch at %d out of range",
+                         off);
+        }
+        I[j] = o;
+      }
     }
     I[0] = vm_resolve(I[0]);
   }
+  return 0;
+}
+
+
+
+/**
+ *
+ */
+static int __attribute__((unused))
+vm_insn_cmp(const vm_insn_t *a, const vm_insn_t *b)
+{
+  return a->vi_offset - b->vi_offset;
+}
+
+
+#ifndef VMIR_VM_PROFILE
+
+/**
+ * Superinstructions generated by vmir_supergen from an opcode profile
+ */
+typedef struct vm_super {
+  uint16_t vs_op;
+  uint8_t vs_len;
+  uint16_t vs_ops[3];
+  uint8_t vs_oplen[3];
+} vm_super_t;
+
+static const vm_super_t vm_supers[] = {
+#define VM_SUPER_PATTERNS
+#include "vmir_vm_super.h"
+#undef VM_SUPER_PATTERNS
+};
+
+#define VM_NUM_SUPERS (sizeof(vm_supers) / sizeof(vm_supers[0]))
+
+
+/**
+ * The AOT and copy-and-patch compilers translate the original ops
+ */
+static int
+vm_use_superinstructions(const ir_unit_t *iu)
+{
+  return VM_NUM_SUPERS > 0 && iu->iu_aot_path == NULL &&
+    !(iu->iu_copy_patch && !iu->iu_tier_up);
+}
+
+
+/**
+ * Replace sequences of instructions with superinstructions.
+ *
+ * A superinstruction has the same operands as the instructions it
+ * replaces so only the opcode of the first instruction is changed.
+ * The other opcodes are left as is, thus branches to them still work
+ */
+static void
+vm_superinstructions(ir_unit_t *iu, ir_function_t *f)
+{
+  const int num_insns = VECTOR_LEN(&iu->iu_vm_insns);
+  uint16_t *text = f->if_vm_text;
+
+  VECTOR_SORT(&iu->iu_vm_insns, vm_insn_cmp);
+
+  for(int i = 0; i < num_insns; i++) {
+    for(int j = 0; j < VM_NUM_SUPERS; j++) {
+      const vm_super_t *vs = &vm_supers[j];
+      int k;
+      for(k = 0; k < vs->vs_len && i + k < num_insns; k++) {
+        const vm_insn_t *vi = &VECTOR_ITEM(&iu->iu_vm_insns, i + k);
+        const int end = i + k + 1 < num_insns ?
+          VECTOR_ITEM(&iu->iu_vm_insns, i + k + 1).vi_offset :
+          f->if_vm_text_size;
+        if(vi->vi_op != vs->vs_ops[k] ||
+           end - vi->vi_offset != 2 * (1 + vs->vs_oplen[k]))
+          break;
+      }
+      if(k == vs->vs_len) {
+        text[VECTOR_ITEM(&iu->iu_vm_insns, i).vi_offset / 2] =
+          vm_resolve(vs->vs_op);
+        iu->iu_stats.vm_superinstructions++;
+        i += vs->vs_len - 1;
+        break;
+      }
+    }
+  }
 }
 
+#else
+
+#define vm_use_superinstructions(iu) 0
+
+#endif
+
+
+/**
+ * A basic block is a loop header if it has an incoming edge from itself
+ * or from a block placed after it. Requires ib_mark to be the bb position
+ */
+static int
+bb_is_loop_header(const ir_bb_t *ib)
+{
+  const ir_bb_edge_t *ibe;
+  LIST_FOREACH(ibe, &ib->ib_incoming_edges, ibe_to_link) {
+    if(ibe->ibe_from->ib_mark >= ib->ib_mark)
+      return 1;
+  }
+  return 0;
+}
 
 
 /**
@@ -4230,16 +4445,47 @@ branch_fixup(ir_unit_t *iu)
 static void
 vm_emit_function(ir_unit_t *iu, ir_function_t *f)
 {
+  // Restored if the function has to be emitted again
+  const vmir_stats_t stats = iu->iu_stats;
+  const int num_instrumentation = VECTOR_LEN(&iu->iu_instrumentation);
+  const int num_call_edges = VECTOR_LEN(&iu->iu_call_edges);
+#ifdef VMIR_VM_JIT
+  const int jit_ptr = iu->iu_jit_ptr;
+#endif
+
+  // The ops are only needed for translating to C, superinstructions
+  // and the cache
+  iu->iu_vm_record_insns = iu->iu_aot_path != NULL ||
+    vm_use_superinstructions(iu) || iu->iu_cache_path != NULL;
+
+  int far_branches = 0;
+ again:
   iu->iu_text_ptr = iu->iu_text_alloc;
 
   VECTOR_RESIZE(&iu->iu_branch_fixups, 0);
+  VECTOR_RESIZE(&iu->iu_branch_veneers, 0);
+  VECTOR_RESIZE(&iu->iu_vm_insns, 0);
   VECTOR_RESIZE(&iu->iu_jit_vmcode_fixups, 0);
   VECTOR_RESIZE(&iu->iu_jit_vmbb_fixups, 0);
   VECTOR_RESIZE(&iu->iu_jit_branch_fixups, 0);
 
+  const int tier_count = iu->iu_tier_threshold && !iu->iu_tier_up;
   ir_bb_t *ib;
+  if(tier_count) {
+    int pos = 0;
+    TAILQ_FOREACH(ib, &f->if_bbs, ib_link)
+      ib->ib_mark = pos++;
+  }
+
   TAILQ_FOREACH(ib, &f->if_bbs, ib_link) {
     ib->ib_text_offset = iu->iu_text_ptr - iu->iu_text_alloc;
+
+    if(tier_count && (ib == TAILQ_FIRST(&f->if_bbs) ||
+                      bb_is_loop_header(ib))) {
+      emit_op(iu, VM_TIER_COUNT);
+      emit_i32(iu, f->if_gfid);
+    }
+
     if(iu->iu_debug_flags_func & VMIR_DBG_BB_INSTRUMENT) {
       emit_op(iu, VM_INSTRUMENT_COUNT);
       emit_i32(iu, VECTOR_LEN(&iu->iu_instrumentation));
@@ -4252,17 +4498,41 @@ vm_emit_function(ir_unit_t *iu, ir_function_t *f)
       ir_instrumentation_t ii = {f, ib->ib_id, num_instructions, 0};
       VECTOR_PUSH_BACK(&iu->iu_instrumentation, ii);
     }
+    const int first_fixup = VECTOR_LEN(&iu->iu_branch_fixups);
     instr_emit(iu, ib, f);
+    if(far_branches)
+      emit_veneers(iu, first_fixup);
+  }
+
+  if(branch_fixup(iu)) {
+    // Some branch is out of range, emit again with veneers
+    assert(!far_branches);
+    far_branches = 1;
+    iu->iu_stats = stats;
+    VECTOR_RESIZE(&iu->iu_instrumentation, num_instrumentation);
+    VECTOR_RESIZE(&iu->iu_call_edges, num_call_edges);
+#ifdef VMIR_VM_JIT
+    iu->iu_jit_ptr = jit_ptr;
+#endif
+    goto again;
   }
 
   f->if_vm_text_size = iu->iu_text_ptr - iu->iu_text_alloc;
-  f->if_vm_text = malloc(f->if_vm_text_size);
+  f->if_vm_text = vm_text_alloc(iu, f->if_vm_text_size);
   memcpy(f->if_vm_text, iu->iu_text_alloc, f->if_vm_text_size);
+  if(far_branches)
+    iu->iu_stats.vm_far_functions++;
 
-  branch_fixup(iu);
 #ifdef VMIR_VM_JIT
   jit_branch_fixup(iu, f);
+  jit_record_relocs(iu, f);
 #endif
+
+#ifndef VMIR_VM_PROFILE
+  if(vm_use_superinstructions(iu))
+    vm_superinstructions(iu, f);
+#endif
+  cache_record_insns(iu, f);
 }
 
 
@@ -4322,11 +4592,18 @@ vm_function_call(ir_unit_t *iu, ir_function_t *f, void *out, ...)
     case VM_STOP_BAD_FUNCTION:
       printf("Bad function %d\n", iu->iu_exit_code);
       break;
+    case VM_STOP_STACK_OVERFLOW:
+      printf("Stack overflow\n");
+      break;
     }
     return r;
   }
 
-  vm_exec(f->if_vm_text, rfa, iu, out, iu->iu_alloca_ptr, -1);
+  if(rfa - iu->iu_mem + iu->iu_vm_frame_sizes[f->if_gfid] > iu->iu_rsize)
+    vm_stop(iu, VM_STOP_STACK_OVERFLOW, 0);
+  iu->iu_vm_depth = 0;
+  vm_host_stack_init(iu);
+  vm_exec(iu->iu_vm_funcs[f->if_gfid], rfa, iu, out, iu->iu_alloca_ptr, -1);
   return r;
 }
 
@@ -28,6 +28,7 @@
 #define VM_STOP_UNREACHABLE 3
 #define VM_STOP_BAD_INSTRUCTION 4
 #define VM_STOP_BAD_FUNCTION 5
+#define VM_STOP_STACK_OVERFLOW 6
 
 typedef enum {
   VM_JIT_CALL,
@@ -519,6 +520,31 @@ typedef enum {
   VM_SLT32_C_BR,
   VM_SLE32_C_BR,
 
+  // Add and compare the result, these must be in same order as enum
+  // Predicate
+  VM_ADD_EQ32_BR,
+  VM_ADD_NE32_BR,
+  VM_ADD_UGT32_BR,
+  VM_ADD_UGE32_BR,
+  VM_ADD_ULT32_BR,
+  VM_ADD_ULE32_BR,
+  VM_ADD_SGT32_BR,
+  VM_ADD_SGE32_BR,
+  VM_ADD_SLT32_BR,
+  VM_ADD_SLE32_BR,
+
+  // These must be in same order as enum Predicate
+  VM_ADD_EQ32_C_BR,
+  VM_ADD_NE32_C_BR,
+  VM_ADD_UGT32_C_BR,
+  VM_ADD_UGE32_C_BR,
+  VM_ADD_ULT32_C_BR,
+  VM_ADD_ULE32_C_BR,
+  VM_ADD_SGT32_C_BR,
+  VM_ADD_SGE32_C_BR,
+  VM_ADD_SLT32_C_BR,
+  VM_ADD_SLE32_C_BR,
+
 
 
   VM_SELECT8RR,
@@ -542,10 +568,13 @@ typedef enum {
   VM_SELECT64CC,
 
   VM_B,
+  VM_BL,      // Branch with an int32_t delta, see branch_fixup()
   VM_BCOND,
   VM_JSR_R,
   VM_JSR_VM,
   VM_JSR_EXT,
+  VM_JSR_VM_TAIL,
+  VM_JSR_R_TAIL,
 
   VM_JUMPTABLE,
   VM_SWITCH8_BS,
@@ -696,5 +725,49 @@ typedef enum {
   VM_NOP,
 
   VM_INSTRUMENT_COUNT,
+  VM_TIER_COUNT,
+  VM_NATIVE,
+  VM_MATERIALIZE,
 
+  // Superinstructions generated by vmir_supergen
+#define VM_SUPER_ENUM
+#include "vmir_vm_super.h"
+#undef VM_SUPER_ENUM
+
+  VM_NUM_OPS,
 } vm_op_t;
+
+
+/**
+ * State shared by the native code emitted by the copy-and-patch and
+ * AOT compilers for one activation of a function
+ */
+typedef struct vm_frame {
+  void *vf_ret;
+  struct ir_unit *vf_iu;
+  uint32_t vf_allocaptr;
+} vm_frame_t;
+
+typedef void (vm_native_t)(void *rf, void *mem, vm_frame_t *vf);
+
+
+/**
+ * Functions in vmir called from code emitted by the AOT compiler
+ */
+typedef struct vm_aot_host {
+  uint32_t (*vm_strchr)(uint32_t a, int b, void *mem);
+  uint32_t (*vm_strrchr)(uint32_t a, int b, void *mem);
+  uint32_t (*vm_vaarg32)(void *rf, void **ptr);
+  uint64_t (*vm_vaarg64)(void *rf, void **ptr);
+  void (*vm_stop)(struct ir_unit *iu, int reason, int code)
+    __attribute__((noreturn));
+  void (*vm_native_jsr_vm)(vm_frame_t *vf, int fid, void *rf, void *ret);
+  void (*vm_native_jsr_ext)(vm_frame_t *vf, int fid, void *rf, void *ret);
+  void (*vm_native_jsr_r)(vm_frame_t *vf, uint32_t fid, void *rf, void *ret);
+  vm_native_t *(*vm_native_tail_vm)(vm_frame_t *vf, int fid, void *rf,
+                                    int argoffset, int argsize);
+  vm_native_t *(*vm_native_tail_r)(vm_frame_t *vf, uint32_t fid, void *rf,
+                                   int argoffset, int argsize);
+  void (*vm_native_tier_count)(vm_frame_t *vf, int fid);
+  void (*vm_native_check_frame)(vm_frame_t *vf, int fid, void *rf);
+} vm_aot_host_t;
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Control flow and call instructions for code that runs natively.
+ *
+ * vm_exec() implements these itself as it has to move the instruction
+ * pointer. This file is included by vmir_stencils.c and by the C source
+ * emitted by the AOT compiler (vmir_aot.c) where NEXT() continues with
+ * the following instruction, BRANCH(n) transfers control to the target
+ * encoded in operand n and RETURN() returns from the function.
+ * Instructions that don't continue with the following instruction
+ * state their length using VMOPN()
+ */
+
+  VMOP(NOP) NEXT(0);
+
+  VMOPN(RET_VOID, 0)
+    RETURN();
+
+  VMOPN(RET_R8, 1)
+    *(uint32_t *)vf->vf_ret = R8(0);
+    RETURN();
+
+  VMOPN(RET_R16, 1)
+    *(uint16_t *)vf->vf_ret = R16(0);
+    RETURN();
+
+  VMOPN(RET_R32, 1)
+    *(uint32_t *)vf->vf_ret = R32(0);
+    RETURN();
+
+  VMOPN(RET_R64, 1)
+    *(uint64_t *)vf->vf_ret = R64(0);
+    RETURN();
+
+  VMOPN(RET_R32C, 2)
+    *(uint32_t *)vf->vf_ret = UIMM32(0);
+    RETURN();
+
+  VMOPN(RET_R64C, 4)
+    *(uint64_t *)vf->vf_ret = UIMM64(0);
+    RETURN();
+
+  VMOPN(B, 1)     BRANCH(0);
+  VMOPN(BCOND, 3) if(R32(0)) BRANCH(1); BRANCH(2);
+
+  VMOP(JSR_VM)
+    vm_native_jsr_vm(vf, UIMM16(0), rf + UIMM16(1), rf + UIMM16(2));
+    NEXT(3);
+
+  VMOP(JSR_EXT)
+    vm_native_jsr_ext(vf, UIMM16(0), rf + UIMM16(1), rf + UIMM16(2));
+    NEXT(3);
+
+  // The inline cache after the operands is only used by vm_exec()
+  VMOP(JSR_R)
+    vm_native_jsr_r(vf, R32(0), rf + UIMM16(1), rf + UIMM16(2));
+    NEXT(16);
+
+  VMOPN(JSR_VM_TAIL, 3)
+  {
+    vm_native_t *code = vm_native_tail_vm(vf, UIMM16(0), rf,
+                                          UIMM16(1), UIMM16(2));
+    if(code != NULL)
+      code(rf, mem, vf); // Sibling call
+    RETURN();
+  }
+
+  VMOPN(JSR_R_TAIL, 16)
+  {
+    vm_native_t *code = vm_native_tail_r(vf, R32(0), rf,
+                                         UIMM16(1), UIMM16(2));
+    if(code != NULL)
+      code(rf, mem, vf);
+    RETURN();
+  }
+
+  VMOPN(EQ8_BR, 4)  if(R8(2) == R8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(NE8_BR, 4)  if(R8(2) != R8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGT8_BR, 4) if(R8(2) >  R8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGE8_BR, 4) if(R8(2) >= R8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULT8_BR, 4) if(R8(2) <  R8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULE8_BR, 4) if(R8(2) <= R8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGT8_BR, 4) if(S8(2) >  S8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGE8_BR, 4) if(S8(2) >= S8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLT8_BR, 4) if(S8(2) <  S8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLE8_BR, 4) if(S8(2) <= S8(3)) BRANCH(0); BRANCH(1);
+
+  VMOPN(EQ8_C_BR, 4)  if(R8(2) == UIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(NE8_C_BR, 4)  if(R8(2) != UIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGT8_C_BR, 4) if(R8(2) >  UIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGE8_C_BR, 4) if(R8(2) >= UIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULT8_C_BR, 4) if(R8(2) <  UIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULE8_C_BR, 4) if(R8(2) <= UIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGT8_C_BR, 4) if(S8(2) >  SIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGE8_C_BR, 4) if(S8(2) >= SIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLT8_C_BR, 4) if(S8(2) <  SIMM8(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLE8_C_BR, 4) if(S8(2) <= SIMM8(3)) BRANCH(0); BRANCH(1);
+
+  VMOPN(EQ32_BR, 4)  if(R32(2) == R32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(NE32_BR, 4)  if(R32(2) != R32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGT32_BR, 4) if(R32(2) >  R32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGE32_BR, 4) if(R32(2) >= R32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULT32_BR, 4) if(R32(2) <  R32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULE32_BR, 4) if(R32(2) <= R32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGT32_BR, 4) if(S32(2) >  S32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGE32_BR, 4) if(S32(2) >= S32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLT32_BR, 4) if(S32(2) <  S32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLE32_BR, 4) if(S32(2) <= S32(3)) BRANCH(0); BRANCH(1);
+
+  VMOPN(EQ32_C_BR, 5)  if(R32(2) == UIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(NE32_C_BR, 5)  if(R32(2) != UIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGT32_C_BR, 5) if(R32(2) >  UIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(UGE32_C_BR, 5) if(R32(2) >= UIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULT32_C_BR, 5) if(R32(2) <  UIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(ULE32_C_BR, 5) if(R32(2) <= UIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGT32_C_BR, 5) if(S32(2) >  SIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SGE32_C_BR, 5) if(S32(2) >= SIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLT32_C_BR, 5) if(S32(2) <  SIMM32(3)) BRANCH(0); BRANCH(1);
+  VMOPN(SLE32_C_BR, 5) if(S32(2) <= SIMM32(3)) BRANCH(0); BRANCH(1);
+
+  VMOPN(ADD_EQ32_BR,  6) AR32(2, R32(3) + SIMM16(4)); if(R32(2) == R32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_NE32_BR,  6) AR32(2, R32(3) + SIMM16(4)); if(R32(2) != R32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_UGT32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(R32(2) >  R32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_UGE32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(R32(2) >= R32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_ULT32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(R32(2) <  R32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_ULE32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(R32(2) <= R32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SGT32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(S32(2) >  S32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SGE32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(S32(2) >= S32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SLT32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(S32(2) <  S32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SLE32_BR, 6) AR32(2, R32(3) + SIMM16(4)); if(S32(2) <= S32(5)) BRANCH(0); BRANCH(1);
+
+  VMOPN(ADD_EQ32_C_BR,  7) AR32(2, R32(3) + SIMM16(4)); if(R32(2) == UIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_NE32_C_BR,  7) AR32(2, R32(3) + SIMM16(4)); if(R32(2) != UIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_UGT32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(R32(2) >  UIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_UGE32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(R32(2) >= UIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_ULT32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(R32(2) <  UIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_ULE32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(R32(2) <= UIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SGT32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(S32(2) >  SIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SGE32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(S32(2) >= SIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SLT32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(S32(2) <  SIMM32(5)) BRANCH(0); BRANCH(1);
+  VMOPN(ADD_SLE32_C_BR, 7) AR32(2, R32(3) + SIMM16(4)); if(S32(2) <= SIMM32(5)) BRANCH(0); BRANCH(1);
+
+  VMOPN(UNREACHABLE, 0)
+    vm_stop(vf->vf_iu, VM_STOP_UNREACHABLE, 0);
+
+  VMOP(TIER_COUNT)
+    vm_native_tier_count(vf, UIMM32(0));
+    NEXT(2);
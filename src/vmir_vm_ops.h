@@ -0,0 +1,807 @@
+/*
+ * Copyright (c) 2016 Lonelycoder AB
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Opcode handlers that only touch the register frame, the immediates,
+ * guest memory and the alloca pointer.
+ *
+ * This file is included twice: into vm_exec() in vmir_vm.c where VMOP()
+ * expands to a label, and into vmir_stencils.c where each VMOP() becomes
+ * a standalone function that the copy-and-patch compiler uses as a
+ * machine code template. It must thus not reference I, iu or ret
+ * directly; operands are only accessed via the R/S/UIMM/SIMM macros.
+ */
+
+  VMOP(ADD_R8)  AR8(0,  R8(1) +  R8(2)); NEXT(3);
+  VMOP(SUB_R8)  AR8(0,  R8(1) -  R8(2)); NEXT(3);
+  VMOP(MUL_R8)  AR8(0,  R8(1) *  R8(2)); NEXT(3);
+  VMOP(UDIV_R8) AR8(0,  R8(1) /  R8(2)); NEXT(3);
+  VMOP(SDIV_R8) AS8(0,  S8(1) /  S8(2)); NEXT(3);
+  VMOP(UREM_R8) AR8(0,  R8(1) %  R8(2)); NEXT(3);
+  VMOP(SREM_R8) AS8(0,  S8(1) %  S8(2)); NEXT(3);
+  VMOP(SHL_R8)  AR8(0,  R8(1) << R8(2)); NEXT(3);
+  VMOP(LSHR_R8) AR8(0,  R8(1) >> R8(2)); NEXT(3);
+  VMOP(ASHR_R8) AS8(0,  S8(1) >> R8(2)); NEXT(3);
+  VMOP(AND_R8)  AR8(0,  R8(1) &  R8(2)); NEXT(3);
+  VMOP(OR_R8)   AR8(0,  R8(1) |  R8(2)); NEXT(3);
+  VMOP(XOR_R8)  AR8(0,  R8(1) ^  R8(2)); NEXT(3);
+
+  VMOP(ADD_R8C)  AR8(0, R8(1) +  UIMM8(2)); NEXT(3);
+  VMOP(SUB_R8C)  AR8(0, R8(1) -  UIMM8(2)); NEXT(3);
+  VMOP(MUL_R8C)  AR8(0, R8(1) *  UIMM8(2)); NEXT(3);
+  VMOP(UDIV_R8C) AR8(0, R8(1) /  UIMM8(2)); NEXT(3);
+  VMOP(SDIV_R8C) AS8(0, S8(1) /  SIMM8(2)); NEXT(3);
+  VMOP(UREM_R8C) AR8(0, R8(1) %  UIMM8(2)); NEXT(3);
+  VMOP(SREM_R8C) AS8(0, S8(1) %  SIMM8(2)); NEXT(3);
+  VMOP(SHL_R8C)  AR8(0, R8(1) << UIMM8(2)); NEXT(3);
+  VMOP(LSHR_R8C) AR8(0, R8(1) >> UIMM8(2)); NEXT(3);
+  VMOP(ASHR_R8C) AS8(0, S8(1) >> UIMM8(2)); NEXT(3);
+  VMOP(AND_R8C)  AR8(0, R8(1) &  UIMM8(2)); NEXT(3);
+  VMOP(OR_R8C)   AR8(0, R8(1) |  UIMM8(2)); NEXT(3);
+  VMOP(XOR_R8C)  AR8(0, R8(1) ^  UIMM8(2)); NEXT(3);
+
+
+
+  VMOP(ADD_R16)  AR16(0, R16(1) +  R16(2)); NEXT(3);
+  VMOP(SUB_R16)  AR16(0, R16(1) -  R16(2)); NEXT(3);
+  VMOP(MUL_R16)  AR16(0, R16(1) *  R16(2)); NEXT(3);
+  VMOP(UDIV_R16) AR16(0, R16(1) /  R16(2)); NEXT(3);
+  VMOP(SDIV_R16) AS16(0, S16(1) /  S16(2)); NEXT(3);
+  VMOP(UREM_R16) AR16(0, R16(1) %  R16(2)); NEXT(3);
+  VMOP(SREM_R16) AS16(0, S16(1) %  S16(2)); NEXT(3);
+  VMOP(SHL_R16)  AR16(0, R16(1) << R16(2)); NEXT(3);
+  VMOP(LSHR_R16) AR16(0, R16(1) >> R16(2)); NEXT(3);
+  VMOP(ASHR_R16) AS16(0, S16(1) >> R16(2)); NEXT(3);
+  VMOP(AND_R16)  AR16(0, R16(1) &  R16(2)); NEXT(3);
+  VMOP(OR_R16)   AR16(0, R16(1) |  R16(2)); NEXT(3);
+  VMOP(XOR_R16)  AR16(0, R16(1) ^  R16(2)); NEXT(3);
+
+  VMOP(ADD_R16C)  AR16(0, R16(1) +  UIMM16(2)); NEXT(3);
+  VMOP(SUB_R16C)  AR16(0, R16(1) -  UIMM16(2)); NEXT(3);
+  VMOP(MUL_R16C)  AR16(0, R16(1) *  UIMM16(2)); NEXT(3);
+  VMOP(UDIV_R16C) AR16(0, R16(1) /  UIMM16(2)); NEXT(3);
+  VMOP(SDIV_R16C) AS16(0, S16(1) /  SIMM16(2)); NEXT(3);
+  VMOP(UREM_R16C) AR16(0, R16(1) %  UIMM16(2)); NEXT(3);
+  VMOP(SREM_R16C) AS16(0, S16(1) %  SIMM16(2)); NEXT(3);
+  VMOP(SHL_R16C)  AR16(0, R16(1) << UIMM16(2)); NEXT(3);
+  VMOP(LSHR_R16C) AR16(0, R16(1) >> UIMM16(2)); NEXT(3);
+  VMOP(ASHR_R16C) AS16(0, S16(1) >> UIMM16(2)); NEXT(3);
+  VMOP(AND_R16C)  AR16(0, R16(1) &  UIMM16(2)); NEXT(3);
+  VMOP(OR_R16C)   AR16(0, R16(1) |  UIMM16(2)); NEXT(3);
+  VMOP(XOR_R16C)  AR16(0, R16(1) ^  UIMM16(2)); NEXT(3);
+
+
+
+
+
+  VMOP(ADD_ACC_R32)  AR32(0, R32_ACC +  R32(1)); NEXT(2);
+  VMOP(SUB_ACC_R32)  AR32(0, R32_ACC -  R32(1)); NEXT(2);
+  VMOP(MUL_ACC_R32)  AR32(0, R32_ACC *  R32(1)); NEXT(2);
+  VMOP(UDIV_ACC_R32) AR32(0, R32_ACC /  R32(1)); NEXT(2);
+  VMOP(SDIV_ACC_R32) AS32(0, S32_ACC /  S32(1)); NEXT(2);
+  VMOP(UREM_ACC_R32) AR32(0, R32_ACC %  R32(1)); NEXT(2);
+  VMOP(SREM_ACC_R32) AS32(0, S32_ACC %  S32(1)); NEXT(2);
+  VMOP(SHL_ACC_R32)  AR32(0, R32_ACC << R32(1)); NEXT(2);
+  VMOP(LSHR_ACC_R32) AR32(0, R32_ACC >> R32(1)); NEXT(2);
+  VMOP(ASHR_ACC_R32) AS32(0, S32_ACC >> R32(1)); NEXT(2);
+  VMOP(AND_ACC_R32)  AR32(0, R32_ACC &  R32(1)); NEXT(2);
+  VMOP(OR_ACC_R32)   AR32(0, R32_ACC |  R32(1)); NEXT(2);
+  VMOP(XOR_ACC_R32)  AR32(0, R32_ACC ^  R32(1)); NEXT(2);
+
+  VMOP(INC_ACC_R32)  AR32(0, R32_ACC + 1); NEXT(1);
+  VMOP(DEC_ACC_R32)  AR32(0, R32_ACC - 1); NEXT(1);
+
+  VMOP(ADD_ACC_R32C)  AR32(0, R32_ACC +  UIMM32(1)); NEXT(3);
+  VMOP(SUB_ACC_R32C)  AR32(0, R32_ACC -  UIMM32(1)); NEXT(3);
+  VMOP(MUL_ACC_R32C)  AR32(0, R32_ACC *  UIMM32(1)); NEXT(3);
+  VMOP(UDIV_ACC_R32C) AR32(0, R32_ACC /  UIMM32(1)); NEXT(3);
+  VMOP(SDIV_ACC_R32C) AS32(0, S32_ACC /  SIMM32(1)); NEXT(3);
+  VMOP(UREM_ACC_R32C) AR32(0, R32_ACC %  UIMM32(1)); NEXT(3);
+  VMOP(SREM_ACC_R32C) AS32(0, S32_ACC %  SIMM32(1)); NEXT(3);
+  VMOP(SHL_ACC_R32C)  AR32(0, R32_ACC << UIMM32(1)); NEXT(3);
+  VMOP(LSHR_ACC_R32C) AR32(0, R32_ACC >> UIMM32(1)); NEXT(3);
+  VMOP(ASHR_ACC_R32C) AS32(0, S32_ACC >> UIMM32(1)); NEXT(3);
+  VMOP(AND_ACC_R32C)  AR32(0, R32_ACC &  UIMM32(1)); NEXT(3);
+  VMOP(OR_ACC_R32C)   AR32(0, R32_ACC |  UIMM32(1)); NEXT(3);
+  VMOP(XOR_ACC_R32C)  AR32(0, R32_ACC ^  UIMM32(1)); NEXT(3);
+
+  VMOP(ADD_2ACC_R32)  AR32_ACC(R32_ACC +  R32(0)); NEXT(1);
+  VMOP(SUB_2ACC_R32)  AR32_ACC(R32_ACC -  R32(0)); NEXT(1);
+  VMOP(MUL_2ACC_R32)  AR32_ACC(R32_ACC *  R32(0)); NEXT(1);
+  VMOP(UDIV_2ACC_R32) AR32_ACC(R32_ACC /  R32(0)); NEXT(1);
+  VMOP(SDIV_2ACC_R32) AS32_ACC(S32_ACC /  S32(0)); NEXT(1);
+  VMOP(UREM_2ACC_R32) AR32_ACC(R32_ACC %  R32(0)); NEXT(1);
+  VMOP(SREM_2ACC_R32) AS32_ACC(S32_ACC %  S32(0)); NEXT(1);
+  VMOP(SHL_2ACC_R32)  AR32_ACC(R32_ACC << R32(0)); NEXT(1);
+  VMOP(LSHR_2ACC_R32) AR32_ACC(R32_ACC >> R32(0)); NEXT(1);
+  VMOP(ASHR_2ACC_R32) AS32_ACC(S32_ACC >> R32(0)); NEXT(1);
+  VMOP(AND_2ACC_R32)  AR32_ACC(R32_ACC &  R32(0)); NEXT(1);
+  VMOP(OR_2ACC_R32)   AR32_ACC(R32_ACC |  R32(0)); NEXT(1);
+  VMOP(XOR_2ACC_R32)  AR32_ACC(R32_ACC ^  R32(0)); NEXT(1);
+
+  VMOP(INC_2ACC_R32)  AR32_ACC(R32_ACC + 1); NEXT(0);
+  VMOP(DEC_2ACC_R32)  AR32_ACC(R32_ACC - 1); NEXT(0);
+
+  VMOP(ADD_2ACC_R32C)  AR32_ACC(R32_ACC +  UIMM32(0)); NEXT(2);
+  VMOP(SUB_2ACC_R32C)  AR32_ACC(R32_ACC -  UIMM32(0)); NEXT(2);
+  VMOP(MUL_2ACC_R32C)  AR32_ACC(R32_ACC *  UIMM32(0)); NEXT(2);
+  VMOP(UDIV_2ACC_R32C) AR32_ACC(R32_ACC /  UIMM32(0)); NEXT(2);
+  VMOP(SDIV_2ACC_R32C) AS32_ACC(S32_ACC /  SIMM32(0)); NEXT(2);
+  VMOP(UREM_2ACC_R32C) AR32_ACC(R32_ACC %  UIMM32(0)); NEXT(2);
+  VMOP(SREM_2ACC_R32C) AS32_ACC(S32_ACC %  SIMM32(0)); NEXT(2);
+  VMOP(SHL_2ACC_R32C)  AR32_ACC(R32_ACC << UIMM32(0)); NEXT(2);
+  VMOP(LSHR_2ACC_R32C) AR32_ACC(R32_ACC >> UIMM32(0)); NEXT(2);
+  VMOP(ASHR_2ACC_R32C) AS32_ACC(S32_ACC >> UIMM32(0)); NEXT(2);
+  VMOP(AND_2ACC_R32C)  AR32_ACC(R32_ACC &  UIMM32(0)); NEXT(2);
+  VMOP(OR_2ACC_R32C)   AR32_ACC(R32_ACC |  UIMM32(0)); NEXT(2);
+  VMOP(XOR_2ACC_R32C)  AR32_ACC(R32_ACC ^  UIMM32(0)); NEXT(2);
+
+
+  VMOP(ADD_R32)  AR32(0, R32(1) +  R32(2)); NEXT(3);
+  VMOP(SUB_R32)  AR32(0, R32(1) -  R32(2)); NEXT(3);
+  VMOP(MUL_R32)  AR32(0, R32(1) *  R32(2)); NEXT(3);
+  VMOP(UDIV_R32) AR32(0, R32(1) /  R32(2)); NEXT(3);
+  VMOP(SDIV_R32) AS32(0, S32(1) /  S32(2)); NEXT(3);
+  VMOP(UREM_R32) AR32(0, R32(1) %  R32(2)); NEXT(3);
+  VMOP(SREM_R32) AS32(0, S32(1) %  S32(2)); NEXT(3);
+  VMOP(SHL_R32)  AR32(0, R32(1) << R32(2)); NEXT(3);
+  VMOP(LSHR_R32) AR32(0, R32(1) >> R32(2)); NEXT(3);
+  VMOP(ASHR_R32) AS32(0, S32(1) >> R32(2)); NEXT(3);
+  VMOP(AND_R32)  AR32(0, R32(1) &  R32(2)); NEXT(3);
+  VMOP(OR_R32)   AR32(0, R32(1) |  R32(2)); NEXT(3);
+  VMOP(XOR_R32)  AR32(0, R32(1) ^  R32(2)); NEXT(3);
+
+  VMOP(INC_R32)  AR32(0, R32(1) + 1); NEXT(2);
+  VMOP(DEC_R32)  AR32(0, R32(1) - 1); NEXT(2);
+
+  VMOP(ADD_R32C)  AR32(0, R32(1) +  UIMM32(2)); NEXT(4);
+  VMOP(SUB_R32C)  AR32(0, R32(1) -  UIMM32(2)); NEXT(4);
+  VMOP(MUL_R32C)  AR32(0, R32(1) *  UIMM32(2)); NEXT(4);
+  VMOP(UDIV_R32C) AR32(0, R32(1) /  UIMM32(2)); NEXT(4);
+  VMOP(SDIV_R32C) AS32(0, S32(1) /  SIMM32(2)); NEXT(4);
+  VMOP(UREM_R32C) AR32(0, R32(1) %  UIMM32(2)); NEXT(4);
+  VMOP(SREM_R32C) AS32(0, S32(1) %  SIMM32(2)); NEXT(4);
+  VMOP(SHL_R32C)  AR32(0, R32(1) << UIMM32(2)); NEXT(4);
+  VMOP(LSHR_R32C) AR32(0, R32(1) >> UIMM32(2)); NEXT(4);
+  VMOP(ASHR_R32C) AS32(0, S32(1) >> UIMM32(2)); NEXT(4);
+  VMOP(AND_R32C)  AR32(0, R32(1) &  UIMM32(2)); NEXT(4);
+  VMOP(OR_R32C)   AR32(0, R32(1) |  UIMM32(2)); NEXT(4);
+  VMOP(XOR_R32C)  AR32(0, R32(1) ^  UIMM32(2)); NEXT(4);
+
+
+
+
+  VMOP(ADD_R64)  AR64(0, R64(1) +  R64(2)); NEXT(3);
+  VMOP(SUB_R64)  AR64(0, R64(1) -  R64(2)); NEXT(3);
+  VMOP(MUL_R64)  AR64(0, R64(1) *  R64(2)); NEXT(3);
+  VMOP(UDIV_R64) AR64(0, R64(1) /  R64(2)); NEXT(3);
+  VMOP(SDIV_R64) AS64(0, S64(1) /  S64(2)); NEXT(3);
+  VMOP(UREM_R64) AR64(0, R64(1) %  R64(2)); NEXT(3);
+  VMOP(SREM_R64) AS64(0, S64(1) %  S64(2)); NEXT(3);
+  VMOP(SHL_R64)  AR64(0, R64(1) << R64(2)); NEXT(3);
+  VMOP(LSHR_R64) AR64(0, R64(1) >> R64(2)); NEXT(3);
+  VMOP(ASHR_R64) AS64(0, S64(1) >> R64(2)); NEXT(3);
+  VMOP(AND_R64)  AR64(0, R64(1) &  R64(2)); NEXT(3);
+  VMOP(OR_R64)   AR64(0, R64(1) |  R64(2)); NEXT(3);
+  VMOP(XOR_R64)  AR64(0, R64(1) ^  R64(2)); NEXT(3);
+
+  VMOP(ADD_R64C)  AR64(0, R64(1) +  UIMM64(2)); NEXT(6);
+  VMOP(SUB_R64C)  AR64(0, R64(1) -  UIMM64(2)); NEXT(6);
+  VMOP(MUL_R64C)  AR64(0, R64(1) *  UIMM64(2)); NEXT(6);
+  VMOP(UDIV_R64C) AR64(0, R64(1) /  UIMM64(2)); NEXT(6);
+  VMOP(SDIV_R64C) AS64(0, S64(1) /  SIMM64(2)); NEXT(6);
+  VMOP(UREM_R64C) AR64(0, R64(1) %  UIMM64(2)); NEXT(6);
+  VMOP(SREM_R64C) AS64(0, S64(1) %  SIMM64(2)); NEXT(6);
+  VMOP(SHL_R64C)  AR64(0, R64(1) << UIMM64(2)); NEXT(6);
+  VMOP(LSHR_R64C) AR64(0, R64(1) >> UIMM64(2)); NEXT(6);
+  VMOP(ASHR_R64C) AS64(0, S64(1) >> UIMM64(2)); NEXT(6);
+  VMOP(AND_R64C)  AR64(0, R64(1) &  UIMM64(2)); NEXT(6);
+  VMOP(OR_R64C)   AR64(0, R64(1) |  UIMM64(2)); NEXT(6);
+  VMOP(XOR_R64C)  AR64(0, R64(1) ^  UIMM64(2)); NEXT(6);
+
+  VMOP(MLA32)     AR32(0, R32(1) * R32(2) + R32(3)); NEXT(4);
+
+  VMOP(ADD_DBL) ADBL(0, RDBL(1) +  RDBL(2)); NEXT(3);
+  VMOP(SUB_DBL) ADBL(0, RDBL(1) -  RDBL(2)); NEXT(3);
+  VMOP(MUL_DBL) ADBL(0, RDBL(1) *  RDBL(2)); NEXT(3);
+  VMOP(DIV_DBL) ADBL(0, RDBL(1) /  RDBL(2)); NEXT(3);
+
+  VMOP(ADD_DBLC) ADBL(0, RDBL(1) +  IMMDBL(2)); NEXT(6);
+  VMOP(SUB_DBLC) ADBL(0, RDBL(1) -  IMMDBL(2)); NEXT(6);
+  VMOP(MUL_DBLC) ADBL(0, RDBL(1) *  IMMDBL(2)); NEXT(6);
+  VMOP(DIV_DBLC) ADBL(0, RDBL(1) /  IMMDBL(2)); NEXT(6);
+
+  VMOP(ADD_FLT) AFLT(0, RFLT(1) +  RFLT(2)); NEXT(3);
+  VMOP(SUB_FLT) AFLT(0, RFLT(1) -  RFLT(2)); NEXT(3);
+  VMOP(MUL_FLT) AFLT(0, RFLT(1) *  RFLT(2)); NEXT(3);
+  VMOP(DIV_FLT) AFLT(0, RFLT(1) /  RFLT(2)); NEXT(3);
+
+  VMOP(ADD_FLTC) AFLT(0, RFLT(1) +  IMMFLT(2)); NEXT(4);
+  VMOP(SUB_FLTC) AFLT(0, RFLT(1) -  IMMFLT(2)); NEXT(4);
+  VMOP(MUL_FLTC) AFLT(0, RFLT(1) *  IMMFLT(2)); NEXT(4);
+  VMOP(DIV_FLTC) AFLT(0, RFLT(1) /  IMMFLT(2)); NEXT(4);
+
+    // Integer compare
+
+  VMOP(EQ8)    AR32(0, R8(1) == R8(2)); NEXT(3);
+  VMOP(NE8)    AR32(0, R8(1) != R8(2)); NEXT(3);
+  VMOP(UGT8)   AR32(0, R8(1) >  R8(2)); NEXT(3);
+  VMOP(UGE8)   AR32(0, R8(1) >= R8(2)); NEXT(3);
+  VMOP(ULT8)   AR32(0, R8(1) <  R8(2)); NEXT(3);
+  VMOP(ULE8)   AR32(0, R8(1) <= R8(2)); NEXT(3);
+  VMOP(SGT8)   AR32(0, S8(1) >  S8(2)); NEXT(3);
+  VMOP(SGE8)   AR32(0, S8(1) >= S8(2)); NEXT(3);
+  VMOP(SLT8)   AR32(0, S8(1) <  S8(2)); NEXT(3);
+  VMOP(SLE8)   AR32(0, S8(1) <= S8(2)); NEXT(3);
+
+  VMOP(EQ8_C)  AR32(0, R8(1) == UIMM8(2)); NEXT(3);
+  VMOP(NE8_C)  AR32(0, R8(1) != UIMM8(2)); NEXT(3);
+  VMOP(UGT8_C) AR32(0, R8(1) >  UIMM8(2)); NEXT(3);
+  VMOP(UGE8_C) AR32(0, R8(1) >= UIMM8(2)); NEXT(3);
+  VMOP(ULT8_C) AR32(0, R8(1) <  UIMM8(2)); NEXT(3);
+  VMOP(ULE8_C) AR32(0, R8(1) <= UIMM8(2)); NEXT(3);
+  VMOP(SGT8_C) AR32(0, S8(1) >  SIMM8(2)); NEXT(3);
+  VMOP(SGE8_C) AR32(0, S8(1) >= SIMM8(2)); NEXT(3);
+  VMOP(SLT8_C) AR32(0, S8(1) <  SIMM8(2)); NEXT(3);
+  VMOP(SLE8_C) AR32(0, S8(1) <= SIMM8(2)); NEXT(3);
+
+  VMOP(EQ16)    AR32(0, R16(1) == R16(2)); NEXT(3);
+  VMOP(NE16)    AR32(0, R16(1) != R16(2)); NEXT(3);
+  VMOP(UGT16)   AR32(0, R16(1) >  R16(2)); NEXT(3);
+  VMOP(UGE16)   AR32(0, R16(1) >= R16(2)); NEXT(3);
+  VMOP(ULT16)   AR32(0, R16(1) <  R16(2)); NEXT(3);
+  VMOP(ULE16)   AR32(0, R16(1) <= R16(2)); NEXT(3);
+  VMOP(SGT16)   AR32(0, S16(1) >  S16(2)); NEXT(3);
+  VMOP(SGE16)   AR32(0, S16(1) >= S16(2)); NEXT(3);
+  VMOP(SLT16)   AR32(0, S16(1) <  S16(2)); NEXT(3);
+  VMOP(SLE16)   AR32(0, S16(1) <= S16(2)); NEXT(3);
+
+  VMOP(EQ16_C)  AR32(0, R16(1) == UIMM16(2)); NEXT(3);
+  VMOP(NE16_C)  AR32(0, R16(1) != UIMM16(2)); NEXT(3);
+  VMOP(UGT16_C) AR32(0, R16(1) >  UIMM16(2)); NEXT(3);
+  VMOP(UGE16_C) AR32(0, R16(1) >= UIMM16(2)); NEXT(3);
+  VMOP(ULT16_C) AR32(0, R16(1) <  UIMM16(2)); NEXT(3);
+  VMOP(ULE16_C) AR32(0, R16(1) <= UIMM16(2)); NEXT(3);
+  VMOP(SGT16_C) AR32(0, S16(1) >  SIMM16(2)); NEXT(3);
+  VMOP(SGE16_C) AR32(0, S16(1) >= SIMM16(2)); NEXT(3);
+  VMOP(SLT16_C) AR32(0, S16(1) <  SIMM16(2)); NEXT(3);
+  VMOP(SLE16_C) AR32(0, S16(1) <= SIMM16(2)); NEXT(3);
+
+  VMOP(EQ32)    AR32(0, R32(1) == R32(2)); NEXT(3);
+  VMOP(NE32)    AR32(0, R32(1) != R32(2)); NEXT(3);
+  VMOP(UGT32)   AR32(0, R32(1) >  R32(2)); NEXT(3);
+  VMOP(UGE32)   AR32(0, R32(1) >= R32(2)); NEXT(3);
+  VMOP(ULT32)   AR32(0, R32(1) <  R32(2)); NEXT(3);
+  VMOP(ULE32)   AR32(0, R32(1) <= R32(2)); NEXT(3);
+  VMOP(SGT32)   AR32(0, S32(1) >  S32(2)); NEXT(3);
+  VMOP(SGE32)   AR32(0, S32(1) >= S32(2)); NEXT(3);
+  VMOP(SLT32)   AR32(0, S32(1) <  S32(2)); NEXT(3);
+  VMOP(SLE32)   AR32(0, S32(1) <= S32(2)); NEXT(3);
+
+  VMOP(EQ32_C)  AR32(0, R32(1) == UIMM32(2)); NEXT(4);
+  VMOP(NE32_C)  AR32(0, R32(1) != UIMM32(2)); NEXT(4);
+  VMOP(UGT32_C) AR32(0, R32(1) >  UIMM32(2)); NEXT(4);
+  VMOP(UGE32_C) AR32(0, R32(1) >= UIMM32(2)); NEXT(4);
+  VMOP(ULT32_C) AR32(0, R32(1) <  UIMM32(2)); NEXT(4);
+  VMOP(ULE32_C) AR32(0, R32(1) <= UIMM32(2)); NEXT(4);
+  VMOP(SGT32_C) AR32(0, S32(1) >  SIMM32(2)); NEXT(4);
+  VMOP(SGE32_C) AR32(0, S32(1) >= SIMM32(2)); NEXT(4);
+  VMOP(SLT32_C) AR32(0, S32(1) <  SIMM32(2)); NEXT(4);
+  VMOP(SLE32_C) AR32(0, S32(1) <= SIMM32(2)); NEXT(4);
+
+  VMOP(EQ64)    AR32(0, R64(1) == R64(2)); NEXT(3);
+  VMOP(NE64)    AR32(0, R64(1) != R64(2)); NEXT(3);
+  VMOP(UGT64)   AR32(0, R64(1) >  R64(2)); NEXT(3);
+  VMOP(UGE64)   AR32(0, R64(1) >= R64(2)); NEXT(3);
+  VMOP(ULT64)   AR32(0, R64(1) <  R64(2)); NEXT(3);
+  VMOP(ULE64)   AR32(0, R64(1) <= R64(2)); NEXT(3);
+  VMOP(SGT64)   AR32(0, S64(1) >  S64(2)); NEXT(3);
+  VMOP(SGE64)   AR32(0, S64(1) >= S64(2)); NEXT(3);
+  VMOP(SLT64)   AR32(0, S64(1) <  S64(2)); NEXT(3);
+  VMOP(SLE64)   AR32(0, S64(1) <= S64(2)); NEXT(3);
+
+  VMOP(EQ64_C)  AR32(0, R64(1) == UIMM64(2)); NEXT(6);
+  VMOP(NE64_C)  AR32(0, R64(1) != UIMM64(2)); NEXT(6);
+  VMOP(UGT64_C) AR32(0, R64(1) >  UIMM64(2)); NEXT(6);
+  VMOP(UGE64_C) AR32(0, R64(1) >= UIMM64(2)); NEXT(6);
+  VMOP(ULT64_C) AR32(0, R64(1) <  UIMM64(2)); NEXT(6);
+  VMOP(ULE64_C) AR32(0, R64(1) <= UIMM64(2)); NEXT(6);
+  VMOP(SGT64_C) AR32(0, S64(1) >  SIMM64(2)); NEXT(6);
+  VMOP(SGE64_C) AR32(0, S64(1) >= SIMM64(2)); NEXT(6);
+  VMOP(SLT64_C) AR32(0, S64(1) <  SIMM64(2)); NEXT(6);
+  VMOP(SLE64_C) AR32(0, S64(1) <= SIMM64(2)); NEXT(6);
+
+
+  VMOP(OEQ_DBL) AR32(0, RDBL(1) == RDBL(2)); NEXT(3);
+  VMOP(OGT_DBL) AR32(0, RDBL(1) >  RDBL(2)); NEXT(3);
+  VMOP(OGE_DBL) AR32(0, RDBL(1) >= RDBL(2)); NEXT(3);
+  VMOP(OLT_DBL) AR32(0, RDBL(1) <  RDBL(2)); NEXT(3);
+  VMOP(OLE_DBL) AR32(0, RDBL(1) <= RDBL(2)); NEXT(3);
+
+  VMOP(ONE_DBL) AR32(0, !__builtin_isnan(RDBL(1))
+                      && !__builtin_isnan(RDBL(2))
+                      && RDBL(1) != RDBL(2)); NEXT(3);
+
+  VMOP(ORD_DBL) AR32(0, !__builtin_isnan(RDBL(1))
+                      && !__builtin_isnan(RDBL(2))); NEXT(3);
+
+  VMOP(UNO_DBL) AR32(0, __builtin_isnan(RDBL(1))
+                      || __builtin_isnan(RDBL(1))); NEXT(3);
+
+  VMOP(UEQ_DBL) AR32(0, __builtin_isnan(RDBL(1))
+                      || __builtin_isnan(RDBL(2))
+                      || RDBL(1) == RDBL(2)); NEXT(3);
+
+  VMOP(UGT_DBL) AR32(0, __builtin_isnan(RDBL(1))
+                      || __builtin_isnan(RDBL(2))
+                      || RDBL(1) >  RDBL(2)); NEXT(3);
+
+  VMOP(UGE_DBL) AR32(0, __builtin_isnan(RDBL(1))
+                      || __builtin_isnan(RDBL(2))
+                      || RDBL(1) <= RDBL(2)); NEXT(3);
+
+  VMOP(ULT_DBL) AR32(0, __builtin_isnan(RDBL(1))
+                      || __builtin_isnan(RDBL(2))
+                      || RDBL(1) <  RDBL(2)); NEXT(3);
+
+  VMOP(ULE_DBL) AR32(0, __builtin_isnan(RDBL(1))
+                      || __builtin_isnan(RDBL(2))
+                      || RDBL(1) <= RDBL(2)); NEXT(3);
+
+  VMOP(UNE_DBL) AR32(0, RDBL(1) != RDBL(2)); NEXT(3);
+
+
+
+  VMOP(OEQ_DBL_C) AR32(0, RDBL(1) == IMMDBL(2)); NEXT(6);
+  VMOP(OGT_DBL_C) AR32(0, RDBL(1) >  IMMDBL(2)); NEXT(6);
+  VMOP(OGE_DBL_C) AR32(0, RDBL(1) >= IMMDBL(2)); NEXT(6);
+  VMOP(OLT_DBL_C) AR32(0, RDBL(1) <  IMMDBL(2)); NEXT(6);
+  VMOP(OLE_DBL_C) AR32(0, RDBL(1) <= IMMDBL(2)); NEXT(6);
+
+  VMOP(ONE_DBL_C) AR32(0, !__builtin_isnan(RDBL(1)) &&
+                        RDBL(1) != IMMDBL(2)); NEXT(6);
+  VMOP(ORD_DBL_C) AR32(0, !__builtin_isnan(RDBL(1))); NEXT(6);
+  VMOP(UNO_DBL_C) AR32(0,  __builtin_isnan(RDBL(1))); NEXT(6);
+  VMOP(UEQ_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
+                        RDBL(1) == IMMDBL(2)); NEXT(6);
+  VMOP(UGT_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
+                        RDBL(1) >  IMMDBL(2)); NEXT(6);
+  VMOP(UGE_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
+                        RDBL(1) <= IMMDBL(2)); NEXT(6);
+  VMOP(ULT_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
+                        RDBL(1) <  IMMDBL(2)); NEXT(6);
+  VMOP(ULE_DBL_C) AR32(0, __builtin_isnan(RDBL(1)) ||
+                        RDBL(1) <= IMMDBL(2)); NEXT(6);
+  VMOP(UNE_DBL_C) AR32(0, RDBL(1) != IMMDBL(2)); NEXT(6);
+
+
+
+  VMOP(OEQ_FLT) AR32(0, RFLT(1) == RFLT(2)); NEXT(3);
+  VMOP(OGT_FLT) AR32(0, RFLT(1) >  RFLT(2)); NEXT(3);
+  VMOP(OGE_FLT) AR32(0, RFLT(1) >= RFLT(2)); NEXT(3);
+  VMOP(OLT_FLT) AR32(0, RFLT(1) <  RFLT(2)); NEXT(3);
+  VMOP(OLE_FLT) AR32(0, RFLT(1) <= RFLT(2)); NEXT(3);
+
+  VMOP(ONE_FLT) AR32(0, !__builtin_isnan(RFLT(1))
+                      && !__builtin_isnan(RFLT(2))
+                      && RFLT(1) != RFLT(2)); NEXT(3);
+
+  VMOP(ORD_FLT) AR32(0, !__builtin_isnan(RFLT(1))
+                      && !__builtin_isnan(RFLT(2))); NEXT(3);
+
+  VMOP(UNO_FLT) AR32(0, __builtin_isnan(RFLT(1))
+                      || __builtin_isnan(RFLT(1))); NEXT(3);
+
+  VMOP(UEQ_FLT) AR32(0, __builtin_isnan(RFLT(1))
+                      || __builtin_isnan(RFLT(2))
+                      || RFLT(1) == RFLT(2)); NEXT(3);
+
+  VMOP(UGT_FLT) AR32(0, __builtin_isnan(RFLT(1))
+                      || __builtin_isnan(RFLT(2))
+                      || RFLT(1) >  RFLT(2)); NEXT(3);
+
+  VMOP(UGE_FLT) AR32(0, __builtin_isnan(RFLT(1))
+                      || __builtin_isnan(RFLT(2))
+                      || RFLT(1) <= RFLT(2)); NEXT(3);
+
+  VMOP(ULT_FLT) AR32(0, __builtin_isnan(RFLT(1))
+                      || __builtin_isnan(RFLT(2))
+                      || RFLT(1) <  RFLT(2)); NEXT(3);
+
+  VMOP(ULE_FLT) AR32(0, __builtin_isnan(RFLT(1))
+                      || __builtin_isnan(RFLT(2))
+                      || RFLT(1) <= RFLT(2)); NEXT(3);
+
+  VMOP(UNE_FLT) AR32(0, RFLT(1) != RFLT(2)); NEXT(3);
+
+
+
+  VMOP(OEQ_FLT_C) AR32(0, RFLT(1) == IMMFLT(2)); NEXT(4);
+  VMOP(OGT_FLT_C) AR32(0, RFLT(1) >  IMMFLT(2)); NEXT(4);
+  VMOP(OGE_FLT_C) AR32(0, RFLT(1) >= IMMFLT(2)); NEXT(4);
+  VMOP(OLT_FLT_C) AR32(0, RFLT(1) <  IMMFLT(2)); NEXT(4);
+  VMOP(OLE_FLT_C) AR32(0, RFLT(1) <= IMMFLT(2)); NEXT(4);
+
+  VMOP(ONE_FLT_C) AR32(0, !__builtin_isnan(RFLT(1)) &&
+                        RFLT(1) != IMMFLT(2)); NEXT(4);
+  VMOP(ORD_FLT_C) AR32(0, !__builtin_isnan(RFLT(1))); NEXT(4);
+  VMOP(UNO_FLT_C) AR32(0,  __builtin_isnan(RFLT(1))); NEXT(4);
+  VMOP(UEQ_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
+                        RFLT(1) == IMMFLT(2)); NEXT(4);
+  VMOP(UGT_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
+                        RFLT(1) >  IMMFLT(2)); NEXT(4);
+  VMOP(UGE_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
+                        RFLT(1) <= IMMFLT(2)); NEXT(4);
+  VMOP(ULT_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
+                        RFLT(1) <  IMMFLT(2)); NEXT(4);
+  VMOP(ULE_FLT_C) AR32(0, __builtin_isnan(RFLT(1)) ||
+                        RFLT(1) <= IMMFLT(2)); NEXT(4);
+  VMOP(UNE_FLT_C) AR32(0, RFLT(1) != IMMFLT(2)); NEXT(4);
+
+
+  VMOP(ABS)       AR32(0, abs(S32(1)));  NEXT(2);
+
+  VMOP(FLOOR)     ADBL(0, floor(RDBL(1)));          NEXT(2);
+  VMOP(SIN)       ADBL(0,   sin(RDBL(1)));          NEXT(2);
+  VMOP(COS)       ADBL(0,   cos(RDBL(1)));          NEXT(2);
+  VMOP(POW)       ADBL(0,   pow(RDBL(1), RDBL(2))); NEXT(3);
+  VMOP(FABS)      ADBL(0,  fabs(RDBL(1)));          NEXT(2);
+  VMOP(FMOD)      ADBL(0,  fmod(RDBL(1), RDBL(2))); NEXT(3);
+  VMOP(LOG10)     ADBL(0, log10(RDBL(1)));          NEXT(2);
+
+  VMOP(FLOORF)    AFLT(0, floorf(RFLT(1)));          NEXT(2);
+  VMOP(SINF)      AFLT(0,   sinf(RFLT(1)));          NEXT(2);
+  VMOP(COSF)      AFLT(0,   cosf(RFLT(1)));          NEXT(2);
+  VMOP(POWF)      AFLT(0,   powf(RFLT(1), RFLT(2))); NEXT(3);
+  VMOP(FABSF)     AFLT(0,  fabsf(RFLT(1)));          NEXT(2);
+  VMOP(FMODF)     AFLT(0,  fmodf(RFLT(1), RFLT(2))); NEXT(3);
+  VMOP(LOG10F)    AFLT(0, log10f(RFLT(1)));          NEXT(2);
+
+    // ---
+
+  VMOP(LOAD8)        LOAD8(0, R32(1));             NEXT(2);
+  VMOP(LOAD8_G)      LOAD8(0, SIMM32(1));          NEXT(3);
+
+  VMOP(LOAD8_OFF)
+    LOAD8(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD8_ZEXT_32_OFF)
+    LOAD8_ZEXT_32(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD8_SEXT_32_OFF)
+    LOAD8_SEXT_32(0, R32(1) + SIMM16(2));
+    NEXT(3);
+
+  VMOP(LOAD8_ROFF)
+    LOAD8(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD8_ZEXT_32_ROFF)
+    LOAD8_ZEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD8_SEXT_32_ROFF)
+    LOAD8_SEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+
+
+  VMOP(STORE8_G)     STORE8(SIMM32(1), R32(0));             NEXT(3);
+  VMOP(STORE8C_OFF)  STORE8(R32(0) + SIMM16(1), SIMM8(2));  NEXT(3);
+  VMOP(STORE8_OFF)   STORE8(R32(0) + SIMM16(2), R8(1));     NEXT(3);
+  VMOP(STORE8)       STORE8(R32(0),             R8(1));     NEXT(2);
+
+    // ---
+
+  VMOP(LOAD16)       LOAD16(0, R32(1));             NEXT(2);
+  VMOP(LOAD16_OFF)
+    LOAD16(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD16_ZEXT_32_OFF)
+    LOAD16_ZEXT_32(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD16_SEXT_32_OFF)
+    LOAD16_SEXT_32(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD16_ROFF)
+    LOAD16(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD16_ZEXT_32_ROFF)
+    LOAD16_ZEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD16_SEXT_32_ROFF)
+    LOAD16_SEXT_32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD16_G)     LOAD16(0, SIMM32(1));          NEXT(3);
+
+  VMOP(STORE16_G)    STORE16(SIMM32(1), R32(0));             NEXT(3);
+  VMOP(STORE16C_OFF) STORE16(R32(0) + SIMM16(1), SIMM16(2)); NEXT(3);
+  VMOP(STORE16_OFF)  STORE16(R32(0) + SIMM16(2), R16(1));    NEXT(3);
+  VMOP(STORE16)      STORE16(R32(0),             R16(1));    NEXT(2);
+
+    // ---
+
+  VMOP(LOAD32)     LOAD32(0, R32(1));                NEXT(2);
+  VMOP(LOAD32_OFF)
+    LOAD32(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD32_ROFF)
+    LOAD32(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD32_G)   LOAD32(0, SIMM32(1));             NEXT(3);
+
+  VMOP(STORE32_G)    STORE32(SIMM32(1), R32(0));             NEXT(3);
+  VMOP(STORE32C_OFF) STORE32(R32(0) + SIMM16(1), UIMM32(2)); NEXT(4);
+  VMOP(STORE32_OFF)  STORE32(R32(0) + SIMM16(2), R32(1));    NEXT(3);
+  VMOP(STORE32)      STORE32(R32(0),             R32(1));    NEXT(2);
+
+    // ---
+
+  VMOP(LOAD64)     LOAD64(0, R32(1)            ); NEXT(2);
+  VMOP(LOAD64_OFF)
+    LOAD64(0, R32(1) + SIMM16(2));
+    NEXT(3);
+  VMOP(LOAD64_ROFF)
+    LOAD64(0, R32(1) + SIMM16(2) + R32(3) * SIMM16(4));
+    NEXT(5);
+  VMOP(LOAD64_G)   LOAD64(0, SIMM32(1)         ); NEXT(3);
+
+  VMOP(STORE64_G)    STORE64(SIMM32(1),          R64(0));    NEXT(3);
+  VMOP(STORE64C_OFF) STORE64(R32(0) + SIMM16(1), UIMM64(2)); NEXT(6);
+  VMOP(STORE64_OFF)  STORE64(R32(0) + SIMM16(2), R64(1));    NEXT(3);
+  VMOP(STORE64)      STORE64(R32(0),             R64(1));    NEXT(2);
+
+
+  VMOP(MOV8)    AR8(0,  R8(1));   NEXT(2);
+  VMOP(MOV32)   AR32(0, R32(1));   NEXT(2);
+  VMOP(MOV64)   AR64(0, R64(1));   NEXT(2);
+
+  VMOP(MOV8_C)  AR8(0,  UIMM8(1)); NEXT(2);
+  VMOP(MOV16_C) AR16(0, UIMM16(1)); NEXT(2);
+  VMOP(MOV32_C) AR32(0, UIMM32(1)); NEXT(3);
+  VMOP(MOV64_C) AR64(0, UIMM64(1)); NEXT(5);
+
+  VMOP(LEA_R32_SHL)     AR32(0, R32(1) + (R32(2) << UIMM16(3))); NEXT(4);
+  VMOP(LEA_R32_SHL2)    AR32(0, R32(1) + (R32(2) << 2)); NEXT(3);
+  VMOP(LEA_R32_SHL_OFF) AR32(0, R32(1) + (R32(2) << UIMM16(3)) + SIMM32(4)); NEXT(6);
+  VMOP(LEA_R32_MUL_OFF) AR32(0, R32(1) + R32(2) * UIMM32(3) + SIMM32(5)); NEXT(7);
+
+  VMOP(CAST_1_TRUNC_8)   AR32(0, !!R8(1)); NEXT(2);
+  VMOP(CAST_1_TRUNC_16)   AR32(0, !!R16(1)); NEXT(2);
+
+  VMOP(CAST_8_ZEXT_1)    AR8(0, R32(1)); NEXT(2);
+  VMOP(CAST_8_TRUNC_16)  AR8(0, R16(1)); NEXT(2);
+  VMOP(CAST_8_TRUNC_32)  AR8(0, R32(1)); NEXT(2);
+  VMOP(CAST_8_TRUNC_64)  AR8(0, R64(1)); NEXT(2);
+
+  VMOP(CAST_16_ZEXT_1)   AR16(0, R32(1)); NEXT(2);
+  VMOP(CAST_16_ZEXT_8)   AR16(0, R8(1)); NEXT(2);
+  VMOP(CAST_16_SEXT_8)   AS16(0, S8(1)); NEXT(2);
+  VMOP(CAST_16_TRUNC_32) AR16(0, R32(1)); NEXT(2);
+  VMOP(CAST_16_TRUNC_64) AR16(0, R64(1)); NEXT(2);
+  VMOP(CAST_16_FPTOSI_FLT) AS16(0, RFLT(1)); NEXT(2);
+  VMOP(CAST_16_FPTOUI_FLT) AR16(0, RFLT(1)); NEXT(2);
+  VMOP(CAST_16_FPTOSI_DBL) AS16(0, RDBL(1)); NEXT(2);
+  VMOP(CAST_16_FPTOUI_DBL) AR16(0, RDBL(1)); NEXT(2);
+
+  VMOP(CAST_32_SEXT_1)   AR32(0, R32(1) ? -1 : 0); NEXT(2);
+  VMOP(CAST_32_ZEXT_8)   AR32(0, R8(1)); NEXT(2);
+  VMOP(CAST_32_SEXT_8)   AS32(0, S8(1)); NEXT(2);
+  VMOP(CAST_32_ZEXT_16)  AR32(0, R16(1)); NEXT(2);
+  VMOP(CAST_32_SEXT_16)  AS32(0, S16(1)); NEXT(2);
+  VMOP(CAST_32_TRUNC_64) AR32(0, R64(1)); NEXT(2);
+
+  VMOP(CAST_32_FPTOSI_FLT) AS32(0, RFLT(1)); NEXT(2);
+  VMOP(CAST_32_FPTOUI_FLT) AR32(0, RFLT(1)); NEXT(2);
+  VMOP(CAST_32_FPTOSI_DBL) AS32(0, RDBL(1)); NEXT(2);
+  VMOP(CAST_32_FPTOUI_DBL) AR32(0, RDBL(1)); NEXT(2);
+
+
+  VMOP(CAST_64_ZEXT_1) AR64(0, R32(1)); NEXT(2);
+  VMOP(CAST_64_SEXT_1) AS64(0, R32(1) ? (int64_t)-1LL : 0); NEXT(2);
+  VMOP(CAST_64_ZEXT_8) AR64(0, R8(1)); NEXT(2);
+  VMOP(CAST_64_SEXT_8) AS64(0, S8(1)); NEXT(2);
+  VMOP(CAST_64_ZEXT_16) AR64(0, R16(1)); NEXT(2);
+  VMOP(CAST_64_SEXT_16) AS64(0, S16(1)); NEXT(2);
+  VMOP(CAST_64_ZEXT_32) AR64(0, R32(1)); NEXT(2);
+  VMOP(CAST_64_SEXT_32) AS64(0, S32(1)); NEXT(2);
+  VMOP(CAST_64_FPTOSI_FLT) AS64(0, RFLT(1)); NEXT(2);
+  VMOP(CAST_64_FPTOUI_FLT) AR64(0, RFLT(1)); NEXT(2);
+  VMOP(CAST_64_FPTOSI_DBL) AS64(0, RDBL(1)); NEXT(2);
+  VMOP(CAST_64_FPTOUI_DBL) AR64(0, RDBL(1)); NEXT(2);
+
+  VMOP(CAST_DBL_FPEXT_FLT)   ADBL(0, RFLT(1)); NEXT(2);
+
+  VMOP(CAST_FLT_FPTRUNC_DBL) AFLT(0, RDBL(1)); NEXT(2);
+  VMOP(CAST_FLT_SITOFP_8)    AFLT(0, S8(1)); NEXT(2);
+  VMOP(CAST_FLT_UITOFP_8)    AFLT(0, R8(1)); NEXT(2);
+  VMOP(CAST_FLT_SITOFP_16)   AFLT(0, S16(1)); NEXT(2);
+  VMOP(CAST_FLT_UITOFP_16)   AFLT(0, R16(1)); NEXT(2);
+  VMOP(CAST_FLT_SITOFP_32)   AFLT(0, S32(1)); NEXT(2);
+  VMOP(CAST_FLT_UITOFP_32)   AFLT(0, R32(1)); NEXT(2);
+  VMOP(CAST_FLT_SITOFP_64)   AFLT(0, S64(1)); NEXT(2);
+  VMOP(CAST_FLT_UITOFP_64)   AFLT(0, R64(1)); NEXT(2);
+
+  VMOP(CAST_DBL_SITOFP_8)    ADBL(0, S8(1)); NEXT(2);
+  VMOP(CAST_DBL_UITOFP_8)    ADBL(0, R8(1)); NEXT(2);
+  VMOP(CAST_DBL_SITOFP_16)   ADBL(0, S16(1)); NEXT(2);
+  VMOP(CAST_DBL_UITOFP_16)   ADBL(0, R16(1)); NEXT(2);
+  VMOP(CAST_DBL_SITOFP_32)   ADBL(0, S32(1)); NEXT(2);
+  VMOP(CAST_DBL_UITOFP_32)   ADBL(0, R32(1)); NEXT(2);
+  VMOP(CAST_DBL_SITOFP_64)   ADBL(0, S64(1)); NEXT(2);
+  VMOP(CAST_DBL_UITOFP_64)   ADBL(0, R64(1)); NEXT(2);
+
+
+  VMOP(SELECT8RR) AR8(0, R32(1) ? R8(2)    : R8(3));    NEXT(4);
+  VMOP(SELECT8RC) AR8(0, R32(1) ? R8(2)    : UIMM8(3)); NEXT(4);
+  VMOP(SELECT8CR) AR8(0, R32(1) ? UIMM8(3) : R8(2));    NEXT(4);
+  VMOP(SELECT8CC) AR8(0, R32(1) ? UIMM8(2) : UIMM8(4)); NEXT(4);
+
+  VMOP(SELECT16RR) AR16(0, R32(1) ? R16(2)    : R16(3));    NEXT(4);
+  VMOP(SELECT16RC) AR16(0, R32(1) ? R16(2)    : UIMM16(3)); NEXT(4);
+  VMOP(SELECT16CR) AR16(0, R32(1) ? UIMM16(3) : R16(2));    NEXT(4);
+  VMOP(SELECT16CC) AR16(0, R32(1) ? UIMM16(2) : UIMM16(4)); NEXT(4);
+
+  VMOP(SELECT32RR) AR32(0, R32(1) ? R32(2)    : R32(3));    NEXT(4);
+  VMOP(SELECT32RC) AR32(0, R32(1) ? R32(2)    : UIMM32(3)); NEXT(5);
+  VMOP(SELECT32CR) AR32(0, R32(1) ? UIMM32(3) : R32(2));    NEXT(5);
+  VMOP(SELECT32CC) AR32(0, R32(1) ? UIMM32(2) : UIMM32(4)); NEXT(6);
+
+  VMOP(SELECT64RR) AR64(0, R32(1) ? R64(2)    : R64(3));    NEXT(4);
+  VMOP(SELECT64RC) AR64(0, R32(1) ? R64(2)    : UIMM64(3)); NEXT(7);
+  VMOP(SELECT64CR) AR64(0, R32(1) ? UIMM64(3) : R64(2));    NEXT(7);
+  VMOP(SELECT64CC) AR64(0, R32(1) ? UIMM64(2) : UIMM64(6)); NEXT(10);
+
+
+  VMOP(ALLOCA) {
+      allocaptr = VMIR_ALIGN(allocaptr, UIMM16(1));
+      AR32(0, allocaptr);
+      allocaptr += UIMM32(2);
+      NEXT(4);
+    }
+
+  VMOP(ALLOCAD) {
+      allocaptr = VMIR_ALIGN(allocaptr, UIMM16(1));
+      uint32_t r = allocaptr;
+      allocaptr += UIMM32(3) * R32(2);
+      AR32(0, r);
+      NEXT(5);
+    }
+
+  VMOP(STACKSHRINK)
+    allocaptr -= UIMM32(0);
+    NEXT(2);
+
+  VMOP(STACKSAVE)
+    AR32(0, allocaptr);
+    NEXT(1);
+
+  VMOP(STACKRESTORE)
+    allocaptr = R32(0);
+    NEXT(1);
+
+  VMOP(STACKCOPYR)
+    allocaptr = VMIR_ALIGN(allocaptr, 4);
+    AR32(0, allocaptr);
+    memcpy(MEM(allocaptr), MEM(R32(1)), UIMM32(2));
+    allocaptr += UIMM32(2);
+    NEXT(4);
+
+  VMOP(STACKCOPYC)
+    allocaptr = VMIR_ALIGN(allocaptr, 4);
+    AR32(0, allocaptr);
+    memcpy(MEM(allocaptr), MEM(UIMM32(1)), UIMM32(3));
+    allocaptr += UIMM32(3);
+    NEXT(5);
+
+
+  VMOP(MEMCPY) {
+      uint32_t r = R32(1);
+      memcpy(MEM(R32(1)), MEM(R32(2)), R32(3));
+      AR32(0, r);
+      NEXT(4);
+    }
+
+  VMOP(MEMSET) {
+      uint32_t r = R32(1);
+      memset(MEM(R32(1)), R32(2), R32(3));
+      AR32(0, r);
+      NEXT(4);
+    }
+
+  VMOP(MEMMOVE) {
+      uint32_t r = R32(1);
+      memmove(MEM(R32(1)), MEM(R32(2)), R32(3));
+      AR32(0, r);
+      NEXT(4);
+    }
+
+  VMOP(LLVM_MEMCPY)
+    memcpy(MEM(R32(0)), MEM(R32(1)), R32(2)); NEXT(3);
+  VMOP(LLVM_MEMSET)
+    memset(MEM(R32(0)), R8(1), R32(2)); NEXT(3);
+  VMOP(LLVM_MEMSET64)
+    memset(MEM(R32(0)), R8(1), R64(2)); NEXT(3);
+
+  VMOP(MEMCMP)
+    AR32(0, memcmp(MEM(R32(1)), MEM(R32(2)), R32(3))); NEXT(4);
+
+  VMOP(STRCPY) {
+      uint32_t r = R32(1);
+      strcpy(MEM(R32(1)), MEM(R32(2)));
+      AR32(0, r);
+      NEXT(3);
+    }
+
+  VMOP(STRNCPY) {
+      uint32_t r = R32(1);
+      strncpy(MEM(R32(1)), MEM(R32(2)), R32(3));
+      AR32(0, r);
+      NEXT(4);
+    }
+
+  VMOP(STRCMP)
+    AR32(0, strcmp(MEM(R32(1)), MEM(R32(2)))); NEXT(3);
+  VMOP(STRNCMP)
+    AR32(0, strncmp(MEM(R32(1)), MEM(R32(2)), R32(3))); NEXT(4);
+  VMOP(STRCHR)
+    AR32(0, vm_strchr(R32(1), R32(2), mem)); NEXT(3);
+  VMOP(STRRCHR)
+    AR32(0, vm_strrchr(R32(1), R32(2), mem)); NEXT(3);
+  VMOP(STRLEN)
+    AR32(0, strlen(MEM(R32(1)))); NEXT(2);
+
+  VMOP(VAARG32)
+    AR32(0, vm_vaarg32(rf, MEM(R32(1)))); NEXT(2);
+
+  VMOP(VAARG64)
+    AR64(0, vm_vaarg64(rf, MEM(R32(1)))); NEXT(2);
+
+  VMOP(VASTART)
+    *(void **)MEM(R32(0)) = rf + S32(1);
+    NEXT(2);
+
+  VMOP(VACOPY)
+    *(void **)MEM(R32(0)) = *(void **)MEM(R32(1));
+    NEXT(2);
+
+  VMOP(CTZ32) AR32(0, __builtin_ctz(R32(1))); NEXT(2);
+  VMOP(CLZ32) AR32(0, __builtin_clz(R32(1))); NEXT(2);
+  VMOP(POP32) AR32(0, __builtin_popcount(R32(1))); NEXT(2);
+
+  VMOP(CTZ64) AR64(0, __builtin_ctzll(R64(1))); NEXT(2);
+  VMOP(CLZ64) AR64(0, __builtin_clzll(R64(1))); NEXT(2);
+  VMOP(POP64) AR64(0, __builtin_popcountll(R64(1))); NEXT(2);
+
+  VMOP(UADDO32)
+  {
+    uint32_t r;
+#if __has_builtin(__builtin_uadd_overflow)
+    AR32(1, __builtin_uadd_overflow(R32(2), R32(3), &r));
+#else
+    uint32_t a = R32(2);
+    uint32_t b = R32(3);
+    AR32(1, UINT32_MAX - a < b);
+    r = a + b;
+#endif
+    AR32(0, r);
+    NEXT(4);
+  }
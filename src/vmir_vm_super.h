@@ -0,0 +1,14 @@
+/* Generated by vmir_supergen, do not edit */
+
+#if defined(VM_SUPER_ENUM)
+
+
+#elif defined(VM_SUPER_RESOLVE)
+
+
+#elif defined(VM_SUPER_HANDLERS)
+
+#elif defined(VM_SUPER_PATTERNS)
+
+
+#endif
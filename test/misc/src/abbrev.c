@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Records that clang writes with abbreviations: C strings made only of
+ * char6 characters, of 7 bit and of 8 bit characters, symbol names of
+ * each kind, and loads, casts, binary operators with and without flags,
+ * GEPs and returns in all the shapes the decoders are specialized for
+ */
+
+const char s_char6[] = "abcXYZ019._";
+const char s_7bit[] = "Hello, world! {~}\t\n";
+const char s_8bit[] = "\xe5\xe4\xf6\x80\xff";
+const char s_zeros[6] = { 'a', 0, 'b', 0, 'c', 0 };
+
+// Names with characters outside the char6 set
+int name_with_7bit_chars$ = 3;
+int NameInChar6Only_09 = 4;
+
+struct pair {
+  uint8_t a;
+  int64_t b;
+};
+
+struct pair pairs[3] = { { 1, -1 }, { 200, 1ll << 40 }, { 255, 0 } };
+
+volatile int one = 1;
+
+
+static int __attribute__((noinline))
+ops(int a, unsigned int b)
+{
+  int r = a + 1;
+  r = r * a;
+  r -= (int)(b / 4);
+  r += (int)(b >> 9) + a * 4;
+  r ^= (int)(b & 0x55);
+  r += (int8_t)a + (uint16_t)b + (int)(float)a;
+  r += (int)(double)(b & 0xfff);
+  return r;
+}
+
+
+static int64_t __attribute__((noinline))
+walk(struct pair *p, int n)
+{
+  int64_t s = 0;
+  for(int i = 0; i < n; i++)
+    s += p[i].a + p[i].b;
+  return s;
+}
+
+
+int main(void)
+{
+  if(strlen(s_char6) != 11 || strcmp(s_char6 + 6, "019._"))
+    abort();
+  if(strlen(s_7bit) != 19 || s_7bit[17] != '\t' || s_7bit[18] != '\n')
+    abort();
+  if(strlen(s_8bit) != 5 || (uint8_t)s_8bit[0] != 0xe5 ||
+     (uint8_t)s_8bit[4] != 0xff)
+    abort();
+  if(s_zeros[1] || s_zeros[4] != 'c' || strlen(s_zeros + 2) != 1)
+    abort();
+  if(name_with_7bit_chars$ + NameInChar6Only_09 != 7)
+    abort();
+  if(ops(7 * one, 100) != 341 || ops(-3 * one, 0xffffffff) != -1065283673)
+    abort();
+  if(walk(pairs, 3 * one) != (1ll << 40) + 455)
+    abort();
+  exit(0);
+}
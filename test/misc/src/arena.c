@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * IR allocations of every size: a switch whose case list (and, when
+ * optimized, the phi joining its cases) is larger than an arena chunk,
+ * next to many tiny functions that reuse the chunks released by each
+ * other. Run with -T to have several threads share the chunk pool
+ */
+
+#define C(k)      case k: r = x * (k) + ((k) ^ 0x5a5); break;
+#define C8(k)     C(k) C(k + 1) C(k + 2) C(k + 3) \
+                  C(k + 4) C(k + 5) C(k + 6) C(k + 7)
+#define C64(k)    C8(k) C8(k + 8) C8(k + 16) C8(k + 24) \
+                  C8(k + 32) C8(k + 40) C8(k + 48) C8(k + 56)
+#define C512(k)   C64(k) C64(k + 64) C64(k + 128) C64(k + 192) \
+                  C64(k + 256) C64(k + 320) C64(k + 384) C64(k + 448)
+
+#define NUM_CASES 4096
+
+
+static uint32_t __attribute__((noinline))
+wide_switch(uint32_t k, uint32_t x)
+{
+  uint32_t r;
+  switch(k) {
+    C512(0) C512(512) C512(1024) C512(1536)
+    C512(2048) C512(2560) C512(3072) C512(3584)
+  default:
+    r = 0;
+    break;
+  }
+  return r;
+}
+
+
+#define F(n)                                                  \
+  static int __attribute__((noinline)) f##n(int x)            \
+  {                                                           \
+    return x * (n) + 1;                                       \
+  }
+
+F(0) F(1) F(2) F(3) F(4) F(5) F(6) F(7) F(8) F(9)
+F(10) F(11) F(12) F(13) F(14) F(15) F(16) F(17) F(18) F(19)
+
+static int (*fs[])(int) = {
+  f0, f1, f2, f3, f4, f5, f6, f7, f8, f9,
+  f10, f11, f12, f13, f14, f15, f16, f17, f18, f19,
+};
+
+
+int main(void)
+{
+  for(uint32_t k = 0; k < NUM_CASES + 10; k++) {
+    const uint32_t x = k * 3 + 1;
+    const uint32_t expect = k < NUM_CASES ? x * k + (k ^ 0x5a5) : 0;
+    if(wide_switch(k, x) != expect)
+      abort();
+  }
+
+  int s = 0;
+  for(int i = 0; i < 20; i++)
+    s += fs[i](i);
+  if(s != 2490)
+    abort();
+  exit(0);
+}
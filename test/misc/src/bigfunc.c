@@ -0,0 +1,72 @@
+#include <stdlib.h>
+
+/*
+ * A function whose basic blocks are further apart than a 16 bit branch
+ * offset can reach, so branches to them go through veneers
+ */
+
+#define S(c, k)   acc = acc * 3 + (c) + (k); acc ^= acc >> 7;
+#define R2(c, k)    S(c, k)         S(c, (k) + 1)
+#define R8(c, k)    R2(c, k)        R2(c, (k) + 2) \
+                    R2(c, (k) + 4)  R2(c, (k) + 6)
+#define R32(c, k)   R8(c, k)        R8(c, (k) + 8) \
+                    R8(c, (k) + 16) R8(c, (k) + 24)
+#define R128(c, k)  R32(c, k)       R32(c, (k) + 32) \
+                    R32(c, (k) + 64) R32(c, (k) + 96)
+#define R1024(c)    R128(c, 0)      R128(c, 128) \
+                    R128(c, 256)    R128(c, 384) \
+                    R128(c, 512)    R128(c, 640) \
+                    R128(c, 768)    R128(c, 896)
+
+#define NUM_STATEMENTS 1024
+
+static const unsigned int constants[4] = { 11, 2000, 77, 123456 };
+
+
+unsigned int __attribute__((noinline)) big(unsigned int acc, int n)
+{
+  for(int i = 0; i < n; i++) {
+    switch((acc + i) & 3) {
+    case 0:
+      R1024(11);
+      break;
+    case 1:
+      R1024(2000);
+      break;
+    case 2:
+      R1024(77);
+      break;
+    default:
+      R1024(123456);
+      break;
+    }
+    if(acc == 0)
+      return 0;
+  }
+  return acc;
+}
+
+
+unsigned int __attribute__((noinline)) small(unsigned int acc, int n)
+{
+  for(int i = 0; i < n; i++) {
+    const unsigned int c = constants[(acc + i) & 3];
+    for(int k = 0; k < NUM_STATEMENTS; k++) {
+      acc = acc * 3 + c + k;
+      acc ^= acc >> 7;
+    }
+    if(acc == 0)
+      return 0;
+  }
+  return acc;
+}
+
+
+int main(void)
+{
+  for(int n = 1; n < 20; n += 6) {
+    if(big(n, n) != small(n, n))
+      abort();
+  }
+  exit(0);
+}
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Bitcode that makes the reader cross word boundaries at every offset:
+ * large initialized arrays of odd sized elements, values near the
+ * limits of each width and long symbol names. The functions that are
+ * never called still have to be read (or skipped) correctly
+ */
+
+const uint8_t bytes[67] = {
+  1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 121, 98, 219, 61, 24, 85,
+  109, 194, 47, 241, 32, 17, 49, 66, 115, 181, 40, 221, 5, 226, 231, 201,
+  176, 121, 41, 162, 203, 109, 56, 165, 221, 130, 95, 225, 64, 33, 97,
+  130, 227, 101, 72, 173, 245, 162, 151, 57, 208, 9, 217, 226, 187, 157,
+  88, 245, 77,
+};
+
+const int16_t shorts[13] = {
+  -32768, 32767, -1, 0, 1, 255, 256, -256, 4095, -4096, 12345, -12345, 7,
+};
+
+const uint64_t longs[9] = {
+  0, 1, 0xffffffffffffffffull, 0x8000000000000000ull,
+  0x7fffffffffffffffull, 0x00000000ffffffffull, 0x0000000100000000ull,
+  0x0123456789abcdefull, 0xfedcba9876543210ull,
+};
+
+const double doubles[5] = {
+  0.0, -0.0, 1e308, 4.9406564584124654e-324, -3.141592653589793,
+};
+
+
+int __attribute__((noinline))
+a_rather_long_function_name_to_make_the_symbol_table_span_words_0123(int x)
+{
+  return x * 5 + 3;
+}
+
+
+// Never called
+int __attribute__((noinline))
+unused_function(int x)
+{
+  static const char table[] = "padding the function block with data";
+  return table[x & 31] + x * x * x;
+}
+
+
+static uint32_t
+checksum(const void *p, size_t len)
+{
+  const uint8_t *b = p;
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < len; i++)
+    h = (h ^ b[i]) * 16777619u;
+  return h;
+}
+
+
+int main(void)
+{
+  uint32_t s = 0;
+  for(int i = 0; i < sizeof(bytes); i++)
+    s = s * 31 + bytes[i];
+  if(s != 0x5e50b975)
+    abort();
+
+  uint32_t t = 0;
+  for(int i = 0; i < 13; i++)
+    t = t * 3 + shorts[i];
+  if(t != 0x4c10687e)
+    abort();
+
+  if(checksum(longs, sizeof(longs)) != 0x02d5e0e1)
+    abort();
+  if(longs[7] >> 32 != 0x01234567 || (uint32_t)longs[8] != 0x76543210)
+    abort();
+
+  if(doubles[2] != 1e308 || doubles[3] == 0 || doubles[3] / 2 != 0)
+    abort();
+  if(doubles[4] != -3.141592653589793 || 1 / doubles[1] > 0)
+    abort();
+
+  if(a_rather_long_function_name_to_make_the_symbol_table_span_words_0123(
+       (int)strlen("abc")) != 18)
+    abort();
+  exit(0);
+}
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A bit of every kind of instruction for the copy-and-patch compiler
+ * (run with -c): integer and floating point arithmetic of all widths,
+ * selects, switches, memory intrinsics, direct, indirect and recursive
+ * calls and stack allocations
+ */
+
+volatile int32_t in32 = -123457;
+volatile int64_t in64 = 0x123456789abcdefll;
+volatile double ind = 2.5;
+volatile float inf = -0.75f;
+
+
+static int32_t __attribute__((noinline))
+arith32(int32_t a, int32_t b)
+{
+  return (a + b) * 3 - (a ^ b) + (a & 0xff) + (b | 1) + a / b + a % b +
+    (int32_t)((uint32_t)a / (uint32_t)b) + (a >> 3) +
+    (int32_t)((uint32_t)a >> 5) + (int32_t)((uint32_t)b << 7);
+}
+
+
+static int64_t __attribute__((noinline))
+arith64(int64_t a, int64_t b)
+{
+  return (a + b) * 5 - (a ^ b) + (a & 0xffff) + a / b + a % b +
+    (int64_t)((uint64_t)a / (uint64_t)b) + (a >> 9) +
+    (int64_t)((uint64_t)a >> 33) + (int64_t)((uint64_t)b << 17);
+}
+
+
+static double __attribute__((noinline))
+fp(double a, float b)
+{
+  const double x = a * b + a / b - (double)(float)(a - b);
+  const int i = x;
+  const unsigned int u = a * 1000;
+  return x + i + u + (a < b ? 1 : 0) + (b <= a ? 2 : 0);
+}
+
+
+static int __attribute__((noinline))
+sw(int x)
+{
+  switch(x) {
+  case 0: return 10;
+  case 1: return 11;
+  case 5: return 15;
+  case 100: return 110;
+  case -7: return -17;
+  default: return x > 1000 ? 1 : 0;
+  }
+}
+
+
+static int __attribute__((noinline))
+sel(int a, int b)
+{
+  return a < b ? a : b;
+}
+
+
+static int __attribute__((noinline))
+fib(int n)
+{
+  return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+
+typedef int (binop_t)(int, int);
+
+static int __attribute__((noinline)) add(int a, int b) { return a + b; }
+static int __attribute__((noinline)) sub(int a, int b) { return a - b; }
+
+binop_t *binops[] = { add, sub, sel };
+
+
+struct rec {
+  int8_t a;
+  int16_t b;
+  int32_t c;
+  int64_t d;
+  char s[13];
+};
+
+
+static int __attribute__((noinline))
+mem(int n)
+{
+  struct rec r[4];
+  memset(r, n, sizeof(r));
+  r[1].a = -1;
+  r[1].b = -2;
+  r[1].c = -3;
+  r[1].d = -4;
+  strcpy(r[1].s, "copy&patch");
+  memcpy(&r[2], &r[1], sizeof(struct rec));
+  memmove(r[3].s + 1, r[2].s, 8);
+
+  char *buf = __builtin_alloca(n);
+  for(int i = 0; i < n; i++)
+    buf[i] = i;
+
+  return r[0].a + r[2].a + r[2].b + r[2].c + (int)r[2].d +
+    strlen(r[2].s) + r[3].s[1] + r[3].s[0] + buf[n - 1];
+}
+
+
+int main(void)
+{
+  if(arith32(in32, 77) != 189737389)
+    abort();
+  if(arith64(in64, -12345) != 492066660484012683ll)
+    abort();
+  if(fp(ind, inf) != 2485.5416666666665)
+    abort();
+  int s = 0;
+  for(int i = -10; i < 1010; i++)
+    s += sw(i) * (i & 3);
+  if(s != 22)
+    abort();
+  if(sel(in32, 5) != in32 || sel(5, in32) != in32)
+    abort();
+  if(fib(20) != 6765)
+    abort();
+  int b = 0;
+  for(int i = 0; i < 30; i++)
+    b += binops[i % 3](i, in32 & 15);
+  if(b != 395)
+    abort();
+  if(mem(9) != 9 - 1 - 2 - 3 - 4 + 10 + 'c' + 9 + 8)
+    abort();
+  exit(0);
+}
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Loads that look redundant but are separated by stores or calls that
+ * may write the same memory, next to expressions that really are
+ * redundant
+ */
+
+volatile int one = 1;
+
+int g;
+
+
+static int __attribute__((noinline))
+alias(int *p, int *q)
+{
+  const int a = *p;
+  *q = a + 1;
+  const int b = *p;     // Same as 'a' unless p == q
+  return a * 10 + b;
+}
+
+
+static int __attribute__((noinline))
+narrow_alias(int *p, char *c)
+{
+  const int a = *p;
+  *c = 0x7f;
+  return *p - a;
+}
+
+
+static void __attribute__((noinline))
+bump(void)
+{
+  g++;
+}
+
+
+static int __attribute__((noinline))
+across_call(void)
+{
+  const int a = g;
+  bump();
+  return g - a;
+}
+
+
+static int __attribute__((noinline))
+across_memset(int *p, int n)
+{
+  const int a = p[1];
+  memset(p, 0, n * sizeof(int));
+  return a - p[1];
+}
+
+
+static int __attribute__((noinline))
+redundant(int x, int y)
+{
+  const int a = (x + y) * (x - y);
+  const int b = (y + x) * (x - y);
+  const int c = x * 3 + 1;
+  int s = a + b;
+  if(x > 0)
+    s += x * 3 + 1;
+  else
+    s -= c;
+  return s;
+}
+
+
+int main(void)
+{
+  int v[4] = { 5, 6, 7, 8 };
+  if(alias(&v[0], &v[1]) != 55 || v[1] != 6)
+    abort();
+  v[1] = 6;
+  if(alias(&v[2], &v[2]) != 78)
+    abort();
+  int w = 0x100 * one;
+  if(narrow_alias(&w, (char *)&w) != 0x7f)
+    abort();
+  if(across_call() != 1 || g != 1)
+    abort();
+  if(across_memset(v, 2 * one) != 6)
+    abort();
+  if(redundant(5 * one, 3) != 16 + 16 + 16)
+    abort();
+  if(redundant(-2 * one, 1) != 3 + 3 + 5)
+    abort();
+  exit(0);
+}
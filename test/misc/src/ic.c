@@ -0,0 +1,80 @@
+#include <stdlib.h>
+
+/*
+ * Inline caches of indirect calls: a call site whose target flips
+ * between a VM function and a native one, and a call site that is
+ * re-entered with another target before its first call returns
+ */
+
+typedef int (strop_t)(const char *);
+
+int __attribute__((noinline)) vm_len(const char *s)
+{
+  int n = 0;
+  while(s[n])
+    n++;
+  return n;
+}
+
+int __attribute__((noinline)) vm_sum(const char *s)
+{
+  int n = 0;
+  while(*s)
+    n += *s++;
+  return n;
+}
+
+static int __attribute__((noinline))
+call(strop_t *f, const char *s)
+{
+  return f(s);
+}
+
+
+typedef int (walk_t)(int);
+
+static walk_t *walkers[2];
+
+static int __attribute__((noinline))
+walk(int depth)
+{
+  // The same call site, alternating between two targets on the way down
+  return depth ? walkers[depth & 1](depth - 1) + 1 : 0;
+}
+
+static int __attribute__((noinline)) walk_odd(int depth)
+{
+  return walk(depth) * 2;
+}
+
+static int __attribute__((noinline)) walk_even(int depth)
+{
+  return walk(depth) + 3;
+}
+
+
+int main(void)
+{
+  strop_t *ops[] = { vm_len, atoi, vm_sum, atoi };
+  const char *str = "12345";
+
+  for(int i = 0; i < 200; i++) {
+    // Stay on one target for a while, then move on
+    const int j = (i / 10) & 3;
+    const int r = call(ops[j], str);
+    if(r != (j == 0 ? 5 : j == 2 ? 255 : 12345))
+      abort();
+  }
+
+  walkers[0] = walk_even;
+  walkers[1] = walk_odd;
+  if(walk(10) != 155)
+    abort();
+
+  // Swap the targets and go again
+  walkers[0] = walk_odd;
+  walkers[1] = walk_even;
+  if(walk(10) != 279)
+    abort();
+  exit(0);
+}
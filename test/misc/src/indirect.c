@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * Indirect calls from call sites that see one, two and many targets,
+ * external functions called through pointers and targets with
+ * different return types
+ */
+
+typedef int (unop_t)(int);
+
+int __attribute__((noinline)) add1(int x) { return x + 1; }
+int __attribute__((noinline)) dbl(int x)  { return x * 2; }
+int __attribute__((noinline)) neg(int x)  { return -x; }
+int __attribute__((noinline)) sq(int x)   { return x * x; }
+int __attribute__((noinline)) half(int x) { return x / 2; }
+
+unop_t *unops[] = { add1, dbl, neg, sq, half, toupper };
+
+#define NUM_UNOPS (sizeof(unops) / sizeof(unops[0]))
+
+
+int __attribute__((noinline)) call(unop_t *f, int x)
+{
+  return f(x);
+}
+
+
+int __attribute__((noinline)) expect(int i, int x)
+{
+  switch(i) {
+  case 0: return x + 1;
+  case 1: return x * 2;
+  case 2: return -x;
+  case 3: return x * x;
+  case 4: return x / 2;
+  default: return toupper(x);
+  }
+}
+
+
+long long __attribute__((noinline)) wide(long long a, int b)
+{
+  return a * b;
+}
+
+void __attribute__((noinline)) store(int *p, int v)
+{
+  *p = v;
+}
+
+struct ops {
+  long long (*wide)(long long, int);
+  void (*store)(int *, int);
+  int (*atoi)(const char *);
+};
+
+struct ops ops = { wide, store, atoi };
+
+
+int main(void)
+{
+  // Monomorphic, then polymorphic
+  for(int i = 0; i < 100; i++)
+    if(call(add1, i) != i + 1)
+      abort();
+  for(int i = 0; i < 100; i++)
+    if(call(i & 1 ? dbl : add1, i) != (i & 1 ? i * 2 : i + 1))
+      abort();
+
+  // Megamorphic, including an external function
+  for(int i = 0; i < 1000; i++) {
+    const int j = (i * 7) % NUM_UNOPS;
+    const int x = i & 127;
+    if(call(unops[j], x) != expect(j, x))
+      abort();
+  }
+
+  // Targets changed at runtime
+  unops[0] = neg;
+  if(call(unops[0], 5) != -5)
+    abort();
+  unops[0] = add1;
+  if(call(unops[0], 5) != 6)
+    abort();
+
+  int v = 0;
+  ops.store(&v, 42);
+  if(v != 42)
+    abort();
+  if(ops.wide(1LL << 40, 3) != 3LL << 40)
+    abort();
+  if(ops.atoi("1234") != 1234)
+    abort();
+  exit(0);
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+
+/*
+ * Small functions called from loops, left for the inliner
+ */
+
+static int clamp(int x, int lo, int hi)
+{
+  if(x < lo)
+    return lo;
+  if(x > hi)
+    return hi;
+  return x;
+}
+
+static void bump(int *p, int v)
+{
+  *p += v;
+}
+
+static long long mac(long long acc, int a, int b)
+{
+  return acc + (long long)a * b;
+}
+
+static double lerp(double a, double b, double t)
+{
+  return a + (b - a) * t;
+}
+
+// Has a local array, its stack must not grow for each inlined call
+static unsigned int window(unsigned int base)
+{
+  unsigned int buf[16];
+  for(int i = 0; i < 16; i++)
+    buf[i] = base + i;
+  return buf[base & 15];
+}
+
+// Recursive, can't be inlined into itself forever
+static int depth(int n)
+{
+  return n ? 1 + depth(n - 1) : 0;
+}
+
+
+int __attribute__((noinline)) run(int n)
+{
+  int count = 0;
+  long long acc = 0, acc_ref = 0;
+  double d = 0;
+  unsigned int w = 0, w_ref = 0;
+
+  for(int i = 0; i < n; i++) {
+    const int c = clamp(i - 50, 0, 100);
+    bump(&count, c);
+    acc = mac(acc, i, c);
+    d = lerp(d, i, 0.5);
+    w += window(i);
+
+    const int c_ref = i < 50 ? 0 : i > 150 ? 100 : i - 50;
+    acc_ref += (long long)i * c_ref;
+    w_ref += i + (i & 15);
+  }
+
+  if(count != 5050 + 100 * (n - 151))
+    abort();
+  if(acc != acc_ref || w != w_ref)
+    abort();
+  if(d < n - 3 || d > n)
+    abort();
+  return depth(10);
+}
+
+
+int main(void)
+{
+  if(run(100000) != 10)
+    abort();
+  exit(0);
+}
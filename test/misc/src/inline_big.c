@@ -0,0 +1,57 @@
+#include <stdlib.h>
+
+/*
+ * A large caller with thousands of calls to a small function. Only a
+ * bounded number of them are inlined so the caller loads quickly
+ */
+
+// Left for the inliner, several returns make it end with a phi
+static unsigned int __attribute__((noinline)) step(unsigned int x,
+                                                   unsigned int k)
+{
+  if(x & 1)
+    return x * 3 + k;
+  if(x & 2)
+    return (x >> 1) ^ k;
+  return x + k + 7;
+}
+
+#define C1(k)    x = step(x, k);
+#define C10(k)   C1(k) C1(k + 1) C1(k + 2) C1(k + 3) C1(k + 4)        \
+                 C1(k + 5) C1(k + 6) C1(k + 7) C1(k + 8) C1(k + 9)
+#define C100(k)  C10(k) C10(k + 10) C10(k + 20) C10(k + 30) C10(k + 40) \
+                 C10(k + 50) C10(k + 60) C10(k + 70) C10(k + 80) C10(k + 90)
+#define C1000(k) C100(k) C100(k + 100) C100(k + 200) C100(k + 300)    \
+                 C100(k + 400) C100(k + 500) C100(k + 600) C100(k + 700) \
+                 C100(k + 800) C100(k + 900)
+
+unsigned int __attribute__((noinline)) big(unsigned int x, int odd)
+{
+  C1000(0)
+  C1000(1000)
+  // Calls before a branch move the phis of its successors
+  if(odd)
+    x = step(x, 1);
+  else
+    x = step(x, 2);
+  C1000(2000)
+  C1000(3000)
+  C1000(4000)
+  return x;
+}
+
+
+int main(void)
+{
+  for(int odd = 0; odd < 2; odd++) {
+    unsigned int x = 12345;
+    for(unsigned int k = 0; k < 2000; k++)
+      x = x & 1 ? x * 3 + k : x & 2 ? (x >> 1) ^ k : x + k + 7;
+    x = x & 1 ? x * 3 + 2 - odd : x & 2 ? (x >> 1) ^ (2 - odd) : x + 9 - odd;
+    for(unsigned int k = 2000; k < 5000; k++)
+      x = x & 1 ? x * 3 + k : x & 2 ? (x >> 1) ^ k : x + k + 7;
+    if(big(12345, odd) != x)
+      abort();
+  }
+  exit(0);
+}
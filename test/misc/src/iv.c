@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Induction variables used after their loop ends, scaled and offset
+ * induction variables, counted loops that run zero times, loops with
+ * negative and wrapping steps and loops with early exits
+ */
+
+volatile int zero = 0;
+
+int arr[64];
+
+
+static int __attribute__((noinline))
+used_after(int n)
+{
+  int i;
+  for(i = 0; i < n; i++)
+    arr[i] = i * 3;
+  // 'i' and a value derived from it live past the loop
+  return i * 100 + arr[i - 1];
+}
+
+
+static int __attribute__((noinline))
+scaled(int n)
+{
+  int s = 0, k = 0;
+  for(int i = 0; i < n; i++) {
+    k = i * 12 + 5;
+    s += k;
+  }
+  return s + k;
+}
+
+
+static int __attribute__((noinline))
+down(int n)
+{
+  int i, s = 0;
+  for(i = n; i > 0; i -= 3)
+    s += arr[i];
+  return s * 1000 + i;
+}
+
+
+static uint32_t __attribute__((noinline))
+wrap(uint32_t start)
+{
+  // Unsigned counter wrapping past zero
+  uint32_t i, c = 0;
+  for(i = start; i != 5; i++)
+    c++;
+  return c;
+}
+
+
+static int __attribute__((noinline))
+early_exit(int n, int stop)
+{
+  int i;
+  for(i = 0; i < n; i++)
+    if(arr[i] == stop)
+      break;
+  return i;
+}
+
+
+static int64_t __attribute__((noinline))
+wide(int n)
+{
+  int64_t s = 0;
+  int64_t j = 0;
+  for(int i = 0; i < n; i++) {
+    j = (int64_t)i * 0x100000000ll;
+    s += j;
+  }
+  return s + j;
+}
+
+
+int main(void)
+{
+  if(used_after(10) != 1027 || used_after(64) != 6589)
+    abort();
+  if(used_after(1 + zero) != 100)
+    abort();
+  if(scaled(zero) != 0 || scaled(10) != 12 * 45 + 50 + 113)
+    abort();
+  if(down(20) != (60 + 51 + 42 + 33 + 24 + 15 + 6) * 1000 - 1)
+    abort();
+  if(down(zero) != 0)
+    abort();
+  if(wrap(0xfffffffe) != 7 || wrap(5 + zero) != 0)
+    abort();
+  if(early_exit(64, 30) != 10 || early_exit(64, 31) != 64)
+    abort();
+  if(early_exit(zero, 0) != 0)
+    abort();
+  if(wide(5) != 14 * 0x100000000ll)
+    abort();
+  exit(0);
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Narrow loads and stores, sign and zero extension, variable shifts
+ * and signed versus unsigned compares. The inputs are volatile so the
+ * operations are left for the JIT to lower
+ */
+
+volatile int32_t vals[] = {
+  0, 1, -1, 2, -2, 0x7f, 0x80, -0x80, -0x81, 0xff, 0x100,
+  0x7fff, 0x8000, -0x8000, 0xffff, 0x12345678, -0x12345678,
+  0x7fffffff, -0x7fffffff - 1,
+};
+
+#define NUM_VALS (sizeof(vals) / sizeof(vals[0]))
+
+volatile int shifts[] = { 0, 1, 3, 7, 8, 15, 16, 31 };
+
+#define NUM_SHIFTS (sizeof(shifts) / sizeof(shifts[0]))
+
+int8_t s8[4];
+uint8_t u8[4];
+int16_t s16[4];
+uint16_t u16[4];
+
+
+static int32_t
+sext(uint32_t x, int bits)
+{
+  const uint32_t m = 1u << (bits - 1);
+  x &= (m << 1) - 1;
+  return (int32_t)(x ^ m) - (int32_t)m;
+}
+
+
+// Shift right one bit at a time rounding down
+static int64_t
+floor_half(int64_t x, int n)
+{
+  while(n--)
+    x = (x - (x & 1)) / 2;
+  return x;
+}
+
+
+static void __attribute__((noinline))
+check_narrow(int32_t v)
+{
+  // Stores must only write their own bytes
+  for(int i = 0; i < 4; i++) {
+    s8[i] = u8[i] = 0x5a;
+    s16[i] = u16[i] = 0x5a5a;
+  }
+  s8[1] = v;
+  u8[2] = v;
+  s16[1] = v;
+  u16[2] = v;
+
+  if(s8[0] != 0x5a || s8[2] != 0x5a || u8[1] != 0x5a || u8[3] != 0x5a)
+    abort();
+  if(s16[0] != 0x5a5a || s16[2] != 0x5a5a ||
+     u16[1] != 0x5a5a || u16[3] != 0x5a5a)
+    abort();
+
+  const int32_t a = s8[1];
+  const uint32_t b = u8[2];
+  const int32_t c = s16[1];
+  const uint32_t d = u16[2];
+  if(a != sext(v, 8) || b != (v & 0xff))
+    abort();
+  if(c != sext(v, 16) || d != (v & 0xffff))
+    abort();
+
+  // Extension to 64 bits
+  const int64_t a64 = s8[1];
+  const uint64_t b64 = u8[2];
+  const int64_t c64 = v;
+  const uint64_t d64 = (uint32_t)v;
+  if(a64 != a || b64 != b)
+    abort();
+  if((c64 < 0) != (v < 0) || (c64 >> 32) != (v < 0 ? -1 : 0))
+    abort();
+  if(d64 >> 32 || (uint32_t)d64 != (uint32_t)v)
+    abort();
+}
+
+
+static void __attribute__((noinline))
+check_shifts(int32_t v, int s)
+{
+  const uint32_t u = v;
+  const int64_t w = (int64_t)v * 0x10001;
+
+  uint32_t l = u;
+  for(int i = 0; i < s; i++)
+    l *= 2;
+  if(u << s != l)
+    abort();
+  if(u >> s != u / (1u << s))
+    abort();
+  if(v >> s != floor_half(v, s))
+    abort();
+
+  uint64_t l64 = w;
+  for(int i = 0; i < s * 2; i++)
+    l64 *= 2;
+  if((uint64_t)w << (s * 2) != l64)
+    abort();
+  if((uint64_t)w >> (s * 2) != (uint64_t)w / (1ull << (s * 2)))
+    abort();
+  if(w >> (s * 2) != floor_half(w, s * 2))
+    abort();
+}
+
+
+static void __attribute__((noinline))
+check_compare(int32_t a, int32_t b)
+{
+  const int64_t d = (int64_t)a - b;
+  const int64_t ud = (int64_t)(uint32_t)a - (uint32_t)b;
+
+  if((a < b) != (d < 0) || (a <= b) != (d <= 0) ||
+     (a > b) != (d > 0) || (a >= b) != (d >= 0))
+    abort();
+  if(((uint32_t)a < (uint32_t)b) != (ud < 0) ||
+     ((uint32_t)a <= (uint32_t)b) != (ud <= 0) ||
+     ((uint32_t)a > (uint32_t)b) != (ud > 0) ||
+     ((uint32_t)a >= (uint32_t)b) != (ud >= 0))
+    abort();
+  if((a == b) != (d == 0) || (a != b) != (d != 0))
+    abort();
+
+  // 64 bit compares, checked on the halves
+  const int64_t x = (uint64_t)(uint32_t)a << 32 | (uint32_t)b;
+  const int64_t y = (uint64_t)(uint32_t)b << 32 | (uint32_t)a;
+  const int lt = a < b || (a == b && (uint32_t)b < (uint32_t)a);
+  const int ult = (uint32_t)a < (uint32_t)b ||
+    (a == b && (uint32_t)b < (uint32_t)a);
+  if((x < y) != lt || (x >= y) != !lt)
+    abort();
+  if(((uint64_t)x < (uint64_t)y) != ult ||
+     ((uint64_t)x >= (uint64_t)y) != !ult)
+    abort();
+
+  // Narrow compares
+  const int8_t a8 = a, b8 = b;
+  const uint16_t a16 = a, b16 = b;
+  if((a8 < b8) != (sext(a, 8) < sext(b, 8)))
+    abort();
+  if((a16 < b16) != ((a & 0xffff) < (b & 0xffff)))
+    abort();
+}
+
+
+int main(void)
+{
+  for(int i = 0; i < NUM_VALS; i++) {
+    check_narrow(vals[i]);
+    for(int j = 0; j < NUM_SHIFTS; j++)
+      check_shifts(vals[i], shifts[j]);
+    for(int j = 0; j < NUM_VALS; j++)
+      check_compare(vals[i], vals[j]);
+  }
+
+  // Known answers in case both sides of a check are lowered alike
+  volatile int32_t m = -0x81;
+  volatile int n = 4;
+  if((int8_t)m != 0x7f || (uint8_t)m != 0x7f || (int16_t)m != -0x81)
+    abort();
+  if(m >> n != -9 || (uint32_t)m >> n != 0xffffff7 ||
+     (uint32_t)m << n != 0xfffff7f0)
+    abort();
+  if(!(m < n) || (uint32_t)m < (uint32_t)n)
+    abort();
+  exit(0);
+}
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Loop invariant code that must not be hoisted out of its guard:
+ * divisions by a zero (or INT_MIN by -1) that the loop never reaches,
+ * loads through pointers that may be NULL and loads of memory that the
+ * loop itself stores to
+ */
+
+volatile int zero = 0;
+
+
+static int __attribute__((noinline))
+guarded_div(int n, int a, int d)
+{
+  int s = 0;
+  for(int i = 0; i < n; i++) {
+    if(d != 0)
+      s += a / d;
+    else
+      s += i;
+  }
+  return s;
+}
+
+
+static int __attribute__((noinline))
+empty_loop_div(int n, int a, int d)
+{
+  // Never runs the division when 'n' is zero
+  int s = 0;
+  for(int i = 0; i < n; i++)
+    s += a / d + a % d;
+  return s;
+}
+
+
+static int __attribute__((noinline))
+guarded_load(int n, const int *p)
+{
+  int s = 0;
+  for(int i = 0; i < n; i++)
+    s += p ? *p : 1;
+  return s;
+}
+
+
+static int __attribute__((noinline))
+stored_load(int n, int *p, int *q)
+{
+  // 'p' and 'q' may point to the same place
+  int s = 0;
+  for(int i = 0; i < n; i++) {
+    s += *p * 2;
+    *q = i;
+  }
+  return s;
+}
+
+
+static int64_t __attribute__((noinline))
+hoistable(int n, int64_t a, int64_t b)
+{
+  int64_t s = 0;
+  for(int i = 0; i < n; i++)
+    s += (a * b + 7) / (b | 1) + i;
+  return s;
+}
+
+
+int main(void)
+{
+  if(guarded_div(10, 100, zero) != 45 || guarded_div(10, 100, 7) != 140)
+    abort();
+  if(empty_loop_div(zero, 1, zero) != 0)
+    abort();
+  if(empty_loop_div(zero, -0x7fffffff - 1, zero - 1) != 0)
+    abort();
+  if(empty_loop_div(3, 17, 5) != 15)
+    abort();
+  int v = 21;
+  if(guarded_load(4, (int *)(intptr_t)zero) != 4 || guarded_load(4, &v) != 84)
+    abort();
+  int w = 0, x = 5;
+  if(stored_load(4, &w, &w) != 6)
+    abort();
+  if(stored_load(4, &x, &w) != 40)
+    abort();
+  if(hoistable(10, 123456789, 1000) != 10 * (123456789007ll / 1001) + 45)
+    abort();
+  exit(0);
+}
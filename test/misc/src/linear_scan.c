@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A function with more values than the linear scan threshold, where
+ * integer and floating point values stay live across a loop and calls
+ * while a long chain of short lived values runs past them. Checked
+ * against a small function doing the same with arrays
+ */
+
+#define NUM_LIVE 32
+
+#define L32(M) M(0) M(1) M(2) M(3) M(4) M(5) M(6) M(7) \
+               M(8) M(9) M(10) M(11) M(12) M(13) M(14) M(15) \
+               M(16) M(17) M(18) M(19) M(20) M(21) M(22) M(23) \
+               M(24) M(25) M(26) M(27) M(28) M(29) M(30) M(31)
+
+#define DEF(k) uint64_t a##k = x * (k + 1) + k; double d##k = k * 0.5 + x;
+#define USE(k) acc += (a##k ^ i) + (uint64_t)d##k; a##k += i;
+#define SUM(k) acc = acc * 7 + a##k + (uint64_t)(d##k * 3);
+
+#define S(k)     acc = acc * 3 + (k); acc ^= acc >> 7;
+#define S8(k)    S(k)      S(k + 1)   S(k + 2)   S(k + 3) \
+                 S(k + 4)  S(k + 5)   S(k + 6)   S(k + 7)
+#define S64(k)   S8(k)     S8(k + 8)  S8(k + 16) S8(k + 24) \
+                 S8(k + 32) S8(k + 40) S8(k + 48) S8(k + 56)
+#define S1024    S64(0)    S64(64)    S64(128)   S64(192)   \
+                 S64(256)  S64(320)   S64(384)   S64(448)   \
+                 S64(512)  S64(576)   S64(640)   S64(704)   \
+                 S64(768)  S64(832)   S64(896)   S64(960)
+
+#define NUM_CHAIN 1024
+
+
+static uint64_t __attribute__((noinline))
+mix(uint64_t v)
+{
+  return v * 0x9e3779b97f4a7c15ull;
+}
+
+
+static uint64_t __attribute__((noinline))
+big(uint64_t x, int n)
+{
+  uint64_t acc = 0;
+  L32(DEF)
+  for(int i = 0; i < n; i++) {
+    L32(USE)
+    acc = mix(acc);
+  }
+  S1024
+  L32(SUM)
+  return acc;
+}
+
+
+static uint64_t __attribute__((noinline))
+ref(uint64_t x, int n)
+{
+  uint64_t a[NUM_LIVE], acc = 0;
+  double d[NUM_LIVE];
+  for(int k = 0; k < NUM_LIVE; k++) {
+    a[k] = x * (k + 1) + k;
+    d[k] = k * 0.5 + x;
+  }
+  for(int i = 0; i < n; i++) {
+    for(int k = 0; k < NUM_LIVE; k++) {
+      acc += (a[k] ^ i) + (uint64_t)d[k];
+      a[k] += i;
+    }
+    acc = mix(acc);
+  }
+  for(int k = 0; k < NUM_CHAIN; k++) {
+    acc = acc * 3 + k;
+    acc ^= acc >> 7;
+  }
+  for(int k = 0; k < NUM_LIVE; k++)
+    acc = acc * 7 + a[k] + (uint64_t)(d[k] * 3);
+  return acc;
+}
+
+
+int main(void)
+{
+  for(int n = 0; n < 5; n++)
+    if(big(n * 1000 + 17, n * 3) != ref(n * 1000 + 17, n * 3))
+      abort();
+  exit(0);
+}
@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Values whose live ranges are awkward for block level liveness:
+ * values that pass through nested loops without being used there,
+ * values live into only one successor, loops entered in the middle and
+ * phis that swap values
+ */
+
+volatile int one = 1;
+
+
+static int __attribute__((noinline))
+pass_through(int a, int b, int n)
+{
+  // 'a' and 'b' are only used after both loops end
+  const int x = a * 7;
+  const int y = b * 11;
+  int s = 0;
+  for(int i = 0; i < n; i++)
+    for(int j = 0; j < i; j++)
+      s += i ^ j;
+  return s + x - y;
+}
+
+
+static int __attribute__((noinline))
+one_side(int c, int a, int b)
+{
+  const int x = a + b;
+  const int y = a - b;
+  int r;
+  if(c)
+    r = x * 3;          // 'y' is dead here
+  else
+    r = y * 5;          // and 'x' here
+  return r + c;
+}
+
+
+static int __attribute__((noinline))
+middle_entry(int n, int k)
+{
+  int i = 0, s = k;
+  if(n & 1)
+    goto mid;
+  while(i < n) {
+    s += i * 2;
+  mid:
+    s ^= k;
+    i++;
+  }
+  return s;
+}
+
+
+static void __attribute__((noinline))
+swap_loop(int n, int *out)
+{
+  // 'a', 'b' and 'c' rotate every iteration (parallel copy of phis)
+  int a = 1, b = 2, c = 3;
+  for(int i = 0; i < n; i++) {
+    const int t = a;
+    a = b;
+    b = c;
+    c = t;
+  }
+  out[0] = a;
+  out[1] = b;
+  out[2] = c;
+}
+
+
+static int64_t __attribute__((noinline))
+loop_carried(int n)
+{
+  // 'prev' is read before it's redefined each iteration
+  int64_t prev = 1, cur = 1;
+  for(int i = 0; i < n; i++) {
+    const int64_t next = prev + cur;
+    prev = cur;
+    cur = next;
+  }
+  return prev;
+}
+
+
+int main(void)
+{
+  if(pass_through(3 * one, 2, 5) != 34 + 21 - 22)
+    abort();
+  if(one_side(one, 10, 4) != 43 || one_side(one - 1, 10, 4) != 30)
+    abort();
+  if(middle_entry(4 * one, 5) != 17 || middle_entry(5 * one, 5) != 28)
+    abort();
+  int r[3];
+  swap_loop(4 * one, r);
+  if(r[0] != 2 || r[1] != 3 || r[2] != 1)
+    abort();
+  swap_loop(one - 1, r);
+  if(r[0] != 1 || r[1] != 2 || r[2] != 3)
+    abort();
+  if(loop_carried(90 * one) != 4660046610375530309ll)
+    abort();
+  exit(0);
+}
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Data that comes straight out of the bitcode file: string constants,
+ * function names and initialized globals. The file is unmapped once
+ * loaded, so none of them may still point into it
+ */
+
+const char greeting[] = "This string is copied out of the mapped bitcode";
+
+const char *names[] = { "alpha", "beta", "gamma", "delta", "epsilon" };
+
+int counts[8] = { 1, 1, 2, 3, 5, 8, 13, 21 };
+
+
+static const char * __attribute__((noinline))
+name(void)
+{
+  return __func__;
+}
+
+
+int main(void)
+{
+  if(strlen(greeting) != 47 || strcmp(greeting + 43, "code"))
+    abort();
+
+  size_t total = 0;
+  for(int i = 0; i < 5; i++)
+    total += strlen(names[i]);
+  if(total != 26 || strcmp(names[4], "epsilon"))
+    abort();
+
+  if(strcmp(name(), "name"))
+    abort();
+
+  // Globals are writable copies
+  counts[0] = 100;
+  int s = 0;
+  for(int i = 0; i < 8; i++)
+    s += counts[i];
+  if(s != 153)
+    abort();
+  exit(0);
+}
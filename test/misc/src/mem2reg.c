@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Locals accessed with other types than they're declared with. Such
+ * allocas must stay in memory (or be promoted with the right
+ * conversion) while plain ones next to them are promoted
+ */
+
+volatile int one = 1;
+
+
+static uint32_t __attribute__((noinline))
+float_bits(float f)
+{
+  union { float f; uint32_t u; } u;
+  u.f = f;
+  return u.u;
+}
+
+
+static float __attribute__((noinline))
+bits_float(uint32_t x)
+{
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+
+static uint32_t __attribute__((noinline))
+halves(uint64_t v)
+{
+  uint64_t x = v;
+  uint32_t w[2];
+  memcpy(w, &x, sizeof(x));
+  w[0] += 1;            // Little endian, low half without carry
+  memcpy(&x, w, sizeof(x));
+  return (uint32_t)x + (uint32_t)(x >> 32) * 2;
+}
+
+
+static int __attribute__((noinline))
+low_byte(int v)
+{
+  int x = v;
+  *(uint8_t *)&x = 0x42;
+  int y = 0;            // Plain local next to the punned one
+  for(int i = 0; i < one * 4; i++)
+    y += x & 0xff;
+  return x + y;
+}
+
+
+static int __attribute__((noinline))
+partial(int c)
+{
+  // Stored as a whole in one branch, a byte at a time in the other
+  uint32_t x;
+  if(c) {
+    x = 0x01020304;
+  } else {
+    uint8_t *b = (uint8_t *)&x;
+    b[0] = 4; b[1] = 3; b[2] = 2; b[3] = 1;
+  }
+  return x == 0x01020304;
+}
+
+
+static double __attribute__((noinline))
+dbl_parts(uint32_t lo, uint32_t hi)
+{
+  union { double d; uint32_t w[2]; } u;
+  u.w[0] = lo;
+  u.w[1] = hi;
+  return u.d;
+}
+
+
+int main(void)
+{
+  if(float_bits(1.0f * one) != 0x3f800000 ||
+     float_bits(-2.5f * one) != 0xc0200000)
+    abort();
+  if(bits_float(0x40490fdb * one) != 3.14159274101257324f)
+    abort();
+  if(halves(0x1234567800000000ull * one) != 0x2468acf1)
+    abort();
+  if(halves(0xffffffffull * one) != 0)
+    abort();
+  if(low_byte(0x12345678 * one) != 0x12345642 + 4 * 0x42)
+    abort();
+  if(!partial(one) || !partial(one - 1))
+    abort();
+  if(dbl_parts(0, 0x3ff00000 * one) != 1.0)
+    abort();
+  exit(0);
+}
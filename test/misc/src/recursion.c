@@ -0,0 +1,62 @@
+#include <stdlib.h>
+
+// Not a candidate for tail recursion elimination
+unsigned int __attribute__((noinline)) deep(unsigned int n)
+{
+  if(n == 0)
+    return 1;
+  return deep(n - 1) * 3 + n;
+}
+
+int __attribute__((noinline)) odd(int n);
+
+int __attribute__((noinline)) even(int n)
+{
+  if(n == 0)
+    return 1;
+  return odd(n - 1) + 1;
+}
+
+int __attribute__((noinline)) odd(int n)
+{
+  if(n == 0)
+    return 0;
+  return even(n - 1) + 1;
+}
+
+// Uses stack for locals on every level
+int __attribute__((noinline)) frame(int n, int a, int b, int c)
+{
+  volatile int buf[16];
+  if(n == 0)
+    return a + b + c;
+  for(int i = 0; i < 16; i++)
+    buf[i] = a + i;
+  return frame(n - 1, b, c, buf[n & 15]) ^ n;
+}
+
+
+int main(void)
+{
+  // Deeper than natively compiled code could go with a fixed host stack cap
+  unsigned int x = 1;
+  for(unsigned int i = 1; i <= 30000; i++)
+    x = x * 3 + i;
+  if(deep(30000) != x)
+    abort();
+
+  if(even(10000) != 10001)
+    abort();
+
+  int a = 1, b = 2, c = 3, r = 0;
+  for(int n = 5000; n > 0; n--) {
+    const int t = a + (n & 15);
+    a = b;
+    b = c;
+    c = t;
+    r ^= n;
+  }
+  if(frame(5000, 1, 2, 3) != ((a + b + c) ^ r))
+    abort();
+  exit(0);
+}
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+
+/*
+ * Functions whose IR is needed after they're emitted: a small callee
+ * defined before and after its callers (kept for the inliner), a
+ * function only reached through a pointer and functions that are first
+ * called long after loading (with -z 1 they're parsed again then)
+ */
+
+volatile int one = 1;
+
+static int late(int x);
+
+static int __attribute__((noinline))
+early(int x)
+{
+  return x * 3 + 1;
+}
+
+
+static int __attribute__((noinline))
+caller_a(int x)
+{
+  return early(x) + late(x);
+}
+
+
+static int __attribute__((noinline))
+late(int x)
+{
+  return x ^ 0x55;
+}
+
+
+static int __attribute__((noinline))
+caller_b(int x)
+{
+  return early(x) * late(x);
+}
+
+
+static int __attribute__((noinline))
+by_pointer(int x)
+{
+  int s = 0;
+  for(int i = 0; i < x; i++)
+    s += early(i);
+  return s;
+}
+
+int (*fp)(int) = by_pointer;
+
+
+static int __attribute__((noinline))
+rarely(int x)
+{
+  // Only called once everything else has run
+  return caller_a(x) - caller_b(x);
+}
+
+
+int main(void)
+{
+  int s = 0;
+  for(int i = 0; i < 100; i++)
+    s += caller_a(i) + caller_b(i & 7);
+  if(s != 114910)
+    abort();
+  if(fp(10 * one) != 145)
+    abort();
+  if(one == 1 && rarely(4) != 13 + 81 - 13 * 81)
+    abort();
+  exit(0);
+}
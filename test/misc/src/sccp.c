@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Constants that only become known through branches and phis, values
+ * that merely look constant, and dead code that must not be folded
+ * (division by zero, oversized shifts)
+ */
+
+volatile int zero = 0;
+
+
+static int __attribute__((noinline))
+cond_const(int n)
+{
+  // 'x' stays 1 as the branch that changes it is never taken
+  int x = 1;
+  for(int i = 0; i < n; i++) {
+    if(x != 1)
+      x = i;
+    x = x * 1;
+  }
+  return x;
+}
+
+
+static int __attribute__((noinline))
+not_const(int n)
+{
+  // Same shape, but the branch is taken once 'n' is large enough
+  int x = 1;
+  for(int i = 0; i < n; i++) {
+    if(i == 50)
+      x = 2;
+    if(x != 1)
+      x = i;
+  }
+  return x;
+}
+
+
+static int __attribute__((noinline))
+dead_traps(int a)
+{
+  const int d = 0;
+  const int s = 40;
+  int r = a;
+  if(d != 0)
+    r = a / d;       // Never executed
+  if(s < 32)
+    r = a << s;      // Never executed
+  if(a > 1000) {
+    r += a % d;      // Only with a > 1000
+  }
+  return r + 1;
+}
+
+
+static uint32_t __attribute__((noinline))
+switch_const(int k)
+{
+  int sel = 3;
+  uint32_t r;
+  switch(sel) {
+  case 1: r = 0xdead; break;
+  case 3: r = 0x1000 + k; break;
+  default: r = 0xbeef; break;
+  }
+  return r;
+}
+
+
+static int64_t __attribute__((noinline))
+wide(int64_t a)
+{
+  const int64_t big = 0x100000000ll;
+  const int64_t c = big * 3 - 1;
+  return a + c + (int64_t)((uint64_t)-1 >> 40) + (c >> 33);
+}
+
+
+int main(void)
+{
+  if(cond_const(100) != 1 || cond_const(zero) != 1)
+    abort();
+  if(not_const(10) != 1 || not_const(100) != 99)
+    abort();
+  if(dead_traps(5) != 6 || dead_traps(zero) != 1)
+    abort();
+  if(switch_const(5) != 0x1005)
+    abort();
+  if(wide(zero + 1) != 0x2ffffffffll + 0xffffff + 1 + 1)
+    abort();
+  exit(0);
+}
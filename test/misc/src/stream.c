@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A module larger than the chunks it's fed in when streamed from a
+ * pipe ('vmir - < stream.bc'), so blocks and records are split across
+ * vmir_load_feed() calls. The table is generated by the preprocessor
+ * and checked against the same formula at runtime
+ */
+
+#define V(k)       ((uint32_t)(k) * 2654435761u >> 7)
+#define V4(k)      V(k), V(k + 1), V(k + 2), V(k + 3)
+#define V16(k)     V4(k), V4(k + 4), V4(k + 8), V4(k + 12)
+#define V64(k)     V16(k), V16(k + 16), V16(k + 32), V16(k + 48)
+#define V256(k)    V64(k), V64(k + 64), V64(k + 128), V64(k + 192)
+#define V1024(k)   V256(k), V256(k + 256), V256(k + 512), V256(k + 768)
+#define V4096(k)   V1024(k), V1024(k + 1024), V1024(k + 2048), \
+                   V1024(k + 3072)
+
+#define TABLE_SIZE 32768
+
+const uint32_t table[TABLE_SIZE] = {
+  V4096(0), V4096(4096), V4096(8192), V4096(12288),
+  V4096(16384), V4096(20480), V4096(24576), V4096(28672),
+};
+
+
+int main(void)
+{
+  for(uint32_t i = 0; i < TABLE_SIZE; i++)
+    if(table[i] != V(i))
+      abort();
+  exit(0);
+}
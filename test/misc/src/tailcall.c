@@ -0,0 +1,78 @@
+#include <stdlib.h>
+
+long long __attribute__((noinline)) sum(int n, long long acc)
+{
+  if(n == 0)
+    return acc;
+  return sum(n - 1, acc + n);
+}
+
+int __attribute__((noinline)) is_odd(int n);
+
+int __attribute__((noinline)) is_even(int n)
+{
+  if(n == 0)
+    return 1;
+  return is_odd(n - 1);
+}
+
+int __attribute__((noinline)) is_odd(int n)
+{
+  if(n == 0)
+    return 0;
+  return is_even(n - 1);
+}
+
+// Tail calls between functions with different arguments and frames
+int __attribute__((noinline)) wide(int n, int a, int b, int c, int d);
+
+int __attribute__((noinline)) narrow(int n)
+{
+  if(n <= 0)
+    return n;
+  return wide(n - 1, n, 2 * n, 3 * n, 4 * n);
+}
+
+int __attribute__((noinline)) wide(int n, int a, int b, int c, int d)
+{
+  volatile int buf[32];
+  for(int i = 0; i < 32; i++)
+    buf[i] = a + b + c + d + i;
+  if(n <= 0)
+    return buf[0];
+  return narrow(n - 1);
+}
+
+int __attribute__((noinline)) add3(int x)
+{
+  return x + 3;
+}
+
+int __attribute__((noinline)) sub1(int x)
+{
+  return x - 1;
+}
+
+int (*ops[2])(int) = { add3, sub1 };
+
+// Indirect tail call
+int __attribute__((noinline)) apply(int i, int x)
+{
+  return ops[i](x);
+}
+
+
+int main(void)
+{
+  if(sum(10000, 0) != 50005000LL)
+    abort();
+  if(!is_even(10000) || is_even(9999) || !is_odd(5001))
+    abort();
+  if(narrow(1000) != 0)
+    abort();
+  if(narrow(1001) != 1 + 2 + 3 + 4)
+    abort();
+  if(apply(0, 10) != 13 || apply(1, 10) != 9)
+    abort();
+  exit(0);
+}